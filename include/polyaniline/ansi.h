@@ -0,0 +1,64 @@
+/**
+ * @file include/polyaniline/ansi.h
+ * @brief ANSI mirror of the terminal for the serial console
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_ANSI_H
+#define POLYANILINE_ANSI_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <polyaniline/terminal.h>
+
+/**** DEFINITIONS ****/
+
+/* Size of the remote screen. Anything outside of it isn't mirrored */
+#define ANSI_COLUMNS            80
+#define ANSI_ROWS               25
+
+/* No window, the serial console is a plain log */
+#define ANSI_WINDOW_NONE        -1
+
+/* Bytes of escape sequences and text built up before they are handed to the serial port */
+#define ANSI_BUFFER_SIZE        256
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Choose the part of the terminal mirrored to the remote screen
+ * @param x The first column of the window, or ANSI_WINDOW_NONE to go back to a plain log
+ * @param y The first line of the window
+ *
+ * Entering a window clears the remote screen, it is then kept in sync by @c ansi_sync
+ */
+void ansi_setWindow(int x, int y);
+
+/**
+ * @brief Log text to the serial console
+ * @param str The text
+ * @param length The amount of characters
+ *
+ * Only does anything while there's no window. Newlines become CRLF.
+ */
+void ansi_log(const char *str, size_t length);
+
+/**
+ * @brief Bring the remote screen up to date with the terminal
+ * @param cells The terminal's cell grid
+ * @param width Width of the grid
+ * @param height Height of the grid
+ *
+ * Only cells that changed since the last sync are sent
+ */
+void ansi_sync(terminal_cell_t *cells, int width, int height);
+
+#endif
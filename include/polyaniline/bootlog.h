@@ -0,0 +1,86 @@
+/**
+ * @file include/polyaniline/bootlog.h
+ * @brief Boot log
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_BOOTLOG_H
+#define POLYANILINE_BOOTLOG_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <polyaniline/log.h>
+
+/**** DEFINITIONS ****/
+
+/* Size of the ring buffer. Once it's full the oldest lines are dropped */
+#define BOOTLOG_SIZE            65536
+
+/* Length of the "[    12.345678] " timestamp put in front of every line */
+#define BOOTLOG_STAMP_LENGTH    16
+
+/* Log records kept unformatted before they are formatted into the ring */
+#define BOOTLOG_RECORDS         256
+
+/* Room for plain text written while there are records waiting */
+#define BOOTLOG_TEXT_SIZE       8192
+
+/**** TYPES ****/
+
+// A log message that hasn't been formatted yet
+typedef struct _bootlog_record {
+    uint64_t time;                  // When it was logged
+    const char *format;             // Format string, NULL for plain text
+    int count;                      // Amount of arguments, or characters of plain text
+    uint64_t args[LOG_MAX_ARGS];    // Raw arguments, or where the plain text starts in the text buffer
+} bootlog_record_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Append text to the boot log
+ * @param str The text
+ * @param length The amount of characters
+ *
+ * Every line gets a timestamp in front of it
+ */
+void bootlog_write(const char *str, size_t length);
+
+/**
+ * @brief Record a log message without formatting it
+ * @param format The format string, has to stay around until the log is read
+ * @param count The amount of arguments
+ * @param args The raw arguments
+ *
+ * It's formatted into the ring when the log is read
+ */
+void bootlog_record(const char *format, int count, const uint64_t *args);
+
+/**
+ * @brief Append formatted text to the boot log
+ * @param format The format string
+ */
+void bootlog_printf(char *format, ...);
+
+/**
+ * @brief Copy the boot log out of the ring buffer
+ * @param buffer Where to copy it to
+ * @param size Size of @p buffer
+ * @returns The amount of bytes copied, oldest first. Starts on a line boundary.
+ */
+size_t bootlog_read(char *buffer, size_t size);
+
+/**
+ * @brief Get the amount of bytes @c bootlog_read would copy
+ */
+size_t bootlog_length();
+
+#endif
@@ -16,6 +16,7 @@
 
 /**** INCLUDES ****/
 #include <stdint.h>
+#include <stddef.h>
 
 /**** VARIABLES ****/
 
@@ -41,8 +42,46 @@ extern const char *__polyaniline_compiler;
 // IMPORTANT: The kernel filename by default and the initrd file name by default
 extern char *__polyaniline_kernel_file, *__polyaniline_initrd_file;
 
+// Optional PSF font file
+extern char *__polyaniline_font_file;
+
 extern const char *__polyaniline_default_kernel_cmdline;
 
 extern const uintptr_t __polyaniline_kernel_address;
 
+// Video mode selection (see VIDEO_MODE_xxx)
+extern const int __polyaniline_video_mode;
+extern const uint32_t __polyaniline_video_width, __polyaniline_video_height;
+
+// Font scale, 0 for automatic
+extern const int __polyaniline_font_scale;
+
+// Write-combining framebuffer
+extern const int __polyaniline_framebuffer_wc;
+
+// Headless boot
+extern const int __polyaniline_headless;
+
+// Serial console
+extern const int __polyaniline_serial;
+extern const int __polyaniline_serial_baud;
+
+// Log level printed while booting
+extern const int __polyaniline_log_console;
+
+// Verbose startup
+extern const int __polyaniline_verbose;
+
+// Chunk size for reading boot files
+extern const size_t __polyaniline_read_chunk;
+
+// Expected XXH64 of the initial ramdisk, 0 to not check it
+extern const uint64_t __polyaniline_initrd_checksum;
+
+// Milliseconds between progress bar repaints
+extern const int __polyaniline_progress_interval;
+
+// Built-in FAT reader
+extern const int __polyaniline_fat_reader;
+
 #endif
\ No newline at end of file
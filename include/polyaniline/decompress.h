@@ -0,0 +1,113 @@
+/**
+ * @file include/polyaniline/decompress.h
+ * @brief Compressed boot files
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_DECOMPRESS_H
+#define POLYANILINE_DECOMPRESS_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/zstd.h>
+
+/**** DEFINITIONS ****/
+
+/* Formats */
+#define DECOMPRESS_UNSUPPORTED  -1  // Compressed, but not with anything we can read
+#define DECOMPRESS_NONE         0   // Not compressed
+#define DECOMPRESS_LZ4          1   // LZ4 frame
+#define DECOMPRESS_ZSTD         2   // zstd frame
+
+/* Bytes needed from the start of a file to detect the format and output size */
+#define DECOMPRESS_HEADER_SIZE  19
+
+/* LZ4 frame format */
+#define LZ4_MAGIC               0x184D2204
+#define LZ4_FLG_VERSION_MASK    0xC0
+#define LZ4_FLG_VERSION         0x40
+#define LZ4_FLG_BLOCK_CHECKSUM  0x10
+#define LZ4_FLG_CONTENT_SIZE    0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICTIONARY      0x01
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000
+#define LZ4_MIN_MATCH           4
+
+/* Magic number of a format that is recognized but not supported */
+#define GZIP_MAGIC              0x8B1F
+
+/**** TYPES ****/
+
+// Where an LZ4 frame decoder is at
+typedef enum {
+    LZ4_STATE_MAGIC,                // Magic, FLG and BD
+    LZ4_STATE_DESCRIPTOR,           // Rest of the frame descriptor
+    LZ4_STATE_BLOCK_SIZE,
+    LZ4_STATE_BLOCK,
+    LZ4_STATE_BLOCK_CHECKSUM,
+    LZ4_STATE_CONTENT_CHECKSUM,
+    LZ4_STATE_DONE
+} lz4_state_t;
+
+// Where a zstd frame decoder is at
+typedef enum {
+    ZSTD_STATE_MAGIC,               // Magic and the frame header descriptor
+    ZSTD_STATE_HEADER,              // Rest of the frame header
+    ZSTD_STATE_BLOCK_HEADER,
+    ZSTD_STATE_BLOCK,
+    ZSTD_STATE_CHECKSUM,
+    ZSTD_STATE_DONE
+} zstd_state_t;
+
+// Consumer that decompresses a file straight into its destination as it's read
+typedef struct _decompress {
+    platform_consumer_t consumer;
+    uint8_t *dest;                  // Output
+    uint64_t dest_size;             // Size of the output, from the frame header
+    uint64_t out;                   // Bytes written so far
+    int partial;                    // Stop quietly once dest is full instead of wanting the whole frame in it
+    int format;                     // DECOMPRESS_LZ4 or DECOMPRESS_ZSTD
+
+    int state;                      // lz4_state_t or zstd_state_t
+    uint8_t flags;                  // FLG byte or frame header descriptor
+    size_t block_max;               // Biggest block the frame can have
+    uint32_t block_size;            // Size field of the current block (the whole block header for zstd)
+
+    uint8_t header[DECOMPRESS_HEADER_SIZE]; // Frame descriptor being gathered
+    uint8_t *stage;                 // A block that is split over two chunks is gathered here
+    size_t staged;                  // Bytes gathered so far
+    zstd_t *zstd;                   // Tables for compressed zstd blocks, allocated with the first one
+} decompress_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Work out how a file is compressed
+ * @param header The start of the file
+ * @param length Amount of bytes in @p header (up to DECOMPRESS_HEADER_SIZE)
+ * @param name Name of the file, for error messages
+ * @param content_size Output for the decompressed size
+ * @returns DECOMPRESS_xxx
+ */
+int decompress_detect(const uint8_t *header, size_t length, const char *name, uint64_t *content_size);
+
+/**
+ * @brief Set up a consumer that decompresses a file as it's read
+ * @param d The consumer
+ * @param format DECOMPRESS_xxx, from @c decompress_detect
+ * @param dest Where the output goes
+ * @param dest_size The decompressed size, from @c decompress_detect
+ * @returns The consumer, put it first in the consumer list
+ */
+platform_consumer_t *decompress_consumer(decompress_t *d, int format, void *dest, uint64_t dest_size);
+
+#endif
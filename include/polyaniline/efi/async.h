@@ -0,0 +1,100 @@
+/**
+ * @file include/polyaniline/efi/async.h
+ * @brief Background file reads
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_ASYNC_H
+#define POLYANILINE_EFI_ASYNC_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/decompress.h>
+#include <efi.h>
+
+/**** DEFINITIONS ****/
+
+/* Most reads kept in flight per file, each one is a chunk (see file_getChunkSize) */
+#define ASYNC_DEPTH             4
+
+/* State of a file */
+#define ASYNC_ERROR             -1
+#define ASYNC_BUSY              0
+#define ASYNC_DONE              1
+
+/**** TYPES ****/
+
+// One read in flight
+typedef struct _async_slot {
+    EFI_FILE_PROTOCOL *handle;      // Own handle, so every read has its own file position
+    EFI_FILE_IO_TOKEN token;        // ReadEx token, its event is signaled when the read is done
+    uint8_t *scratch;               // Where compressed data is read to, NULL to read straight into the file buffer
+    size_t length;                  // Size of the read
+} async_slot_t;
+
+// A file being read in the background
+typedef struct _async_file {
+    char *path;
+    int flags;                      // PLATFORM_LOAD_xxx
+    int state;                      // ASYNC_xxx
+    int sync;                       // The firmware can't do ReadEx, so it's read with Read() instead
+
+    uint8_t *buffer;                // Contents
+    uint64_t size;                  // Size of the contents (decompressed)
+    uint64_t file_size;             // Size of the file on disk
+    uint64_t submitted;             // Bytes asked for so far
+    uint64_t consumed;              // Bytes handed to the consumers so far
+    int depth;                      // Amount of slots that could be set up
+    int inflight;                   // Reads submitted and not consumed yet
+    int oldest;                     // Slot with the oldest read in it, the others follow round robin
+
+    decompress_t decompress;        // Used if the file is compressed
+    platform_consumer_t *consumers; // Consumers, the decompressor first
+
+    async_slot_t slots[ASYNC_DEPTH];
+    struct _async_file *next;       // Next file being read
+} async_file_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Start reading a whole file in the background
+ * @param af The file
+ * @param path Path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param consumers Consumers, they see the file as it is on disk
+ * @returns 0 on success
+ */
+int async_open(async_file_t *af, char *path, int flags, platform_consumer_t *consumers);
+
+/**
+ * @brief Hand finished reads to the consumers and keep new ones going
+ * @param af The file
+ * @returns ASYNC_xxx
+ */
+int async_poll(async_file_t *af);
+
+/**
+ * @brief Poll every file being read in the background
+ *
+ * Called whenever the loader does something else with the disk, so the background reads never run dry.
+ */
+void async_pump();
+
+/**
+ * @brief Wait for a file to be read completely
+ * @param af The file
+ * @param size Output for the size of the contents
+ * @returns The contents, or NULL if it failed
+ */
+void *async_finish(async_file_t *af, size_t *size);
+
+#endif
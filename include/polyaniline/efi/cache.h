@@ -0,0 +1,62 @@
+/**
+ * @file include/polyaniline/efi/cache.h
+ * @brief Framebuffer memory type (PAT/MTRR) control
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_CACHE_H
+#define POLYANILINE_EFI_CACHE_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+
+/**** DEFINITIONS ****/
+
+/* How the range ended up write-combining */
+#define CACHE_WC_FAILED         0   // It didn't, the range keeps whatever type it had
+#define CACHE_WC_ALREADY        1   // The firmware already mapped it write-combining
+#define CACHE_WC_PAT            2   // The pages were pointed at a write-combining PAT entry
+#define CACHE_WC_MTRR           3   // A free variable MTRR was programmed
+
+/* PAT entry repurposed as write-combining. Entry 7 (PAT+PCD+PWT) is the least likely to be in use */
+#define CACHE_PAT_INDEX         7
+
+/* Page table entry bits */
+#define CACHE_PTE_PRESENT       (1ULL << 0)
+#define CACHE_PTE_WRITE         (1ULL << 1)
+#define CACHE_PTE_USER          (1ULL << 2)
+#define CACHE_PTE_PWT           (1ULL << 3)
+#define CACHE_PTE_PCD           (1ULL << 4)
+#define CACHE_PTE_LARGE         (1ULL << 7)
+#define CACHE_PTE_PAT_4K        (1ULL << 7)
+#define CACHE_PTE_PAT_LARGE     (1ULL << 12)
+#define CACHE_PTE_ADDRESS       0x000FFFFFFFFFF000ULL
+#define CACHE_PTE_FLAGS         0xFFF0000000000FFFULL
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Make a range of physical memory write-combining
+ * @param base Start of the range
+ * @param size Size of the range
+ * @returns CACHE_WC_xxx
+ *
+ * The previous state is saved and put back by @c cache_restore
+ */
+int cache_setWriteCombining(uint64_t base, uint64_t size);
+
+/**
+ * @brief Undo @c cache_setWriteCombining
+ *
+ * Must be called before ExitBootServices(), the kernel expects the firmware's PAT and MTRRs
+ */
+void cache_restore();
+
+#endif
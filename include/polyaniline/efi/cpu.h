@@ -0,0 +1,164 @@
+/**
+ * @file include/polyaniline/efi/cpu.h
+ * @brief x86_64 CPU helpers
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_CPU_H
+#define POLYANILINE_EFI_CPU_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+
+/**** DEFINITIONS ****/
+
+/* CPUID.1:EDX */
+#define CPU_FEATURE_MTRR            (1 << 12)
+#define CPU_FEATURE_PAT             (1 << 16)
+
+/* CPUID.1:ECX */
+#define CPU_FEATURE_ECX_OSXSAVE     (1 << 27)
+#define CPU_FEATURE_ECX_AVX         (1 << 28)
+
+/* CPUID.7.0:EBX */
+#define CPU_FEATURE7_AVX2           (1 << 5)
+#define CPU_FEATURE7_ERMS           (1 << 9)    // Enhanced REP MOVSB/STOSB
+#define CPU_FEATURE7_EDX_FSRM       (1 << 4)    // Fast short REP MOVSB
+
+/* XCR0 bits, both have to be set before AVX can be used */
+#define CPU_XCR0_SSE                (1 << 1)
+#define CPU_XCR0_AVX                (1 << 2)
+
+/* MSRs */
+#define CPU_MSR_MTRRCAP             0xFE
+#define CPU_MSR_PAT                 0x277
+#define CPU_MSR_MTRR_DEF_TYPE       0x2FF
+#define CPU_MSR_MTRR_PHYSBASE(n)    (0x200 + (n) * 2)
+#define CPU_MSR_MTRR_PHYSMASK(n)    (0x201 + (n) * 2)
+
+/* MTRR bits */
+#define CPU_MTRRCAP_VCNT            0xFF
+#define CPU_MTRRCAP_WC              (1 << 10)
+#define CPU_MTRR_DEF_ENABLE         (1 << 11)
+#define CPU_MTRR_MASK_VALID         (1 << 11)
+
+/* Memory types, as used by MTRRs and PAT entries */
+#define CPU_MEMTYPE_UC              0
+#define CPU_MEMTYPE_WC              1
+#define CPU_MEMTYPE_WT              4
+#define CPU_MEMTYPE_WP              5
+#define CPU_MEMTYPE_WB              6
+#define CPU_MEMTYPE_UC_MINUS        7
+
+/* Control register bits */
+#define CPU_CR0_NW                  (1UL << 29)
+#define CPU_CR0_CD                  (1UL << 30)
+#define CPU_CR0_WP                  (1UL << 16)
+#define CPU_CR4_LA57                (1UL << 12)
+
+/**** FUNCTIONS ****/
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t cpu_rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t cpu_rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t cpu_xgetbv(uint32_t xcr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(xcr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t cpu_readCR0() {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cpu_writeCR0(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(value) : "memory");
+}
+
+static inline uint64_t cpu_readCR3() {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cpu_writeCR3(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(value) : "memory");
+}
+
+static inline uint64_t cpu_readCR4() {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cpu_outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" :: "a"(value), "Nd"(port));
+}
+
+static inline uint8_t cpu_inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile ("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void cpu_pause() {
+    __asm__ volatile ("pause");
+}
+
+static inline void cpu_wbinvd() {
+    __asm__ volatile ("wbinvd" ::: "memory");
+}
+
+/**
+ * @brief Disable interrupts
+ * @returns The old flags, for @c cpu_restoreInterrupts
+ */
+static inline uint64_t cpu_disableInterrupts() {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void cpu_restoreInterrupts(uint64_t flags) {
+    if (flags & (1 << 9)) __asm__ volatile ("sti" ::: "memory");
+}
+
+/**
+ * @brief Get the TSC frequency
+ * @returns Ticks per microsecond (measured once, against BS->Stall)
+ */
+uint64_t cpu_tscPerMicrosecond();
+
+/**
+ * @brief Check whether the CPU has a feature from CPUID.1:EDX
+ * @param feature CPU_FEATURE_xxx
+ */
+int cpu_hasFeature(uint32_t feature);
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file include/polyaniline/efi/fat.h
+ * @brief Built-in FAT reader
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_FAT_H
+#define POLYANILINE_EFI_FAT_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <efi.h>
+
+/**** DEFINITIONS ****/
+
+/* FAT sectors cached, each line covers FAT_CACHE_LINE_SIZE bytes of the first FAT */
+#define FAT_CACHE_LINES         8
+#define FAT_CACHE_LINE_SIZE     4096
+
+/* Buffer for directory sectors and the unaligned ends of reads */
+#define FAT_BOUNCE_SIZE         (64 * 1024)
+
+/* Biggest sector the reader handles, anything bigger goes to the firmware */
+#define FAT_SECTOR_MAXIMUM      4096
+
+/* A long name is at most 20 entries of 13 characters */
+#define FAT_LFN_ENTRIES         20
+#define FAT_LFN_CHARACTERS      13
+
+/* Directory entry attributes */
+#define FAT_ATTR_READ_ONLY      0x01
+#define FAT_ATTR_HIDDEN         0x02
+#define FAT_ATTR_SYSTEM         0x04
+#define FAT_ATTR_VOLUME_ID      0x08
+#define FAT_ATTR_DIRECTORY      0x10
+#define FAT_ATTR_ARCHIVE        0x20
+#define FAT_ATTR_LFN            (FAT_ATTR_READ_ONLY | FAT_ATTR_HIDDEN | FAT_ATTR_SYSTEM | FAT_ATTR_VOLUME_ID)
+#define FAT_ATTR_LFN_MASK       (FAT_ATTR_LFN | FAT_ATTR_DIRECTORY | FAT_ATTR_ARCHIVE)
+
+/* Directory entry markers */
+#define FAT_ENTRY_END           0x00
+#define FAT_ENTRY_DELETED       0xE5
+#define FAT_ENTRY_E5            0x05    // First character really is 0xE5
+#define FAT_LFN_LAST            0x40    // Set in the order of the last (first stored) LFN entry
+
+/* Volumes with less clusters than these are FAT12 or FAT16 */
+#define FAT12_CLUSTERS          4085
+#define FAT16_CLUSTERS          65525
+
+/* Mount state */
+#define FAT_UNMOUNTED           0
+#define FAT_MOUNTED             1
+#define FAT_UNUSABLE            -1
+
+/**** TYPES ****/
+
+// BIOS parameter block, the start of the first sector
+typedef struct _fat_bpb {
+    uint8_t jump[3];
+    uint8_t oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t fats;
+    uint16_t root_entries;          // 0 on FAT32
+    uint16_t sectors16;
+    uint8_t media;
+    uint16_t fat_sectors16;         // 0 on FAT32
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden_sectors;
+    uint32_t sectors32;
+
+    // FAT32 only
+    uint32_t fat_sectors32;
+    uint16_t flags;
+    uint16_t version;
+    uint32_t root_cluster;
+} __attribute__((packed)) fat_bpb_t;
+
+// Directory entry
+typedef struct _fat_dirent {
+    uint8_t name[11];               // 8.3, padded with spaces
+    uint8_t attributes;
+    uint8_t reserved;
+    uint8_t create_tenths;
+    uint16_t create_time;
+    uint16_t create_date;
+    uint16_t access_date;
+    uint16_t cluster_hi;            // FAT32 only
+    uint16_t write_time;
+    uint16_t write_date;
+    uint16_t cluster_lo;
+    uint32_t size;
+} __attribute__((packed)) fat_dirent_t;
+
+// Long file name entry, 13 characters of the name each
+typedef struct _fat_lfn {
+    uint8_t order;
+    uint16_t name1[5];
+    uint8_t attributes;             // FAT_ATTR_LFN
+    uint8_t type;
+    uint8_t checksum;               // Of the 8.3 name it belongs to
+    uint16_t name2[6];
+    uint16_t cluster;
+    uint16_t name3[2];
+} __attribute__((packed)) fat_lfn_t;
+
+// The mounted volume. Everything is in device blocks, which can be smaller than FAT sectors.
+typedef struct _fat_volume {
+    EFI_BLOCK_IO_PROTOCOL *blockio;
+    uint32_t block_size;            // Bytes per device block
+    uint32_t sector_blocks;         // Device blocks per FAT sector
+    uint32_t sector_size;           // Bytes per FAT sector
+    uint32_t cluster_size;          // Bytes per cluster
+    int type;                       // 12, 16 or 32
+    uint64_t fat_start;             // First block of the first FAT
+    uint64_t fat_size;              // Bytes in one FAT
+    uint64_t root_start;            // First block of the FAT12/16 root directory
+    uint32_t root_sectors;          // Sectors in it
+    uint32_t root_cluster;          // First cluster of the FAT32 root directory
+    uint64_t data_start;            // First block of cluster 2
+    uint32_t clusters;              // Amount of data clusters
+} fat_volume_t;
+
+// A run of contiguous clusters in a file
+typedef struct _fat_run {
+    uint64_t block;                 // First device block
+    uint64_t offset;                // Offset in the file
+    uint64_t length;                // Bytes in the run, the last one ends with the file
+} fat_run_t;
+
+// An open file. The rest of the loader only sees the EFI_FILE_PROTOCOL.
+typedef struct _fat_file {
+    EFI_FILE_PROTOCOL protocol;     // Has to come first
+    uint64_t size;
+    uint64_t position;
+    fat_run_t *runs;
+    int run_count;
+    int run_cursor;                 // Run the last read ended in, reads are mostly sequential
+} fat_file_t;
+
+// A cached piece of the FAT
+typedef struct _fat_cache_line {
+    uint64_t block;                 // First device block in it
+    int valid;
+    uint8_t *data;
+} fat_cache_line_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Open a file on the boot volume with the built-in FAT reader
+ * @param path The path of the file, '/' and '\\' are both separators
+ * @returns The file, or NULL if it should be opened through the firmware instead
+ *
+ * NULL is returned for anything the reader isn't sure about: a volume that isn't FAT, a file it can't find,
+ * or a cluster chain that doesn't add up.
+ */
+EFI_FILE_PROTOCOL *fat_open(char *path);
+
+/**
+ * @brief Free everything the FAT reader uses
+ *
+ * Called before ExitBootServices.
+ */
+void fat_shutdown();
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file include/polyaniline/efi/file.h
+ * @brief EFI boot volume access
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_FILE_H
+#define POLYANILINE_EFI_FILE_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <polyaniline/platform.h>
+#include <efi.h>
+
+/**** DEFINITIONS ****/
+
+/* Longest path we can open, in characters */
+#define FILE_PATH_LENGTH        256
+
+/* Limits for the configured read chunk size */
+#define FILE_CHUNK_MINIMUM      (1024 * 1024)
+#define FILE_CHUNK_MAXIMUM      (8 * 1024 * 1024)
+
+/* Decompressed start of an opened compressed file that is kept for reading headers */
+#define FILE_HEAD_SIZE          (64 * 1024)
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Open a file on the boot volume
+ * @param path The path of the file, '/' is accepted as a separator
+ * @returns The file or NULL if it couldn't be opened
+ */
+EFI_FILE_PROTOCOL *file_open(char *path);
+
+/**
+ * @brief Get the size of an open file
+ * @param file The file
+ * @param size Output for the size
+ * @returns 0 on success
+ */
+int file_getSize(EFI_FILE_PROTOCOL *file, uint64_t *size);
+
+/**
+ * @brief Read exactly @p size bytes from the current position of a file
+ * @param file The file
+ * @param buffer Where to read to
+ * @param size The amount of bytes
+ * @returns 0 on success, 1 on an error or if the file ended early
+ */
+int file_read(EFI_FILE_PROTOCOL *file, void *buffer, uint64_t size);
+
+/**
+ * @brief Get the amount of bytes to read at a time
+ *
+ * The configured size is rounded down to a multiple of the optimal transfer size of the boot device,
+ * so no request gets split into an odd piece.
+ */
+size_t file_getChunkSize();
+
+/**
+ * @brief Work out whether an open file is compressed, and leave it at the start
+ * @param file The file
+ * @param file_size Size of the file
+ * @param path Name of the file, for error messages
+ * @param content_size Output for the decompressed size
+ * @returns DECOMPRESS_xxx
+ */
+int file_detect(EFI_FILE_PROTOCOL *file, uint64_t file_size, char *path, uint64_t *content_size);
+
+/**
+ * @brief Allocate memory for a file
+ * @param size The amount of bytes
+ * @param flags PLATFORM_LOAD_xxx
+ */
+void *file_allocate(uint64_t size, int flags);
+
+/**
+ * @brief Free memory from @c file_allocate
+ */
+void file_free(void *buffer, uint64_t size, int flags);
+
+/**
+ * @brief Read exactly @p size bytes a chunk at a time, handing every chunk to consumers
+ * @param file The file
+ * @param buffer Where to read to
+ * @param size The amount of bytes
+ * @param consumers List of consumers, or NULL
+ * @returns 0 on success, 1 on a read error or if a consumer failed
+ */
+int file_readChunked(EFI_FILE_PROTOCOL *file, void *buffer, uint64_t size, platform_consumer_t *consumers);
+
+/**
+ * @brief Close a file opened with @c file_open
+ */
+void file_close(EFI_FILE_PROTOCOL *file);
+
+/**
+ * @brief Close the boot volume
+ *
+ * Called before ExitBootServices.
+ */
+void file_shutdown();
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file include/polyaniline/efi/glyph.h
+ * @brief Glyph cache
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_GLYPH_H
+#define POLYANILINE_EFI_GLYPH_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <polyaniline/font.h>
+#include <polyaniline/psf.h>
+
+/**** DEFINITIONS ****/
+
+/* Amount of color pairs the cache holds before it starts evicting */
+#define GLYPH_CACHE_PAIRS       8
+
+/* Amount of glyphs in the font */
+#define GLYPH_COUNT             256
+
+/* Largest integer scale the font can be drawn at */
+#define GLYPH_MAX_SCALE         4
+
+/* Widest scaled row (in source bits) a row mask can hold */
+#define GLYPH_MASK_BITS         64
+
+/**** TYPES ****/
+
+// One color pair worth of expanded glyphs
+typedef struct _glyph_cache_entry {
+    uint32_t fg;                            // Foreground pixel
+    uint32_t bg;                            // Background pixel
+    uint64_t last_used;                     // Used for eviction
+    uint64_t expanded[GLYPH_COUNT / 64];    // Bitmap of glyphs that have been expanded
+    uint32_t *tiles;                        // GLYPH_COUNT tiles of glyph_width * glyph_height pixels
+} glyph_cache_entry_t;
+
+/**** VARIABLES ****/
+
+/* Size of a character cell on screen, in pixels */
+extern int glyph_width;
+extern int glyph_height;
+
+/* Integer scale the font is drawn at */
+extern int glyph_scale;
+
+/* Font being drawn */
+extern psf_atlas_t *glyph_font;
+
+/* The built-in font, described as an atlas */
+extern psf_atlas_t glyph_builtin;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Set the font and the scale glyphs are drawn at
+ * @param font The font to draw with, NULL for the built-in one
+ * @param scale Integer scale, 1 to GLYPH_MAX_SCALE (less for wide fonts)
+ */
+void glyph_init(psf_atlas_t *font, int scale);
+
+/**
+ * @brief Get the expanded tile of a character
+ * @param ch The character
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ * @returns glyph_height rows of glyph_width pixels or NULL if the cache could not be allocated
+ */
+uint32_t *glyph_get(int ch, uint32_t fg, uint32_t bg);
+
+/**
+ * @brief Draw a character
+ * @param ch The character
+ * @param dest Top left pixel to draw to
+ * @param pitch Pixels per row of @p dest
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ */
+void glyph_draw(int ch, uint32_t *dest, uint32_t pitch, uint32_t fg, uint32_t bg);
+
+/**
+ * @brief Drop all cached glyphs
+ */
+void glyph_flush();
+
+#endif
@@ -17,6 +17,64 @@
 
 /**** INCLUDES ****/
 #include <polyaniline/video.h>
+#include <stdint.h>
+
+/**** DEFINITIONS ****/
+
+/* Maximum amount of dirty rectangles tracked before they get collapsed into one */
+#define GOP_MAX_DIRTY_RECTS     16
+
+/* No usable video mode */
+#define GOP_NO_MODE             0xFFFFFFFF
+
+/* Screen height that gets one step of font scale when picking it automatically */
+#define GOP_SCALE_STEP          720
+
+/* How drawing reaches video memory, picked by the bandwidth probe */
+#define GOP_STRATEGY_DIRECT     0   // Draw straight into the framebuffer
+#define GOP_STRATEGY_BLT        1   // Draw into the back buffer, present with Blt(EfiBltBufferToVideo)
+#define GOP_STRATEGY_STREAM     2   // Draw into the back buffer, present with streaming stores
+
+/* Rows of the screen the bandwidth probe writes */
+#define GOP_PROBE_LINES         64
+
+/* Direct drawing has to beat presenting by this factor, since scrolling reads video memory back */
+#define GOP_DIRECT_FACTOR       2
+
+/**** TYPES ****/
+
+// Rectangle of the screen (x2/y2 are exclusive)
+typedef struct _gop_rect {
+    uint32_t x1;
+    uint32_t y1;
+    uint32_t x2;
+    uint32_t y2;
+} gop_rect_t;
+
+// Position of a PixelBitMask channel
+typedef struct _gop_channel {
+    uint32_t shift;
+    uint32_t bits;
+} gop_channel_t;
+
+// Video mode we picked on a previous boot (stored in an EFI variable)
+typedef struct _gop_cached_mode {
+    uint32_t policy;            // VIDEO_MODE_xxx this was picked for
+    uint32_t target_width;      // Resolution the policy asked for, so a new setting or monitor picks again
+    uint32_t target_height;
+    uint32_t mode;              // Mode number
+    uint32_t width;             // Resolution of the mode, to check it's still the same mode
+    uint32_t height;
+} gop_cached_mode_t;
+
+// Off-screen copy of the screen, in native pixels
+struct _video_surface {
+    uint32_t generation;        // gop_generation when captured, so we know the mode hasn't changed
+    uint32_t y;                 // Screen row it was taken from
+    uint32_t width;
+    uint32_t height;
+    uint32_t *pixels;           // width * height pixels, no padding
+};
 
 /**** FUNCTIONS ****/
 
@@ -30,4 +88,11 @@ int gop_initialize();
  */
 video_info_t gop_collectVideoInformation();
 
+/**
+ * @brief Present any pending changes and switch to drawing directly to video memory
+ * 
+ * Blt() is a boot service, so this has to be called before ExitBootServices()
+ */
+void gop_shutdown();
+
 #endif
\ No newline at end of file
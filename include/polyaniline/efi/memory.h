@@ -0,0 +1,51 @@
+/**
+ * @file include/polyaniline/efi/memory.h
+ * @brief Bulk memory copy and fill
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_MEMORY_H
+#define POLYANILINE_EFI_MEMORY_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** DEFINITIONS ****/
+
+/* Vector unit used for copies that don't go through rep movsb */
+#define MEMORY_VECTOR_SSE2          0
+#define MEMORY_VECTOR_AVX2          1
+
+/* Below this a plain word loop wins, rep movsb/stosb has a startup cost (none with FSRM, see memory_init) */
+#define MEMORY_SMALL_THRESHOLD      128
+
+/* Below this a word loop fills faster than the vector loops, which take longer to set up than to copy */
+#define MEMORY_SMALL_FILL_THRESHOLD 256
+
+/* Copies at least this big skip the cache, unless CPUID tells us how big the cache is */
+#define MEMORY_STREAM_DEFAULT       (1024 * 1024)
+
+/* Never stream below this, whatever the cache size */
+#define MEMORY_STREAM_MINIMUM       (256 * 1024)
+
+/* Always stream from here, big shared caches are split between a lot of cores */
+#define MEMORY_STREAM_MAXIMUM       (16 * 1024 * 1024)
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Pick copy and fill methods for this CPU
+ *
+ * Called once early on. Until then the SSE2 paths are used, which every x86_64 CPU has.
+ */
+void memory_init();
+
+#endif
@@ -32,6 +32,13 @@
  */
 int multiboot_create(multiboot_t *multiboot, char *cmdline, uintptr_t initrd_start, uintptr_t initrd, uintptr_t *kernel_end);
 
+/**
+ * @brief Copy the boot log into its Multiboot module
+ *
+ * Call as late as possible, anything logged after this doesn't make it to the kernel
+ */
+void multiboot_finishBootLog();
+
 /**
  * @brief Relocate the initial ramdisk after Multiboot information was compiled
  * @param initrd Initial ramdisk location in memory
@@ -0,0 +1,68 @@
+/**
+ * @file include/polyaniline/efi/serial.h
+ * @brief EFI serial console
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_SERIAL_H
+#define POLYANILINE_EFI_SERIAL_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <polyaniline/interfaces/serial.h>
+
+/**** DEFINITIONS ****/
+
+/* How output reaches the port */
+#define SERIAL_NONE             0   // No serial console
+#define SERIAL_EFI              1   // The firmware's serial I/O protocol
+#define SERIAL_PORT             2   // Straight to the UART with port I/O
+
+/* COM1 */
+#define SERIAL_COM1             0x3F8
+#define SERIAL_BAUD_BASE        115200
+
+/* 16550 registers (offsets from the port base) */
+#define SERIAL_DATA             0   // Transmit/receive, divisor low with DLAB
+#define SERIAL_IER              1   // Interrupt enable, divisor high with DLAB
+#define SERIAL_FCR              2   // FIFO control (write)
+#define SERIAL_IIR              2   // Interrupt identification (read)
+#define SERIAL_LCR              3   // Line control
+#define SERIAL_MCR              4   // Modem control
+#define SERIAL_LSR              5   // Line status
+#define SERIAL_SCRATCH          7
+
+/* Register bits */
+#define SERIAL_LCR_8N1          0x03
+#define SERIAL_LCR_DLAB         0x80
+#define SERIAL_FCR_ENABLE       0xC7    // Enable and clear both FIFOs, 14 byte receive threshold
+#define SERIAL_IIR_FIFO         0xC0    // Both bits set if the FIFO is there and working
+#define SERIAL_MCR_DTR_RTS      0x03
+#define SERIAL_LSR_THRE         0x20    // Transmit holding register (FIFO) empty
+
+/* A 16550A transmit FIFO. Without a FIFO only one byte fits at a time */
+#define SERIAL_FIFO_SIZE        16
+
+/* Bytes queued before a flush is forced */
+#define SERIAL_BUFFER_SIZE      1024
+
+/* How many times to poll LSR before giving up on the UART */
+#define SERIAL_SPIN_LIMIT       100000
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Stop using firmware services for the serial console
+ *
+ * Called before ExitBootServices. Output carries on over port I/O if the UART is there.
+ */
+void serial_shutdown();
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * @file include/polyaniline/efi/variables.h
+ * @brief EFI variables used by Polyaniline
+ * 
+ * 
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ * 
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_EFI_VARIABLES_H
+#define POLYANILINE_EFI_VARIABLES_H
+
+/**** DEFINITIONS ****/
+
+/* Vendor GUID all of our variables live under */
+#define POLYANILINE_VARIABLE_GUID       { 0x6c1a3f2e, 0x5b7d, 0x4e9a, {0x9c, 0x41, 0x2d, 0x8e, 0x73, 0xb5, 0x0f, 0x16} }
+
+/* Variable names */
+#define POLYANILINE_VARIABLE_VIDEO_MODE L"PolyanilineVideoMode"
+#define POLYANILINE_VARIABLE_HEADLESS   L"PolyanilineHeadless"      // UINT8, nonzero to boot headless
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file include/polyaniline/hash.h
+ * @brief XXH64 checksums
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_HASH_H
+#define POLYANILINE_HASH_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <polyaniline/platform.h>
+
+/**** TYPES ****/
+
+// XXH64 state, data can be fed in pieces of any size
+typedef struct _hash_state {
+    uint64_t acc[4];                // The four lanes
+    uint64_t total;                 // Bytes hashed so far
+    uint8_t buffer[32];             // Partial stripe
+    size_t buffered;                // Bytes in buffer
+} hash_state_t;
+
+// Consumer that checks a file against a known XXH64
+typedef struct _hash_consumer {
+    platform_consumer_t consumer;
+    hash_state_t state;
+    uint64_t expected;              // What it should come out as
+    const char *name;               // Name for the error message
+} hash_consumer_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Start an XXH64 hash
+ * @param state The state
+ * @param seed Seed, normally 0
+ */
+void hash_init(hash_state_t *state, uint64_t seed);
+
+/**
+ * @brief Add data to an XXH64 hash
+ * @param state The state
+ * @param data The data
+ * @param length The amount of bytes
+ */
+void hash_update(hash_state_t *state, const void *data, size_t length);
+
+/**
+ * @brief Get the XXH64 of everything added so far
+ * @param state The state
+ */
+uint64_t hash_digest(hash_state_t *state);
+
+/**
+ * @brief Set up a consumer that checks a file as it's read
+ * @param hc The consumer
+ * @param name Name of the file, for the error message
+ * @param expected The XXH64 it should have
+ * @returns The consumer, to put in a consumer list
+ */
+platform_consumer_t *hash_checkConsumer(hash_consumer_t *hc, const char *name, uint64_t expected);
+
+#endif
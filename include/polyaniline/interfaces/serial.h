@@ -0,0 +1,43 @@
+/**
+ * @file include/polyaniline/interfaces/serial.h
+ * @brief Serial console interface
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_INTERFACES_SERIAL_H
+#define POLYANILINE_INTERFACES_SERIAL_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Initialize the serial console
+ * @returns 0 on success, 1 if there is no serial port to use
+ */
+int platform_serialInit();
+
+/**
+ * @brief Queue bytes for the serial console
+ * @param data The bytes
+ * @param length The amount of bytes
+ *
+ * Nothing is guaranteed to be sent until @c platform_serialFlush
+ */
+void platform_serialWrite(const char *data, size_t length);
+
+/**
+ * @brief Send everything queued for the serial console
+ */
+void platform_serialFlush();
+
+#endif
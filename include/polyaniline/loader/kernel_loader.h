@@ -14,14 +14,30 @@
 #ifndef POLYANILINE_LOADER_KERNEL_LOADER_H
 #define POLYANILINE_LOADER_KERNEL_LOADER_H
 
+/**** INCLUDES ****/
+#include <stdint.h>
+
+/**** TYPES ****/
+
+// A PT_LOAD segment, the same for ELF32 and ELF64
+typedef struct _kernel_segment {
+    uintptr_t dest;                 // Where it goes in memory
+    uint64_t offset;                // Offset in the file
+    uintptr_t filesz;               // Bytes in the file
+    uintptr_t memsz;                // Bytes in memory, anything past filesz is zeroed
+} kernel_segment_t;
+
 /**** FUNCTIONS ****/
 
 /**
  * @brief Load the kernel image
- * @param kernel_image Pointer to kernel image
+ * @param path Path of the kernel file on the boot volume
  * @param entrypoint Output entrypoint
+ * @param reserved Called once all the memory of the kernel is claimed and before the segments are read, or NULL
  * @returns A pointer to the end of the kernel image
+ *
+ * Only the headers are read up front, every segment is read straight from the file to where it belongs.
  */
-uintptr_t kernel_load(void *kernel_image, uintptr_t *entrypoint);
+uintptr_t kernel_load(char *path, uintptr_t *entrypoint, void (*reserved)());
 
 #endif
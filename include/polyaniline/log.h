@@ -0,0 +1,107 @@
+/**
+ * @file include/polyaniline/log.h
+ * @brief Leveled logging
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_LOG_H
+#define POLYANILINE_LOG_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** DEFINITIONS ****/
+
+/* Log levels */
+#define LOG_LEVEL_NONE          0
+#define LOG_LEVEL_ERROR         1
+#define LOG_LEVEL_WARN          2
+#define LOG_LEVEL_INFO          3
+#define LOG_LEVEL_DEBUG         4
+
+/* Build-time threshold. Anything above it isn't compiled in at all (set with LOG_LEVEL= in the Makefile) */
+#ifndef POLYANILINE_LOG_LEVEL
+#define POLYANILINE_LOG_LEVEL   LOG_LEVEL_DEBUG
+#endif
+
+/* Per-subsystem thresholds, default to the global one */
+#ifndef LOG_LEVEL_LOADER
+#define LOG_LEVEL_LOADER        POLYANILINE_LOG_LEVEL   // ELF loading
+#endif
+
+#ifndef LOG_LEVEL_BOOT
+#define LOG_LEVEL_BOOT          POLYANILINE_LOG_LEVEL   // Loading files and starting the kernel
+#endif
+
+#ifndef LOG_LEVEL_MULTIBOOT
+#define LOG_LEVEL_MULTIBOOT     POLYANILINE_LOG_LEVEL   // Multiboot information
+#endif
+
+/* Most arguments a log call can take */
+#define LOG_MAX_ARGS            8
+
+/* Longest formatted log line */
+#define LOG_LINE_LENGTH         256
+
+/**** MACROS ****/
+
+// Argument counting and packing, so a call site only stores raw 64-bit values
+#define LOG_CAST(x) ((uint64_t)(x))
+#define LOG_PICK(_0, _1, _2, _3, _4, _5, _6, _7, _8, name, ...) name
+#define LOG_COUNT(...) LOG_PICK(_0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_PACK0()
+#define LOG_PACK1(a) , LOG_CAST(a)
+#define LOG_PACK2(a, ...) , LOG_CAST(a) LOG_PACK1(__VA_ARGS__)
+#define LOG_PACK3(a, ...) , LOG_CAST(a) LOG_PACK2(__VA_ARGS__)
+#define LOG_PACK4(a, ...) , LOG_CAST(a) LOG_PACK3(__VA_ARGS__)
+#define LOG_PACK5(a, ...) , LOG_CAST(a) LOG_PACK4(__VA_ARGS__)
+#define LOG_PACK6(a, ...) , LOG_CAST(a) LOG_PACK5(__VA_ARGS__)
+#define LOG_PACK7(a, ...) , LOG_CAST(a) LOG_PACK6(__VA_ARGS__)
+#define LOG_PACK8(a, ...) , LOG_CAST(a) LOG_PACK7(__VA_ARGS__)
+#define LOG_PACK(...) LOG_PICK(_0, ##__VA_ARGS__, LOG_PACK8, LOG_PACK7, LOG_PACK6, LOG_PACK5, LOG_PACK4, LOG_PACK3, LOG_PACK2, LOG_PACK1, LOG_PACK0)(__VA_ARGS__)
+
+/**
+ * Log a message for a subsystem. Compiles to nothing if @p level is above the subsystem's threshold.
+ * Only integer and pointer arguments are allowed, and strings (%s) have to outlive the call since
+ * formatting can happen much later.
+ */
+#define LOG_WRITE(subsystem, level, format, ...) do { \
+        if ((level) <= LOG_LEVEL_##subsystem) { \
+            log_write((level), (format), LOG_COUNT(__VA_ARGS__), (const uint64_t[]){ 0 LOG_PACK(__VA_ARGS__) } + 1); \
+        } \
+    } while (0)
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Log a message
+ * @param level LOG_LEVEL_xxx
+ * @param format The format string, has to stay around (a literal)
+ * @param count The amount of arguments
+ * @param args The arguments, each widened to 64 bits
+ *
+ * Use @c LOG_WRITE instead. Messages at or below the console level are formatted and printed straight away,
+ * the rest are only recorded into the boot log and formatted when it's read.
+ */
+void log_write(int level, const char *format, int count, const uint64_t *args);
+
+/**
+ * @brief Format a log message
+ * @param buffer Output buffer
+ * @param size Size of @p buffer
+ * @param format The format string (d, i, u, x, X, p, s, c with flags 0 and -, a width and l/ll/z)
+ * @param count The amount of arguments
+ * @param args The arguments
+ * @returns The amount of characters written, not counting the terminating NUL
+ */
+size_t log_format(char *buffer, size_t size, const char *format, int count, const uint64_t *args);
+
+#endif
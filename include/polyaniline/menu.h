@@ -17,6 +17,7 @@
 /**** INCLUDES ****/
 #include <stdint.h>
 #include <polyaniline/video.h>
+#include <polyaniline/terminal.h>
 
 /**** DEFINITIONS ****/
 
@@ -35,6 +36,12 @@
 /* Default titlebar stuff */
 #define TITLEBAR_DEFAULT_COLOR  RGB(40, 1, 56)
 
+/* Lines of the boot log shown at once */
+#define MENU_LOG_ROWS           (USERBOX_HEIGHT - 2)
+
+/* Amount of menu screens whose chrome (logo, copyright, title bar) is kept around */
+#define MENU_CHROME_SLOTS       3
+
 /**** TYPES ****/
 
 typedef struct option {
@@ -47,6 +54,18 @@ typedef struct option {
     int inv;                    // Cosmetic. Inverts the actual look of the checkbox
 } option_t;
 
+// Cached chrome of a menu screen
+typedef struct _menu_chrome {
+    const char *title;          // Title bar text (a literal, compared by pointer), NULL if the slot is empty
+    color_t titlebar;           // Title bar color
+    color_t liquid;             // Logo liquid color
+    color_t fg;                 // Terminal colors it was drawn with
+    color_t bg;
+    int copyright;              // Whether the copyright footer is part of it
+    uint64_t last_used;         // Used for eviction
+    terminal_snapshot_t snapshot;
+} menu_chrome_t;
+
 /**** MACROS ****/
 
 #define OPTIONS_START() option_t options[MAX_PAGES][MAX_OPTIONS] = { NULL }; int optcount = 0; int pages = 0; int selected = 0; int selected_page = 0;
@@ -59,7 +78,7 @@ typedef struct option {
         terminal_setXY(ub_offset_x, ub_offset_y + 2); \
         for (int i = 0; i < MAX_OPTIONS; i++) { \
             if (options[selected_page][i].type) { menu_renderOption(&options[selected_page][i], (i == selected), selected_page, pages); len++; } \
-            else { terminal_setXY(ub_offset_x, terminal_y); for (int i = ub_offset_x; i < terminal_width - ub_offset_x; i++) terminal_putCharacter(' '); terminal_y++;  } \
+            else { terminal_fillSpan(ub_offset_x, terminal_y, terminal_width - ub_offset_x * 2, terminal_bg); terminal_y++; } \
         }\
         int k = platform_readKeyboard(0); \
         if (k == KEYBOARD_DOWN && selected < len-1) selected++; \
@@ -109,5 +128,17 @@ void menu_renderOption(option_t *opt, int selected, int page, int pages);
  */
 void menu_drawTitleBar(color_t bg, char *str);
 
+/**
+ * @brief Clear the screen and draw the static parts of a menu screen
+ * @param liquid The logo liquid color
+ * @param titlebar The title bar color
+ * @param title The title bar text
+ * @param copyright Whether to draw the copyright footer
+ *
+ * The result is cached, so switching back to a screen is a single copy.
+ * The cursor is left on the line under the title bar.
+ */
+void menu_drawChrome(color_t liquid, color_t titlebar, char *title, int copyright);
+
 
 #endif
\ No newline at end of file
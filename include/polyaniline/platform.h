@@ -14,6 +14,29 @@
 #ifndef POLYANILINE_PLATFORM_H
 #define POLYANILINE_PLATFORM_H
 
+/**** INCLUDES ****/
+#include <stddef.h>
+#include <stdint.h>
+
+/**** DEFINITIONS ****/
+
+/* platform_loadFile flags */
+#define PLATFORM_LOAD_PAGES     0x01    // Load into whole pages that are handed to the kernel and never freed
+
+/**** TYPES ****/
+
+// An open file on the boot volume
+typedef struct platform_file platform_file_t;
+
+// Something that looks at a file chunk by chunk while it's being read (embed it at the start of your own structure)
+typedef struct _platform_consumer {
+    int (*start)(struct _platform_consumer *consumer, uint64_t size);                   // Before the first chunk (optional)
+    int (*consume)(struct _platform_consumer *consumer, const void *data, size_t length);  // Every chunk, in order
+    int (*finish)(struct _platform_consumer *consumer);                                 // After the last chunk (optional)
+    void (*release)(struct _platform_consumer *consumer);                               // Instead of finish after a failure, whether or not it was started (optional)
+    struct _platform_consumer *next;
+} platform_consumer_t;
+
 /**** FUNCTIONS ****/
 
 /**
@@ -29,4 +52,89 @@ void platform_boot(char *cmdline);
  */
 void platform_reboot();
 
+/**
+ * @brief Allocate memory
+ * @param size The amount of bytes to allocate
+ * @returns A pointer to the memory or NULL on failure
+ */
+void *platform_allocate(size_t size);
+
+/**
+ * @brief Free memory allocated by @c platform_allocate
+ * @param ptr The pointer to free
+ */
+void platform_free(void *ptr);
+
+/**
+ * @brief Copy memory, picking the fastest method the CPU has for the size
+ * @param dest Destination
+ * @param src Source, must not overlap @p dest
+ * @param size The amount of bytes to copy
+ */
+void platform_copyMemory(void *dest, const void *src, size_t size);
+
+/**
+ * @brief Fill memory, picking the fastest method the CPU has for the size
+ * @param dest Destination
+ * @param value The byte to fill with
+ * @param size The amount of bytes to fill
+ */
+void platform_fillMemory(void *dest, int value, size_t size);
+
+/**
+ * @brief Load a whole file from the boot volume
+ * @param path The path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param size Output for the size of the file
+ * @returns The file, or NULL if it couldn't be read. Free it with @c platform_free unless it was loaded with PLATFORM_LOAD_PAGES.
+ */
+void *platform_loadFile(char *path, int flags, size_t *size);
+
+/**
+ * @brief Load a whole file from the boot volume, handing every chunk to some consumers as it arrives
+ * @param path The path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param size Output for the size of the file
+ * @param consumers List of consumers, or NULL
+ * @returns The file, or NULL if it couldn't be read or a consumer failed
+ */
+void *platform_streamFile(char *path, int flags, size_t *size, platform_consumer_t *consumers);
+
+/**
+ * @brief Open a file on the boot volume to read parts of it
+ * @param path The path of the file
+ * @param size Output for the size of the file
+ * @returns The file or NULL if it couldn't be opened
+ */
+platform_file_t *platform_openFile(char *path, size_t *size);
+
+/**
+ * @brief Read part of an open file
+ * @param file The file
+ * @param offset Where in the file to start
+ * @param buffer Where to read to
+ * @param size The amount of bytes, all of them have to be there
+ * @returns 0 on success
+ */
+int platform_readFileAt(platform_file_t *file, uint64_t offset, void *buffer, size_t size);
+
+/**
+ * @brief Close a file opened with @c platform_openFile
+ */
+void platform_closeFile(platform_file_t *file);
+
+/**
+ * @brief Claim physical memory at a fixed address so nothing else gets put there
+ * @param address Page aligned start of the memory
+ * @param size The amount of bytes, rounded up to whole pages
+ * @returns 0 on success, 1 if the memory is in use or doesn't exist
+ */
+int platform_reserveMemory(uintptr_t address, size_t size);
+
+/**
+ * @brief Get a timestamp
+ * @returns Microseconds since the machine was reset
+ */
+uint64_t platform_getTime();
+
 #endif
\ No newline at end of file
@@ -14,6 +14,11 @@
 #ifndef POLYANILINE_POLYANILINE_H
 #define POLYANILINE_POLYANILINE_H
 
+/**** VARIABLES ****/
+
+/* Set by the platform when there is no screen (or it shouldn't be used). No menu is shown */
+extern int polyaniline_headless;
+
 /**** FUNCTIONS ****/
 
 /**
@@ -0,0 +1,51 @@
+/**
+ * @file include/polyaniline/progress.h
+ * @brief Loading progress bar
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_PROGRESS_H
+#define POLYANILINE_PROGRESS_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+#include <polyaniline/platform.h>
+
+/**** DEFINITIONS ****/
+
+/* Widest the bar gets, in cells */
+#define PROGRESS_BAR_WIDTH      40
+
+/**** TYPES ****/
+
+// Consumer that draws a progress bar while a file is read
+typedef struct _progress {
+    platform_consumer_t consumer;
+    const char *label;              // Shown in front of the bar
+    uint64_t total;                 // Bytes expected
+    uint64_t done;                  // Bytes so far
+    uint64_t started;               // platform_getTime() at the start
+    uint64_t painted;               // platform_getTime() at the last repaint
+    int row;                        // Terminal row the bar was put on
+    int scrolled;                   // terminal_scrolled at the time
+} progress_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Set up a progress bar consumer
+ * @param progress The consumer
+ * @param label Label shown in front of the bar, has to stay around
+ * @returns The consumer, to put in a consumer list
+ */
+platform_consumer_t *progress_consumer(progress_t *progress, const char *label);
+
+#endif
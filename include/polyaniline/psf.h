@@ -0,0 +1,98 @@
+/**
+ * @file include/polyaniline/psf.h
+ * @brief PC Screen Font loader
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_PSF_H
+#define POLYANILINE_PSF_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** DEFINITIONS ****/
+
+/* PSF1 */
+#define PSF1_MAGIC0             0x36
+#define PSF1_MAGIC1             0x04
+#define PSF1_MODE512            0x01    // 512 glyphs instead of 256
+#define PSF1_MODEHASTAB         0x02    // Unicode table follows the glyphs
+#define PSF1_MODESEQ            0x04    // Same as PSF1_MODEHASTAB
+#define PSF1_SEPARATOR          0xFFFF
+#define PSF1_STARTSEQ           0xFFFE
+
+/* PSF2 */
+#define PSF2_MAGIC              0x864AB572
+#define PSF2_HAS_UNICODE_TABLE  0x01
+#define PSF2_SEPARATOR          0xFF
+#define PSF2_STARTSEQ           0xFE
+
+/* Atlas layout */
+#define PSF_ATLAS_GLYPHS        256     // The atlas is indexed by character, not by glyph
+#define PSF_ATLAS_ALIGN         64      // Cache line
+#define PSF_MAX_WIDTH           32
+#define PSF_MAX_HEIGHT          64
+
+/**** TYPES ****/
+
+typedef struct _psf1_header {
+    uint8_t magic[2];
+    uint8_t mode;
+    uint8_t charsize;           // Bytes per glyph, which is also the height
+} __attribute__((packed)) psf1_header_t;
+
+typedef struct _psf2_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headersize;        // Offset of the glyphs
+    uint32_t flags;
+    uint32_t length;            // Amount of glyphs
+    uint32_t charsize;          // Bytes per glyph
+    uint32_t height;
+    uint32_t width;
+} __attribute__((packed)) psf2_header_t;
+
+// A font converted into something the renderer can index directly
+typedef struct _psf_atlas {
+    uint32_t width;             // Glyph width in pixels
+    uint32_t height;            // Glyph height in pixels
+    uint32_t row_bytes;         // Bytes per glyph row, the leftmost pixel is the top bit of the first byte
+    uint32_t stride;            // Bytes between glyphs
+    uint8_t *glyphs;            // PSF_ATLAS_GLYPHS glyphs
+
+    void *file;                 // The original file, kept so it can be passed to the kernel
+    size_t file_size;
+} psf_atlas_t;
+
+/**** VARIABLES ****/
+
+/* The font loaded from the boot volume, NULL if there isn't one */
+extern psf_atlas_t *psf_font;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Validate a PSF1/PSF2 file and convert it into an atlas
+ * @param data The file
+ * @param size The size of the file
+ * @param atlas The atlas to fill in
+ * @returns 0 on success
+ */
+int psf_parse(void *data, size_t size, psf_atlas_t *atlas);
+
+/**
+ * @brief Load a font from the boot volume into @c psf_font
+ * @param path The path of the font
+ * @returns 0 on success
+ */
+int psf_load(char *path);
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file include/polyaniline/strbuf.h
+ * @brief String builder
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_STRBUF_H
+#define POLYANILINE_STRBUF_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** TYPES ****/
+
+// A string being built in a fixed buffer. It's always NUL terminated.
+typedef struct _strbuf {
+    char *buffer;           // The buffer
+    size_t size;            // Size of the buffer, including the NUL
+    size_t length;          // Characters in it right now
+    int truncated;          // Set once something didn't fit
+} strbuf_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Start building a string
+ * @param sb The builder
+ * @param buffer Where to build it
+ * @param size Size of @p buffer, has to be at least 1
+ */
+void strbuf_init(strbuf_t *sb, char *buffer, size_t size);
+
+/**
+ * @brief Append characters
+ * @param sb The builder
+ * @param str The characters
+ * @param length The amount of characters
+ * @returns 0 on success, 1 if it had to be cut short
+ */
+int strbuf_appendn(strbuf_t *sb, const char *str, size_t length);
+
+/**
+ * @brief Append a string
+ * @param sb The builder
+ * @param str The string
+ * @returns 0 on success, 1 if it had to be cut short
+ */
+int strbuf_append(strbuf_t *sb, const char *str);
+
+/**
+ * @brief Append one character
+ * @param sb The builder
+ * @param c The character
+ * @returns 0 on success, 1 if it didn't fit
+ */
+int strbuf_putc(strbuf_t *sb, char c);
+
+#endif
@@ -16,8 +16,39 @@
 
 /**** INCLUDES ****/
 #include <stdint.h>
+#include <stddef.h>
 #include <polyaniline/video.h>
 
+/**** DEFINITIONS ****/
+
+/* Cell contents that never match anything, forces the cell to be redrawn */
+#define TERMINAL_CELL_INVALID   0xFFFFFFFF
+
+/* The serial console logs output instead of mirroring a window of the screen */
+#define TERMINAL_SERIAL_LOG     -1
+
+/* Runs of rows a snapshot keeps pixels for, the last one stretches over any more there are */
+#define TERMINAL_SNAPSHOT_BANDS 4
+
+/**** TYPES ****/
+
+// What's currently drawn in a character cell
+typedef struct _terminal_cell {
+    uint32_t ch;                // Character
+    uint32_t fg;                // Foreground (same as bg for blank cells)
+    uint32_t bg;                // Background
+} terminal_cell_t;
+
+// Saved copy of the whole terminal. Pixels are only kept for rows that aren't blank, the rest is cleared on restore.
+typedef struct _terminal_snapshot {
+    video_surface_t *bands[TERMINAL_SNAPSHOT_BANDS]; // Pixels of runs of rows that aren't blank, NULL past the last one
+    terminal_cell_t *cells;     // The cell grid
+    int width;                  // Size of the grid
+    int height;
+    color_t clear;              // What the screen was cleared with, blank rows are this
+    color_t fg;                 // Colors at the time
+    color_t bg;
+} terminal_snapshot_t;
 
 /**** VARIABLES ****/
 
@@ -33,6 +64,12 @@ extern int terminal_height;
 extern color_t terminal_fg;
 extern color_t terminal_bg;
 
+/* Output is a log (no menu is up) */
+extern int terminal_logging;
+
+/* Lines scrolled so far (including ones that are pending) */
+extern int terminal_scrolled;
+
 /**** FUNCTIONS ****/
 
 /**
@@ -54,6 +91,58 @@ void terminal_clearScreen(color_t fg, color_t bg);
  */
 void terminal_putCharacter(int ch);
 
+/**
+ * @brief Write a run of characters to the terminal
+ * @param run The characters to write
+ * @param length The amount of characters
+ */
+void terminal_writeRun(const char *run, size_t length);
+
+/**
+ * @brief Get everything drawn so far onto the screen and the serial console
+ */
+void terminal_present();
+
+/**
+ * @brief Choose what the serial console shows
+ * @param x The first column of the window to mirror, or TERMINAL_SERIAL_LOG for a plain log of output
+ * @param y The first line of the window to mirror
+ *
+ * Output only goes into the boot log while the serial console is a log, menus aren't logged
+ */
+void terminal_setSerialWindow(int x, int y);
+
+/**
+ * @brief Blank a span of cells on one line without moving the cursor
+ * @param x The first column
+ * @param y The line
+ * @param length The amount of cells
+ * @param bg The background to fill with
+ */
+void terminal_fillSpan(int x, int y, int length, color_t bg);
+
+/**
+ * @brief Save the whole terminal into a snapshot
+ * @param snapshot The snapshot, anything already in it is reused
+ * @returns 0 on success, 1 if there's no memory for it or no cell grid to work out what's on screen
+ */
+int terminal_saveSnapshot(terminal_snapshot_t *snapshot);
+
+/**
+ * @brief Put a snapshot back on the screen
+ * @param snapshot The snapshot
+ * @returns 0 on success, 1 if the snapshot is stale and the caller has to draw from scratch
+ *
+ * The cursor is moved to the top left
+ */
+int terminal_restoreSnapshot(terminal_snapshot_t *snapshot);
+
+/**
+ * @brief Free what a snapshot holds
+ * @param snapshot The snapshot
+ */
+void terminal_freeSnapshot(terminal_snapshot_t *snapshot);
+
 /**
  * @brief Set foreground color
  * @param fg The foreground color
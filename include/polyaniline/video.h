@@ -18,6 +18,13 @@
 #include <stdint.h>
 #include <polyaniline/font.h>
 
+/**** DEFINITIONS ****/
+
+/* Video mode selection policies */
+#define VIDEO_MODE_NATIVE       0   // The panel's preferred resolution (or whatever the firmware set up)
+#define VIDEO_MODE_LARGEST      1   // The largest mode available
+#define VIDEO_MODE_CONFIGURED   2   // __polyaniline_video_width x __polyaniline_video_height
+
 /**** TYPES ****/
 
 // Common video information
@@ -25,8 +32,14 @@ typedef struct _video_info {
     uint32_t width;
     uint32_t height;
     uint32_t bpp;
+    uint32_t cell_width;        // Size of a character cell in pixels
+    uint32_t cell_height;
+    uint32_t scale;             // Integer scale the font is drawn at
 } video_info_t;
 
+// Off-screen copy of the screen, the layout is up to the platform
+typedef struct _video_surface video_surface_t;
+
 
 // This type is for any color. You can use the definitions or macros to interact, or make your own.
 typedef union _color {
@@ -84,12 +97,30 @@ typedef union _color {
  */
 void platform_putPixel(int x, int y, color_t color);
 
+/**
+ * @brief Fill a rectangle on the screen
+ * @param x X coordinate of the rectangle
+ * @param y Y coordinate of the rectangle
+ * @param width Width of the rectangle
+ * @param height Height of the rectangle
+ * @param color The color to fill with
+ */
+void platform_fillRect(int x, int y, int width, int height, color_t color);
+
 /**
  * @brief Clear the screen
  * @param color The color to clear with
  */
 void platform_clearScreen(color_t color);
 
+/**
+ * @brief Scroll the top of the screen up
+ * @param height Height of the region to scroll, starting from the top of the screen
+ * @param pixels Amount of pixels to move the region up by
+ * @param color The color to fill the freed rows with
+ */
+void platform_scroll(int height, int pixels, color_t color);
+
 /**
  * @brief Draw a character to the screen
  * @param ch The character to draw
@@ -100,5 +131,43 @@ void platform_clearScreen(color_t color);
  */
 void platform_drawCharacter(int ch, int x, int y, color_t fg, color_t bg);
 
+/**
+ * @brief Draw a run of characters on one line
+ * @param str The characters to draw
+ * @param count The amount of characters
+ * @param x The X coordinate of the first character
+ * @param y The Y coordinate
+ * @param fg The fg of the characters
+ * @param bg The bg of the characters
+ */
+void platform_drawRun(const char *str, int count, int x, int y, color_t fg, color_t bg);
+
+/**
+ * @brief Copy everything drawn since the last call to the screen
+ */
+void platform_present();
+
+/**
+ * @brief Copy a band of whole pixel rows into an off-screen surface
+ * @param surface A surface to reuse, or NULL to allocate one
+ * @param y The first row
+ * @param height The amount of rows
+ * @returns The surface or NULL if it couldn't be allocated or the rows aren't on the screen
+ */
+video_surface_t *platform_captureRows(video_surface_t *surface, int y, int height);
+
+/**
+ * @brief Put rows captured by @c platform_captureRows back where they came from
+ * @param surface The surface
+ * @returns 0 on success, 1 if the surface is from a different video mode
+ */
+int platform_restoreRows(video_surface_t *surface);
+
+/**
+ * @brief Free a surface
+ * @param surface The surface
+ */
+void platform_freeSurface(video_surface_t *surface);
+
 
 #endif
@@ -0,0 +1,110 @@
+/**
+ * @file include/polyaniline/zstd.h
+ * @brief zstd block decoder
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_ZSTD_H
+#define POLYANILINE_ZSTD_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** DEFINITIONS ****/
+
+/* Frame format */
+#define ZSTD_MAGIC              0xFD2FB528
+#define ZSTD_FHD_FCS(fhd)       ((fhd) >> 6)    // Frame content size field size
+#define ZSTD_FHD_SINGLE_SEGMENT 0x20            // No window descriptor, the window is the whole content
+#define ZSTD_FHD_RESERVED       0x08
+#define ZSTD_FHD_CHECKSUM       0x04            // Low 32 bits of the content's XXH64 after the last block
+#define ZSTD_FHD_DICTIONARY(fhd) ((fhd) & 3)    // Dictionary ID field size
+#define ZSTD_FRAME_HEADER_MAX   18              // Magic, descriptor, window, dictionary ID and content size
+
+/* Blocks */
+#define ZSTD_BLOCK_HEADER_SIZE  3
+#define ZSTD_BLOCK_LAST(h)      ((h) & 1)
+#define ZSTD_BLOCK_TYPE(h)      (((h) >> 1) & 3)
+#define ZSTD_BLOCK_SIZE(h)      ((h) >> 3)
+#define ZSTD_BLOCK_RAW          0
+#define ZSTD_BLOCK_RLE          1
+#define ZSTD_BLOCK_COMPRESSED   2
+#define ZSTD_BLOCK_MAX          (128 * 1024)
+
+/* Table limits */
+#define ZSTD_HUFFMAN_MAX_BITS   11
+#define ZSTD_LL_MAX_LOG         9
+#define ZSTD_ML_MAX_LOG         9
+#define ZSTD_OF_MAX_LOG         8
+#define ZSTD_LL_SYMBOLS         36
+#define ZSTD_ML_SYMBOLS         53
+#define ZSTD_OF_SYMBOLS         32
+
+/* Literals can be copied 8 bytes at a time past their end */
+#define ZSTD_LITERALS_SLACK     8
+
+/**** TYPES ****/
+
+// One state of an FSE table
+typedef struct _zstd_fse_entry {
+    uint8_t symbol;
+    uint8_t bits;                   // Bits read for the next state
+    uint16_t base;                  // Added to them
+} zstd_fse_entry_t;
+
+// One entry of a Huffman table, indexed by the next ZSTD_HUFFMAN_MAX_BITS bits at most
+typedef struct _zstd_huffman_entry {
+    uint8_t symbol;
+    uint8_t bits;                   // Length of its code
+} zstd_huffman_entry_t;
+
+// An FSE table for one of the sequence fields, big enough for any of them
+typedef struct _zstd_fse {
+    zstd_fse_entry_t entries[1 << ZSTD_LL_MAX_LOG];
+    int log;                        // Accuracy log, the table has 1 << log states
+    int valid;                      // Set once a block has described it, so later ones can repeat it
+} zstd_fse_t;
+
+// Everything that carries over from one compressed block to the next
+typedef struct _zstd {
+    zstd_huffman_entry_t huffman[1 << ZSTD_HUFFMAN_MAX_BITS];
+    int huffman_bits;               // Longest code in the Huffman table, 0 if there is none yet
+
+    zstd_fse_t ll;                  // Literal lengths
+    zstd_fse_t of;                  // Offsets
+    zstd_fse_t ml;                  // Match lengths
+    uint64_t repeat[3];             // Repeated offsets
+
+    uint8_t literals[ZSTD_BLOCK_MAX + ZSTD_LITERALS_SLACK];
+} zstd_t;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Get ready for a new frame
+ * @param z The tables
+ */
+void zstd_reset(zstd_t *z);
+
+/**
+ * @brief Decompress one compressed zstd block
+ * @param z Tables from the blocks before
+ * @param src The block
+ * @param size Size of the block
+ * @param dest The whole output of the frame, matches can reach back anywhere in it
+ * @param out Bytes written to @p dest so far, advanced past the block
+ * @param dest_size Size of @p dest
+ * @param partial Stop quietly once @p dest is full instead of failing
+ * @returns 0 on success, 1 if the block is corrupt
+ */
+int zstd_decodeBlock(zstd_t *z, const uint8_t *src, size_t size, uint8_t *dest, uint64_t *out, uint64_t dest_size, int partial);
+
+#endif
@@ -22,8 +22,13 @@
 
 void * memcpy ( void * destination, const void * source, size_t num );
 void * memset ( void * ptr, int value, size_t num );
+void * memmove ( void * destination, const void * source, size_t num );
+int memcmp ( const void * ptr1, const void * ptr2, size_t num );
+void * memchr ( const void * ptr, int value, size_t num );
 size_t strlen(const char *s);
+size_t strnlen(const char *s, size_t maxlen);
 char * strcpy(char *dest, const char *src);
+char * strncpy(char *dest, const char *src, size_t num);
 char * strcat(char *dest, const char *src);
 
 #endif
\ No newline at end of file
@@ -436,16 +436,34 @@ int sprintf(char * str, const char * format, ...) {
 	return out;
 }
 
+/* printf output is collected into lines and handed to the terminal in runs */
+#define PRINTF_BUFFER_SIZE 256
+
+struct PrintfBuffer {
+	char buffer[PRINTF_BUFFER_SIZE];
+	size_t length;
+};
+
 static int cb_printf(void * user, char c) {
-	terminal_putCharacter(c);
+	struct PrintfBuffer * data = user;
+	data->buffer[data->length++] = c;
+	if (c == '\n' || data->length == PRINTF_BUFFER_SIZE) {
+		terminal_writeRun(data->buffer, data->length);
+		data->length = 0;
+	}
 	return 0;
 }
 
 int printf(const char * fmt, ...) {
+	struct PrintfBuffer data;
+	data.length = 0;
+
 	va_list args;
 	va_start(args, fmt);
-	int out = xvasprintf(cb_printf, NULL, fmt, args);
+	int out = xvasprintf(cb_printf, &data, fmt, args);
 	va_end(args);
 
+	if (data.length) terminal_writeRun(data.buffer, data.length);
+
 	return out;
 }
\ No newline at end of file
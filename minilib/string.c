@@ -1,70 +1,210 @@
 /**
  * @file minilib/string.c
  * @brief string functions (and memory)
- * 
- * 
+ *
+ * Most of these work 8 bytes at a time. A word has a zero byte in it if
+ * (word - 0x0101...) & ~word & 0x8080... is nonzero, which is what the string scans use.
+ * Aligned word reads never cross a page, so reading a little past the end of a string is safe.
+ *
  * @copyright
  * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
  * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
  * Please see the LICENSE file in the main repository for more details.
- * 
+ *
  * Copyright (C) 2024 Samuel Stuart
  */
 
 #include <string.h>
 
-#ifndef __EFI__ // GNUEFI provides functions for these
+#define STRING_ONES     0x0101010101010101ULL
+#define STRING_HIGHS    0x8080808080808080ULL
 
-void* memcpy(void* __restrict destination_ptr, const void* __restrict source_ptr, size_t size) {
-    unsigned char* destination = (unsigned char*)destination_ptr;
-    const unsigned char* source = (const unsigned char*)source_ptr;
+// Nonzero if any byte of the word is zero
+#define STRING_HAS_ZERO(w) (((w) - STRING_ONES) & ~(w) & STRING_HIGHS)
+
+// A word that can alias anything
+typedef uint64_t __attribute__((may_alias)) string_word_t;
+
+/**
+ * @brief Load 8 bytes from anywhere
+ */
+static inline uint64_t string_load(const void *ptr) {
+    uint64_t word;
+    __builtin_memcpy(&word, ptr, 8);
+    return word;
+}
+
+/**
+ * @brief Store 8 bytes anywhere
+ */
+static inline void string_store(void *ptr, uint64_t word) {
+    __builtin_memcpy(ptr, &word, 8);
+}
 
-    for (size_t i = 0; i < size; i++)
-        destination[i] = source[i];
+/**
+ * @brief Copy forwards a word at a time (safe if @p dest is below @p src)
+ */
+static void string_copyForward(unsigned char *dest, const unsigned char *src, size_t size) {
+    for (; size >= 8; size -= 8, dest += 8, src += 8) string_store(dest, string_load(src));
+    while (size--) *dest++ = *src++;
+}
+
+/**
+ * @brief Copy backwards a word at a time (safe if @p dest is above @p src)
+ */
+static void string_copyBackward(unsigned char *dest, const unsigned char *src, size_t size) {
+    dest += size;
+    src += size;
+    for (; size >= 8; size -= 8) {
+        dest -= 8;
+        src -= 8;
+        string_store(dest, string_load(src));
+    }
 
+    while (size--) *--dest = *--src;
+}
+
+/**
+ * @brief Fill a word at a time
+ */
+static void string_fill(unsigned char *dest, unsigned char value, size_t size) {
+    uint64_t pattern = value * STRING_ONES;
+    for (; size >= 8; size -= 8, dest += 8) string_store(dest, pattern);
+    while (size--) *dest++ = value;
+}
+
+#ifndef __EFI__ // GNUEFI provides functions for these
+
+void* memcpy(void* __restrict destination_ptr, const void* __restrict source_ptr, size_t size) {
+    string_copyForward(destination_ptr, source_ptr, size);
     return destination_ptr;
 }
 
 void* memset(void* destination_ptr, int value, size_t size) {
-    size_t i = 0;
-    for (; i < size; i++) {
-        ((char*)destination_ptr)[i] = value;
-    }
-    
+    string_fill(destination_ptr, (unsigned char)value, size);
     return destination_ptr;
 }
 
 #endif
 
+void* memmove(void* destination_ptr, const void* source_ptr, size_t size) {
+    unsigned char *destination = (unsigned char*)destination_ptr;
+    const unsigned char *source = (const unsigned char*)source_ptr;
+
+    if (destination == source || !size) return destination_ptr;
+
+    // Only copy backwards when the destination starts inside the source
+    if (destination > source && destination < source + size) {
+        string_copyBackward(destination, source, size);
+    } else {
+        string_copyForward(destination, source, size);
+    }
+
+    return destination_ptr;
+}
+
+int memcmp(const void* ptr1, const void* ptr2, size_t size) {
+    const unsigned char *a = (const unsigned char*)ptr1;
+    const unsigned char *b = (const unsigned char*)ptr2;
+
+    // Skip equal words, the byte loop finds which byte differs
+    while (size >= 8 && string_load(a) == string_load(b)) {
+        a += 8;
+        b += 8;
+        size -= 8;
+    }
+
+    for (; size; size--, a++, b++) {
+        if (*a != *b) return *a - *b;
+    }
+
+    return 0;
+}
+
+void* memchr(const void* ptr, int value, size_t size) {
+    const unsigned char *p = (const unsigned char*)ptr;
+    unsigned char c = (unsigned char)value;
+
+    // Bytes up to a word boundary
+    for (; size && ((uintptr_t)p & 7); size--, p++) {
+        if (*p == c) return (void*)p;
+    }
+
+    // Matching bytes become zero bytes after the XOR
+    uint64_t pattern = c * STRING_ONES;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word = *(const string_word_t*)p ^ pattern;
+        if (STRING_HAS_ZERO(word)) break;
+    }
+
+    for (; size; size--, p++) {
+        if (*p == c) return (void*)p;
+    }
+
+    return NULL;
+}
+
 size_t strlen(const char *s) {
-    char *p = (char*)s;
+    const char *p = s;
+
+    // Bytes up to a word boundary
+    for (; (uintptr_t)p & 7; p++) {
+        if (!*p) return p - s;
+    }
 
-    size_t out = 0;
-    while (*p++) out++;
-    return out;
+    // Then whole words until one has a NUL in it
+    while (!STRING_HAS_ZERO(*(const string_word_t*)p)) p += 8;
+
+    while (*p) p++;
+    return p - s;
+}
+
+size_t strnlen(const char *s, size_t maxlen) {
+    const char *p = s;
+    const char *end = s + maxlen;
+
+    for (; p < end && ((uintptr_t)p & 7); p++) {
+        if (!*p) return p - s;
+    }
+
+    while (end - p >= 8 && !STRING_HAS_ZERO(*(const string_word_t*)p)) p += 8;
+
+    while (p < end && *p) p++;
+    return p - s;
 }
 
 char* strcpy(char* destination_str, const char* source_str) {
-    char *destination_ptr = destination_str;
-    
-    while ( (*destination_str = *source_str) ) {
-        destination_str++;
-        source_str++;
+    char *destination = destination_str;
+    const char *source = source_str;
+
+    // Align the source so word reads can't run off the end of a page
+    for (; (uintptr_t)source & 7; source++, destination++) {
+        if (!(*destination = *source)) return destination_str;
     }
 
-    return destination_ptr;
+    for (;;) {
+        uint64_t word = *(const string_word_t*)source;
+        if (STRING_HAS_ZERO(word)) break;
+
+        string_store(destination, word);
+        source += 8;
+        destination += 8;
+    }
+
+    while ((*destination++ = *source++));
+    return destination_str;
+}
+
+char* strncpy(char* destination_str, const char* source_str, size_t num) {
+    size_t length = strnlen(source_str, num);
+
+    string_copyForward((unsigned char*)destination_str, (const unsigned char*)source_str, length);
+    string_fill((unsigned char*)destination_str + length, 0, num - length);
+
+    return destination_str;
 }
 
 char * strcat(char *dest, const char *src) {
-	char * end = dest;
-	while (*end != '\0') {
-		++end;
-	}
-	while (*src) {
-		*end = *src;
-		end++;
-		src++;
-	}
-	*end = '\0';
-	return dest;
-}
\ No newline at end of file
+    strcpy(dest + strlen(dest), src);
+    return dest;
+}
@@ -0,0 +1,309 @@
+/**
+ * @file platform/efi/async.c
+ * @brief Background file reads
+ *
+ * The initrd is read while the kernel is being loaded. Every file gets a few handles of its own,
+ * each with at most one ReadEx() in flight at its own position, so the disk always has the next chunks
+ * to work on while the CPU loads kernel segments or decompresses the chunks that already came in.
+ * Finished chunks go to the consumers strictly in file order.
+ *
+ * Nothing runs in the background by itself, the loader calls @c async_pump whenever it touches the disk.
+ * Firmware without revision 2 of EFI_FILE_PROTOCOL (or that doesn't implement ReadEx) gets plain Read()
+ * calls instead, one chunk at a time when the file is waited for.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/async.h>
+#include <polyaniline/efi/file.h>
+#include <polyaniline/log.h>
+#include <efi.h>
+#include <efilib.h>
+
+#define LOG(level, ...) LOG_WRITE(LOADER, LOG_LEVEL_##level, __VA_ARGS__)
+
+/* Files being read in the background */
+static async_file_t *async_list = NULL;
+
+/* Set while async_pump runs, consumers may read files themselves */
+static int async_pumping = 0;
+
+/**
+ * @brief Close the handles and events of a file and forget about it
+ * @param af The file, nothing may be in flight anymore
+ */
+static void async_close(async_file_t *af) {
+    for (int i = 0; i < ASYNC_DEPTH; i++) {
+        async_slot_t *slot = &af->slots[i];
+        if (slot->token.Event) uefi_call_wrapper(BS->CloseEvent, 1, slot->token.Event);
+        if (slot->handle) file_close(slot->handle);
+        if (slot->scratch) platform_free(slot->scratch);
+
+        slot->token.Event = NULL;
+        slot->handle = NULL;
+        slot->scratch = NULL;
+    }
+
+    for (async_file_t **p = &async_list; *p; p = &(*p)->next) {
+        if (*p == af) {
+            *p = af->next;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Let every consumer drop what it holds
+ */
+static void async_release(async_file_t *af) {
+    for (platform_consumer_t *consumer = af->consumers; consumer; consumer = consumer->next) {
+        if (consumer->release) consumer->release(consumer);
+    }
+}
+
+/**
+ * @brief Give up on a file
+ *
+ * Reads still in flight are waited for, the firmware is writing into our buffers.
+ */
+static int async_fail(async_file_t *af) {
+    for (; af->inflight; af->inflight--) {
+        async_slot_t *slot = &af->slots[af->oldest];
+        while (uefi_call_wrapper(BS->CheckEvent, 1, slot->token.Event) == EFI_NOT_READY) __builtin_ia32_pause();
+        af->oldest = (af->oldest + 1) % af->depth;
+    }
+
+    LOG(ERROR, "Reading %s failed at offset %llu\n", af->path, af->consumed);
+    async_release(af);
+    async_close(af);
+    af->state = ASYNC_ERROR;
+    return ASYNC_ERROR;
+}
+
+/**
+ * @brief Hand a chunk to the consumers
+ * @returns 0 on success
+ */
+static int async_consume(async_file_t *af, const void *data, size_t length) {
+    for (platform_consumer_t *consumer = af->consumers; consumer; consumer = consumer->next) {
+        if (consumer->consume(consumer, data, length)) return 1;
+    }
+
+    af->consumed += length;
+    return 0;
+}
+
+/**
+ * @brief Fill every free slot with the next chunk of the file
+ * @returns 0 on success
+ */
+static int async_submit(async_file_t *af) {
+    size_t chunk = file_getChunkSize();
+
+    while (af->inflight < af->depth && af->submitted < af->file_size) {
+        async_slot_t *slot = &af->slots[(af->oldest + af->inflight) % af->depth];
+        uint64_t left = af->file_size - af->submitted;
+        slot->length = (left < chunk) ? left : chunk;
+
+        EFI_STATUS status = uefi_call_wrapper(slot->handle->SetPosition, 2, slot->handle, af->submitted);
+        if (EFI_ERROR(status)) return 1;
+
+        slot->token.Status = EFI_SUCCESS;
+        slot->token.BufferSize = slot->length;
+        slot->token.Buffer = slot->scratch ? slot->scratch : af->buffer + af->submitted;
+
+        status = uefi_call_wrapper(slot->handle->ReadEx, 2, slot->handle, &slot->token);
+        if (status == EFI_UNSUPPORTED && !af->submitted) {
+            // Claims revision 2 but doesn't do it, read it the old way
+            LOG(DEBUG, "ReadEx() unsupported, reading %s synchronously\n", af->path);
+            af->sync = 1;
+            status = uefi_call_wrapper(af->slots[0].handle->SetPosition, 2, af->slots[0].handle, 0);
+            return EFI_ERROR(status) ? 1 : 0;
+        }
+
+        if (EFI_ERROR(status)) return 1;
+
+        af->submitted += slot->length;
+        af->inflight++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finish up once everything went through the consumers
+ */
+static int async_done(async_file_t *af) {
+    for (platform_consumer_t *consumer = af->consumers; consumer; consumer = consumer->next) {
+        if (consumer->finish && consumer->finish(consumer)) return async_fail(af);
+    }
+
+    async_close(af);
+    af->state = ASYNC_DONE;
+    return ASYNC_DONE;
+}
+
+/**
+ * @brief Start reading a whole file in the background
+ * @param af The file
+ * @param path Path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param consumers Consumers, they see the file as it is on disk
+ * @returns 0 on success
+ */
+int async_open(async_file_t *af, char *path, int flags, platform_consumer_t *consumers) {
+    platform_fillMemory(af, 0, sizeof(async_file_t));
+    af->path = path;
+    af->flags = flags;
+    af->consumers = consumers;
+
+    async_slot_t *first = &af->slots[0];
+    if (!(first->handle = file_open(path))) return 1;
+    if (file_getSize(first->handle, &af->file_size) || !af->file_size) goto _error;
+
+    af->size = af->file_size;
+    int format = file_detect(first->handle, af->file_size, path, &af->size);
+    if (format == DECOMPRESS_UNSUPPORTED || !af->size) goto _error;
+
+    if (!(af->buffer = file_allocate(af->size, flags))) goto _error;
+
+    // The compressed data only passes through the slots, it's decompressed straight into the buffer
+    size_t chunk = file_getChunkSize();
+    if (format != DECOMPRESS_NONE) {
+        platform_consumer_t *decompressor = decompress_consumer(&af->decompress, format, af->buffer, af->size);
+        decompressor->next = consumers;
+        af->consumers = decompressor;
+    }
+
+    // ReadEx() is new in revision 2
+    af->sync = first->handle->Revision < EFI_FILE_PROTOCOL_REVISION2 || !first->handle->ReadEx;
+
+    // Every slot needs its own handle and event, make do with however many we get
+    af->depth = af->sync ? 1 : ASYNC_DEPTH;
+    for (int i = 0; i < af->depth; i++) {
+        async_slot_t *slot = &af->slots[i];
+        if (i && !(slot->handle = file_open(path))) {
+            af->depth = i;
+            break;
+        }
+
+        if (format != DECOMPRESS_NONE) {
+            slot->scratch = platform_allocate((af->file_size < chunk) ? af->file_size : chunk);
+            if (!slot->scratch) goto _error;
+        }
+
+        if (!af->sync) {
+            EFI_STATUS status = uefi_call_wrapper(BS->CreateEvent, 5, 0, TPL_CALLBACK, NULL, NULL, &slot->token.Event);
+            if (EFI_ERROR(status)) goto _error;
+        }
+    }
+
+    for (platform_consumer_t *consumer = af->consumers; consumer; consumer = consumer->next) {
+        if (consumer->start && consumer->start(consumer, af->file_size)) goto _error;
+    }
+
+    af->state = ASYNC_BUSY;
+    af->next = async_list;
+    async_list = af;
+
+    if (!af->sync && async_submit(af)) {
+        async_fail(af);
+        goto _error_buffer;
+    }
+
+    LOG(DEBUG, "Reading %s (%llu KB) with %d reads in flight\n", path, af->file_size / 1024, af->sync ? 0 : af->depth);
+    return 0;
+
+_error:
+    async_release(af);
+    async_close(af);
+_error_buffer:
+    if (af->buffer) file_free(af->buffer, af->size, flags);
+    af->buffer = NULL;
+    af->state = ASYNC_ERROR;
+    return 1;
+}
+
+/**
+ * @brief Hand finished reads to the consumers and keep new ones going
+ * @param af The file
+ * @returns ASYNC_xxx
+ */
+int async_poll(async_file_t *af) {
+    if (af->state != ASYNC_BUSY) return af->state;
+
+    if (af->sync) {
+        // One chunk per call, so whoever is waiting gets to look around in between
+        async_slot_t *slot = &af->slots[0];
+        uint64_t left = af->file_size - af->consumed;
+        size_t chunk = file_getChunkSize();
+        size_t length = (left < chunk) ? left : chunk;
+        uint8_t *target = slot->scratch ? slot->scratch : af->buffer + af->consumed;
+
+        if (file_read(slot->handle, target, length) || async_consume(af, target, length)) return async_fail(af);
+    } else {
+        while (af->inflight) {
+            async_slot_t *slot = &af->slots[af->oldest];
+            if (uefi_call_wrapper(BS->CheckEvent, 1, slot->token.Event) == EFI_NOT_READY) break;
+
+            if (EFI_ERROR(slot->token.Status) || slot->token.BufferSize != slot->length) return async_fail(af);
+
+            // Consumed before the slot is reused for the next chunk
+            if (async_consume(af, slot->token.Buffer, slot->length)) return async_fail(af);
+            af->inflight--;
+            af->oldest = (af->oldest + 1) % af->depth;
+
+            if (async_submit(af)) return async_fail(af);
+        }
+    }
+
+    if (af->consumed == af->file_size) return async_done(af);
+    return ASYNC_BUSY;
+}
+
+/**
+ * @brief Poll every file being read in the background
+ *
+ * Called whenever the loader does something else with the disk, so the background reads never run dry.
+ */
+void async_pump() {
+    if (async_pumping) return;
+    async_pumping = 1;
+
+    async_file_t *af = async_list;
+    while (af) {
+        // Polling can take the file off the list
+        async_file_t *next = af->next;
+        if (!af->sync) async_poll(af);
+        af = next;
+    }
+
+    async_pumping = 0;
+}
+
+/**
+ * @brief Wait for a file to be read completely
+ * @param af The file
+ * @param size Output for the size of the contents
+ * @returns The contents, or NULL if it failed
+ */
+void *async_finish(async_file_t *af, size_t *size) {
+    int state;
+    while ((state = async_poll(af)) == ASYNC_BUSY) {
+        if (!af->sync) __builtin_ia32_pause();
+    }
+
+    if (state == ASYNC_ERROR) {
+        if (af->buffer) file_free(af->buffer, af->size, af->flags);
+        af->buffer = NULL;
+        return NULL;
+    }
+
+    *size = af->size;
+    return af->buffer;
+}
@@ -17,184 +17,60 @@
 #include <polyaniline/efi/multiboot.h>
 #include <polyaniline/config.h>
 #include <polyaniline/loader/kernel_loader.h>
+#include <polyaniline/efi/gop.h>
+#include <polyaniline/efi/serial.h>
+#include <polyaniline/efi/file.h>
+#include <polyaniline/efi/async.h>
+#include <polyaniline/terminal.h>
+#include <polyaniline/progress.h>
+#include <polyaniline/hash.h>
 #include <efi.h>
 #include <efilib.h>
+#include <polyaniline/log.h>
 #include <stdio.h>
 
+#define LOG(level, ...) LOG_WRITE(BOOT, LOG_LEVEL_##level, __VA_ARGS__)
+
 
 /* Loaded image */
 extern EFI_LOADED_IMAGE *LoadedImage;
 
+/* The initial ramdisk, read in the background while the kernel loads */
+static async_file_t initrd_file;
+static progress_t initrd_progress;
+static hash_consumer_t initrd_checksum;
+
 /**
- * @brief Read the kernel file into memory
- * @returns A pointer to the kernel file
+ * @brief Start reading the initial ramdisk
  */
-uintptr_t platform_loadKernel() {
-    // We want to get the simple filesystem protocol for managing files
-    EFI_STATUS status;
-    EFI_GUID fs_guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
-    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs_protocol;
-    status = uefi_call_wrapper(ST->BootServices->LocateProtocol, 3, &fs_guid, NULL, (VOID**)&fs_protocol);
-
-
-    // Now we need to open the root directory of the volume
-    EFI_FILE_PROTOCOL *root_directory;
-    status = uefi_call_wrapper(fs_protocol->OpenVolume, 2, fs_protocol, &root_directory);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Opening root directory for EFI failed\n");
-    }
-
-    // Convert the kernel file path to CHAR16
-    CHAR16 kernel_file_path[64] = { 0 };
-    int i = 0;
-    char *s = (char*)__polyaniline_kernel_file;
-
-    while (*s) {
-        kernel_file_path[i] = *s;
-        i++;
-        s++;
-    }
-
-
-    // Try to get the kernel file
-    EFI_FILE_PROTOCOL *kernel_file;
-    status = uefi_call_wrapper(root_directory->Open, 5, root_directory, &kernel_file, kernel_file_path, EFI_FILE_MODE_READ, 0);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Kernel file '%s' not found.\n", __polyaniline_kernel_file);
-    }
-
-    printf("Located kernel file successfully (\"%s\")\n", __polyaniline_kernel_file);
+static void platform_startInitrd() {
+    // Show progress while it's read, and check it on the way if we know what it should be
+    platform_consumer_t *consumers = progress_consumer(&initrd_progress, __polyaniline_initrd_file);
+    if (__polyaniline_initrd_checksum) consumers->next = hash_checkConsumer(&initrd_checksum, __polyaniline_initrd_file, __polyaniline_initrd_checksum);
 
-    // Get the file information 
-    EFI_FILE_INFO *kernel_info = NULL;
-    EFI_GUID information_id = EFI_FILE_INFO_ID;
-    UINTN buffer_size = 128; // !!! wtf?
-    status = uefi_call_wrapper(kernel_file->GetInfo, 4, kernel_file, &information_id, &buffer_size, (void*)kernel_info);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to get information on kernel file (status %d)\n", status);
-    }
-
-    // Calculate the amount of pages for the kernel
-    UINTN kernel_pages =  (kernel_info->FileSize / 4096) + 1;
-
-    // Make some memory for the kernel to sit in
-    // (Section 7.2.1 - UEFI spec 2.10) Allocation requests of Type AllocateAddress allocate pages at the address pointed by Memory on input
-    EFI_PHYSICAL_ADDRESS kernel_address = (EFI_PHYSICAL_ADDRESS)__polyaniline_kernel_address;
-    status = uefi_call_wrapper(ST->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, kernel_pages, &kernel_address);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to allocate %d pages for kernel (status %d address %p)\n", kernel_pages, status, kernel_address);
-    }
-
-    printf("Loading file into memory at %p\n", kernel_address);
-
-    // Make even more memory for the kernel to sit in after loading
-    EFI_PHYSICAL_ADDRESS kernel_address_actual = (EFI_PHYSICAL_ADDRESS)__polyaniline_kernel_address;
-    status = uefi_call_wrapper(ST->BootServices->AllocatePages, 4, AllocateAddress, EfiLoaderData, kernel_pages, &kernel_address_actual); 
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to allocate %d pages for kernel (status %d address %p)\n", kernel_pages, status, kernel_address_actual);
-    }
-
-    printf("Allocated %d pages for kernel successfully\n", kernel_pages);
-
-    // Now read in the file
-    UINTN read_size = 134217728; // TEMPORARY
-    status = uefi_call_wrapper(kernel_file->Read, 3, kernel_file, &read_size, (void*)kernel_address);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to read kernel file\n");
+    if (async_open(&initrd_file, __polyaniline_initrd_file, PLATFORM_LOAD_PAGES, consumers)) {
+        polyaniline_error("platform_boot(): Could not load initial ramdisk file '%s'\n", __polyaniline_initrd_file);
     }
-
-    printf("Kernel loaded successfully (%i KB)\n", read_size / 1024);
-    return kernel_address;
 }
 
 /**
- * @brief Load the initial ramdisk
+ * @brief Wait for the initial ramdisk to finish loading
  * @param initrd_start Start of initrd
  * @param initrd_end End of initrd
  */
 uintptr_t platform_loadInitrd(uintptr_t *initrd_start, uintptr_t *initrd_end) {
-    // We want to get the simple filesystem protocol for managing files
-    EFI_STATUS status;
-    EFI_GUID fs_guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
-    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs_protocol;
-    status = uefi_call_wrapper(ST->BootServices->LocateProtocol, 3, &fs_guid, NULL, (VOID**)&fs_protocol);
-
-
-    // Now we need to open the root directory of the volume
-    EFI_FILE_PROTOCOL *root_directory;
-    status = uefi_call_wrapper(fs_protocol->OpenVolume, 2, fs_protocol, &root_directory);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Opening root directory for EFI failed\n");
-    }
-
-    // Convert the initrd file path to CHAR16
-    CHAR16 initrd_file_path[64] = { 0 };
-    int i = 0;
-    char *s = (char*)__polyaniline_initrd_file;
-
-    while (*s) {
-        initrd_file_path[i] = *s;
-        i++;
-        s++;
+    size_t initrd_size;
+    void *initrd = async_finish(&initrd_file, &initrd_size);
+    if (!initrd) {
+        polyaniline_error("platform_boot(): Could not load initial ramdisk file '%s'\n", __polyaniline_initrd_file);
     }
 
+    LOG(INFO, "Loaded initial ramdisk \"%s\" at %p - %p (%i KB)\n", __polyaniline_initrd_file, initrd, (uintptr_t)initrd + initrd_size, initrd_size / 1024);
 
-    // Try to get the kernel file
-    EFI_FILE_PROTOCOL *initrd_file;
-    status = uefi_call_wrapper(root_directory->Open, 5, root_directory, &initrd_file, initrd_file_path, EFI_FILE_MODE_READ, 0);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Initial ramdisk file '%s' not found.\n", __polyaniline_initrd_file);
-    }
-
-    printf("Located initial ramdisk file successfully (\"%s\")\n", __polyaniline_initrd_file);
-
-    // Get the file information 
-    EFI_FILE_INFO *initrd_info = NULL;
-    EFI_GUID information_id = EFI_FILE_INFO_ID;
-    UINTN buffer_size = 128; // !!! wtf?
-    status = uefi_call_wrapper(initrd_file->GetInfo, 4, initrd_file, &information_id, &buffer_size, (void*)initrd_info);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to get information on initrd file (status %d)\n", status);
-    }
-
-    // Calculate the amount of pages for the initrd
-    UINTN initrd_pages =  (initrd_info->FileSize / 4096) + 200;
-
-
-    // Make memory for the initrd
-    EFI_PHYSICAL_ADDRESS initrd_address = (EFI_PHYSICAL_ADDRESS)0x0;
-    status = uefi_call_wrapper(ST->BootServices->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, initrd_pages, &initrd_address); 
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to allocate %d pages for initial ramdisk (status %d address %p)\n", initrd_pages, status, initrd_address);
-    }
-
-
-    printf("Loading initial ramdisk into memory at %p - %p\n", initrd_address, initrd_address + initrd_info->FileSize);
-
-    // Now read in the file
-    UINTN read_size = 134217728; // TEMPORARY
-    status = uefi_call_wrapper(initrd_file->Read, 3, initrd_file, &read_size, (void*)initrd_address);
-
-    if (EFI_ERROR(status)) {
-        polyaniline_error("platform_boot(): Failed to read initial ramdisk file\n");
-    }
-
-    printf("Initial ramdisk loaded successfully (%i KB)\n", read_size / 1024);
-
-    *initrd_start = initrd_address;
-    *initrd_end = initrd_address + initrd_info->FileSize;
-    *initrd_end = (*initrd_end + 0x1000) & ~0xFFF;
-    return initrd_address;
+    // The end is rounded up to the page, which is still inside the allocation
+    *initrd_start = (uintptr_t)initrd;
+    *initrd_end = ((uintptr_t)initrd + initrd_size + 0xFFF) & ~0xFFF;
+    return (uintptr_t)initrd;
 }
 
 typedef struct gdtr {
@@ -233,19 +109,20 @@ void platform_boot(char *cmdline) {
     // First clear the UEFI watchdog timer to prevent it from resetting us
     uefi_call_wrapper(ST->BootServices->SetWatchdogTimer, 4, 0, 0, 0, NULL);
 
-    // Load kernel
-    uintptr_t kernel_address = platform_loadKernel();
+    // Loading messages go to the serial console as a log again
+    terminal_setSerialWindow(TERMINAL_SERIAL_LOG, 0);
 
-    // Done. Now load the ELF file.
+    // Load the kernel, its segments are read straight to where they go.
+    // The initial ramdisk is read in the background as soon as the kernel has its memory (so it can't end up in the way).
     uintptr_t kernel_entry = 0x0;
-    uintptr_t kernel_end = kernel_load((void*)kernel_address, &kernel_entry);
+    uintptr_t kernel_end = kernel_load(__polyaniline_kernel_file, &kernel_entry, platform_startInitrd);
 
     // Allocate a Multiboot structure
     multiboot_t *mboot = (multiboot_t*)kernel_end;
     kernel_end += sizeof(multiboot_t);
 
 
-    // Load the initial ramdisk
+    // Wait for whatever is left of the initial ramdisk
     uintptr_t initrd_start, initrd_end;
     platform_loadInitrd(&initrd_start, &initrd_end);
 
@@ -255,6 +132,11 @@ void platform_boot(char *cmdline) {
         polyaniline_error("platform_boot(): Could not parse Multiboot information\n");
     }
 
+    // Stop using the back buffer, Blt() goes away with boot services
+    gop_shutdown();
+    serial_shutdown();
+    file_shutdown();
+
     // Exit boot services
     EFI_STATUS status;
     UINTN mapSize = 0, mapKey, descriptorSize;
@@ -264,10 +146,10 @@ void platform_boot(char *cmdline) {
         polyaniline_error("platform_boot(): Failed to exit boot services\n");
     }
 
-    printf("Exited boot services successfully\n");
+    LOG(INFO, "Exited boot services successfully\n");
 
 
-    printf("Finished loading everything successfully (%p - %p)\n", kernel_entry, kernel_end);
+    LOG(INFO, "Finished loading everything successfully (%p - %p)\n", kernel_entry, kernel_end);
 
     // Create temporary GDT
     gdt_t temp_gdt = {
@@ -284,7 +166,10 @@ void platform_boot(char *cmdline) {
     };
 
     gdtr_t temp_gdtr = { .limit = sizeof(temp_gdt.entry) - 1, .base = (uintptr_t)&temp_gdt.entry};
-    printf("GDTR available at %p - GDT at %p\n", &temp_gdtr, &temp_gdt);
+    LOG(DEBUG, "GDTR available at %p - GDT at %p\n", &temp_gdtr, &temp_gdt);
+
+    // Nothing else gets printed, the log can go to the kernel now
+    multiboot_finishBootLog();
 
     platform_bootKernelImage(kernel_entry, &temp_gdtr, (multiboot_t*)mboot);
 }
\ No newline at end of file
@@ -0,0 +1,382 @@
+/**
+ * @file platform/efi/cache.c
+ * @brief Framebuffer memory type (PAT/MTRR) control
+ *
+ * Some firmware maps the framebuffer uncached, which makes every write to it a bus transaction.
+ * This tries to make it write-combining instead:
+ *  - PAT: repurpose entry CACHE_PAT_INDEX as WC and point the framebuffer pages at it. This wins
+ *    over an uncached MTRR, so it is tried first. Large pages that stick out of the range are split.
+ *    Only done if no page outside the framebuffer uses that entry already.
+ *  - MTRR: program a free variable MTRR, if nothing else covers the range and it is size aligned.
+ *
+ * Everything is put back by @c cache_restore before ExitBootServices().
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/cache.h>
+#include <polyaniline/efi/cpu.h>
+#include <efi.h>
+#include <efilib.h>
+
+/* What was changed, for cache_restore */
+static int cache_method = CACHE_WC_FAILED;
+static uint64_t cache_base = 0;
+static uint64_t cache_end = 0;
+static uint64_t cache_pat = 0;              // Original IA32_PAT
+static int cache_pat_index = 0;             // Original PAT index of the pages
+static int cache_mtrr = -1;                 // Variable MTRR we took
+
+/**
+ * @brief Find the leaf page table entry mapping an address
+ * @param addr The address
+ * @param level Output for the level of the entry (0 = 4KB, 1 = 2MB, 2 = 1GB)
+ * @returns The entry or NULL if the address isn't mapped
+ */
+static uint64_t *cache_findEntry(uint64_t addr, int *level) {
+    uint64_t *table = (uint64_t*)(cpu_readCR3() & CACHE_PTE_ADDRESS);
+
+    for (int l = 3; l >= 0; l--) {
+        uint64_t *entry = &table[(addr >> (12 + l * 9)) & 0x1FF];
+        if (!(*entry & CACHE_PTE_PRESENT)) return NULL;
+
+        if (l == 0 || (l < 3 && (*entry & CACHE_PTE_LARGE))) {
+            *level = l;
+            return entry;
+        }
+
+        table = (uint64_t*)(*entry & CACHE_PTE_ADDRESS);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Get the PAT index a leaf entry uses
+ * @param entry The entry
+ * @param level Its level
+ */
+static int cache_getIndex(uint64_t entry, int level) {
+    uint64_t pat = level ? CACHE_PTE_PAT_LARGE : CACHE_PTE_PAT_4K;
+    return ((entry & CACHE_PTE_PWT) ? 1 : 0) | ((entry & CACHE_PTE_PCD) ? 2 : 0) | ((entry & pat) ? 4 : 0);
+}
+
+/**
+ * @brief Set the PAT index of a leaf entry
+ * @param entry The entry
+ * @param level Its level
+ * @param index The PAT index
+ */
+static void cache_setIndex(uint64_t *entry, int level, int index) {
+    uint64_t pat = level ? CACHE_PTE_PAT_LARGE : CACHE_PTE_PAT_4K;
+    uint64_t value = *entry & ~(CACHE_PTE_PWT | CACHE_PTE_PCD | pat);
+
+    if (index & 1) value |= CACHE_PTE_PWT;
+    if (index & 2) value |= CACHE_PTE_PCD;
+    if (index & 4) value |= pat;
+    *entry = value;
+}
+
+/**
+ * @brief Check whether any page outside the range uses a PAT index
+ * @param table The page table
+ * @param level Its level (3 = PML4)
+ * @param base First address it maps
+ * @param index The PAT index
+ * @returns 1 if a page that isn't completely inside [cache_base, cache_end) uses @p index
+ */
+static int cache_indexInUse(uint64_t *table, int level, uint64_t base, int index) {
+    uint64_t size = 1ULL << (12 + level * 9);
+
+    for (int i = 0; i < 512; i++) {
+        uint64_t entry = table[i];
+        if (!(entry & CACHE_PTE_PRESENT)) continue;
+
+        uint64_t addr = base + i * size;
+        if (level && (level == 3 || !(entry & CACHE_PTE_LARGE))) {
+            if (cache_indexInUse((uint64_t*)(entry & CACHE_PTE_ADDRESS), level - 1, addr, index)) return 1;
+            continue;
+        }
+
+        if (cache_getIndex(entry, level) == index && (addr < cache_base || addr + size > cache_end)) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Split a large page into a table of the next size down, mapping the same memory
+ * @param entry The large page entry
+ * @param level Its level (1 or 2)
+ * @returns 0 on success
+ */
+static int cache_splitEntry(uint64_t *entry, int level) {
+    EFI_PHYSICAL_ADDRESS table_address;
+    EFI_STATUS status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, 1, &table_address);
+    if (EFI_ERROR(status)) return 1;
+
+    uint64_t *table = (uint64_t*)table_address;
+    uint64_t child_size = 1ULL << (12 + (level - 1) * 9);
+    uint64_t base = *entry & CACHE_PTE_ADDRESS & ~((child_size << 9) - 1);
+    uint64_t flags = *entry & CACHE_PTE_FLAGS;
+
+    for (int i = 0; i < 512; i++) {
+        if (level == 1) {
+            // 2MB -> 4KB, the PAT bit moves down to where the large page bit was
+            table[i] = (flags & ~CACHE_PTE_LARGE) | ((*entry & CACHE_PTE_PAT_LARGE) ? CACHE_PTE_PAT_4K : 0) | (base + i * child_size);
+        } else {
+            // 1GB -> 2MB, same layout
+            table[i] = flags | (*entry & CACHE_PTE_PAT_LARGE) | (base + i * child_size);
+        }
+    }
+
+    // The firmware may have write protected its page tables
+    uint64_t cr0 = cpu_readCR0();
+    cpu_writeCR0(cr0 & ~CPU_CR0_WP);
+    *entry = table_address | (*entry & (CACHE_PTE_PRESENT | CACHE_PTE_WRITE | CACHE_PTE_USER));
+    cpu_writeCR0(cr0);
+
+    cpu_writeCR3(cpu_readCR3());
+    return 0;
+}
+
+/**
+ * @brief Disable caches for a memory type change (Intel SDM 11.11.7.2)
+ * @param cr0 Output for the original CR0
+ * @returns The original flags
+ */
+static uint64_t cache_begin(uint64_t *cr0) {
+    uint64_t flags = cpu_disableInterrupts();
+    *cr0 = cpu_readCR0();
+
+    cpu_writeCR0((*cr0 | CPU_CR0_CD) & ~(CPU_CR0_NW | CPU_CR0_WP));
+    cpu_wbinvd();
+    cpu_writeCR3(cpu_readCR3());
+    return flags;
+}
+
+/**
+ * @brief Re-enable caches after @c cache_begin
+ * @param flags The original flags
+ * @param cr0 The original CR0
+ */
+static void cache_finish(uint64_t flags, uint64_t cr0) {
+    cpu_wbinvd();
+    cpu_writeCR3(cpu_readCR3());
+    cpu_writeCR0(cr0);
+    cpu_restoreInterrupts(flags);
+}
+
+/**
+ * @brief Point every page in the range at a PAT index
+ * @param index The PAT index
+ */
+static void cache_setRange(int index) {
+    int level = 0;
+    for (uint64_t addr = cache_base; addr < cache_end; addr += (1ULL << (12 + level * 9))) {
+        uint64_t *entry = cache_findEntry(addr, &level);
+        cache_setIndex(entry, level, index);
+    }
+}
+
+/**
+ * @brief Get the MTRR type of an address
+ * @param addr The address
+ * @param overlap Output for whether any variable MTRR touches [addr, addr + size)
+ * @param size Size of the range (power of two, aligned)
+ */
+static int cache_getMTRRType(uint64_t addr, uint64_t size, int *overlap) {
+    uint64_t def_type = cpu_rdmsr(CPU_MSR_MTRR_DEF_TYPE);
+    int count = cpu_rdmsr(CPU_MSR_MTRRCAP) & CPU_MTRRCAP_VCNT;
+    int type = -1;
+
+    *overlap = 0;
+    if (!(def_type & CPU_MTRR_DEF_ENABLE)) return CPU_MEMTYPE_UC;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t mask = cpu_rdmsr(CPU_MSR_MTRR_PHYSMASK(i));
+        if (!(mask & CPU_MTRR_MASK_VALID)) continue;
+
+        uint64_t base = cpu_rdmsr(CPU_MSR_MTRR_PHYSBASE(i));
+        uint64_t range_mask = mask & CACHE_PTE_ADDRESS;
+        if (((base ^ addr) & range_mask & ~(size - 1)) == 0) *overlap = 1;
+
+        // UC wins any overlap, WT wins over WB
+        if (((base ^ addr) & range_mask) == 0) {
+            int mtrr_type = base & 0xFF;
+            if (type == -1 || mtrr_type == CPU_MEMTYPE_UC || (mtrr_type == CPU_MEMTYPE_WT && type == CPU_MEMTYPE_WB)) {
+                type = mtrr_type;
+            }
+        }
+    }
+
+    return (type == -1) ? (int)(def_type & 0xFF) : type;
+}
+
+/**
+ * @brief Try the PAT method
+ * @returns 0 on success
+ */
+static int cache_tryPAT() {
+    if (!cpu_hasFeature(CPU_FEATURE_PAT)) return 1;
+    if (cpu_readCR4() & CPU_CR4_LA57) return 1;
+
+    // The entry changes for everything that uses it. Firmware can map MMIO with any UC entry, so leave it alone if anything else does.
+    if (cache_indexInUse((uint64_t*)(cpu_readCR3() & CACHE_PTE_ADDRESS), 3, 0, CACHE_PAT_INDEX)) return 1;
+
+    // Make sure every page is inside the range and uses the same PAT entry, splitting large pages as needed
+    int index = -1;
+    int level = 0;
+    for (uint64_t addr = cache_base; addr < cache_end; addr += (1ULL << (12 + level * 9))) {
+        uint64_t *entry = cache_findEntry(addr, &level);
+        if (!entry) return 1;
+
+        uint64_t page_size = 1ULL << (12 + level * 9);
+        if (level && ((addr & (page_size - 1)) || addr + page_size > cache_end)) {
+            if (cache_splitEntry(entry, level)) return 1;
+            level = 0;
+            addr -= 0x1000;    // Look at the same address again
+            continue;
+        }
+
+        int page_index = cache_getIndex(*entry, level);
+        if (index != -1 && page_index != index) return 1;
+        index = page_index;
+    }
+
+    cache_pat_index = index;
+    cache_pat = cpu_rdmsr(CPU_MSR_PAT);
+
+    uint64_t cr0;
+    uint64_t flags = cache_begin(&cr0);
+    cpu_wrmsr(CPU_MSR_PAT, (cache_pat & ~(0xFFULL << (CACHE_PAT_INDEX * 8))) | ((uint64_t)CPU_MEMTYPE_WC << (CACHE_PAT_INDEX * 8)));
+    cache_setRange(CACHE_PAT_INDEX);
+    cache_finish(flags, cr0);
+
+    return 0;
+}
+
+/**
+ * @brief Try the MTRR method
+ * @param pat_type The PAT type of the range, which has to let an MTRR WC through
+ * @returns 0 on success
+ */
+static int cache_tryMTRR(int pat_type) {
+    if (!cpu_hasFeature(CPU_FEATURE_MTRR)) return 1;
+    if (pat_type != CPU_MEMTYPE_WB && pat_type != CPU_MEMTYPE_UC_MINUS) return 1;
+
+    uint64_t cap = cpu_rdmsr(CPU_MSR_MTRRCAP);
+    if (!(cap & CPU_MTRRCAP_WC)) return 1;
+
+    // Variable MTRRs cover a power of two sized, size aligned range
+    uint64_t size = 0x1000;
+    while (size < cache_end - cache_base) size <<= 1;
+    if (cache_base & (size - 1)) return 1;
+
+    int overlap;
+    cache_getMTRRType(cache_base, size, &overlap);
+    if (overlap) return 1;
+
+    // Find a free one
+    int count = cap & CPU_MTRRCAP_VCNT;
+    for (int i = 0; i < count; i++) {
+        if (cpu_rdmsr(CPU_MSR_MTRR_PHYSMASK(i)) & CPU_MTRR_MASK_VALID) continue;
+
+        uint32_t a, b, c, d;
+        int address_bits = 36;
+        cpu_cpuid(0x80000000, 0, &a, &b, &c, &d);
+        if (a >= 0x80000008) {
+            cpu_cpuid(0x80000008, 0, &a, &b, &c, &d);
+            address_bits = a & 0xFF;
+        }
+
+        uint64_t mask = ~(size - 1) & ((1ULL << address_bits) - 1);
+
+        uint64_t cr0;
+        uint64_t flags = cache_begin(&cr0);
+        uint64_t def_type = cpu_rdmsr(CPU_MSR_MTRR_DEF_TYPE);
+        cpu_wrmsr(CPU_MSR_MTRR_DEF_TYPE, def_type & ~CPU_MTRR_DEF_ENABLE);
+        cpu_wrmsr(CPU_MSR_MTRR_PHYSBASE(i), cache_base | CPU_MEMTYPE_WC);
+        cpu_wrmsr(CPU_MSR_MTRR_PHYSMASK(i), mask | CPU_MTRR_MASK_VALID);
+        cpu_wrmsr(CPU_MSR_MTRR_DEF_TYPE, def_type);
+        cache_finish(flags, cr0);
+
+        cache_mtrr = i;
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Make a range of physical memory write-combining
+ * @param base Start of the range
+ * @param size Size of the range
+ * @returns CACHE_WC_xxx
+ *
+ * The previous state is saved and put back by @c cache_restore
+ */
+int cache_setWriteCombining(uint64_t base, uint64_t size) {
+    if (cache_method != CACHE_WC_FAILED) return cache_method;
+
+    cache_base = base & ~0xFFFULL;
+    cache_end = (base + size + 0xFFF) & ~0xFFFULL;
+
+    // Work out what the range is right now
+    int level;
+    uint64_t *entry = cache_findEntry(cache_base, &level);
+    if (!entry) return CACHE_WC_FAILED;
+
+    int pat_type = CPU_MEMTYPE_WB;
+    if (cpu_hasFeature(CPU_FEATURE_PAT)) {
+        pat_type = (cpu_rdmsr(CPU_MSR_PAT) >> (cache_getIndex(*entry, level) * 8)) & 7;
+    }
+
+    int overlap;
+    int mtrr_type = cpu_hasFeature(CPU_FEATURE_MTRR) ? cache_getMTRRType(cache_base, 0x1000, &overlap) : CPU_MEMTYPE_UC;
+
+    if (pat_type == CPU_MEMTYPE_WC ||
+        (mtrr_type == CPU_MEMTYPE_WC && (pat_type == CPU_MEMTYPE_WB || pat_type == CPU_MEMTYPE_UC_MINUS))) {
+        return CACHE_WC_ALREADY;
+    }
+
+    if (!cache_tryPAT()) {
+        cache_method = CACHE_WC_PAT;
+    } else if (!cache_tryMTRR(pat_type)) {
+        cache_method = CACHE_WC_MTRR;
+    }
+
+    return cache_method;
+}
+
+/**
+ * @brief Undo @c cache_setWriteCombining
+ *
+ * Must be called before ExitBootServices(), the kernel expects the firmware's PAT and MTRRs
+ */
+void cache_restore() {
+    if (cache_method != CACHE_WC_PAT && cache_method != CACHE_WC_MTRR) return;
+
+    uint64_t cr0;
+    uint64_t flags = cache_begin(&cr0);
+
+    if (cache_method == CACHE_WC_PAT) {
+        // Split pages are left split, they map the same memory
+        cache_setRange(cache_pat_index);
+        cpu_wrmsr(CPU_MSR_PAT, cache_pat);
+    } else {
+        uint64_t def_type = cpu_rdmsr(CPU_MSR_MTRR_DEF_TYPE);
+        cpu_wrmsr(CPU_MSR_MTRR_DEF_TYPE, def_type & ~CPU_MTRR_DEF_ENABLE);
+        cpu_wrmsr(CPU_MSR_MTRR_PHYSMASK(cache_mtrr), 0);
+        cpu_wrmsr(CPU_MSR_MTRR_PHYSBASE(cache_mtrr), 0);
+        cpu_wrmsr(CPU_MSR_MTRR_DEF_TYPE, def_type);
+    }
+
+    cache_finish(flags, cr0);
+    cache_method = CACHE_WC_FAILED;
+}
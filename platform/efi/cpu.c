@@ -0,0 +1,58 @@
+/**
+ * @file platform/efi/cpu.c
+ * @brief x86_64 CPU helpers
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/cpu.h>
+#include <polyaniline/platform.h>
+#include <efi.h>
+#include <efilib.h>
+
+/* How long to calibrate the TSC for */
+#define CPU_CALIBRATE_US    10000
+
+/* TSC ticks per microsecond, 0 until measured */
+static uint64_t cpu_tsc_per_us = 0;
+
+/**
+ * @brief Get the TSC frequency
+ * @returns Ticks per microsecond (measured once, against BS->Stall)
+ */
+uint64_t cpu_tscPerMicrosecond() {
+    if (cpu_tsc_per_us) return cpu_tsc_per_us;
+
+    uint64_t start = cpu_rdtsc();
+    uefi_call_wrapper(BS->Stall, 1, CPU_CALIBRATE_US);
+    uint64_t end = cpu_rdtsc();
+
+    cpu_tsc_per_us = (end - start) / CPU_CALIBRATE_US;
+    if (!cpu_tsc_per_us) cpu_tsc_per_us = 1;
+    return cpu_tsc_per_us;
+}
+
+/**
+ * @brief Check whether the CPU has a feature from CPUID.1:EDX
+ * @param feature CPU_FEATURE_xxx
+ */
+int cpu_hasFeature(uint32_t feature) {
+    uint32_t a, b, c, d;
+    cpu_cpuid(1, 0, &a, &b, &c, &d);
+    return (d & feature) == feature;
+}
+
+/**
+ * @brief Get a timestamp
+ * @returns Microseconds since the machine was reset
+ */
+uint64_t platform_getTime() {
+    // The TSC counts from reset, the frequency was measured long before boot services go away
+    return cpu_rdtsc() / cpu_tscPerMicrosecond();
+}
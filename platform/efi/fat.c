@@ -0,0 +1,633 @@
+/**
+ * @file platform/efi/fat.c
+ * @brief Built-in FAT reader
+ *
+ * Some firmware FAT drivers read a file one cluster at a time, which makes a big initrd thousands of tiny
+ * disk requests. This reads FAT12/16/32 straight from the BlockIo protocol of the boot volume instead:
+ * the cluster chain of a file is walked once when it's opened and turned into runs of contiguous clusters,
+ * and every read is a few big ReadBlocks() calls straight into the destination.
+ *
+ * It's read-only and only as clever as it needs to be. Anything it isn't sure about (no BPB, a file it can't
+ * find, a chain that doesn't match the file size) makes fat_open return NULL, and the file is opened through
+ * the firmware's EFI_SIMPLE_FILE_SYSTEM_PROTOCOL instead.
+ *
+ * Files are handed out as an EFI_FILE_PROTOCOL of our own, so file.c and async.c don't know the difference.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/fat.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/log.h>
+#include <efi.h>
+#include <efilib.h>
+#include <string.h>
+
+#define LOG(level, ...) LOG_WRITE(LOADER, LOG_LEVEL_##level, __VA_ARGS__)
+
+// Our EFI_FILE_PROTOCOL functions get called like firmware ones, with the Microsoft calling convention
+#define FAT_EFIAPI __attribute__((ms_abi))
+
+/* Loaded image */
+extern EFI_LOADED_IMAGE *LoadedImage;
+
+/* The boot volume */
+static fat_volume_t fat_volume;
+static int fat_state = FAT_UNMOUNTED;
+
+/* Pages for the bounce buffer and the FAT cache */
+static uint8_t *fat_bounce = NULL;
+static fat_cache_line_t fat_cache[FAT_CACHE_LINES];
+static uint8_t *fat_cache_data = NULL;
+
+/**
+ * @brief Read whole device blocks
+ * @param block First block
+ * @param buffer Where to read to, aligned for the device
+ * @param size The amount of bytes, a multiple of the block size
+ * @returns 0 on success
+ */
+static int fat_readBlocks(uint64_t block, void *buffer, size_t size) {
+    EFI_BLOCK_IO_PROTOCOL *blockio = fat_volume.blockio;
+    if (block + size / fat_volume.block_size - 1 > blockio->Media->LastBlock) return 1;
+
+    EFI_STATUS status = uefi_call_wrapper(blockio->ReadBlocks, 5, blockio, blockio->Media->MediaId, block, size, buffer);
+    return EFI_ERROR(status) ? 1 : 0;
+}
+
+/**
+ * @brief Allocate whole pages, they're aligned for any device we use
+ */
+static void *fat_allocatePages(size_t size) {
+    EFI_PHYSICAL_ADDRESS address = 0;
+    EFI_STATUS status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &address);
+    return EFI_ERROR(status) ? NULL : (void*)(uintptr_t)address;
+}
+
+static void fat_freePages(void *buffer, size_t size) {
+    uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(uintptr_t)buffer, EFI_SIZE_TO_PAGES(size));
+}
+
+/**
+ * @brief Check the BPB of the boot volume and work out where everything is
+ * @returns 0 on success, 1 if it isn't a FAT volume we can read
+ */
+static int fat_parse(EFI_BLOCK_IO_PROTOCOL *blockio) {
+    EFI_BLOCK_IO_MEDIA *media = blockio->Media;
+    if (!media->MediaPresent || media->BlockSize < 512 || media->BlockSize > FAT_SECTOR_MAXIMUM) return 1;
+    if ((media->BlockSize & (media->BlockSize - 1)) || media->IoAlign > EFI_PAGE_SIZE) return 1;
+
+    fat_volume.blockio = blockio;
+    fat_volume.block_size = media->BlockSize;
+    if (fat_readBlocks(0, fat_bounce, media->BlockSize)) return 1;
+
+    fat_bpb_t *bpb = (fat_bpb_t*)fat_bounce;
+    if (fat_bounce[510] != 0x55 || fat_bounce[511] != 0xAA) return 1;
+    if (bpb->jump[0] != 0xEB && bpb->jump[0] != 0xE9) return 1;
+
+    // Sectors have to be made of whole device blocks
+    uint32_t sector_size = bpb->bytes_per_sector;
+    if (sector_size < media->BlockSize || sector_size > FAT_SECTOR_MAXIMUM || (sector_size & (sector_size - 1))) return 1;
+
+    uint8_t spc = bpb->sectors_per_cluster;
+    if (!spc || (spc & (spc - 1)) || !bpb->reserved_sectors || !bpb->fats) return 1;
+
+    uint64_t fat_sectors = bpb->fat_sectors16 ? bpb->fat_sectors16 : bpb->fat_sectors32;
+    uint64_t total = bpb->sectors16 ? bpb->sectors16 : bpb->sectors32;
+    uint64_t root_sectors = ((uint64_t)bpb->root_entries * sizeof(fat_dirent_t) + sector_size - 1) / sector_size;
+    uint64_t data_start = bpb->reserved_sectors + bpb->fats * fat_sectors + root_sectors;
+    if (!fat_sectors || total <= data_start) return 1;
+
+    // The type only depends on the amount of clusters (Microsoft FAT specification, section 3.5)
+    uint64_t clusters = (total - data_start) / spc;
+    int type = (clusters < FAT12_CLUSTERS) ? 12 : (clusters < FAT16_CLUSTERS) ? 16 : 32;
+    if ((type == 32) != (bpb->root_entries == 0)) return 1;
+    if (type == 32 && (bpb->fat_sectors16 || bpb->root_cluster < 2 || bpb->root_cluster >= clusters + 2)) return 1;
+
+    // The FAT has to have an entry for every cluster, and the volume has to fit on the device
+    if (fat_sectors * sector_size * 8 / type < clusters + 2) return 1;
+
+    uint32_t sector_blocks = sector_size / media->BlockSize;
+    if (total * sector_blocks - 1 > media->LastBlock) return 1;
+
+    fat_volume.sector_blocks = sector_blocks;
+    fat_volume.sector_size = sector_size;
+    fat_volume.cluster_size = spc * sector_size;
+    fat_volume.type = type;
+    fat_volume.fat_start = (uint64_t)bpb->reserved_sectors * sector_blocks;
+    fat_volume.fat_size = fat_sectors * sector_size;
+    fat_volume.root_start = (bpb->reserved_sectors + bpb->fats * fat_sectors) * sector_blocks;
+    fat_volume.root_sectors = root_sectors;
+    fat_volume.root_cluster = (type == 32) ? bpb->root_cluster : 0;
+    fat_volume.data_start = data_start * sector_blocks;
+    fat_volume.clusters = clusters;
+    return 0;
+}
+
+/**
+ * @brief Mount the boot volume the first time it's needed
+ * @returns 0 if it can be used
+ */
+static int fat_mount() {
+    if (fat_state != FAT_UNMOUNTED) return (fat_state == FAT_MOUNTED) ? 0 : 1;
+    fat_state = FAT_UNUSABLE;
+
+    EFI_GUID blockio_guid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_BLOCK_IO_PROTOCOL *blockio;
+    EFI_STATUS status = uefi_call_wrapper(BS->HandleProtocol, 3, LoadedImage->DeviceHandle, &blockio_guid, (void**)&blockio);
+    if (EFI_ERROR(status)) return 1;
+
+    fat_bounce = fat_allocatePages(FAT_BOUNCE_SIZE);
+    fat_cache_data = fat_allocatePages(FAT_CACHE_LINES * FAT_CACHE_LINE_SIZE);
+    if (!fat_bounce || !fat_cache_data || fat_parse(blockio)) {
+        LOG(DEBUG, "Boot volume isn't FAT we can read, using the firmware's driver\n");
+        fat_shutdown();
+        fat_state = FAT_UNUSABLE;
+        return 1;
+    }
+
+    for (int i = 0; i < FAT_CACHE_LINES; i++) {
+        fat_cache[i].valid = 0;
+        fat_cache[i].data = fat_cache_data + i * FAT_CACHE_LINE_SIZE;
+    }
+
+    LOG(DEBUG, "Boot volume is FAT%d, %d byte clusters, %d clusters\n", fat_volume.type, fat_volume.cluster_size, fat_volume.clusters);
+    fat_state = FAT_MOUNTED;
+    return 0;
+}
+
+/**
+ * @brief Get a byte of the first FAT through the cache
+ * @param offset Offset in the FAT
+ * @param byte Output for the byte
+ * @returns 0 on success
+ */
+static int fat_getByte(uint64_t offset, uint8_t *byte) {
+    if (offset >= fat_volume.fat_size) return 1;
+
+    uint64_t line = offset / FAT_CACHE_LINE_SIZE;
+    uint64_t block = fat_volume.fat_start + line * (FAT_CACHE_LINE_SIZE / fat_volume.block_size);
+    fat_cache_line_t *cache = &fat_cache[line % FAT_CACHE_LINES];
+
+    if (!cache->valid || cache->block != block) {
+        cache->valid = 0;
+        if (fat_readBlocks(block, cache->data, FAT_CACHE_LINE_SIZE)) return 1;
+        cache->block = block;
+        cache->valid = 1;
+    }
+
+    *byte = cache->data[offset % FAT_CACHE_LINE_SIZE];
+    return 0;
+}
+
+/**
+ * @brief Follow the FAT to the next cluster of a chain
+ * @param cluster The cluster
+ * @param next Output for the next cluster, 0 if the chain ends here
+ * @returns 0 on success, 1 if the FAT couldn't be read or points somewhere it shouldn't
+ */
+static int fat_next(uint32_t cluster, uint32_t *next) {
+    int bytes = (fat_volume.type == 32) ? 4 : 2;
+    uint64_t offset = (fat_volume.type == 12) ? cluster + cluster / 2 : (uint64_t)cluster * bytes;
+
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        uint8_t byte;
+        if (fat_getByte(offset + i, &byte)) return 1;
+        value |= (uint32_t)byte << (i * 8);
+    }
+
+    uint32_t end;
+    switch (fat_volume.type) {
+        case 12:
+            value = (cluster & 1) ? (value >> 4) : (value & 0xFFF);
+            end = 0xFF8;
+            break;
+        case 16:
+            end = 0xFFF8;
+            break;
+        default:
+            value &= 0x0FFFFFFF;
+            end = 0x0FFFFFF8;
+            break;
+    }
+
+    if (value >= end) {
+        *next = 0;
+        return 0;
+    }
+
+    // Free, reserved, bad or past the end of the volume
+    if (value < 2 || value >= fat_volume.clusters + 2) return 1;
+
+    *next = value;
+    return 0;
+}
+
+/**
+ * @brief Get the first device block of a cluster
+ */
+static inline uint64_t fat_clusterBlock(uint32_t cluster) {
+    return fat_volume.data_start + (uint64_t)(cluster - 2) * (fat_volume.cluster_size / fat_volume.block_size);
+}
+
+/**
+ * @brief Get the 8.3 checksum that LFN entries carry
+ */
+static uint8_t fat_checksum(const uint8_t *name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    return sum;
+}
+
+static inline char fat_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/**
+ * @brief Compare an 8.3 name with a path component, ignoring case
+ */
+static int fat_matchShort(const uint8_t *short_name, const char *name, size_t length) {
+    char buffer[12];
+    size_t count = 0;
+
+    for (int i = 0; i < 8 && short_name[i] != ' '; i++) {
+        buffer[count++] = (i == 0 && short_name[0] == FAT_ENTRY_E5) ? (char)FAT_ENTRY_DELETED : short_name[i];
+    }
+
+    if (short_name[8] != ' ') {
+        buffer[count++] = '.';
+        for (int i = 8; i < 11 && short_name[i] != ' '; i++) buffer[count++] = short_name[i];
+    }
+
+    if (count != length) return 0;
+    for (size_t i = 0; i < length; i++) {
+        if (fat_lower(buffer[i]) != fat_lower(name[i])) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Compare a long name with a path component, ignoring case
+ * @param lfn The long name
+ * @param lfn_length Characters in @p lfn, it ends there or at a NUL
+ */
+static int fat_matchLong(const uint16_t *lfn, size_t lfn_length, const char *name, size_t length) {
+    if (length > lfn_length) return 0;
+    if (length < lfn_length && lfn[length]) return 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if (lfn[i] >= 0x80 || fat_lower((char)lfn[i]) != fat_lower(name[i])) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Look for a name in a directory
+ * @param cluster First cluster of the directory, 0 for the FAT12/16 root directory
+ * @param name The name, not NUL terminated
+ * @param length Length of @p name
+ * @param found Output for the directory entry
+ * @returns 0 if it was found
+ */
+static int fat_lookup(uint32_t cluster, const char *name, size_t length, fat_dirent_t *found) {
+    uint16_t lfn[FAT_LFN_ENTRIES * FAT_LFN_CHARACTERS];
+    size_t lfn_length = 0;
+    int lfn_next = 0;               // Order of the LFN entry expected next, 0 once a whole name was seen
+    int lfn_valid = 0;
+    uint8_t lfn_checksum = 0;
+
+    uint32_t sector = 0;
+    uint32_t sectors_per_cluster = fat_volume.cluster_size / fat_volume.sector_size;
+
+    // A directory can't have more clusters than the volume, that's as far as we follow one
+    for (uint32_t clusters = 0; clusters <= fat_volume.clusters; sector++) {
+        uint64_t block;
+        if (!cluster) {
+            if (sector >= fat_volume.root_sectors) return 1;
+            block = fat_volume.root_start + (uint64_t)sector * fat_volume.sector_blocks;
+        } else {
+            if (sector == sectors_per_cluster) {
+                if (fat_next(cluster, &cluster) || !cluster) return 1;
+                sector = 0;
+                clusters++;
+            }
+
+            block = fat_clusterBlock(cluster) + (uint64_t)sector * fat_volume.sector_blocks;
+        }
+
+        if (fat_readBlocks(block, fat_bounce, fat_volume.sector_size)) return 1;
+
+        for (uint32_t i = 0; i < fat_volume.sector_size; i += sizeof(fat_dirent_t)) {
+            fat_dirent_t *entry = (fat_dirent_t*)(fat_bounce + i);
+
+            if (entry->name[0] == FAT_ENTRY_END) return 1;
+            if (entry->name[0] == FAT_ENTRY_DELETED) {
+                lfn_valid = 0;
+                continue;
+            }
+
+            if ((entry->attributes & FAT_ATTR_LFN_MASK) == FAT_ATTR_LFN) {
+                fat_lfn_t *l = (fat_lfn_t*)entry;
+                int order = l->order & 0x1F;
+
+                // The last piece of the name is stored first
+                if (l->order & FAT_LFN_LAST) {
+                    lfn_valid = 1;
+                    lfn_next = order;
+                    lfn_checksum = l->checksum;
+                    lfn_length = order * FAT_LFN_CHARACTERS;
+                }
+
+                if (!lfn_valid || !order || order > FAT_LFN_ENTRIES || order != lfn_next || l->checksum != lfn_checksum) {
+                    lfn_valid = 0;
+                    continue;
+                }
+
+                uint16_t *p = &lfn[(order - 1) * FAT_LFN_CHARACTERS];
+                for (int c = 0; c < 5; c++) *p++ = l->name1[c];
+                for (int c = 0; c < 6; c++) *p++ = l->name2[c];
+                for (int c = 0; c < 2; c++) *p++ = l->name3[c];
+
+                lfn_next--;
+                continue;
+            }
+
+            int has_lfn = lfn_valid && !lfn_next && fat_checksum(entry->name) == lfn_checksum;
+            lfn_valid = 0;
+            if (entry->attributes & FAT_ATTR_VOLUME_ID) continue;
+
+            if ((has_lfn && fat_matchLong(lfn, lfn_length, name, length)) || fat_matchShort(entry->name, name, length)) {
+                *found = *entry;
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Turn the cluster chain of a file into runs of contiguous clusters
+ * @param file The file, with its size set
+ * @param cluster First cluster of the file
+ * @returns 0 on success, 1 if the chain doesn't match the size of the file
+ */
+static int fat_buildRuns(fat_file_t *file, uint32_t cluster) {
+    uint64_t count = (file->size + fat_volume.cluster_size - 1) / fat_volume.cluster_size;
+    if (!count) return cluster ? 1 : 0;
+    if (count > fat_volume.clusters) return 1;
+
+    int capacity = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (cluster < 2 || cluster >= fat_volume.clusters + 2) return 1;
+
+        uint64_t block = fat_clusterBlock(cluster);
+        fat_run_t *last = file->run_count ? &file->runs[file->run_count - 1] : NULL;
+
+        if (last && last->block + last->length / fat_volume.block_size == block) {
+            last->length += fat_volume.cluster_size;
+        } else {
+            if (file->run_count == capacity) {
+                int new_capacity = capacity ? capacity * 2 : 16;
+                fat_run_t *runs = platform_allocate(new_capacity * sizeof(fat_run_t));
+                if (!runs) return 1;
+
+                if (file->runs) {
+                    platform_copyMemory(runs, file->runs, file->run_count * sizeof(fat_run_t));
+                    platform_free(file->runs);
+                }
+
+                file->runs = runs;
+                capacity = new_capacity;
+            }
+
+            file->runs[file->run_count++] = (fat_run_t){ block, i * fat_volume.cluster_size, fat_volume.cluster_size };
+        }
+
+        if (fat_next(cluster, &cluster)) return 1;
+        if (!cluster && i != count - 1) return 1;   // Chain is shorter than the file
+    }
+
+    // ...or longer
+    if (cluster) return 1;
+
+    fat_run_t *last = &file->runs[file->run_count - 1];
+    last->length = file->size - last->offset;
+    return 0;
+}
+
+/**
+ * @brief Read part of a file
+ * @param file The file
+ * @param offset Where to start, inside the file
+ * @param buffer Where to read to
+ * @param size The amount of bytes, all inside the file
+ * @returns 0 on success
+ */
+static int fat_readAt(fat_file_t *file, uint64_t offset, uint8_t *buffer, uint64_t size) {
+    uint32_t block_size = fat_volume.block_size;
+    uint32_t align = fat_volume.blockio->Media->IoAlign;
+
+    while (size) {
+        // Reads are mostly sequential, so look from where the last one stopped
+        if (file->run_cursor >= file->run_count || offset < file->runs[file->run_cursor].offset) file->run_cursor = 0;
+        while (file->run_cursor < file->run_count - 1 && offset >= file->runs[file->run_cursor].offset + file->runs[file->run_cursor].length) {
+            file->run_cursor++;
+        }
+
+        fat_run_t *run = &file->runs[file->run_cursor];
+        uint64_t into = offset - run->offset;
+        uint64_t length = run->length - into;
+        if (length > size) length = size;
+
+        uint64_t block = run->block + into / block_size;
+        size_t skip = into % block_size;
+
+        if (!skip && length >= block_size && (align <= 1 || !((uintptr_t)buffer % align))) {
+            // Whole blocks go straight to where they belong, as many as the run has
+            length -= length % block_size;
+            if (fat_readBlocks(block, buffer, length)) return 1;
+        } else {
+            // Unaligned ends go through the bounce buffer. Whole blocks past the end of the file are still in the cluster.
+            if (length > FAT_BOUNCE_SIZE - skip) length = FAT_BOUNCE_SIZE - skip;
+            size_t blocks_size = (skip + length + block_size - 1) & ~(uint64_t)(block_size - 1);
+            if (fat_readBlocks(block, fat_bounce, blocks_size)) return 1;
+            platform_copyMemory(buffer, fat_bounce + skip, length);
+        }
+
+        buffer += length;
+        offset += length;
+        size -= length;
+    }
+
+    return 0;
+}
+
+/* EFI_FILE_PROTOCOL */
+
+static FAT_EFIAPI EFI_STATUS fat_fileOpen(EFI_FILE_PROTOCOL *protocol, EFI_FILE_PROTOCOL **new, CHAR16 *name, UINT64 mode, UINT64 attributes) {
+    return EFI_UNSUPPORTED;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileClose(EFI_FILE_PROTOCOL *protocol) {
+    fat_file_t *file = (fat_file_t*)protocol;
+    if (file->runs) platform_free(file->runs);
+    platform_free(file);
+    return EFI_SUCCESS;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileDelete(EFI_FILE_PROTOCOL *protocol) {
+    fat_fileClose(protocol);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileRead(EFI_FILE_PROTOCOL *protocol, UINTN *size, VOID *buffer) {
+    fat_file_t *file = (fat_file_t*)protocol;
+    uint64_t left = (file->position < file->size) ? file->size - file->position : 0;
+    if (*size > left) *size = left;
+
+    if (*size && fat_readAt(file, file->position, buffer, *size)) {
+        *size = 0;
+        return EFI_DEVICE_ERROR;
+    }
+
+    file->position += *size;
+    return EFI_SUCCESS;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileWrite(EFI_FILE_PROTOCOL *protocol, UINTN *size, VOID *buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileGetPosition(EFI_FILE_PROTOCOL *protocol, UINT64 *position) {
+    *position = ((fat_file_t*)protocol)->position;
+    return EFI_SUCCESS;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileSetPosition(EFI_FILE_PROTOCOL *protocol, UINT64 position) {
+    fat_file_t *file = (fat_file_t*)protocol;
+
+    // All ones means the end of the file
+    file->position = (position == (UINT64)-1) ? file->size : position;
+    return EFI_SUCCESS;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileGetInfo(EFI_FILE_PROTOCOL *protocol, EFI_GUID *type, UINTN *size, VOID *buffer) {
+    fat_file_t *file = (fat_file_t*)protocol;
+    EFI_GUID info_id = EFI_FILE_INFO_ID;
+    if (memcmp(type, &info_id, sizeof(EFI_GUID))) return EFI_UNSUPPORTED;
+
+    // Only the sizes are filled in, with an empty name
+    UINTN needed = SIZE_OF_EFI_FILE_INFO + sizeof(CHAR16);
+    if (*size < needed || !buffer) {
+        *size = needed;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    EFI_FILE_INFO *info = (EFI_FILE_INFO*)buffer;
+    platform_fillMemory(info, 0, needed);
+    info->Size = needed;
+    info->FileSize = file->size;
+    info->PhysicalSize = (file->size + fat_volume.cluster_size - 1) & ~(uint64_t)(fat_volume.cluster_size - 1);
+    info->Attribute = EFI_FILE_READ_ONLY;
+
+    *size = needed;
+    return EFI_SUCCESS;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileSetInfo(EFI_FILE_PROTOCOL *protocol, EFI_GUID *type, UINTN size, VOID *buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static FAT_EFIAPI EFI_STATUS fat_fileFlush(EFI_FILE_PROTOCOL *protocol) {
+    return EFI_SUCCESS;
+}
+
+/**
+ * @brief Open a file on the boot volume with the built-in FAT reader
+ * @param path The path of the file, '/' and '\\' are both separators
+ * @returns The file, or NULL if it should be opened through the firmware instead
+ *
+ * NULL is returned for anything the reader isn't sure about: a volume that isn't FAT, a file it can't find,
+ * or a cluster chain that doesn't add up.
+ */
+EFI_FILE_PROTOCOL *fat_open(char *path) {
+    if (fat_mount()) return NULL;
+
+    char *name = path;
+    uint32_t cluster = fat_volume.root_cluster;
+    fat_dirent_t entry;
+    int found = 0;
+
+    while (*path) {
+        if (*path == '/' || *path == '\\') {
+            path++;
+            continue;
+        }
+
+        // Only directories have anything in them
+        if (found && !(entry.attributes & FAT_ATTR_DIRECTORY)) return NULL;
+
+        char *end = path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        if (fat_lookup(cluster, path, end - path, &entry)) return NULL;
+
+        cluster = entry.cluster_lo | ((fat_volume.type == 32) ? (uint32_t)entry.cluster_hi << 16 : 0);
+        if (!cluster) cluster = fat_volume.root_cluster;    // ".." of a directory in the root
+        found = 1;
+        path = end;
+    }
+
+    if (!found || (entry.attributes & FAT_ATTR_DIRECTORY)) return NULL;
+
+    fat_file_t *file = platform_allocate(sizeof(fat_file_t));
+    if (!file) return NULL;
+    platform_fillMemory(file, 0, sizeof(fat_file_t));
+
+    file->size = entry.size;
+    uint32_t first = entry.cluster_lo | ((fat_volume.type == 32) ? (uint32_t)entry.cluster_hi << 16 : 0);
+    if (fat_buildRuns(file, first)) {
+        LOG(WARN, "Cluster chain of %s doesn't add up, using the firmware's driver\n", name);
+        if (file->runs) platform_free(file->runs);
+        platform_free(file);
+        return NULL;
+    }
+
+    // ReadEx() and friends are left out, so async.c reads it synchronously (ReadBlocks() is anyway)
+    file->protocol.Revision = EFI_FILE_PROTOCOL_REVISION;
+    file->protocol.Open = (void*)fat_fileOpen;
+    file->protocol.Close = (void*)fat_fileClose;
+    file->protocol.Delete = (void*)fat_fileDelete;
+    file->protocol.Read = (void*)fat_fileRead;
+    file->protocol.Write = (void*)fat_fileWrite;
+    file->protocol.GetPosition = (void*)fat_fileGetPosition;
+    file->protocol.SetPosition = (void*)fat_fileSetPosition;
+    file->protocol.GetInfo = (void*)fat_fileGetInfo;
+    file->protocol.SetInfo = (void*)fat_fileSetInfo;
+    file->protocol.Flush = (void*)fat_fileFlush;
+
+    LOG(DEBUG, "%s: %llu bytes in %d runs\n", name, file->size, file->run_count);
+    return &file->protocol;
+}
+
+/**
+ * @brief Free everything the FAT reader uses
+ *
+ * Called before ExitBootServices.
+ */
+void fat_shutdown() {
+    if (fat_bounce) fat_freePages(fat_bounce, FAT_BOUNCE_SIZE);
+    if (fat_cache_data) fat_freePages(fat_cache_data, FAT_CACHE_LINES * FAT_CACHE_LINE_SIZE);
+
+    fat_bounce = NULL;
+    fat_cache_data = NULL;
+    fat_state = FAT_UNMOUNTED;
+}
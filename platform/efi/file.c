@@ -0,0 +1,525 @@
+/**
+ * @file platform/efi/file.c
+ * @brief EFI boot volume access
+ *
+ * The volume we were loaded from is opened once and kept open, every file is opened relative to it.
+ * Files the built-in FAT reader can find (see fat.c) are read straight from the disk instead.
+ * Files are sized from their EFI_FILE_INFO and read in one go into exactly as much memory as they need,
+ * or opened and read a piece at a time (the kernel loader reads segments straight to where they go).
+ * Files read in the background (see async.c) get a turn whenever one of these touches the disk.
+ * LZ4 and zstd compressed files are picked up by their magic and decompressed on the way (see decompress.c).
+ * Opened compressed files are only decompressed as far as they're read, see platform_file below.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/file.h>
+#include <polyaniline/efi/async.h>
+#include <polyaniline/efi/fat.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/config.h>
+#include <polyaniline/decompress.h>
+#include <efi.h>
+#include <efilib.h>
+
+/* Loaded image */
+extern EFI_LOADED_IMAGE *LoadedImage;
+
+/*
+ * An open file. Compressed files only have their start decompressed when they're opened, which is enough for headers.
+ * All of it is decompressed into memory the first time something past that is read, so for the kernel that
+ * memory is allocated after the segments are claimed and can't end up in their way.
+ */
+struct platform_file {
+    EFI_FILE_PROTOCOL *file;
+    char *path;
+    int format;                         // DECOMPRESS_xxx
+    uint8_t *head;                      // Decompressed start of a compressed file
+    uint64_t head_size;
+    uint8_t *data;                      // All of a compressed file once it's needed
+    uint64_t size;                      // Size of the contents
+};
+
+/* Root directory of the boot volume, NULL until first used */
+static EFI_FILE_PROTOCOL *file_volume = NULL;
+
+/* Bytes read at a time, worked out the first time a file is read */
+static size_t file_chunk = 0;
+
+/**
+ * @brief Get the root directory of the boot volume, opening it the first time
+ */
+static EFI_FILE_PROTOCOL *file_getVolume() {
+    if (file_volume) return file_volume;
+
+    EFI_GUID fs_guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs_protocol;
+
+    // Use the volume we were loaded from, not just whatever filesystem the firmware finds first
+    EFI_STATUS status = uefi_call_wrapper(BS->HandleProtocol, 3, LoadedImage->DeviceHandle, &fs_guid, (void**)&fs_protocol);
+    if (EFI_ERROR(status)) return NULL;
+
+    status = uefi_call_wrapper(fs_protocol->OpenVolume, 2, fs_protocol, &file_volume);
+    if (EFI_ERROR(status)) {
+        file_volume = NULL;
+        return NULL;
+    }
+
+    return file_volume;
+}
+
+/**
+ * @brief Open a file on the boot volume
+ * @param path The path of the file, '/' is accepted as a separator
+ * @returns The file or NULL if it couldn't be opened
+ */
+EFI_FILE_PROTOCOL *file_open(char *path) {
+    // Try reading it off the disk ourselves first, the firmware's driver is the fallback
+    EFI_FILE_PROTOCOL *file;
+    if (__polyaniline_fat_reader && (file = fat_open(path))) return file;
+
+    EFI_FILE_PROTOCOL *volume = file_getVolume();
+    if (!volume) return NULL;
+
+    // Convert the path to CHAR16
+    CHAR16 file_path[FILE_PATH_LENGTH];
+    int i = 0;
+    for (; path[i] && i < FILE_PATH_LENGTH - 1; i++) file_path[i] = (path[i] == '/') ? '\\' : path[i];
+    if (path[i]) return NULL;
+    file_path[i] = 0;
+
+    EFI_STATUS status = uefi_call_wrapper(volume->Open, 5, volume, &file, file_path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status)) return NULL;
+
+    return file;
+}
+
+/**
+ * @brief Get the size of an open file
+ * @param file The file
+ * @param size Output for the size
+ * @returns 0 on success
+ */
+int file_getSize(EFI_FILE_PROTOCOL *file, uint64_t *size) {
+    EFI_GUID information_id = EFI_FILE_INFO_ID;
+    EFI_FILE_INFO *info = NULL;
+    UINTN info_size = 0;
+
+    // EFI_FILE_INFO ends with the file name, so ask how big it is first
+    EFI_STATUS status = uefi_call_wrapper(file->GetInfo, 4, file, &information_id, &info_size, NULL);
+    if (status != EFI_BUFFER_TOO_SMALL || !(info = AllocatePool(info_size))) return 1;
+
+    status = uefi_call_wrapper(file->GetInfo, 4, file, &information_id, &info_size, (void*)info);
+    if (!EFI_ERROR(status)) *size = info->FileSize;
+
+    FreePool(info);
+    return EFI_ERROR(status) ? 1 : 0;
+}
+
+/**
+ * @brief Read exactly @p size bytes from the current position of a file
+ * @param file The file
+ * @param buffer Where to read to
+ * @param size The amount of bytes
+ * @returns 0 on success, 1 on an error or if the file ended early
+ */
+int file_read(EFI_FILE_PROTOCOL *file, void *buffer, uint64_t size) {
+    // Read() normally does it all at once, but it's allowed to come back short
+    while (size) {
+        UINTN read_size = size;
+        EFI_STATUS status = uefi_call_wrapper(file->Read, 3, file, &read_size, buffer);
+        if (EFI_ERROR(status) || !read_size) return 1;
+
+        buffer = (uint8_t*)buffer + read_size;
+        size -= read_size;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the amount of bytes to read at a time
+ *
+ * The configured size is rounded down to a multiple of the optimal transfer size of the boot device,
+ * so no request gets split into an odd piece.
+ */
+size_t file_getChunkSize() {
+    if (file_chunk) return file_chunk;
+
+    size_t chunk = __polyaniline_read_chunk;
+    if (chunk < FILE_CHUNK_MINIMUM) chunk = FILE_CHUNK_MINIMUM;
+    if (chunk > FILE_CHUNK_MAXIMUM) chunk = FILE_CHUNK_MAXIMUM;
+
+    EFI_GUID blockio_guid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_BLOCK_IO_PROTOCOL *blockio;
+    EFI_STATUS status = uefi_call_wrapper(BS->HandleProtocol, 3, LoadedImage->DeviceHandle, &blockio_guid, (void**)&blockio);
+
+    if (!EFI_ERROR(status) && blockio->Media->BlockSize) {
+        size_t granularity = blockio->Media->BlockSize;
+
+        // The optimal transfer size only exists from revision 3 on
+        if (blockio->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3 && blockio->Media->OptimalTransferLengthGranularity) {
+            granularity *= blockio->Media->OptimalTransferLengthGranularity;
+        }
+
+        if (granularity <= chunk) chunk -= chunk % granularity;
+    }
+
+    file_chunk = chunk;
+    return file_chunk;
+}
+
+/**
+ * @brief Let every consumer drop what it holds after a failed read
+ * @param consumers List of consumers, or NULL
+ */
+static void file_release(platform_consumer_t *consumers) {
+    for (platform_consumer_t *consumer = consumers; consumer; consumer = consumer->next) {
+        if (consumer->release) consumer->release(consumer);
+    }
+}
+
+/**
+ * @brief Read exactly @p size bytes a chunk at a time, handing every chunk to consumers
+ * @param file The file
+ * @param buffer Where to read to
+ * @param size The amount of bytes
+ * @param consumers List of consumers, or NULL
+ * @returns 0 on success, 1 on a read error or if a consumer failed
+ */
+int file_readChunked(EFI_FILE_PROTOCOL *file, void *buffer, uint64_t size, platform_consumer_t *consumers) {
+    for (platform_consumer_t *consumer = consumers; consumer; consumer = consumer->next) {
+        if (consumer->start && consumer->start(consumer, size)) {
+            file_release(consumers);
+            return 1;
+        }
+    }
+
+    size_t chunk = file_getChunkSize();
+    uint8_t *data = (uint8_t*)buffer;
+
+    // Without a buffer only the consumers want the data, so keep reusing one chunk
+    uint8_t *scratch = NULL;
+    if (!buffer) {
+        scratch = platform_allocate((size < chunk) ? size : chunk);
+        if (!scratch) {
+            file_release(consumers);
+            return 1;
+        }
+    }
+
+    int ret = 1;
+    while (size) {
+        size_t length = (size < chunk) ? size : chunk;
+        uint8_t *target = scratch ? scratch : data;
+        async_pump();
+        if (file_read(file, target, length)) goto _done;
+
+        // The chunk is still in the cache, look at it now rather than going over the whole file again later
+        for (platform_consumer_t *consumer = consumers; consumer; consumer = consumer->next) {
+            if (consumer->consume(consumer, target, length)) goto _done;
+        }
+
+        data += length;
+        size -= length;
+    }
+
+    for (platform_consumer_t *consumer = consumers; consumer; consumer = consumer->next) {
+        if (consumer->finish && consumer->finish(consumer)) goto _done;
+    }
+
+    ret = 0;
+
+_done:
+    if (ret) file_release(consumers);
+    if (scratch) platform_free(scratch);
+    return ret;
+}
+
+/**
+ * @brief Close a file opened with @c file_open
+ */
+void file_close(EFI_FILE_PROTOCOL *file) {
+    uefi_call_wrapper(file->Close, 1, file);
+}
+
+/**
+ * @brief Close the boot volume
+ *
+ * Called before ExitBootServices.
+ */
+void file_shutdown() {
+    fat_shutdown();
+    if (!file_volume) return;
+    uefi_call_wrapper(file_volume->Close, 1, file_volume);
+    file_volume = NULL;
+}
+
+/**
+ * @brief Work out whether an open file is compressed, and leave it at the start
+ * @param file The file
+ * @param file_size Size of the file
+ * @param path Name of the file, for error messages
+ * @param content_size Output for the decompressed size
+ * @returns DECOMPRESS_xxx
+ */
+int file_detect(EFI_FILE_PROTOCOL *file, uint64_t file_size, char *path, uint64_t *content_size) {
+    uint8_t header[DECOMPRESS_HEADER_SIZE];
+    size_t length = (file_size < DECOMPRESS_HEADER_SIZE) ? file_size : DECOMPRESS_HEADER_SIZE;
+
+    if (file_read(file, header, length)) return DECOMPRESS_UNSUPPORTED;
+
+    EFI_STATUS status = uefi_call_wrapper(file->SetPosition, 2, file, 0);
+    if (EFI_ERROR(status)) return DECOMPRESS_UNSUPPORTED;
+
+    return decompress_detect(header, length, path, content_size);
+}
+
+/**
+ * @brief Allocate memory for a file
+ * @param size The amount of bytes
+ * @param flags PLATFORM_LOAD_xxx
+ */
+void *file_allocate(uint64_t size, int flags) {
+    if (!(flags & PLATFORM_LOAD_PAGES)) return platform_allocate(size);
+
+    EFI_PHYSICAL_ADDRESS address = 0;
+    EFI_STATUS status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &address);
+    return EFI_ERROR(status) ? NULL : (void*)(uintptr_t)address;
+}
+
+/**
+ * @brief Free memory from @c file_allocate
+ */
+void file_free(void *buffer, uint64_t size, int flags) {
+    if (flags & PLATFORM_LOAD_PAGES) {
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(uintptr_t)buffer, EFI_SIZE_TO_PAGES(size));
+    } else {
+        platform_free(buffer);
+    }
+}
+
+/**
+ * @brief Load the whole of an open file, decompressing it if needed
+ * @param file The file, at the start
+ * @param path Name of the file, for error messages
+ * @param flags PLATFORM_LOAD_xxx
+ * @param size Output for the (decompressed) size
+ * @param consumers Consumers, they see the file as it is on disk
+ * @returns The contents or NULL
+ */
+static void *file_load(EFI_FILE_PROTOCOL *file, char *path, int flags, size_t *size, platform_consumer_t *consumers) {
+    uint64_t file_size;
+    if (file_getSize(file, &file_size) || !file_size) return NULL;
+
+    uint64_t content_size = file_size;
+    int format = file_detect(file, file_size, path, &content_size);
+    if (format == DECOMPRESS_UNSUPPORTED || !content_size) return NULL;
+
+    void *buffer = file_allocate(content_size, flags);
+    if (!buffer) return NULL;
+
+    int error;
+    if (format == DECOMPRESS_NONE) {
+        error = file_readChunked(file, buffer, file_size, consumers);
+    } else {
+        // The compressed data only passes through, it's decompressed straight into the buffer
+        decompress_t decompress;
+        platform_consumer_t *decompressor = decompress_consumer(&decompress, format, buffer, content_size);
+        decompressor->next = consumers;
+        error = file_readChunked(file, NULL, file_size, decompressor);
+    }
+
+    if (error) {
+        file_free(buffer, content_size, flags);
+        return NULL;
+    }
+
+    *size = content_size;
+    return buffer;
+}
+
+/**
+ * @brief Load a whole file from the boot volume, handing every chunk to some consumers as it arrives
+ * @param path The path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param size Output for the size of the file
+ * @param consumers List of consumers, or NULL
+ * @returns The file, or NULL if it couldn't be read or a consumer failed
+ *
+ * Compressed files are decompressed while they're read and @p size is the decompressed size.
+ * The consumers see the file as it is on disk.
+ */
+void *platform_streamFile(char *path, int flags, size_t *size, platform_consumer_t *consumers) {
+    EFI_FILE_PROTOCOL *file = file_open(path);
+    if (!file) return NULL;
+
+    void *buffer = file_load(file, path, flags, size, consumers);
+    file_close(file);
+    return buffer;
+}
+
+/**
+ * @brief Load a whole file from the boot volume
+ * @param path The path of the file
+ * @param flags PLATFORM_LOAD_xxx
+ * @param size Output for the size of the file
+ * @returns The file, or NULL if it couldn't be read. Free it with @c platform_free unless it was loaded with PLATFORM_LOAD_PAGES.
+ */
+void *platform_loadFile(char *path, int flags, size_t *size) {
+    return platform_streamFile(path, flags, size, NULL);
+}
+
+/**
+ * @brief Decompress the start of a compressed file into its head buffer, and leave the file at the start
+ * @param handle The file
+ * @param file_size Size of the file on disk
+ * @returns 0 on success
+ */
+static int file_decompressHead(platform_file_t *handle, uint64_t file_size) {
+    // Read small pieces, the point is not to go through the whole file
+    size_t piece = (file_size < FILE_HEAD_SIZE) ? file_size : FILE_HEAD_SIZE;
+    uint8_t *scratch = platform_allocate(piece);
+    if (!scratch) return 1;
+
+    decompress_t decompress;
+    platform_consumer_t *decompressor = decompress_consumer(&decompress, handle->format, handle->head, handle->head_size);
+    decompress.partial = 1;
+
+    int ret = 1;
+    uint64_t left = file_size;
+    if (decompressor->start(decompressor, file_size)) goto _done;
+
+    while (left && decompress.out < handle->head_size) {
+        size_t length = (left < piece) ? left : piece;
+        async_pump();
+        if (file_read(handle->file, scratch, length) || decompressor->consume(decompressor, scratch, length)) goto _done;
+        left -= length;
+    }
+
+    if (!decompressor->finish(decompressor)) ret = 0;
+
+_done:
+    if (ret) decompressor->release(decompressor);
+    platform_free(scratch);
+
+    EFI_STATUS status = uefi_call_wrapper(handle->file->SetPosition, 2, handle->file, 0);
+    return (ret || EFI_ERROR(status)) ? 1 : 0;
+}
+
+/**
+ * @brief Open a file on the boot volume to read parts of it
+ * @param path The path of the file
+ * @param size Output for the size of the file
+ * @returns The file or NULL if it couldn't be opened
+ */
+platform_file_t *platform_openFile(char *path, size_t *size) {
+    EFI_FILE_PROTOCOL *file = file_open(path);
+    if (!file) return NULL;
+
+    platform_file_t *handle = platform_allocate(sizeof(platform_file_t));
+    if (!handle) goto _error;
+
+    handle->file = file;
+    handle->path = path;
+    handle->head = NULL;
+    handle->data = NULL;
+
+    uint64_t file_size, content_size;
+    if (file_getSize(file, &file_size)) goto _error;
+
+    handle->format = file_detect(file, file_size, path, &content_size);
+    if (handle->format == DECOMPRESS_UNSUPPORTED) goto _error;
+
+    if (handle->format != DECOMPRESS_NONE) {
+        // Can't seek around in a compressed file, only the start is decompressed for now
+        handle->head_size = (content_size < FILE_HEAD_SIZE) ? content_size : FILE_HEAD_SIZE;
+        handle->head = platform_allocate(handle->head_size ? handle->head_size : 1);
+        if (!handle->head || file_decompressHead(handle, file_size)) goto _error;
+        file_size = content_size;
+    }
+
+    handle->size = file_size;
+    *size = file_size;
+    return handle;
+
+_error:
+    if (handle) {
+        if (handle->head) platform_free(handle->head);
+        platform_free(handle);
+    }
+
+    file_close(file);
+    return NULL;
+}
+
+/**
+ * @brief Read part of an open file
+ * @param file The file
+ * @param offset Where in the file to start
+ * @param buffer Where to read to
+ * @param size The amount of bytes, all of them have to be there
+ * @returns 0 on success
+ */
+int platform_readFileAt(platform_file_t *file, uint64_t offset, void *buffer, size_t size) {
+    if (file->format != DECOMPRESS_NONE) {
+        if (offset > file->size || size > file->size - offset) return 1;
+
+        if (!file->data && offset + size <= file->head_size) {
+            platform_copyMemory(buffer, file->head + offset, size);
+            return 0;
+        }
+
+        if (!file->data) {
+            size_t data_size;
+            if (!(file->data = file_load(file->file, file->path, 0, &data_size, NULL))) return 1;
+        }
+
+        platform_copyMemory(buffer, file->data + offset, size);
+        return 0;
+    }
+
+    EFI_STATUS status = uefi_call_wrapper(file->file->SetPosition, 2, file->file, offset);
+    if (EFI_ERROR(status)) return 1;
+
+    // A chunk at a time, so the background reads are kept going in between
+    size_t chunk = file_getChunkSize();
+    while (size) {
+        size_t length = (size < chunk) ? size : chunk;
+        async_pump();
+        if (file_read(file->file, buffer, length)) return 1;
+
+        buffer = (uint8_t*)buffer + length;
+        size -= length;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close a file opened with @c platform_openFile
+ */
+void platform_closeFile(platform_file_t *file) {
+    if (file->head) platform_free(file->head);
+    if (file->data) platform_free(file->data);
+    file_close(file->file);
+    platform_free(file);
+}
+
+/**
+ * @brief Claim physical memory at a fixed address so nothing else gets put there
+ * @param address Page aligned start of the memory
+ * @param size The amount of bytes, rounded up to whole pages
+ * @returns 0 on success, 1 if the memory is in use or doesn't exist
+ */
+int platform_reserveMemory(uintptr_t address, size_t size) {
+    // (Section 7.2.1 - UEFI spec 2.10) Allocation requests of Type AllocateAddress allocate pages at the address pointed by Memory on input
+    EFI_PHYSICAL_ADDRESS memory = (EFI_PHYSICAL_ADDRESS)address;
+    EFI_STATUS status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &memory);
+    return EFI_ERROR(status) ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/**
+ * @file platform/efi/glyph.c
+ * @brief Glyph cache
+ *
+ * Characters are expanded from the 1bpp font into full 32bpp tiles once per color pair,
+ * so drawing a character is just copying glyph_height rows.
+ * The menus only use a handful of color pairs so this almost never misses.
+ *
+ * On large screens the font is scaled up by an integer factor. The scaled masks of every
+ * possible font byte are worked out once in @c glyph_init so a scaled tile costs the same
+ * per pixel as an unscaled one.
+ *
+ * Glyphs come from a PSF atlas (see psf.c), either one loaded from the boot volume or
+ * the built-in font described as one.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/glyph.h>
+#include <efi.h>
+#include <efilib.h>
+
+/* Size of a character cell on screen */
+int glyph_width = FONT_CELL_WIDTH;
+int glyph_height = FONT_CELL_HEIGHT;
+int glyph_scale = 1;
+
+/* The built-in font */
+psf_atlas_t glyph_builtin = {
+    .width = FONT_CELL_WIDTH,
+    .height = FONT_CELL_HEIGHT,
+    .row_bytes = 1,
+    .stride = FONT_CELL_HEIGHT,
+    .glyphs = (uint8_t*)terminal_font,
+};
+
+/* Font being drawn */
+psf_atlas_t *glyph_font = &glyph_builtin;
+
+/* Font byte (8 pixels) to scaled mask. The leftmost pixel is the highest bit */
+static uint32_t glyph_masks[256] = { 0 };
+
+/* Bits in a scaled row mask, including the padding at the end of the row */
+static int glyph_row_bits = FONT_CELL_WIDTH;
+
+/* Cache entries */
+static glyph_cache_entry_t glyph_cache[GLYPH_CACHE_PAIRS] = { 0 };
+
+/* Last entry that was hit, checked first */
+static glyph_cache_entry_t *glyph_last = NULL;
+
+/* Use counter for eviction */
+static uint64_t glyph_clock = 0;
+
+/**
+ * @brief Get the scaled mask of a glyph row
+ * @param src The row in the font
+ */
+static inline uint64_t glyph_rowMask(uint8_t *src) {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < glyph_font->row_bytes; i++) {
+        mask = (mask << (8 * glyph_scale)) | glyph_masks[src[i]];
+    }
+
+    return mask;
+}
+
+/**
+ * @brief Expand one scaled glyph row into pixels
+ * @param mask The scaled row mask
+ * @param row Output row of glyph_width pixels
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ */
+static inline void glyph_expandRow(uint64_t mask, uint32_t *row, uint32_t fg, uint32_t bg) {
+    for (int w = 0; w < glyph_width; w++) {
+        row[w] = (mask & (1ULL << (glyph_row_bits - 1 - w))) ? fg : bg;
+    }
+}
+
+/**
+ * @brief Expand a glyph into its tile
+ * @param entry The cache entry
+ * @param ch The character
+ */
+static void glyph_expand(glyph_cache_entry_t *entry, int ch) {
+    uint8_t *fc = glyph_font->glyphs + ch * glyph_font->stride;
+    uint32_t *tile = entry->tiles + ch * glyph_width * glyph_height;
+
+    for (uint32_t h = 0; h < glyph_font->height; h++, fc += glyph_font->row_bytes) {
+        // Expand the row once and repeat it for the rest of the scale
+        glyph_expandRow(glyph_rowMask(fc), tile, entry->fg, entry->bg);
+        for (int s = 1; s < glyph_scale; s++) {
+            __builtin_memcpy(tile + s * glyph_width, tile, glyph_width * sizeof(uint32_t));
+        }
+
+        tile += glyph_width * glyph_scale;
+    }
+
+    entry->expanded[ch / 64] |= (1UL << (ch % 64));
+}
+
+/**
+ * @brief Set the font and the scale glyphs are drawn at
+ * @param font The font to draw with, NULL for the built-in one
+ * @param scale Integer scale, 1 to GLYPH_MAX_SCALE (less for wide fonts)
+ */
+void glyph_init(psf_atlas_t *font, int scale) {
+    if (!font) font = &glyph_builtin;
+
+    // A whole scaled row has to fit in a row mask
+    int max_scale = GLYPH_MASK_BITS / (font->row_bytes * 8);
+    if (max_scale > GLYPH_MAX_SCALE) max_scale = GLYPH_MAX_SCALE;
+    if (scale > max_scale) scale = max_scale;
+    if (scale < 1) scale = 1;
+
+    if (scale != glyph_scale || font->width != glyph_font->width || font->height != glyph_font->height) {
+        // Tiles are a different size now
+        for (int i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+            if (glyph_cache[i].tiles) FreePool(glyph_cache[i].tiles);
+            glyph_cache[i].tiles = NULL;
+        }
+
+        glyph_last = NULL;
+    }
+
+    glyph_font = font;
+    glyph_scale = scale;
+    glyph_width = font->width * scale;
+    glyph_height = font->height * scale;
+    glyph_row_bits = font->row_bytes * 8 * scale;
+
+    // Every source pixel becomes scale pixels wide
+    for (int bits = 0; bits < 256; bits++) {
+        uint32_t mask = 0;
+        for (int w = 0; w < 8; w++) {
+            mask <<= scale;
+            if (bits & (1 << (7 - w))) mask |= (1U << scale) - 1;
+        }
+
+        glyph_masks[bits] = mask;
+    }
+
+    glyph_flush();
+}
+
+/**
+ * @brief Find or create the cache entry for a color pair
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ */
+static glyph_cache_entry_t *glyph_getEntry(uint32_t fg, uint32_t bg) {
+    if (glyph_last && glyph_last->fg == fg && glyph_last->bg == bg) return glyph_last;
+
+    glyph_cache_entry_t *victim = &glyph_cache[0];
+    for (int i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+        glyph_cache_entry_t *entry = &glyph_cache[i];
+        if (entry->tiles && entry->fg == fg && entry->bg == bg) return entry;
+
+        // Prefer empty entries, then whichever was used longest ago
+        if (!entry->tiles) {
+            if (victim->tiles) victim = entry;
+        } else if (victim->tiles && entry->last_used < victim->last_used) {
+            victim = entry;
+        }
+    }
+
+    // Missed, take over the victim. Tiles are expanded as they are used.
+    if (!victim->tiles) {
+        victim->tiles = AllocatePool(GLYPH_COUNT * glyph_width * glyph_height * sizeof(uint32_t));
+        if (!victim->tiles) return NULL;
+    }
+
+    victim->fg = fg;
+    victim->bg = bg;
+    for (int i = 0; i < GLYPH_COUNT / 64; i++) victim->expanded[i] = 0;
+
+    return victim;
+}
+
+/**
+ * @brief Get the expanded tile of a character
+ * @param ch The character
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ * @returns glyph_height rows of glyph_width pixels or NULL if the cache could not be allocated
+ */
+uint32_t *glyph_get(int ch, uint32_t fg, uint32_t bg) {
+    ch &= (GLYPH_COUNT - 1);
+
+    glyph_cache_entry_t *entry = glyph_getEntry(fg, bg);
+    if (!entry) return NULL;
+
+    entry->last_used = ++glyph_clock;
+    glyph_last = entry;
+
+    if (!(entry->expanded[ch / 64] & (1UL << (ch % 64)))) glyph_expand(entry, ch);
+    return entry->tiles + ch * glyph_width * glyph_height;
+}
+
+/**
+ * @brief Draw a character
+ * @param ch The character
+ * @param dest Top left pixel to draw to
+ * @param pitch Pixels per row of @p dest
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ */
+void glyph_draw(int ch, uint32_t *dest, uint32_t pitch, uint32_t fg, uint32_t bg) {
+    uint32_t *tile = glyph_get(ch, fg, bg);
+
+    if (tile) {
+        // Fast path, each row is a straight copy out of the cache
+        for (int h = 0; h < glyph_height; h++) {
+            __builtin_memcpy(dest, tile, glyph_width * sizeof(uint32_t));
+            tile += glyph_width;
+            dest += pitch;
+        }
+
+        return;
+    }
+
+    // The cache couldn't be allocated, expand the glyph straight into the destination
+    uint8_t *fc = glyph_font->glyphs + (ch & (GLYPH_COUNT - 1)) * glyph_font->stride;
+    for (uint32_t h = 0; h < glyph_font->height; h++, fc += glyph_font->row_bytes) {
+        uint64_t mask = glyph_rowMask(fc);
+        for (int s = 0; s < glyph_scale; s++) {
+            glyph_expandRow(mask, dest, fg, bg);
+            dest += pitch;
+        }
+    }
+}
+
+/**
+ * @brief Drop all cached glyphs
+ */
+void glyph_flush() {
+    for (int i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+        for (int j = 0; j < GLYPH_COUNT / 64; j++) glyph_cache[i].expanded[j] = 0;
+    }
+}
@@ -1,27 +1,517 @@
 /**
  * @file platform/efi/gop.c
  * @brief Graphics output protocol
- * 
- * 
+ *
+ * All drawing goes into a back buffer in normal RAM. Changed regions are tracked as
+ * dirty rectangles and copied to video memory in one go by @c platform_present
+ *
  * @copyright
  * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
  * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
  * Please see the LICENSE file in the main repository for more details.
- * 
+ *
  * Copyright (C) 2024 Samuel Stuart
  */
 
 #include <polyaniline/efi/gop.h>
+#include <polyaniline/efi/glyph.h>
+#include <polyaniline/efi/variables.h>
+#include <polyaniline/efi/cache.h>
+#include <polyaniline/efi/cpu.h>
 #include <polyaniline/video.h>
+#include <polyaniline/config.h>
+#include <polyaniline/menu.h>
+#include <polyaniline/platform.h>
 #include <efi.h>
 #include <efilib.h>
+#include <emmintrin.h>
 
 /* Variables */
 EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
 
+/* Bumped every time the mode is set up, surfaces from an older generation are stale */
+static uint32_t gop_generation = 0;
+
+/* Framebuffer geometry (cached so we don't chase gop->Mode->Info on every pixel) */
+static uint32_t gop_width = 0;
+static uint32_t gop_height = 0;
+static uint32_t gop_pitch = 0;              // Pixels per scanline of video memory
+
+/* Video memory, NULL if the mode is PixelBltOnly */
+static uint32_t *gop_framebuffer = NULL;
+
+/* Native pixel format */
+static EFI_GRAPHICS_PIXEL_FORMAT gop_format = PixelBlueGreenRedReserved8BitPerColor;
+
+/* Channel positions for PixelBitMask */
+static gop_channel_t gop_channel_r, gop_channel_g, gop_channel_b;
+
+/* Whether pixels in the back buffer are laid out the way Blt() wants them */
+static int gop_blt_native = 1;
+
+/* Back buffer, NULL if we are drawing straight to video memory */
+static uint32_t *gop_backbuffer = NULL;
+
+/* Current draw target. Either the back buffer or the framebuffer */
+static uint32_t *gop_target = NULL;
+static uint32_t gop_target_pitch = 0;       // Pixels per scanline of the draw target
+
+/* Dirty rectangles waiting to be presented */
+static gop_rect_t gop_dirty[GOP_MAX_DIRTY_RECTS];
+static int gop_dirty_count = 0;
+
+/* How pending changes get to video memory (GOP_STRATEGY_xxx) */
+static int gop_strategy = GOP_STRATEGY_BLT;
+
+/* Whether Blt(EfiBltVideoFill) and Blt(EfiBltVideoToVideo) work. Cleared the first time they fail */
+static int gop_blt_fill = 1;
+static int gop_blt_move = 1;
+
 /* Log "method" */
 #define LOG(...) Print(L"[GOP] " __VA_ARGS__)
 
+/* Define a converter from color_t to a fixed 8-bit-per-channel pixel layout */
+#define GOP_PIXEL_MAPPER(name, rshift, gshift, bshift) \
+    static inline uint32_t name(color_t color) { \
+        return ((uint32_t)RGB_R(color) << rshift) | ((uint32_t)RGB_G(color) << gshift) | ((uint32_t)RGB_B(color) << bshift); \
+    }
+
+GOP_PIXEL_MAPPER(gop_mapPixelBGR, 16, 8, 0)     // PixelBlueGreenRedReserved8BitPerColor (also what Blt() takes)
+GOP_PIXEL_MAPPER(gop_mapPixelRGB, 0, 8, 16)     // PixelRedGreenBlueReserved8BitPerColor
+
+/**
+ * @brief Scale an 8-bit channel into a PixelBitMask channel
+ * @param value The 8-bit channel value
+ * @param channel The channel
+ */
+static inline uint32_t gop_mapChannel(uint32_t value, gop_channel_t *channel) {
+    if (channel->bits <= 8) value >>= (8 - channel->bits);
+    else value <<= (channel->bits - 8);
+    return value << channel->shift;
+}
+
+/**
+ * @brief Convert a color to the native pixel format
+ * @param color The color to convert
+ *
+ * Everything converts its colors once up front and only deals with native pixels afterwards.
+ */
+static inline uint32_t gop_mapColor(color_t color) {
+    switch (gop_format) {
+        case PixelRedGreenBlueReserved8BitPerColor:
+            return gop_mapPixelRGB(color);
+
+        case PixelBitMask:
+            return gop_mapChannel(RGB_R(color), &gop_channel_r) | gop_mapChannel(RGB_G(color), &gop_channel_g) | gop_mapChannel(RGB_B(color), &gop_channel_b);
+
+        case PixelBlueGreenRedReserved8BitPerColor:
+        case PixelBltOnly:
+        default:
+            return gop_mapPixelBGR(color);
+    }
+}
+
+/**
+ * @brief Work out where a PixelBitMask channel sits
+ * @param mask The channel mask
+ * @param channel Output channel
+ */
+static void gop_setupChannel(uint32_t mask, gop_channel_t *channel) {
+    channel->shift = mask ? __builtin_ctz(mask) : 0;
+    channel->bits = __builtin_popcount(mask);
+}
+
+/**
+ * @brief Mark a region of the back buffer as dirty
+ * @param x X coordinate of the region
+ * @param y Y coordinate of the region
+ * @param width Width of the region
+ * @param height Height of the region
+ */
+static void gop_markDirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (!gop_backbuffer) return; // Direct mode, nothing to track
+
+    // Clip to the screen
+    if (x >= gop_width || y >= gop_height) return;
+    uint32_t x2 = (x + width > gop_width) ? gop_width : x + width;
+    uint32_t y2 = (y + height > gop_height) ? gop_height : y + height;
+
+    // Merge with any rectangle we touch or overlap. Consecutive characters on a line collapse into one rectangle this way.
+    for (int i = 0; i < gop_dirty_count; i++) {
+        gop_rect_t *r = &gop_dirty[i];
+        if (x <= r->x2 && x2 >= r->x1 && y <= r->y2 && y2 >= r->y1) {
+            if (x < r->x1) r->x1 = x;
+            if (y < r->y1) r->y1 = y;
+            if (x2 > r->x2) r->x2 = x2;
+            if (y2 > r->y2) r->y2 = y2;
+            return;
+        }
+    }
+
+    if (gop_dirty_count == GOP_MAX_DIRTY_RECTS) {
+        // Out of slots, collapse everything into one bounding rectangle
+        gop_rect_t *r = &gop_dirty[0];
+        for (int i = 1; i < gop_dirty_count; i++) {
+            if (gop_dirty[i].x1 < r->x1) r->x1 = gop_dirty[i].x1;
+            if (gop_dirty[i].y1 < r->y1) r->y1 = gop_dirty[i].y1;
+            if (gop_dirty[i].x2 > r->x2) r->x2 = gop_dirty[i].x2;
+            if (gop_dirty[i].y2 > r->y2) r->y2 = gop_dirty[i].y2;
+        }
+
+        gop_dirty_count = 1;
+    }
+
+    gop_dirty[gop_dirty_count++] = (gop_rect_t){ .x1 = x, .y1 = y, .x2 = x2, .y2 = y2 };
+}
+
+/**
+ * @brief Copy a row of pixels
+ * @param dest Destination
+ * @param src Source
+ * @param count Amount of pixels to copy
+ */
+static inline void gop_copyRow(uint32_t *dest, uint32_t *src, uint32_t count) {
+    platform_copyMemory(dest, src, count * sizeof(uint32_t));
+}
+
+/**
+ * @brief Fill a row of pixels using 64-bit stores
+ * @param dest Destination
+ * @param pixel The pixel value to fill with
+ * @param count Amount of pixels to fill
+ */
+static inline void gop_fillRow(uint32_t *dest, uint32_t pixel, uint32_t count) {
+    if (((uintptr_t)dest & 7) && count) {
+        *dest++ = pixel;
+        count--;
+    }
+
+    uint64_t *d = (uint64_t*)dest;
+    uint64_t pattern = ((uint64_t)pixel << 32) | pixel;
+    for (uint32_t i = 0; i < count / 2; i++) d[i] = pattern;
+
+    if (count & 1) dest[count - 1] = pixel;
+}
+
+/**
+ * @brief Fill a row of video memory using non-temporal stores
+ * @param dest Destination in video memory
+ * @param pixel The pixel value to fill with
+ * @param count Amount of pixels to fill
+ *
+ * Video memory is usually uncached or write-combining. Streaming stores skip the cache
+ * and get combined into full lines, where normal stores would go out one at a time.
+ */
+static inline void gop_streamRow(uint32_t *dest, uint32_t pixel, uint32_t count) {
+    // Get the destination 16-byte aligned first
+    while (((uintptr_t)dest & 15) && count) {
+        *dest++ = pixel;
+        count--;
+    }
+
+    __m128i pattern = _mm_set1_epi32(pixel);
+    for (; count >= 4; count -= 4, dest += 4) _mm_stream_si128((__m128i*)dest, pattern);
+
+    while (count--) *dest++ = pixel;
+}
+
+/**
+ * @brief Copy a row of pixels to video memory with non-temporal stores
+ * @param dest The destination
+ * @param src The source
+ * @param count The amount of pixels
+ *
+ * The caller has to _mm_sfence() once it's done streaming
+ */
+static inline void gop_streamCopyRow(uint32_t *dest, uint32_t *src, uint32_t count) {
+    // Get the destination 16-byte aligned first
+    while (((uintptr_t)dest & 15) && count) {
+        *dest++ = *src++;
+        count--;
+    }
+
+    for (; count >= 4; count -= 4, dest += 4, src += 4) {
+        _mm_stream_si128((__m128i*)dest, _mm_loadu_si128((__m128i*)src));
+    }
+
+    while (count--) *dest++ = *src++;
+}
+
+/**
+ * @brief Fill a rectangle of video memory, bypassing the back buffer
+ * @param x X coordinate of the rectangle
+ * @param y Y coordinate of the rectangle
+ * @param width Width of the rectangle
+ * @param height Height of the rectangle
+ * @param pixel The pixel value to fill with
+ */
+static void gop_fillVideo(uint32_t x, uint32_t y, uint32_t width, uint32_t height, color_t color, uint32_t pixel) {
+    if (gop_blt_fill) {
+        // Let the firmware do it, it knows how its video memory is mapped
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL blt_pixel = { .Blue = RGB_B(color), .Green = RGB_G(color), .Red = RGB_R(color) };
+        EFI_STATUS status = uefi_call_wrapper(gop->Blt, 10, gop, &blt_pixel, EfiBltVideoFill, 0, 0, x, y, width, height, 0);
+        if (!EFI_ERROR(status)) return;
+
+        // Don't bother with it again
+        gop_blt_fill = 0;
+    }
+
+    if (!gop_framebuffer) {
+        // Nothing we can write to, leave it to the next present
+        gop_markDirty(x, y, width, height);
+        return;
+    }
+
+    uint32_t *row = gop_framebuffer + y * gop_pitch + x;
+    for (uint32_t i = 0; i < height; i++) {
+        gop_streamRow(row, pixel, width);
+        row += gop_pitch;
+    }
+
+    // Make sure the streaming stores are visible before anything else touches video memory
+    _mm_sfence();
+}
+
+/**
+ * @brief Get the preferred resolution of the active display from its EDID
+ * @param width Output width
+ * @param height Output height
+ * @returns 0 on success
+ */
+static int gop_getPreferredResolution(uint32_t *width, uint32_t *height) {
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GUID edid_guid = EFI_EDID_ACTIVE_PROTOCOL_GUID;
+    EFI_HANDLE *handles = NULL;
+    UINTN handle_count = 0;
+
+    EFI_STATUS status = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &gop_guid, NULL, &handle_count, &handles);
+    if (EFI_ERROR(status) || !handle_count) return 1;
+
+    EFI_EDID_ACTIVE_PROTOCOL *edid = NULL;
+    status = uefi_call_wrapper(BS->HandleProtocol, 3, handles[0], &edid_guid, (void**)&edid);
+    FreePool(handles);
+
+    // The first detailed timing descriptor (offset 54) is the preferred mode
+    if (EFI_ERROR(status) || !edid || edid->SizeOfEdid < 128) return 1;
+    uint8_t *dtd = edid->Edid + 54;
+    *width = dtd[2] | ((dtd[4] & 0xF0) << 4);
+    *height = dtd[5] | ((dtd[7] & 0xF0) << 4);
+
+    return (*width && *height) ? 0 : 1;
+}
+
+/**
+ * @brief Pick the video mode to use
+ * @returns The mode number or GOP_NO_MODE
+ *
+ * The choice is remembered in an EFI variable so later boots skip enumerating modes.
+ */
+static uint32_t gop_selectMode() {
+    EFI_GUID var_guid = POLYANILINE_VARIABLE_GUID;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info;
+    UINTN info_size;
+    EFI_STATUS status;
+
+    // Work out what resolution we're after. 0x0 means the largest one.
+    uint32_t target_width = 0, target_height = 0;
+    if (__polyaniline_video_mode == VIDEO_MODE_CONFIGURED) {
+        target_width = __polyaniline_video_width;
+        target_height = __polyaniline_video_height;
+    } else if (__polyaniline_video_mode == VIDEO_MODE_NATIVE) {
+        if (gop_getPreferredResolution(&target_width, &target_height)) {
+            // No EDID, trust whatever the firmware set up
+            status = uefi_call_wrapper(gop->QueryMode, 4, gop, gop->Mode->Mode, &info_size, &info);
+            if (!EFI_ERROR(status)) {
+                target_width = info->HorizontalResolution;
+                target_height = info->VerticalResolution;
+            }
+        }
+    }
+
+    // Did we already choose one for this policy and resolution?
+    gop_cached_mode_t cached;
+    UINTN cached_size = sizeof(gop_cached_mode_t);
+    status = uefi_call_wrapper(RT->GetVariable, 5, POLYANILINE_VARIABLE_VIDEO_MODE, &var_guid, NULL, &cached_size, &cached);
+    if (!EFI_ERROR(status) && cached_size == sizeof(gop_cached_mode_t) &&
+            cached.policy == (uint32_t)__polyaniline_video_mode &&
+            cached.target_width == target_width && cached.target_height == target_height &&
+            cached.mode < gop->Mode->MaxMode) {
+
+        // Make sure it's still the same mode (someone could have plugged in a different monitor)
+        status = uefi_call_wrapper(gop->QueryMode, 4, gop, cached.mode, &info_size, &info);
+        if (!EFI_ERROR(status) && info->HorizontalResolution == cached.width && info->VerticalResolution == cached.height) {
+            return cached.mode;
+        }
+    }
+
+    uint32_t best = GOP_NO_MODE;
+    uint64_t best_area = 0;
+    for (uint32_t mode = 0; mode < gop->Mode->MaxMode; mode++) {
+        status = uefi_call_wrapper(gop->QueryMode, 4, gop, mode, &info_size, &info);
+        if (EFI_ERROR(status)) continue;
+
+        if (info->HorizontalResolution == target_width && info->VerticalResolution == target_height) {
+            best = mode;
+            break;
+        }
+
+        // Fall back to the largest mode there is
+        uint64_t area = (uint64_t)info->HorizontalResolution * info->VerticalResolution;
+        if (area > best_area) {
+            best = mode;
+            best_area = area;
+        }
+    }
+
+    if (best == GOP_NO_MODE) return best;
+
+    // Remember it for next time
+    status = uefi_call_wrapper(gop->QueryMode, 4, gop, best, &info_size, &info);
+    if (!EFI_ERROR(status)) {
+        cached = (gop_cached_mode_t){
+            .policy = __polyaniline_video_mode,
+            .target_width = target_width,
+            .target_height = target_height,
+            .mode = best,
+            .width = info->HorizontalResolution,
+            .height = info->VerticalResolution
+        };
+
+        uefi_call_wrapper(RT->SetVariable, 5, POLYANILINE_VARIABLE_VIDEO_MODE, &var_guid,
+                            EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS, sizeof(gop_cached_mode_t), &cached);
+
+        LOG(L"Selected mode %d (%dx%d)\n", best, cached.width, cached.height);
+    }
+
+    return best;
+}
+
+/**
+ * @brief Check whether the menu fits on screen with a font
+ * @param font The font
+ * @param scale The scale it would be drawn at
+ */
+static int gop_fontFits(psf_atlas_t *font, int scale) {
+    // The menu needs USERBOX_WIDTH columns and a few rows around USERBOX_HEIGHT for the title and logo
+    return gop_width / (font->width * scale) >= USERBOX_WIDTH &&
+            gop_height / (font->height * scale) >= USERBOX_HEIGHT + 10;
+}
+
+/**
+ * @brief Pick the integer scale to draw the font at
+ * @param font The font
+ *
+ * One step per GOP_SCALE_STEP lines of height, but never so large that the menu box doesn't fit.
+ */
+static int gop_selectFontScale(psf_atlas_t *font) {
+    int scale = __polyaniline_font_scale ? __polyaniline_font_scale : (int)(gop_height / GOP_SCALE_STEP);
+    if (scale < 1) scale = 1;
+    if (scale > GLYPH_MAX_SCALE) scale = GLYPH_MAX_SCALE;
+
+    while (scale > 1 && !gop_fontFits(font, scale)) scale--;
+    return scale;
+}
+
+/**
+ * @brief Time a full screen clear of video memory
+ * @returns The time it took in microseconds
+ */
+static uint64_t gop_timeClear() {
+    // Calibrate first, the first call stalls for a while
+    uint64_t tsc_per_us = cpu_tscPerMicrosecond();
+
+    uint64_t start = cpu_rdtsc();
+    gop_fillVideo(0, 0, gop_width, gop_height, BOOT_DEFAULT_BG, gop_mapColor(BOOT_DEFAULT_BG));
+    return (cpu_rdtsc() - start) / tsc_per_us;
+}
+
+/**
+ * @brief Try to make the framebuffer write-combining
+ */
+static void gop_setupWriteCombining() {
+    static const CHAR16 *methods[] = { L"unavailable", L"already set by firmware", L"PAT", L"MTRR" };
+
+    uint64_t before = __polyaniline_verbose ? gop_timeClear() : 0;
+    int method = cache_setWriteCombining(gop->Mode->FrameBufferBase, gop->Mode->FrameBufferSize);
+
+    if (__polyaniline_verbose) {
+        uint64_t after = gop_timeClear();
+        LOG(L"Write-combining: %s (clear took %ld us before, %ld us after)\n", methods[method], before, after);
+    }
+}
+
+/**
+ * @brief Convert a TSC interval over a byte count into MB/s
+ * @param bytes The bytes moved
+ * @param start TSC at the start
+ * @param tsc_per_us cpu_tscPerMicrosecond(), got before @p start so its calibration isn't timed
+ */
+static uint32_t gop_bandwidth(uint64_t bytes, uint64_t start, uint64_t tsc_per_us) {
+    uint64_t us = (cpu_rdtsc() - start) / tsc_per_us;
+    return (uint32_t)(bytes / (us ? us : 1));   // Bytes per microsecond is MB/s
+}
+
+/**
+ * @brief Time the ways we can get pixels to video memory and pick the fastest
+ *
+ * Called with the back buffer allocated, but before anything is drawn.
+ */
+static void gop_probe() {
+    static const CHAR16 *strategies[] = { L"direct", L"back buffer + Blt", L"back buffer + streaming stores" };
+
+    uint32_t lines = (gop_height < GOP_PROBE_LINES) ? gop_height : GOP_PROBE_LINES;
+    uint64_t bytes = (uint64_t)gop_width * lines * sizeof(uint32_t);
+    uint32_t pixel = gop_mapColor(BOOT_DEFAULT_BG);
+    uint32_t direct = 0, stream = 0, blt_fill = 0, blt_copy = 0;
+    uint64_t start;
+
+    // The first call calibrates the TSC, which takes a while
+    uint64_t tsc_per_us = cpu_tscPerMicrosecond();
+
+    // Give the copies something to copy
+    for (uint32_t i = 0; i < gop_width * lines; i++) gop_backbuffer[i] = pixel;
+
+    if (gop_framebuffer) {
+        start = cpu_rdtsc();
+        for (uint32_t y = 0; y < lines; y++) gop_copyRow(gop_framebuffer + y * gop_pitch, gop_backbuffer + y * gop_width, gop_width);
+        direct = gop_bandwidth(bytes, start, tsc_per_us);
+
+        start = cpu_rdtsc();
+        for (uint32_t y = 0; y < lines; y++) gop_streamCopyRow(gop_framebuffer + y * gop_pitch, gop_backbuffer + y * gop_width, gop_width);
+        _mm_sfence();
+        stream = gop_bandwidth(bytes, start, tsc_per_us);
+    }
+
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL blt_pixel = { .Blue = RGB_B(BOOT_DEFAULT_BG), .Green = RGB_G(BOOT_DEFAULT_BG), .Red = RGB_R(BOOT_DEFAULT_BG) };
+    start = cpu_rdtsc();
+    EFI_STATUS status = uefi_call_wrapper(gop->Blt, 10, gop, &blt_pixel, EfiBltVideoFill, 0, 0, 0, 0, gop_width, lines, 0);
+    if (EFI_ERROR(status)) gop_blt_fill = 0;
+    else blt_fill = gop_bandwidth(bytes, start, tsc_per_us);
+
+    if (gop_blt_native) {
+        start = cpu_rdtsc();
+        status = uefi_call_wrapper(gop->Blt, 10, gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)gop_backbuffer, EfiBltBufferToVideo,
+                                    0, 0, 0, 0, gop_width, lines, gop_width * sizeof(uint32_t));
+        if (!EFI_ERROR(status)) blt_copy = gop_bandwidth(bytes, start, tsc_per_us);
+    }
+
+    // Fills are done straight to video memory, use whichever is faster for them
+    if (gop_blt_fill && gop_framebuffer && blt_fill < stream) gop_blt_fill = 0;
+
+    // Present with the faster of Blt and streaming, or skip the back buffer if writing video memory is just that fast
+    uint32_t present = (blt_copy > stream) ? blt_copy : stream;
+    if (!gop_framebuffer) {
+        gop_strategy = GOP_STRATEGY_BLT;
+    } else if (direct > present * GOP_DIRECT_FACTOR) {
+        gop_strategy = GOP_STRATEGY_DIRECT;
+    } else {
+        gop_strategy = (blt_copy > stream) ? GOP_STRATEGY_BLT : GOP_STRATEGY_STREAM;
+    }
+
+    LOG(L"Bandwidth (MB/s): direct %d, streaming %d, Blt fill %d, Blt copy %d\n", direct, stream, blt_fill, blt_copy);
+    LOG(L"Rendering strategy: %s\n", strategies[gop_strategy]);
+}
+
 /**
  * @brief Initialize the Graphics Output Protocol
  */
@@ -36,24 +526,77 @@ int gop_initialize() {
         return 1;
     }
 
-    // Get the native mode of the hardware
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info;
-    UINTN SizeOfInfo;
-    status = uefi_call_wrapper(gop->QueryMode, 4, gop, gop->Mode == NULL ? 0 : gop->Mode->Mode, &SizeOfInfo, &info);
-    if (status == EFI_NOT_STARTED) {
-        // Set the video mode
-        status = uefi_call_wrapper(gop->SetMode, 2, gop, 0);
-    }
-    
-    // Did it fail?
-    if (EFI_ERROR(status)) {
-        LOG(L"Failed to get native video mode from GOP.\n");
+    // Pick a mode and switch to it if we aren't already in it
+    uint32_t mode = gop_selectMode();
+    if (mode == GOP_NO_MODE) {
+        LOG(L"No usable video mode found.\n");
         return 1;
     }
 
+    if (!gop->Mode || !gop->Mode->Info || gop->Mode->Mode != mode) {
+        status = uefi_call_wrapper(gop->SetMode, 2, gop, mode);
+        if (EFI_ERROR(status)) {
+            LOG(L"Failed to set video mode %d.\n", mode);
+            return 1;
+        }
+    }
+
+    gop_generation++;
+    gop_width = gop->Mode->Info->HorizontalResolution;
+    gop_height = gop->Mode->Info->VerticalResolution;
+    gop_pitch = gop->Mode->Info->PixelsPerScanLine;
+    gop_format = gop->Mode->Info->PixelFormat;
+
+    if (gop_format == PixelBitMask) {
+        gop_setupChannel(gop->Mode->Info->PixelInformation.RedMask, &gop_channel_r);
+        gop_setupChannel(gop->Mode->Info->PixelInformation.GreenMask, &gop_channel_g);
+        gop_setupChannel(gop->Mode->Info->PixelInformation.BlueMask, &gop_channel_b);
+    }
+
+    // Blt() only understands BGR, anything else has to be copied to video memory by hand
+    gop_framebuffer = (gop_format == PixelBltOnly) ? NULL : (uint32_t*)gop->Mode->FrameBufferBase;
+    gop_blt_native = (gop_format == PixelBlueGreenRedReserved8BitPerColor || gop_format == PixelBltOnly);
+
+    if (gop_framebuffer && __polyaniline_framebuffer_wc) gop_setupWriteCombining();
+
+    // Try to get a back buffer. If we can't we just draw straight to video memory.
+    gop_backbuffer = AllocatePool(gop_width * gop_height * sizeof(uint32_t));
+    if (gop_backbuffer) gop_probe();
+
+    if (gop_backbuffer && gop_strategy == GOP_STRATEGY_DIRECT) {
+        // Video memory is fast enough on its own
+        FreePool(gop_backbuffer);
+        gop_backbuffer = NULL;
+        gop_target = gop_framebuffer;
+        gop_target_pitch = gop_pitch;
+    } else if (gop_backbuffer) {
+        gop_target = gop_backbuffer;
+        gop_target_pitch = gop_width;
+    } else if (gop_framebuffer) {
+        gop_strategy = GOP_STRATEGY_DIRECT;
+        LOG(L"Could not allocate a back buffer, drawing directly to the framebuffer\n");
+        gop_target = gop_framebuffer;
+        gop_target_pitch = gop_pitch;
+    } else {
+        LOG(L"Could not allocate a back buffer and the mode has no framebuffer\n");
+        return 1;
+    }
+
+    // Use the font from the boot volume as long as the menu still fits with it
+    psf_atlas_t *font = psf_font ? psf_font : &glyph_builtin;
+    if (!gop_fontFits(font, 1)) {
+        LOG(L"Loaded font is too large for this mode, using the built-in one\n");
+        font = &glyph_builtin;
+    }
+
+    // Scale the font up on large screens
+    glyph_init(font, gop_selectFontScale(font));
+    LOG(L"Drawing %dx%d text at %dx scale\n", glyph_font->width, glyph_font->height, glyph_scale);
+
     // Clear the screen
     platform_clearScreen(BOOT_DEFAULT_BG);
-    
+    platform_present();
+
     return 0;
 }
 
@@ -64,12 +607,169 @@ video_info_t gop_collectVideoInformation() {
     video_info_t ret = {
         .bpp = gop->Mode->Info->PixelsPerScanLine,
         .width = gop->Mode->Info->HorizontalResolution,
-        .height = gop->Mode->Info->VerticalResolution
+        .height = gop->Mode->Info->VerticalResolution,
+        .cell_width = glyph_width,
+        .cell_height = glyph_height,
+        .scale = glyph_scale
     };
 
     return ret;
 }
 
+/**
+ * @brief Present any pending changes and switch to drawing directly to video memory
+ *
+ * Blt() is a boot service, so this has to be called before ExitBootServices()
+ */
+void gop_shutdown() {
+    if (gop_backbuffer) platform_present();
+
+    // Hand the framebuffer over with the firmware's memory type
+    cache_restore();
+
+    // Blt() is a boot service, whether or not there's a back buffer
+    gop_blt_fill = 0;
+    gop_blt_move = 0;
+    gop_blt_native = 0;
+
+    if (!gop_backbuffer) return;
+
+    // Without a framebuffer we keep drawing into the back buffer, nobody will see it anymore
+    if (!gop_framebuffer) return;
+
+    // The back buffer is left allocated, it's in loader data anyways
+    gop_backbuffer = NULL;
+    gop_target = gop_framebuffer;
+    gop_target_pitch = gop_pitch;
+}
+
+/**
+ * @brief Copy all dirty regions of the back buffer to video memory
+ */
+void platform_present() {
+    if (!gop_backbuffer) return;
+
+    for (int i = 0; i < gop_dirty_count; i++) {
+        gop_rect_t *r = &gop_dirty[i];
+        uint32_t width = r->x2 - r->x1;
+        uint32_t height = r->y2 - r->y1;
+
+        // Blt() takes care of whatever caching the firmware has on video memory
+        EFI_STATUS status = EFI_UNSUPPORTED;
+        if (gop_blt_native && gop_strategy == GOP_STRATEGY_BLT) {
+            status = uefi_call_wrapper(gop->Blt, 10, gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)gop_backbuffer, EfiBltBufferToVideo,
+                                                r->x1, r->y1, r->x1, r->y1, width, height, gop_width * sizeof(uint32_t));
+        }
+
+        if (EFI_ERROR(status) && gop_framebuffer) {
+            // Copy it ourselves, streaming if the probe said that's faster
+            uint32_t *src = gop_backbuffer + r->y1 * gop_width + r->x1;
+            uint32_t *dest = gop_framebuffer + r->y1 * gop_pitch + r->x1;
+            for (uint32_t y = 0; y < height; y++) {
+                if (gop_strategy == GOP_STRATEGY_STREAM) {
+                    gop_streamCopyRow(dest, src, width);
+                } else {
+                    gop_copyRow(dest, src, width);
+                }
+
+                src += gop_width;
+                dest += gop_pitch;
+            }
+        }
+    }
+
+    if (gop_strategy == GOP_STRATEGY_STREAM) _mm_sfence();
+    gop_dirty_count = 0;
+}
+
+/**
+ * @brief Copy a band of whole pixel rows into an off-screen surface
+ * @param surface A surface to reuse, or NULL to allocate one
+ * @param y The first row
+ * @param height The amount of rows
+ * @returns The surface or NULL if it couldn't be allocated or the rows aren't on the screen
+ */
+video_surface_t *platform_captureRows(video_surface_t *surface, int y, int height) {
+    if (y < 0 || height <= 0 || (uint32_t)(y + height) > gop_height) {
+        platform_freeSurface(surface);
+        return NULL;
+    }
+
+    if (surface && (surface->width != gop_width || surface->height != (uint32_t)height)) {
+        platform_freeSurface(surface);
+        surface = NULL;
+    }
+
+    if (!surface) {
+        surface = AllocatePool(sizeof(video_surface_t));
+        if (!surface) return NULL;
+
+        surface->pixels = AllocatePool(gop_width * height * sizeof(uint32_t));
+        if (!surface->pixels) {
+            FreePool(surface);
+            return NULL;
+        }
+    }
+
+    surface->generation = gop_generation;
+    surface->y = y;
+    surface->width = gop_width;
+    surface->height = height;
+
+    // The draw target always has the latest contents
+    uint32_t *src = gop_target + y * gop_target_pitch;
+    if (gop_target_pitch == gop_width) {
+        platform_copyMemory(surface->pixels, src, gop_width * height * sizeof(uint32_t));
+    } else {
+        for (int i = 0; i < height; i++) {
+            gop_copyRow(surface->pixels + i * gop_width, src + i * gop_target_pitch, gop_width);
+        }
+    }
+
+    return surface;
+}
+
+/**
+ * @brief Put rows captured by @c platform_captureRows back where they came from
+ * @param surface The surface
+ * @returns 0 on success, 1 if the surface is from a different video mode
+ */
+int platform_restoreRows(video_surface_t *surface) {
+    if (!surface || surface->generation != gop_generation || surface->width != gop_width || surface->y + surface->height > gop_height) return 1;
+
+    if (gop_backbuffer) {
+        // One copy into the back buffer, the next present sends it out with everything else
+        platform_copyMemory(gop_backbuffer + surface->y * gop_width, surface->pixels, gop_width * surface->height * sizeof(uint32_t));
+        gop_markDirty(0, surface->y, gop_width, surface->height);
+        return 0;
+    }
+
+    // Drawing directly, so go straight to video memory
+    EFI_STATUS status = EFI_UNSUPPORTED;
+    if (gop_blt_native) {
+        status = uefi_call_wrapper(gop->Blt, 10, gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)surface->pixels, EfiBltBufferToVideo,
+                                            0, 0, 0, surface->y, gop_width, surface->height, gop_width * sizeof(uint32_t));
+    }
+
+    if (EFI_ERROR(status)) {
+        for (uint32_t i = 0; i < surface->height; i++) {
+            gop_copyRow(gop_target + (surface->y + i) * gop_target_pitch, surface->pixels + i * gop_width, gop_width);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free a surface
+ * @param surface The surface
+ */
+void platform_freeSurface(video_surface_t *surface) {
+    if (!surface) return;
+    if (surface->pixels) FreePool(surface->pixels);
+    FreePool(surface);
+}
+
 /**
  * @brief Plot a pixel on X, Y
  * @param x X coordinate
@@ -77,23 +777,137 @@ video_info_t gop_collectVideoInformation() {
  * @param color Color of the pixel
  */
 void platform_putPixel(int x, int y, color_t color) {
-    *((uint32_t*)(gop->Mode->FrameBufferBase + 4 * gop->Mode->Info->PixelsPerScanLine * y + 4 * x)) = color.rgb;
+    gop_target[gop_target_pitch * y + x] = gop_mapColor(color);
+    gop_markDirty(x, y, 1, 1);
 }
 
 
+/**
+ * @brief Fill a rectangle on the screen
+ * @param x X coordinate of the rectangle
+ * @param y Y coordinate of the rectangle
+ * @param width Width of the rectangle
+ * @param height Height of the rectangle
+ * @param color The color to fill with
+ */
+void platform_fillRect(int x, int y, int width, int height, color_t color) {
+    // Clip to the screen
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > (int)gop_width) width = gop_width - x;
+    if (y + height > (int)gop_height) height = gop_height - y;
+    if (width <= 0 || height <= 0) return;
+
+    uint32_t x2 = x + width;
+    uint32_t y2 = y + height;
+    uint32_t pixel = gop_mapColor(color);
+
+    if (gop_backbuffer) {
+        // Keep the back buffer in sync, it's normal RAM so this is cheap
+        uint32_t *row = gop_backbuffer + y * gop_width + x;
+        for (int i = 0; i < height; i++) {
+            gop_fillRow(row, pixel, width);
+            row += gop_width;
+        }
+
+        // Video memory gets filled right away so anything dirty that's fully covered doesn't need presenting
+        for (int i = 0; i < gop_dirty_count; i++) {
+            gop_rect_t *r = &gop_dirty[i];
+            if (r->x1 >= (uint32_t)x && r->y1 >= (uint32_t)y && r->x2 <= x2 && r->y2 <= y2) {
+                gop_dirty[i--] = gop_dirty[--gop_dirty_count];
+            }
+        }
+    }
+
+    gop_fillVideo(x, y, width, height, color, pixel);
+}
+
 /**
  * @brief Clear the screen
  * @param color The color to clear with
  */
 void platform_clearScreen(color_t color) {
-    EFI_PHYSICAL_ADDRESS vram = gop->Mode->FrameBufferBase;
-    for (unsigned int y = 0; y < gop->Mode->Info->VerticalResolution; y++) {
-        for (unsigned int x = 0; x < gop->Mode->Info->HorizontalResolution; x++) {
-            *((uint32_t*)(vram + 4 * x)) = color.rgb;
+    platform_fillRect(0, 0, gop_width, gop_height, color);
+}
+
+/**
+ * @brief Scroll the top of the screen up
+ * @param height Height of the region to scroll, starting from the top of the screen
+ * @param pixels Amount of pixels to move the region up by
+ * @param color The color to fill the freed rows with
+ */
+void platform_scroll(int height, int pixels, color_t color) {
+    if (height > (int)gop_height) height = gop_height;
+    if (pixels <= 0 || height <= 0) return;
+
+    if (pixels >= height) {
+        // Everything scrolls out
+        platform_fillRect(0, 0, gop_width, height, color);
+        return;
+    }
+
+    uint32_t moved = height - pixels;
+
+    if (gop_backbuffer) {
+        // Rows only ever move up, so copying top to bottom never overwrites a row we still need
+        uint32_t *row = gop_backbuffer;
+        for (uint32_t y = 0; y < moved; y++) {
+            gop_copyRow(row, row + pixels * gop_width, gop_width);
+            row += gop_width;
+        }
+
+        // Anything waiting to be presented moved along with its contents
+        for (int i = 0; i < gop_dirty_count; i++) {
+            gop_rect_t *r = &gop_dirty[i];
+            if (r->y1 >= (uint32_t)height) continue;
+
+            uint32_t y1 = (r->y1 > (uint32_t)pixels) ? r->y1 - pixels : 0;
+            uint32_t y2 = (r->y2 > (uint32_t)height) ? r->y2 : ((r->y2 > (uint32_t)pixels) ? r->y2 - pixels : 0);
+
+            if (y2 <= y1) {
+                gop_dirty[i--] = gop_dirty[--gop_dirty_count];
+            } else {
+                r->y1 = y1;
+                r->y2 = y2;
+            }
+        }
+    }
+
+    // Now move video memory
+    int video_moved = 0;
+    if (gop_blt_move) {
+        EFI_STATUS status = uefi_call_wrapper(gop->Blt, 10, gop, NULL, EfiBltVideoToVideo, 0, pixels, 0, 0, gop_width, moved, 0);
+        if (!EFI_ERROR(status)) video_moved = 1;
+        else gop_blt_move = 0;
+    }
+
+    if (!video_moved) {
+        if (gop_backbuffer) {
+            // The back buffer already has the moved contents, present it from there
+            gop_markDirty(0, 0, gop_width, moved);
+        } else if (gop_framebuffer) {
+            uint32_t *row = gop_framebuffer;
+            for (uint32_t y = 0; y < moved; y++) {
+                gop_copyRow(row, row + pixels * gop_pitch, gop_width);
+                row += gop_pitch;
+            }
         }
-        
-        vram += (4 * gop->Mode->Info->PixelsPerScanLine);
     }
+
+    // Clear the rows that scrolled in
+    platform_fillRect(0, moved, gop_width, pixels, color);
+}
+
+/**
+ * @brief Draw a glyph into the draw target without marking it dirty
+ * @param ch The character to draw
+ * @param realx The X coordinate in pixels
+ * @param realy The Y coordinate in pixels
+ * @param fg The foreground pixel
+ * @param bg The background pixel
+ */
+static inline void gop_drawGlyph(int ch, int realx, int realy, uint32_t fg, uint32_t bg) {
+    glyph_draw(ch, gop_target + gop_target_pitch * realy + realx, gop_target_pitch, fg, bg);
 }
 
 /**
@@ -105,20 +919,31 @@ void platform_clearScreen(color_t color) {
  * @param bg The bg of the character
  */
 void platform_drawCharacter(int ch, int x, int y, color_t fg, color_t bg) {
-    uint8_t* fc = terminal_font[ch];
+    int realx = x * glyph_width;
+    int realy = y * glyph_height;
 
-    int realx = x * FONT_CELL_WIDTH;
-    int realy = y * FONT_CELL_HEIGHT;
+    gop_drawGlyph(ch, realx, realy, gop_mapColor(fg), gop_mapColor(bg));
+    gop_markDirty(realx, realy, glyph_width, glyph_height);
+}
 
-    for (uint8_t h = 0; h < FONT_CELL_HEIGHT; h++) {
-        for (uint8_t w = 0; w < FONT_CELL_WIDTH; w++) {
-            if (fc[h] & (1 << (FONT_MASK - w))) {
-                // Foreground pixel
-                platform_putPixel(realx+w, realy+h, fg);
-            } else {
-                // Background pixel
-                platform_putPixel(realx+w, realy+h, bg);
-            }
-        }
+/**
+ * @brief Draw a run of characters on one line
+ * @param str The characters to draw
+ * @param count The amount of characters
+ * @param x The X coordinate of the first character
+ * @param y The Y coordinate
+ * @param fg The fg of the characters
+ * @param bg The bg of the characters
+ */
+void platform_drawRun(const char *str, int count, int x, int y, color_t fg, color_t bg) {
+    int realx = x * glyph_width;
+    int realy = y * glyph_height;
+    uint32_t fg_pixel = gop_mapColor(fg);
+    uint32_t bg_pixel = gop_mapColor(bg);
+
+    for (int i = 0; i < count; i++) {
+        gop_drawGlyph((unsigned char)str[i], realx + i * glyph_width, realy, fg_pixel, bg_pixel);
     }
+
+    gop_markDirty(realx, realy, count * glyph_width, glyph_height);
 }
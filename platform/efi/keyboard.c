@@ -14,6 +14,7 @@
 #include <efi.h>
 #include <efilib.h>
 #include <polyaniline/interfaces/keyboard.h>
+#include <polyaniline/terminal.h>
 
 /**
  * @brief Read a keyboard key with a specific timeout
@@ -22,6 +23,9 @@
 int platform_readKeyboard(int timeout) {
     UINTN index;
 
+    // Whatever was drawn up until now is what the user is about to react to
+    terminal_present();
+
     if (timeout) {
         // We need to create an event in conjunction with ST->ConIn->WaitForKey
         // See https://uefi.org/sites/default/files/resources/UEFI_Spec_2_10_Aug29.pdf (sections 7.1.1, 7.1.5, and 7.1.7)
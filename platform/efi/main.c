@@ -23,13 +23,32 @@
 #include <polyaniline/terminal.h>
 #include <polyaniline/config.h>
 #include <polyaniline/polyaniline.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/psf.h>
+#include <polyaniline/efi/variables.h>
+#include <polyaniline/efi/memory.h>
 
 // Interfaces
 #include <polyaniline/interfaces/keyboard.h>
+#include <polyaniline/interfaces/serial.h>
 
 /* Loaded image */
 EFI_LOADED_IMAGE *LoadedImage = NULL;
 
+/**
+ * @brief Check whether we were asked to boot headless
+ */
+static int efi_wantHeadless() {
+    if (__polyaniline_headless) return 1;
+
+    EFI_GUID var_guid = POLYANILINE_VARIABLE_GUID;
+    UINT8 headless = 0;
+    UINTN size = sizeof(headless);
+    EFI_STATUS status = uefi_call_wrapper(RT->GetVariable, 5, POLYANILINE_VARIABLE_HEADLESS, &var_guid, NULL, &size, &headless);
+
+    return !EFI_ERROR(status) && size == sizeof(headless) && headless;
+}
+
 EFI_STATUS EFIAPI efi_main (EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
     // Initialize the library & print hello
@@ -49,12 +68,29 @@ EFI_STATUS EFIAPI efi_main (EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTabl
 
     Print(L"Image base: 0x%lx\n", LoadedImage->ImageBase);
 
+    // Pick copy and fill methods before anything big gets moved around
+    memory_init();
+
+    // Bring up the serial console early so it sees everything printed
+    platform_serialInit();
+
+    // Headless boots don't touch the screen at all, output only goes to the serial console
+    polyaniline_headless = efi_wantHeadless();
+    if (polyaniline_headless) {
+        Print(L"Booting headless\n");
+        polyaniline_main();
+        return EFI_SUCCESS;
+    }
+
+    // Load a font from the boot volume. If there isn't one the built-in font is used.
+    if (__polyaniline_font_file) psf_load(__polyaniline_font_file);
 
-    // Initialize the GOP
+    // Initialize the GOP. Without one we can still boot, just without the menu.
     if (gop_initialize()) {
-        Print(L"FATAL: Could not initialize GOP video, rebooting.\n");
-        uefi_call_wrapper(ST->RuntimeServices->ResetSystem, 4, EfiResetWarm, EFI_SUCCESS, 0, NULL);
-        return EFI_ABORTED;
+        Print(L"Could not initialize GOP video, booting headless\n");
+        polyaniline_headless = 1;
+        polyaniline_main();
+        return EFI_SUCCESS;
     }
 
     // Initialize the terminal
@@ -81,4 +117,21 @@ void platform_reboot() {
     uefi_call_wrapper(ST->RuntimeServices->ResetSystem, EfiResetWarm, EFI_SUCCESS, 0, NULL);
     // ??? now what
     for (;;);
+}
+
+/**
+ * @brief Allocate memory
+ * @param size The amount of bytes to allocate
+ * @returns A pointer to the memory or NULL on failure
+ */
+void *platform_allocate(size_t size) {
+    return AllocatePool(size);
+}
+
+/**
+ * @brief Free memory allocated by @c platform_allocate
+ * @param ptr The pointer to free
+ */
+void platform_free(void *ptr) {
+    FreePool(ptr);
 }
\ No newline at end of file
@@ -15,18 +15,59 @@
 #include <polyaniline/efi/gop.h>
 #include <polyaniline/config.h>
 #include <polyaniline/error.h>
+#include <polyaniline/psf.h>
+#include <polyaniline/polyaniline.h>
+#include <polyaniline/bootlog.h>
+#include <polyaniline/log.h>
+#include <polyaniline/platform.h>
 #include <stdio.h>
 #include <string.h>
 #include <efi.h>
 #include <efilib.h>
 
+#define LOG(level, ...) LOG_WRITE(MULTIBOOT, LOG_LEVEL_##level, __VA_ARGS__)
+
 /* Allocate a new multiboot structure */
-#define MULTIBOOT_ALLOCATE(type)    ({type *structure = (type*)*kernel_end; *kernel_end = *kernel_end + sizeof(type) + 1; structure; })
-#define MULTIBOOT_ALLOCATE_SIZE(size)   ({void *structure = (void*)*kernel_end; *kernel_end = *kernel_end + size + 1; structure; })
+#define MULTIBOOT_ALLOCATE(type)    ({type *structure = (type*)*kernel_end; *kernel_end = *kernel_end + sizeof(type) + 1; multiboot_claim(*kernel_end); structure; })
+#define MULTIBOOT_ALLOCATE_SIZE(size)   ({void *structure = (void*)*kernel_end; *kernel_end = *kernel_end + size + 1; multiboot_claim(*kernel_end); structure; })
 
 /* Stored Multiboot information */
 multiboot_t *mboot = NULL;
 
+/* End of the memory claimed for Multiboot structures so far */
+static uintptr_t multiboot_claimed = 0x0;
+
+/* The boot log module */
+static multiboot1_mod_t *bootlog_mod = NULL;
+
+/**
+ * @brief Claim the memory of the Multiboot structures up to @p end
+ * @param end End of the structures
+ *
+ * They go past the end of the kernel, which the firmware thinks is free until it's claimed.
+ */
+static void multiboot_claim(uintptr_t end) {
+    end = (end + 0xFFF) & ~0xFFF;
+    if (end <= multiboot_claimed) return;
+
+    if (platform_reserveMemory(multiboot_claimed, end - multiboot_claimed)) {
+        polyaniline_error("multiboot_claim(): Memory at %p - %p is not available for Multiboot information\n", multiboot_claimed, end);
+    }
+
+    multiboot_claimed = end;
+}
+
+/**
+ * @brief Copy the boot log into its Multiboot module
+ *
+ * Call as late as possible, anything logged after this doesn't make it to the kernel
+ */
+void multiboot_finishBootLog() {
+    if (!bootlog_mod) return;
+    size_t length = bootlog_read((char*)(uintptr_t)bootlog_mod->mod_start, BOOTLOG_SIZE);
+    bootlog_mod->mod_end = bootlog_mod->mod_start + length;
+}
+
 /**
  * @brief Relocate the initial ramdisk after Multiboot information was compiled
  * @param initrd Initial ramdisk location in memory
@@ -47,8 +88,8 @@ int multiboot_relocateRamdisk(uintptr_t initrd, uintptr_t initrd_size, uintptr_t
 
     // Copy
     // !!!: stupid but kernel will whine if we go anywhere other than an address >0x200000... why???
-    memcpy((void*)0x300000, (void*)initrd, initrd_size);
-    printf("Relocated initial ramdisk from %p to %016llX\n", initrd, (uint32_t)0x300000);
+    platform_copyMemory((void*)0x300000, (void*)initrd, initrd_size);
+    LOG(INFO, "Relocated initial ramdisk from %p to %016llX\n", initrd, (uint32_t)0x300000);
 
     return 0;
 }
@@ -65,6 +106,10 @@ int multiboot_relocateRamdisk(uintptr_t initrd, uintptr_t initrd_size, uintptr_t
  */
 int multiboot_create(multiboot_t *multiboot, char *cmdline, uintptr_t initrd_start, uintptr_t initrd, uintptr_t *kernel_end) {
     mboot = multiboot;
+
+    // The page the kernel ends in is the kernel's, everything after it has to be claimed
+    multiboot_claimed = ((uintptr_t)multiboot + 0xFFF) & ~0xFFF;
+    multiboot_claim((uintptr_t)multiboot + sizeof(multiboot_t));
     memset((void*)multiboot, 0, sizeof(multiboot_t));
 
     // Get the initial ramdisk end
@@ -93,26 +138,52 @@ int multiboot_create(multiboot_t *multiboot, char *cmdline, uintptr_t initrd_sta
     EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
 
     status = uefi_call_wrapper(BS->LocateProtocol, 3, &gop_guid, NULL, (void**)&gop);
-    if (EFI_ERROR(status)) {
+    if (!EFI_ERROR(status) && gop) {
+        // The mode is whatever the firmware left if we never initialized the GOP (headless)
+        multiboot->framebuffer_addr = gop->Mode->FrameBufferBase;
+        multiboot->framebuffer_bpp = gop->Mode->Info->HorizontalResolution;
+        multiboot->framebuffer_pitch = gop->Mode->Info->PixelsPerScanLine * 4;
+        multiboot->framebuffer_height = gop->Mode->Info->VerticalResolution;
+        multiboot->framebuffer_width = gop->Mode->Info->HorizontalResolution;
+        multiboot->flags |= 0x1000;
+    } else if (!polyaniline_headless) {
         polyaniline_error("multiboot_create(): Failed to locate GOP (BS->LocateProtocol error)\n");
         return 1;
     }
-    
-    multiboot->framebuffer_addr = gop->Mode->FrameBufferBase;
-    multiboot->framebuffer_bpp = gop->Mode->Info->HorizontalResolution;
-    multiboot->framebuffer_pitch = gop->Mode->Info->PixelsPerScanLine * 4;
-    multiboot->framebuffer_height = gop->Mode->Info->VerticalResolution;
-    multiboot->framebuffer_width = gop->Mode->Info->HorizontalResolution;
-    multiboot->flags |= 0x1000;
-
-    // Create module
-    multiboot1_mod_t *initrd_mod = MULTIBOOT_ALLOCATE(multiboot1_mod_t);
+
+    // Create modules. The initrd is always first, followed by the font if we loaded one and the boot log
+    int mod_count = psf_font ? 3 : 2;
+    multiboot1_mod_t *initrd_mod = MULTIBOOT_ALLOCATE_SIZE(sizeof(multiboot1_mod_t) * mod_count);
     initrd_mod->cmdline = (uint32_t)(uintptr_t)MULTIBOOT_ALLOCATE_SIZE(strlen("type=initrd"));
     strcpy((char*)(uintptr_t)initrd_mod->cmdline, "type=initrd");
     initrd_mod->mod_start = initrd_start;
     initrd_mod->mod_end = initrd;
+
+    multiboot1_mod_t *next_mod = initrd_mod + 1;
+    if (psf_font) {
+        // Hand the PSF over as-is so the kernel doesn't have to dig it out of the initrd
+        multiboot1_mod_t *font_mod = next_mod++;
+        font_mod->cmdline = (uint32_t)(uintptr_t)MULTIBOOT_ALLOCATE_SIZE(strlen("type=font"));
+        strcpy((char*)(uintptr_t)font_mod->cmdline, "type=font");
+
+        *kernel_end = (*kernel_end + 0xFFF) & ~0xFFF;
+        void *font_copy = MULTIBOOT_ALLOCATE_SIZE(psf_font->file_size);
+        platform_copyMemory(font_copy, psf_font->file, psf_font->file_size);
+        font_mod->mod_start = (uint32_t)(uintptr_t)font_copy;
+        font_mod->mod_end = font_mod->mod_start + psf_font->file_size;
+    }
+
+    // Room for the boot log, which is copied in by multiboot_finishBootLog right before the kernel starts
+    bootlog_mod = next_mod;
+    bootlog_mod->cmdline = (uint32_t)(uintptr_t)MULTIBOOT_ALLOCATE_SIZE(strlen("type=bootlog"));
+    strcpy((char*)(uintptr_t)bootlog_mod->cmdline, "type=bootlog");
+
+    *kernel_end = (*kernel_end + 0xFFF) & ~0xFFF;
+    bootlog_mod->mod_start = (uint32_t)(uintptr_t)MULTIBOOT_ALLOCATE_SIZE(BOOTLOG_SIZE);
+    bootlog_mod->mod_end = bootlog_mod->mod_start;
+
     multiboot->mods_addr = (uint32_t)(uintptr_t)initrd_mod;
-    multiboot->mods_count = 1;
+    multiboot->mods_count = mod_count;
 
     // Realign to page boundary for memory map. This isn't required but is liked when done
     *kernel_end += 0x1000;
@@ -123,7 +194,8 @@ int multiboot_create(multiboot_t *multiboot, char *cmdline, uintptr_t initrd_sta
     // We need to get the map size so we can allocate - no error checking is done because this is supposed to fail
     status = uefi_call_wrapper(ST->BootServices->GetMemoryMap, 5, &map_size, NULL, &map_key, &descriptor_size, NULL);
 
-    // Now allocate
+    // Now allocate. Claiming the memory for it can split a descriptor, so leave room for a few more
+    map_size += descriptor_size * 4;
     EFI_MEMORY_DESCRIPTOR *memory_desc = MULTIBOOT_ALLOCATE_SIZE(map_size);
 
     status = uefi_call_wrapper(ST->BootServices->GetMemoryMap, 5, &map_size, memory_desc, &map_key, &descriptor_size, NULL);
@@ -188,7 +260,7 @@ int multiboot_create(multiboot_t *multiboot, char *cmdline, uintptr_t initrd_sta
     *kernel_end += 0x5000;
     *kernel_end &= ~0xFFF;
 
-    printf("kernel_end = %p\n", *kernel_end);
+    LOG(DEBUG, "kernel_end = %p\n", *kernel_end);
 
     return 0;
 }
\ No newline at end of file
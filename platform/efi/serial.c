@@ -0,0 +1,193 @@
+/**
+ * @file platform/efi/serial.c
+ * @brief Serial console for EFI
+ *
+ * Output is queued in a buffer and sent in batches. The firmware's EFI_SERIAL_IO_PROTOCOL
+ * gets the whole batch in one Write() call. Without it we drive COM1 ourselves, waiting for
+ * the transmit FIFO to drain and then refilling all of it at once instead of polling the
+ * line status before every byte.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/efi/serial.h>
+#include <polyaniline/efi/cpu.h>
+#include <polyaniline/config.h>
+#include <efi.h>
+#include <efilib.h>
+
+#define LOG(...) Print(L"[SERIAL] " __VA_ARGS__)
+
+/* How output reaches the port */
+static int serial_type = SERIAL_NONE;
+
+/* Firmware serial port, if it has one */
+static SERIAL_IO_INTERFACE *serial_io = NULL;
+
+/* Bytes the UART takes per burst */
+static int serial_fifo_size = 1;
+
+/* Queued output */
+static char serial_buffer[SERIAL_BUFFER_SIZE];
+static size_t serial_length = 0;
+
+/**
+ * @brief Check for a UART at COM1 and set it up
+ * @returns 1 if it is there
+ */
+static int serial_probePort() {
+    // Nothing answers port I/O on legacy-free machines, reads come back as 0xFF
+    cpu_outb(SERIAL_COM1 + SERIAL_SCRATCH, 0xAE);
+    if (cpu_inb(SERIAL_COM1 + SERIAL_SCRATCH) != 0xAE) return 0;
+
+    uint16_t divisor = SERIAL_BAUD_BASE / __polyaniline_serial_baud;
+    if (!divisor) divisor = 1;
+
+    cpu_outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+    cpu_outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_DLAB);
+    cpu_outb(SERIAL_COM1 + SERIAL_DATA, divisor & 0xFF);
+    cpu_outb(SERIAL_COM1 + SERIAL_IER, divisor >> 8);
+    cpu_outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_8N1);
+    cpu_outb(SERIAL_COM1 + SERIAL_FCR, SERIAL_FCR_ENABLE);
+    cpu_outb(SERIAL_COM1 + SERIAL_MCR, SERIAL_MCR_DTR_RTS);
+
+    // Older UARTs (8250/16450) don't have a FIFO and take one byte at a time
+    serial_fifo_size = ((cpu_inb(SERIAL_COM1 + SERIAL_IIR) & SERIAL_IIR_FIFO) == SERIAL_IIR_FIFO) ? SERIAL_FIFO_SIZE : 1;
+    return 1;
+}
+
+/**
+ * @brief Initialize the serial console
+ * @returns 0 on success, 1 if there is no serial port to use
+ */
+int platform_serialInit() {
+    if (!__polyaniline_serial) return 1;
+
+    EFI_GUID serial_guid = SERIAL_IO_PROTOCOL;
+    EFI_STATUS status = uefi_call_wrapper(BS->LocateProtocol, 3, &serial_guid, NULL, (void**)&serial_io);
+
+    if (!EFI_ERROR(status) && serial_io) {
+        if (serial_io->Mode && serial_io->Mode->BaudRate != (UINT64)__polyaniline_serial_baud) {
+            // Zeroes keep the firmware defaults for everything else
+            uefi_call_wrapper(serial_io->SetAttributes, 7, serial_io, (UINT64)__polyaniline_serial_baud, 0, 0, DefaultParity, 0, DefaultStopBits);
+        }
+
+        serial_type = SERIAL_EFI;
+        LOG(L"Using firmware serial port\n");
+        return 0;
+    }
+
+    serial_io = NULL;
+    if (serial_probePort()) {
+        serial_type = SERIAL_PORT;
+        LOG(L"Using COM1 (%d byte FIFO)\n", serial_fifo_size);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Send a batch straight to the UART
+ * @param data The bytes
+ * @param length The amount of bytes
+ */
+static void serial_sendPort(const char *data, size_t length) {
+    while (length) {
+        // Wait for the FIFO to empty out completely, then fill all of it
+        int spins = 0;
+        while (!(cpu_inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE)) {
+            if (++spins > SERIAL_SPIN_LIMIT) {
+                // The UART stopped draining, don't hang the boot on it
+                serial_type = SERIAL_NONE;
+                return;
+            }
+
+            cpu_pause();
+        }
+
+        size_t burst = (length < (size_t)serial_fifo_size) ? length : (size_t)serial_fifo_size;
+        for (size_t i = 0; i < burst; i++) cpu_outb(SERIAL_COM1 + SERIAL_DATA, data[i]);
+
+        data += burst;
+        length -= burst;
+    }
+}
+
+/**
+ * @brief Send a batch through the firmware
+ * @param data The bytes
+ * @param length The amount of bytes
+ */
+static void serial_sendEFI(const char *data, size_t length) {
+    while (length) {
+        // Write() can time out part way through, carry on from wherever it got to
+        UINTN written = length;
+        EFI_STATUS status = uefi_call_wrapper(serial_io->Write, 3, serial_io, &written, (void*)data);
+        if (EFI_ERROR(status) && !written) return;
+
+        data += written;
+        length -= written;
+    }
+}
+
+/**
+ * @brief Send everything queued for the serial console
+ */
+void platform_serialFlush() {
+    if (!serial_length) return;
+
+    if (serial_type == SERIAL_EFI) serial_sendEFI(serial_buffer, serial_length);
+    else if (serial_type == SERIAL_PORT) serial_sendPort(serial_buffer, serial_length);
+
+    serial_length = 0;
+}
+
+/**
+ * @brief Queue bytes for the serial console
+ * @param data The bytes
+ * @param length The amount of bytes
+ *
+ * Nothing is guaranteed to be sent until @c platform_serialFlush
+ */
+void platform_serialWrite(const char *data, size_t length) {
+    if (serial_type == SERIAL_NONE) return;
+
+    while (length) {
+        size_t space = SERIAL_BUFFER_SIZE - serial_length;
+        size_t count = (length < space) ? length : space;
+
+        for (size_t i = 0; i < count; i++) serial_buffer[serial_length + i] = data[i];
+        serial_length += count;
+        data += count;
+        length -= count;
+
+        if (serial_length == SERIAL_BUFFER_SIZE) platform_serialFlush();
+    }
+}
+
+/**
+ * @brief Stop using firmware services for the serial console
+ *
+ * Called before ExitBootServices. Output carries on over port I/O if the UART is there.
+ */
+void serial_shutdown() {
+    platform_serialFlush();
+    if (serial_type != SERIAL_EFI) return;
+
+    // The firmware's UART driver is gone once boot services are, so take COM1 over ourselves.
+    // Its settings (baud, FIFO) were already made by the firmware, just check it exists.
+    serial_io = NULL;
+    cpu_outb(SERIAL_COM1 + SERIAL_SCRATCH, 0xAE);
+    if (cpu_inb(SERIAL_COM1 + SERIAL_SCRATCH) == 0xAE) {
+        serial_fifo_size = ((cpu_inb(SERIAL_COM1 + SERIAL_IIR) & SERIAL_IIR_FIFO) == SERIAL_IIR_FIFO) ? SERIAL_FIFO_SIZE : 1;
+        serial_type = SERIAL_PORT;
+    } else {
+        serial_type = SERIAL_NONE;
+    }
+}
@@ -0,0 +1,270 @@
+/**
+ * @file polyaniline/ansi.c
+ * @brief ANSI mirror of the terminal for the serial console
+ *
+ * Until a menu is up, the serial console just gets a copy of everything printed.
+ * While one is, a window of the terminal's cell grid is mirrored onto an 80x25 ANSI screen.
+ * A shadow copy of the remote screen is kept so a sync only sends the cells that changed,
+ * with cursor moves and color changes only where they're actually needed.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/ansi.h>
+#include <polyaniline/interfaces/serial.h>
+
+/* Cells between two changes that are cheaper to send again than to move the cursor past */
+#define ANSI_GAP_REWRITE        4
+
+/* The 16 ANSI colors, in SGR order */
+static const color_t ansi_palette[16] = {
+    COLOR_BLACK, COLOR_RED, COLOR_GREEN, COLOR_BROWN, COLOR_BLUE, COLOR_PURPLE, COLOR_CYAN, COLOR_GRAY,
+    COLOR_DARK_GRAY, COLOR_LIGHT_RED, COLOR_LIGHT_GREEN, COLOR_YELLOW, COLOR_LIGHT_BLUE, COLOR_LIGHT_PURPLE, COLOR_LIGHT_CYAN, COLOR_WHITE,
+};
+
+/* Top left of the mirrored window in the terminal */
+static int ansi_window_x = ANSI_WINDOW_NONE;
+static int ansi_window_y = 0;
+
+/* What the remote screen shows. Colors are palette indices */
+static terminal_cell_t ansi_cells[ANSI_COLUMNS * ANSI_ROWS];
+
+/* Remote cursor, -1 if we don't know where it is */
+static int ansi_cursor_x = -1;
+static int ansi_cursor_y = -1;
+
+/* Remote colors, -1 if unknown */
+static int ansi_fg = -1;
+static int ansi_bg = -1;
+
+/* Output being built up */
+static char ansi_buffer[ANSI_BUFFER_SIZE];
+static size_t ansi_length = 0;
+
+/**
+ * @brief Hand the built up output to the serial port
+ */
+static void ansi_flush() {
+    platform_serialWrite(ansi_buffer, ansi_length);
+    ansi_length = 0;
+}
+
+/**
+ * @brief Add a character to the output
+ */
+static inline void ansi_put(char ch) {
+    if (ansi_length == ANSI_BUFFER_SIZE) ansi_flush();
+    ansi_buffer[ansi_length++] = ch;
+}
+
+/**
+ * @brief Add a string to the output
+ */
+static void ansi_puts(const char *str) {
+    while (*str) ansi_put(*str++);
+}
+
+/**
+ * @brief Add a decimal number to the output
+ */
+static void ansi_putNumber(int n) {
+    char digits[12];
+    int count = 0;
+
+    do {
+        digits[count++] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+
+    while (count) ansi_put(digits[--count]);
+}
+
+/**
+ * @brief Find the closest palette entry to a color
+ * @param rgb The color, as stored in a terminal cell
+ */
+static int ansi_paletteIndex(uint32_t rgb) {
+    int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    int best = 0;
+    int best_distance = 0x7FFFFFFF;
+
+    for (int i = 0; i < 16; i++) {
+        int dr = r - RGB_R(ansi_palette[i]);
+        int dg = g - RGB_G(ansi_palette[i]);
+        int db = b - RGB_B(ansi_palette[i]);
+        int distance = dr * dr + dg * dg + db * db;
+
+        if (distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Convert a terminal cell to what the remote screen would show for it
+ * @param cell The terminal cell
+ */
+static terminal_cell_t ansi_translate(terminal_cell_t *cell) {
+    terminal_cell_t out = { .ch = cell->ch, .bg = ansi_paletteIndex(cell->bg) };
+
+    switch (cell->ch) {
+        // Arrows in the built-in font
+        case '\030': out.ch = '^'; break;
+        case '\031': out.ch = 'v'; break;
+        case '\032': out.ch = '>'; break;
+        case '\033': out.ch = '<'; break;
+
+        // Something drawn over the cell (test tube, etc.) that text can't show
+        case TERMINAL_CELL_INVALID: out.ch = ' '; break;
+
+        default:
+            if (cell->ch < ' ' || cell->ch > '~') out.ch = '?';
+            break;
+    }
+
+    // Only the background of a blank cell shows
+    out.fg = (out.ch == ' ') ? out.bg : (uint32_t)ansi_paletteIndex(cell->fg);
+    return out;
+}
+
+/**
+ * @brief Move the remote cursor
+ * @param x The column
+ * @param y The row
+ */
+static void ansi_moveCursor(int x, int y) {
+    ansi_puts("\033[");
+    ansi_putNumber(y + 1);
+    ansi_put(';');
+    ansi_putNumber(x + 1);
+    ansi_put('H');
+
+    ansi_cursor_x = x;
+    ansi_cursor_y = y;
+}
+
+/**
+ * @brief Send a cell at the cursor, changing colors first if needed
+ * @param cell The translated cell
+ */
+static void ansi_putCell(terminal_cell_t *cell) {
+    int fg_changed = (cell->ch != ' ' && (int)cell->fg != ansi_fg);
+    int bg_changed = ((int)cell->bg != ansi_bg);
+
+    if (fg_changed || bg_changed) {
+        ansi_puts("\033[");
+
+        if (fg_changed) {
+            ansi_putNumber(cell->fg < 8 ? 30 + cell->fg : 90 + cell->fg - 8);
+            if (bg_changed) ansi_put(';');
+            ansi_fg = cell->fg;
+        }
+
+        if (bg_changed) {
+            ansi_putNumber(cell->bg < 8 ? 40 + cell->bg : 100 + cell->bg - 8);
+            ansi_bg = cell->bg;
+        }
+
+        ansi_put('m');
+    }
+
+    ansi_put(cell->ch);
+
+    // Terminals differ on what happens at the last column, so don't trust the cursor after it
+    if (++ansi_cursor_x >= ANSI_COLUMNS) ansi_cursor_x = ansi_cursor_y = -1;
+}
+
+/**
+ * @brief Choose the part of the terminal mirrored to the remote screen
+ * @param x The first column of the window, or ANSI_WINDOW_NONE to go back to a plain log
+ * @param y The first line of the window
+ *
+ * Entering a window clears the remote screen, it is then kept in sync by @c ansi_sync
+ */
+void ansi_setWindow(int x, int y) {
+    if (x == ANSI_WINDOW_NONE) {
+        if (ansi_window_x == ANSI_WINDOW_NONE) return;
+
+        // Carry on logging below the last screen
+        ansi_window_x = ANSI_WINDOW_NONE;
+        ansi_puts("\033[0m");
+        ansi_moveCursor(0, ANSI_ROWS - 1);
+        ansi_puts("\r\n");
+    } else {
+        ansi_window_x = (x < 0) ? 0 : x;
+        ansi_window_y = (y < 0) ? 0 : y;
+
+        // Clear to black, which is what the shadow starts as
+        ansi_puts("\033[0;40m\033[2J");
+        ansi_moveCursor(0, 0);
+        ansi_fg = -1;
+        ansi_bg = 0;
+
+        for (int i = 0; i < ANSI_COLUMNS * ANSI_ROWS; i++) ansi_cells[i] = (terminal_cell_t){ .ch = ' ', .fg = 0, .bg = 0 };
+    }
+
+    ansi_flush();
+    platform_serialFlush();
+}
+
+/**
+ * @brief Log text to the serial console
+ * @param str The text
+ * @param length The amount of characters
+ *
+ * Only does anything while there's no window. Newlines become CRLF.
+ */
+void ansi_log(const char *str, size_t length) {
+    if (ansi_window_x != ANSI_WINDOW_NONE) return;
+
+    for (size_t i = 0; i < length; i++) {
+        if (str[i] == '\n') ansi_put('\r');
+        if (str[i]) ansi_put(str[i]);
+    }
+
+    ansi_flush();
+    platform_serialFlush();
+}
+
+/**
+ * @brief Bring the remote screen up to date with the terminal
+ * @param cells The terminal's cell grid
+ * @param width Width of the grid
+ * @param height Height of the grid
+ *
+ * Only cells that changed since the last sync are sent
+ */
+void ansi_sync(terminal_cell_t *cells, int width, int height) {
+    if (ansi_window_x == ANSI_WINDOW_NONE || !cells) return;
+
+    for (int row = 0; row < ANSI_ROWS && ansi_window_y + row < height; row++) {
+        terminal_cell_t *src = cells + (ansi_window_y + row) * width + ansi_window_x;
+        terminal_cell_t *shadow = ansi_cells + row * ANSI_COLUMNS;
+
+        for (int col = 0; col < ANSI_COLUMNS && ansi_window_x + col < width; col++) {
+            terminal_cell_t cell = ansi_translate(&src[col]);
+            if (cell.ch == shadow[col].ch && cell.fg == shadow[col].fg && cell.bg == shadow[col].bg) continue;
+
+            // Get the cursor here, either by sending the few cells in the way again or by moving it
+            if (ansi_cursor_y == row && ansi_cursor_x >= 0 && ansi_cursor_x < col && col - ansi_cursor_x <= ANSI_GAP_REWRITE) {
+                while (ansi_cursor_x < col) ansi_putCell(&shadow[ansi_cursor_x]);
+            } else if (ansi_cursor_y != row || ansi_cursor_x != col) {
+                ansi_moveCursor(col, row);
+            }
+
+            ansi_putCell(&cell);
+            shadow[col] = cell;
+        }
+    }
+
+    ansi_flush();
+    platform_serialFlush();
+}
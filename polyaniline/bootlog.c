@@ -0,0 +1,260 @@
+/**
+ * @file polyaniline/bootlog.c
+ * @brief Boot log
+ *
+ * Everything printed while booting is kept in a ring buffer, with a timestamp on every line,
+ * so it can be looked at from the menu and handed to the kernel later.
+ *
+ * Log messages nobody is shown are kept as raw records (see log.c) and only formatted into
+ * the ring when the log is read. Text written while there are records waiting is kept
+ * as a record too, so everything still ends up in order.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/bootlog.h>
+#include <polyaniline/platform.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* The ring buffer */
+static char bootlog_buffer[BOOTLOG_SIZE];
+
+/* Where the next byte goes, and how many bytes are valid */
+static size_t bootlog_head = 0;
+static size_t bootlog_used = 0;
+
+/* Whether the next character starts a line (and needs a timestamp) */
+static int bootlog_line_start = 1;
+
+/* Records waiting to be formatted */
+static bootlog_record_t bootlog_records[BOOTLOG_RECORDS];
+static int bootlog_pending = 0;
+
+/* Plain text of the records that have some */
+static char bootlog_pending_text[BOOTLOG_TEXT_SIZE];
+static size_t bootlog_pending_length = 0;
+
+/**
+ * @brief Append a run of bytes to the ring
+ * @param data The bytes
+ * @param length The amount of bytes
+ */
+static void bootlog_append(const char *data, size_t length) {
+    while (length) {
+        size_t count = BOOTLOG_SIZE - bootlog_head;
+        if (count > length) count = length;
+
+        memcpy(bootlog_buffer + bootlog_head, data, count);
+
+        bootlog_head = (bootlog_head + count) % BOOTLOG_SIZE;
+        bootlog_used = (bootlog_used + count > BOOTLOG_SIZE) ? BOOTLOG_SIZE : bootlog_used + count;
+        data += count;
+        length -= count;
+    }
+}
+
+/**
+ * @brief Append the timestamp for a new line
+ * @param time Microseconds since reset
+ */
+static void bootlog_stamp(uint64_t time) {
+    uint64_t seconds = time / 1000000;
+    uint64_t micros = time % 1000000;
+
+    // "[    12.345678] ", built from the right
+    char stamp[BOOTLOG_STAMP_LENGTH];
+    int i = BOOTLOG_STAMP_LENGTH - 1;
+
+    stamp[i--] = ' ';
+    stamp[i--] = ']';
+    for (int d = 0; d < 6; d++, micros /= 10) stamp[i--] = '0' + (micros % 10);
+    stamp[i--] = '.';
+    do {
+        stamp[i--] = '0' + (seconds % 10);
+        seconds /= 10;
+    } while (seconds && i > 0);
+    while (i > 0) stamp[i--] = ' ';
+    stamp[0] = '[';
+
+    bootlog_append(stamp, BOOTLOG_STAMP_LENGTH);
+}
+
+/**
+ * @brief Append text to the ring
+ * @param str The text
+ * @param length The amount of characters
+ * @param time Timestamp for any lines it starts
+ */
+static void bootlog_text(const char *str, size_t length, uint64_t time) {
+    while (length) {
+        if (bootlog_line_start) {
+            bootlog_stamp(time);
+            bootlog_line_start = 0;
+        }
+
+        // Take the rest of the line in one go
+        size_t count = 0;
+        while (count < length && str[count] != '\n' && str[count] != '\0') count++;
+        bootlog_append(str, count);
+
+        str += count;
+        length -= count;
+        if (!length) break;
+
+        if (*str == '\n') {
+            bootlog_append("\n", 1);
+            bootlog_line_start = 1;
+        }
+
+        str++;
+        length--;
+    }
+}
+
+/**
+ * @brief Format all pending records into the ring
+ */
+static void bootlog_flush() {
+    for (int i = 0; i < bootlog_pending; i++) {
+        bootlog_record_t *record = &bootlog_records[i];
+        if (!record->format) {
+            bootlog_text(bootlog_pending_text + record->args[0], record->count, record->time);
+            continue;
+        }
+
+        char line[LOG_LINE_LENGTH];
+        size_t length = log_format(line, LOG_LINE_LENGTH, record->format, record->count, record->args);
+        bootlog_text(line, length, record->time);
+    }
+
+    bootlog_pending = 0;
+    bootlog_pending_length = 0;
+}
+
+/**
+ * @brief Append text to the boot log
+ * @param str The text
+ * @param length The amount of characters
+ *
+ * Every line gets a timestamp in front of it
+ */
+void bootlog_write(const char *str, size_t length) {
+    uint64_t time = platform_getTime();
+
+    if (bootlog_pending && (bootlog_pending == BOOTLOG_RECORDS || length > BOOTLOG_TEXT_SIZE - bootlog_pending_length)) {
+        bootlog_flush();
+    }
+
+    if (!bootlog_pending) {
+        bootlog_text(str, length, time);
+        return;
+    }
+
+    // Records are waiting, so this has to wait behind them
+    bootlog_record_t *record = &bootlog_records[bootlog_pending++];
+    record->time = time;
+    record->format = NULL;
+    record->count = length;
+    record->args[0] = bootlog_pending_length;
+
+    memcpy(bootlog_pending_text + bootlog_pending_length, str, length);
+    bootlog_pending_length += length;
+}
+
+/**
+ * @brief Record a log message without formatting it
+ * @param format The format string, has to stay around until the log is read
+ * @param count The amount of arguments
+ * @param args The raw arguments
+ *
+ * It's formatted into the ring when the log is read
+ */
+void bootlog_record(const char *format, int count, const uint64_t *args) {
+    if (bootlog_pending == BOOTLOG_RECORDS) bootlog_flush();
+
+    bootlog_record_t *record = &bootlog_records[bootlog_pending++];
+    record->time = platform_getTime();
+    record->format = format;
+    record->count = (count > LOG_MAX_ARGS) ? LOG_MAX_ARGS : count;
+    for (int i = 0; i < record->count; i++) record->args[i] = args[i];
+}
+
+/**
+ * @brief Append formatted text to the boot log
+ * @param format The format string
+ */
+void bootlog_printf(char *format, ...) {
+    char buffer[512];
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(buffer, 512, format, ap);
+    va_end(ap);
+
+    if (length > 511) length = 511;
+    if (length > 0) bootlog_write(buffer, length);
+}
+
+/**
+ * @brief Find where the readable part of the log starts
+ * @param start Output for the offset of the oldest byte
+ * @returns The amount of readable bytes
+ */
+static size_t bootlog_start(size_t *start) {
+    *start = (bootlog_head + BOOTLOG_SIZE - bootlog_used) % BOOTLOG_SIZE;
+    size_t used = bootlog_used;
+
+    if (used == BOOTLOG_SIZE) {
+        // The oldest line was partly overwritten, skip what's left of it
+        while (used && bootlog_buffer[*start] != '\n') {
+            *start = (*start + 1) % BOOTLOG_SIZE;
+            used--;
+        }
+
+        if (used) {
+            *start = (*start + 1) % BOOTLOG_SIZE;
+            used--;
+        }
+    }
+
+    return used;
+}
+
+/**
+ * @brief Get the amount of bytes @c bootlog_read would copy
+ */
+size_t bootlog_length() {
+    if (bootlog_pending) bootlog_flush();
+
+    size_t start;
+    return bootlog_start(&start);
+}
+
+/**
+ * @brief Copy the boot log out of the ring buffer
+ * @param buffer Where to copy it to
+ * @param size Size of @p buffer
+ * @returns The amount of bytes copied, oldest first. Starts on a line boundary.
+ */
+size_t bootlog_read(char *buffer, size_t size) {
+    if (bootlog_pending) bootlog_flush();
+
+    size_t start;
+    size_t length = bootlog_start(&start);
+    if (length > size) length = size;
+
+    // At most two pieces, the end of the buffer and then the start of it
+    size_t first = BOOTLOG_SIZE - start;
+    if (first > length) first = length;
+
+    memcpy(buffer, bootlog_buffer + start, first);
+    memcpy(buffer + first, bootlog_buffer, length - first);
+
+    return length;
+}
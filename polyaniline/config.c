@@ -12,6 +12,8 @@
  */
 
 #include <polyaniline/config.h>
+#include <polyaniline/video.h>
+#include <polyaniline/log.h>
 
 
 // This file is deleted and rebuilt every build to update these.
@@ -27,16 +29,57 @@ const int __polyaniline_version_lower = 0;
 // Codename
 const char *__polyaniline_version_codename = "Sunset";
 
-// Default boot files
+// Default boot files (either can be LZ4 or zstd compressed, made with lz4 --content-size or zstd)
 char *__polyaniline_kernel_file = "hexahedron-kernel.elf";
 char *__polyaniline_initrd_file = "initrd.tar.img";
 
+// Optional PSF font on the boot volume (NULL to always use the built-in one)
+char *__polyaniline_font_file = "font.psf";
+
 // Default kernel command line
 const char *__polyaniline_default_kernel_cmdline = "--use-polyaniline";
 
 // Kernel load address
 const uintptr_t __polyaniline_kernel_address = 0x100000;
 
+// Video mode selection. The resolution is only used by VIDEO_MODE_CONFIGURED
+const int __polyaniline_video_mode = VIDEO_MODE_NATIVE;
+const uint32_t __polyaniline_video_width = 1920;
+const uint32_t __polyaniline_video_height = 1080;
+
+// Font scale (1-4). 0 picks one based on the screen height
+const int __polyaniline_font_scale = 0;
+
+// Try to map the framebuffer write-combining (x86 PAT/MTRR)
+const int __polyaniline_framebuffer_wc = 1;
+
+// Boot straight into the kernel with the default command line, without touching the screen.
+// Can also be turned on per machine with the PolyanilineHeadless EFI variable.
+const int __polyaniline_headless = 0;
+
+// Mirror the console to a serial port (COM1 or the firmware's serial device)
+const int __polyaniline_serial = 1;
+const int __polyaniline_serial_baud = 115200;
+
+// Highest log level (LOG_LEVEL_xxx) printed while booting. Anything above it only goes into the boot log.
+// What gets compiled in at all is set with LOG_LEVEL in the Makefile.
+const int __polyaniline_log_console = LOG_LEVEL_INFO;
+
+// Print extra diagnostics (timings, etc.) while starting up
+const int __polyaniline_verbose = 0;
+
+// Boot files are read this much at a time (1-8 MiB, rounded to what the disk likes best)
+const size_t __polyaniline_read_chunk = 4 * 1024 * 1024;
+
+// XXH64 of the initial ramdisk, checked while it's read. 0 to not check it
+const uint64_t __polyaniline_initrd_checksum = 0;
+
+// How often the loading progress bar is repainted, in milliseconds
+const int __polyaniline_progress_interval = 50;
+
+// Read boot files straight from the disk with the built-in FAT reader, the firmware's driver is the fallback
+const int __polyaniline_fat_reader = 1;
+
 /**** AUTO-GENERATED VERSIONING INFO ****/
 
 
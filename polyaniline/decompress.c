@@ -0,0 +1,607 @@
+/**
+ * @file polyaniline/decompress.c
+ * @brief Compressed boot files
+ *
+ * Boot files compressed as an LZ4 or zstd frame are decompressed while they're read, chunk by chunk,
+ * straight into their final memory. The frame has to carry its content size (lz4 --content-size, zstd
+ * adds it unless it's compressing a pipe) so the destination can be allocated before the first block comes in.
+ *
+ * The whole output is one buffer, so matches can reach back into it directly and no window is kept.
+ * Only a block that is split between two chunks gets gathered into a staging buffer first.
+ * Compressed zstd blocks are decoded by zstd.c.
+ * A partial decompressor stops quietly once its output is full, that's how just the start of a file is read.
+ * The XXH32 header, block and content checksums of LZ4 are not checked, use __polyaniline_initrd_checksum for that.
+ * The zstd content checksum is, once the whole frame is out.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/decompress.h>
+#include <polyaniline/hash.h>
+#include <polyaniline/log.h>
+#include <string.h>
+
+#define LOG(level, ...) LOG_WRITE(LOADER, LOG_LEVEL_##level, __VA_ARGS__)
+
+/* Sizes of the zstd dictionary ID and content size fields, by their flags in the frame header descriptor */
+static const uint8_t decompress_zstdDictionarySizes[4] = { 0, 1, 2, 4 };
+static const uint8_t decompress_zstdContentSizes[4] = { 0, 2, 4, 8 };
+
+static inline uint32_t decompress_read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t decompress_read64(const uint8_t *p) {
+    return decompress_read32(p) | ((uint64_t)decompress_read32(p + 4) << 32);
+}
+
+/**
+ * @brief Get the size of the frame descriptor after magic, FLG and BD
+ * @param flags FLG byte
+ */
+static inline size_t decompress_descriptorSize(uint8_t flags) {
+    return ((flags & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + ((flags & LZ4_FLG_DICTIONARY) ? 4 : 0) + 1;
+}
+
+/**
+ * @brief Get the size of a zstd frame header after magic and the frame header descriptor
+ * @param fhd Frame header descriptor
+ */
+static inline size_t decompress_zstdHeaderSize(uint8_t fhd) {
+    int single = (fhd & ZSTD_FHD_SINGLE_SEGMENT) ? 1 : 0;
+
+    // A single segment frame always has a content size, 1 byte if the flag is 0
+    size_t content = ZSTD_FHD_FCS(fhd) ? decompress_zstdContentSizes[ZSTD_FHD_FCS(fhd)] : single;
+    return !single + decompress_zstdDictionarySizes[ZSTD_FHD_DICTIONARY(fhd)] + content;
+}
+
+/**
+ * @brief Get the content size field of a zstd frame header
+ * @param fhd Frame header descriptor
+ * @param p The field
+ */
+static inline uint64_t decompress_zstdContentSize(uint8_t fhd, const uint8_t *p) {
+    switch (ZSTD_FHD_FCS(fhd)) {
+        case 0: return p[0];
+        case 1: return (p[0] | (p[1] << 8)) + 256;
+        case 2: return decompress_read32(p);
+        default: return decompress_read64(p);
+    }
+}
+
+/**
+ * @brief Work out the decompressed size of a zstd frame
+ * @returns DECOMPRESS_ZSTD or DECOMPRESS_UNSUPPORTED
+ */
+static int decompress_detectZstd(const uint8_t *header, size_t length, const char *name, uint64_t *content_size) {
+    if (length < 5) {
+        LOG(ERROR, "%s: zstd frame header is cut off\n", name);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    uint8_t fhd = header[4];
+    if (fhd & ZSTD_FHD_RESERVED) {
+        LOG(ERROR, "%s: unsupported zstd frame (descriptor %02x)\n", name, fhd);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    // We need to know how much memory it's going to take up front
+    if (!ZSTD_FHD_FCS(fhd) && !(fhd & ZSTD_FHD_SINGLE_SEGMENT)) {
+        LOG(ERROR, "%s: zstd frame has no content size, compress it from a file rather than a pipe\n", name);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    if (length < 5 + decompress_zstdHeaderSize(fhd)) {
+        LOG(ERROR, "%s: zstd frame header is cut off\n", name);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    // The dictionary ID can be there and be 0, which means no dictionary
+    const uint8_t *p = header + 5 + !(fhd & ZSTD_FHD_SINGLE_SEGMENT);
+    uint32_t dictionary = 0;
+    for (int i = 0; i < decompress_zstdDictionarySizes[ZSTD_FHD_DICTIONARY(fhd)]; i++) dictionary |= (uint32_t)*p++ << (8 * i);
+    if (dictionary) {
+        LOG(ERROR, "%s: zstd frame needs dictionary %d, which isn't supported\n", name, dictionary);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    *content_size = decompress_zstdContentSize(fhd, p);
+    LOG(INFO, "%s is zstd compressed (%llu KB decompressed)\n", name, *content_size / 1024);
+    return DECOMPRESS_ZSTD;
+}
+
+/**
+ * @brief Work out how a file is compressed
+ * @param header The start of the file
+ * @param length Amount of bytes in @p header (up to DECOMPRESS_HEADER_SIZE)
+ * @param name Name of the file, for error messages
+ * @param content_size Output for the decompressed size
+ * @returns DECOMPRESS_xxx
+ */
+int decompress_detect(const uint8_t *header, size_t length, const char *name, uint64_t *content_size) {
+    if (length >= 4 && decompress_read32(header) == ZSTD_MAGIC) {
+        return decompress_detectZstd(header, length, name, content_size);
+    }
+
+    if (length >= 2 && (header[0] | (header[1] << 8)) == GZIP_MAGIC) {
+        LOG(ERROR, "%s is compressed with gzip, which isn't supported. Use LZ4 or zstd instead.\n", name);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    if (length < 6 || decompress_read32(header) != LZ4_MAGIC) return DECOMPRESS_NONE;
+
+    uint8_t flags = header[4];
+    if ((flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || (flags & LZ4_FLG_DICTIONARY)) {
+        LOG(ERROR, "%s: unsupported LZ4 frame (FLG %02x)\n", name, flags);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    // We need to know how much memory it's going to take up front
+    if (!(flags & LZ4_FLG_CONTENT_SIZE) || length < 14) {
+        LOG(ERROR, "%s: LZ4 frame has no content size, compress it with lz4 --content-size\n", name);
+        return DECOMPRESS_UNSUPPORTED;
+    }
+
+    *content_size = decompress_read64(header + 6);
+    LOG(INFO, "%s is LZ4 compressed (%llu KB decompressed)\n", name, *content_size / 1024);
+    return DECOMPRESS_LZ4;
+}
+
+/**
+ * @brief Get some contiguous bytes from the input, gathering them into @p stage if they're split over chunks
+ * @param d The decompressor
+ * @param stage Where to gather them
+ * @param data Input, advanced past what was used
+ * @param length Input length, reduced by what was used
+ * @param need The amount of bytes needed
+ * @returns The bytes, or NULL if the input ran out first (what was there is kept for the next chunk)
+ */
+static const uint8_t *decompress_take(decompress_t *d, uint8_t *stage, const uint8_t **data, size_t *length, size_t need) {
+    // Nothing gathered and it's all here, use it where it is
+    if (!d->staged && *length >= need) {
+        const uint8_t *p = *data;
+        *data += need;
+        *length -= need;
+        return p;
+    }
+
+    size_t count = need - d->staged;
+    if (count > *length) count = *length;
+
+    memcpy(stage + d->staged, *data, count);
+    d->staged += count;
+    *data += count;
+    *length -= count;
+
+    if (d->staged < need) return NULL;
+
+    d->staged = 0;
+    return stage;
+}
+
+/**
+ * @brief Copy 8 bytes at a time and then single bytes, never touching anything past @p size
+ */
+static inline void decompress_copy(uint8_t *dest, const uint8_t *src, size_t size) {
+    for (; size >= 8; size -= 8, dest += 8, src += 8) {
+        uint64_t word;
+        __builtin_memcpy(&word, src, 8);
+        __builtin_memcpy(dest, &word, 8);
+    }
+
+    while (size--) *dest++ = *src++;
+}
+
+/**
+ * @brief Decompress one LZ4 block into the output
+ * @param d The decompressor
+ * @param src The compressed block
+ * @param size Size of the block
+ * @returns 0 on success, 1 if the block is corrupt
+ */
+static int decompress_block(decompress_t *d, const uint8_t *src, size_t size) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + size;
+    uint8_t *op = d->dest + d->out;
+    uint8_t *oend = d->dest + d->dest_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        // Literals
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return 1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+
+        if (literals > (size_t)(iend - ip)) return 1;
+        if (literals > (size_t)(oend - op)) {
+            if (!d->partial) return 1;
+            literals = oend - op;
+        }
+
+        decompress_copy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // The last sequence is only literals
+        if (ip == iend || op == oend) break;
+
+        // Match
+        if (iend - ip < 2) return 1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - d->dest)) return 1;
+
+        size_t match = token & 15;
+        if (match == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return 1;
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+
+        match += LZ4_MIN_MATCH;
+        if (match > (size_t)(oend - op)) {
+            if (!d->partial) return 1;
+            match = oend - op;
+        }
+
+        // 8 bytes at a time is only safe if the source is at least 8 bytes back, otherwise it repeats a short pattern
+        const uint8_t *from = op - offset;
+        if (offset >= 8) {
+            decompress_copy(op, from, match);
+        } else {
+            for (size_t i = 0; i < match; i++) op[i] = from[i];
+        }
+
+        op += match;
+    }
+
+    d->out = op - d->dest;
+    return 0;
+}
+
+/**
+ * @brief Get the staging buffer ready if a block of @p size bytes doesn't fit in what's left of the chunk
+ * @returns 0 on success, 1 if it couldn't be allocated
+ */
+static int decompress_stage(decompress_t *d, size_t length, size_t size) {
+    // Only need the staging buffer once a block is actually split
+    if (d->stage || length >= size) return 0;
+
+    d->stage = platform_allocate(d->block_max);
+    if (!d->stage) {
+        LOG(ERROR, "Out of memory for a %d byte block\n", d->block_max);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int decompress_start(platform_consumer_t *consumer, uint64_t size) {
+    decompress_t *d = (decompress_t*)consumer;
+    d->state = (d->format == DECOMPRESS_ZSTD) ? ZSTD_STATE_MAGIC : LZ4_STATE_MAGIC;
+    d->out = 0;
+    d->staged = 0;
+    d->stage = NULL;
+    d->zstd = NULL;
+    return 0;
+}
+
+static int decompress_consumeLz4(platform_consumer_t *consumer, const void *chunk, size_t length) {
+    decompress_t *d = (decompress_t*)consumer;
+    const uint8_t *data = (const uint8_t*)chunk;
+    const uint8_t *p;
+
+    while (length) {
+        // A partial decompressor doesn't care about the rest
+        if (d->partial && d->out == d->dest_size) return 0;
+
+        switch (d->state) {
+            case LZ4_STATE_MAGIC:
+                if (!(p = decompress_take(d, d->header, &data, &length, 6))) return 0;
+                if (decompress_read32(p) != LZ4_MAGIC) {
+                    LOG(ERROR, "LZ4: bad frame magic\n");
+                    return 1;
+                }
+
+                d->flags = p[4];
+
+                // Block maximum size is 64 KB << (2 * (n - 4)), n from 4 to 7
+                int id = (p[5] >> 4) & 7;
+                if (id < 4) {
+                    LOG(ERROR, "LZ4: bad block maximum size\n");
+                    return 1;
+                }
+
+                d->block_max = (size_t)65536 << (2 * (id - 4));
+                d->state = LZ4_STATE_DESCRIPTOR;
+                break;
+
+            case LZ4_STATE_DESCRIPTOR:
+                // Content size was already read by decompress_detect, the header checksum isn't checked
+                if (!decompress_take(d, d->header, &data, &length, decompress_descriptorSize(d->flags))) return 0;
+                d->state = LZ4_STATE_BLOCK_SIZE;
+                break;
+
+            case LZ4_STATE_BLOCK_SIZE:
+                if (!(p = decompress_take(d, d->header, &data, &length, 4))) return 0;
+                d->block_size = decompress_read32(p);
+
+                if (!d->block_size) {
+                    d->state = (d->flags & LZ4_FLG_CONTENT_CHECKSUM) ? LZ4_STATE_CONTENT_CHECKSUM : LZ4_STATE_DONE;
+                    break;
+                }
+
+                if ((d->block_size & ~LZ4_BLOCK_UNCOMPRESSED) > d->block_max) {
+                    LOG(ERROR, "LZ4: block of %d bytes is bigger than the frame allows\n", d->block_size & ~LZ4_BLOCK_UNCOMPRESSED);
+                    return 1;
+                }
+
+                d->state = LZ4_STATE_BLOCK;
+                break;
+
+            case LZ4_STATE_BLOCK: {
+                size_t size = d->block_size & ~LZ4_BLOCK_UNCOMPRESSED;
+                if (decompress_stage(d, length, size)) return 1;
+
+                if (!(p = decompress_take(d, d->stage, &data, &length, size))) return 0;
+
+                if (d->block_size & LZ4_BLOCK_UNCOMPRESSED) {
+                    if (size > d->dest_size - d->out) {
+                        if (!d->partial) {
+                            LOG(ERROR, "LZ4: output is bigger than the content size\n");
+                            return 1;
+                        }
+
+                        size = d->dest_size - d->out;
+                    }
+
+                    platform_copyMemory(d->dest + d->out, p, size);
+                    d->out += size;
+                } else if (decompress_block(d, p, size)) {
+                    LOG(ERROR, "LZ4: corrupt block at output offset %llu\n", d->out);
+                    return 1;
+                }
+
+                d->state = (d->flags & LZ4_FLG_BLOCK_CHECKSUM) ? LZ4_STATE_BLOCK_CHECKSUM : LZ4_STATE_BLOCK_SIZE;
+                break;
+            }
+
+            case LZ4_STATE_BLOCK_CHECKSUM:
+                if (!decompress_take(d, d->header, &data, &length, 4)) return 0;
+                d->state = LZ4_STATE_BLOCK_SIZE;
+                break;
+
+            case LZ4_STATE_CONTENT_CHECKSUM:
+                if (!decompress_take(d, d->header, &data, &length, 4)) return 0;
+                d->state = LZ4_STATE_DONE;
+                break;
+
+            case LZ4_STATE_DONE:
+                LOG(ERROR, "LZ4: data after the end of the frame\n");
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check a zstd frame's content checksum, the low 32 bits of the XXH64 of everything decompressed
+ * @returns 0 if it matches
+ */
+static int decompress_zstdChecksum(decompress_t *d, uint32_t expected) {
+    hash_state_t state;
+    hash_init(&state, 0);
+    hash_update(&state, d->dest, d->out);
+
+    uint32_t checksum = (uint32_t)hash_digest(&state);
+    if (checksum == expected) return 0;
+
+    LOG(ERROR, "zstd: content checksum is %08x, the frame says %08x\n", checksum, expected);
+    return 1;
+}
+
+static int decompress_consumeZstd(platform_consumer_t *consumer, const void *chunk, size_t length) {
+    decompress_t *d = (decompress_t*)consumer;
+    const uint8_t *data = (const uint8_t*)chunk;
+    const uint8_t *p;
+
+    while (length) {
+        // A partial decompressor doesn't care about the rest
+        if (d->partial && d->out == d->dest_size) return 0;
+
+        switch (d->state) {
+            case ZSTD_STATE_MAGIC:
+                if (!(p = decompress_take(d, d->header, &data, &length, 5))) return 0;
+                if (decompress_read32(p) != ZSTD_MAGIC) {
+                    LOG(ERROR, "zstd: bad frame magic\n");
+                    return 1;
+                }
+
+                d->flags = p[4];
+                d->state = ZSTD_STATE_HEADER;
+                break;
+
+            case ZSTD_STATE_HEADER:
+                // Content size and dictionary were already checked by decompress_detect, only the window matters here
+                if (!(p = decompress_take(d, d->header, &data, &length, decompress_zstdHeaderSize(d->flags)))) return 0;
+
+                // Blocks are at most 128 KB, or the window size if that's smaller
+                d->block_max = ZSTD_BLOCK_MAX;
+                uint64_t window;
+                if (d->flags & ZSTD_FHD_SINGLE_SEGMENT) {
+                    window = decompress_zstdContentSize(d->flags, p + decompress_zstdDictionarySizes[ZSTD_FHD_DICTIONARY(d->flags)]);
+                } else {
+                    // Window descriptor is 1 << (10 + exponent), plus eighths of that
+                    window = (uint64_t)1 << (10 + (p[0] >> 3));
+                    window += (window / 8) * (p[0] & 7);
+                }
+
+                if (window < d->block_max) d->block_max = window;
+                d->state = ZSTD_STATE_BLOCK_HEADER;
+                break;
+
+            case ZSTD_STATE_BLOCK_HEADER:
+                if (!(p = decompress_take(d, d->header, &data, &length, ZSTD_BLOCK_HEADER_SIZE))) return 0;
+                d->block_size = p[0] | (p[1] << 8) | (p[2] << 16);
+
+                if (ZSTD_BLOCK_TYPE(d->block_size) > ZSTD_BLOCK_COMPRESSED) {
+                    LOG(ERROR, "zstd: reserved block type\n");
+                    return 1;
+                }
+
+                if (ZSTD_BLOCK_SIZE(d->block_size) > d->block_max) {
+                    LOG(ERROR, "zstd: block of %d bytes is bigger than the frame allows\n", ZSTD_BLOCK_SIZE(d->block_size));
+                    return 1;
+                }
+
+                d->state = ZSTD_STATE_BLOCK;
+                break;
+
+            case ZSTD_STATE_BLOCK: {
+                int type = ZSTD_BLOCK_TYPE(d->block_size);
+                size_t size = ZSTD_BLOCK_SIZE(d->block_size);
+
+                if (type == ZSTD_BLOCK_RLE) {
+                    // One byte, repeated size times
+                    if (!(p = decompress_take(d, d->header, &data, &length, 1))) return 0;
+                } else {
+                    if (decompress_stage(d, length, size)) return 1;
+                    if (!(p = decompress_take(d, d->stage, &data, &length, size))) return 0;
+                }
+
+                if (type == ZSTD_BLOCK_COMPRESSED) {
+                    if (!d->zstd) {
+                        d->zstd = platform_allocate(sizeof(zstd_t));
+                        if (!d->zstd) {
+                            LOG(ERROR, "zstd: out of memory for the decoder tables\n");
+                            return 1;
+                        }
+
+                        zstd_reset(d->zstd);
+                    }
+
+                    if (zstd_decodeBlock(d->zstd, p, size, d->dest, &d->out, d->dest_size, d->partial)) {
+                        LOG(ERROR, "zstd: corrupt block at output offset %llu\n", d->out);
+                        return 1;
+                    }
+                } else {
+                    if (size > d->dest_size - d->out) {
+                        if (!d->partial) {
+                            LOG(ERROR, "zstd: output is bigger than the content size\n");
+                            return 1;
+                        }
+
+                        size = d->dest_size - d->out;
+                    }
+
+                    if (type == ZSTD_BLOCK_RLE) {
+                        platform_fillMemory(d->dest + d->out, p[0], size);
+                    } else {
+                        platform_copyMemory(d->dest + d->out, p, size);
+                    }
+
+                    d->out += size;
+                }
+
+                if (!ZSTD_BLOCK_LAST(d->block_size)) {
+                    d->state = ZSTD_STATE_BLOCK_HEADER;
+                } else {
+                    d->state = (d->flags & ZSTD_FHD_CHECKSUM) ? ZSTD_STATE_CHECKSUM : ZSTD_STATE_DONE;
+                }
+
+                break;
+            }
+
+            case ZSTD_STATE_CHECKSUM:
+                if (!(p = decompress_take(d, d->header, &data, &length, 4))) return 0;
+
+                // A partial decompressor doesn't have all of the content to check
+                if (!d->partial && d->out == d->dest_size && decompress_zstdChecksum(d, decompress_read32(p))) return 1;
+                d->state = ZSTD_STATE_DONE;
+                break;
+
+            case ZSTD_STATE_DONE:
+                LOG(ERROR, "zstd: data after the end of the frame\n");
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free the staging buffer and the zstd tables
+ */
+static void decompress_release(platform_consumer_t *consumer) {
+    decompress_t *d = (decompress_t*)consumer;
+
+    if (d->stage) {
+        platform_free(d->stage);
+        d->stage = NULL;
+    }
+
+    if (d->zstd) {
+        platform_free(d->zstd);
+        d->zstd = NULL;
+    }
+}
+
+static int decompress_finish(platform_consumer_t *consumer) {
+    decompress_t *d = (decompress_t*)consumer;
+    const char *name = (d->format == DECOMPRESS_ZSTD) ? "zstd" : "LZ4";
+    int done = (d->format == DECOMPRESS_ZSTD) ? ZSTD_STATE_DONE : LZ4_STATE_DONE;
+
+    decompress_release(consumer);
+
+    if (d->partial) {
+        if (d->out == d->dest_size) return 0;
+        LOG(ERROR, "%s: file ended after %llu of %llu bytes\n", name, d->out, d->dest_size);
+        return 1;
+    }
+
+    if (d->state != done || d->out != d->dest_size) {
+        LOG(ERROR, "%s: frame ended early (%llu of %llu bytes)\n", name, d->out, d->dest_size);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Set up a consumer that decompresses a file as it's read
+ * @param d The consumer
+ * @param format DECOMPRESS_xxx, from @c decompress_detect
+ * @param dest Where the output goes
+ * @param dest_size The decompressed size, from @c decompress_detect
+ * @returns The consumer, put it first in the consumer list
+ */
+platform_consumer_t *decompress_consumer(decompress_t *d, int format, void *dest, uint64_t dest_size) {
+    d->consumer.start = decompress_start;
+    d->consumer.consume = (format == DECOMPRESS_ZSTD) ? decompress_consumeZstd : decompress_consumeLz4;
+    d->consumer.finish = decompress_finish;
+    d->consumer.release = decompress_release;
+    d->consumer.next = NULL;
+    d->dest = (uint8_t*)dest;
+    d->dest_size = dest_size;
+    d->format = format;
+    d->stage = NULL;
+    d->zstd = NULL;
+    d->partial = 0;
+    return &d->consumer;
+}
@@ -14,6 +14,8 @@
 #include <polyaniline/error.h>
 #include <polyaniline/terminal.h>
 #include <polyaniline/menu.h>
+#include <polyaniline/polyaniline.h>
+#include <polyaniline/bootlog.h>
 #include <polyaniline/interfaces/keyboard.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -24,6 +26,19 @@
  * @param format The error format string
  */
 void polyaniline_error(char *format, ...) {
+    if (polyaniline_headless) {
+        // Nothing to draw on, the log is all there is
+        char errbuf[512];
+        va_list ap;
+        va_start(ap, format);
+        vsnprintf(errbuf, 512, format, ap);
+        va_end(ap);
+
+        printf("*** %s", errbuf);
+        printf("Boot process halted.\n");
+        for (;;);
+    }
+
     // terminal_clearScreen(BOOT_DEFAULT_FG, BOOT_DEFAULT_BG);
     terminal_drawTestTube(BOOT_LIQUID_ERROR);
     
@@ -40,6 +55,9 @@ void polyaniline_error(char *format, ...) {
     int len = vsnprintf(errbuf, 512, format, ap);
     va_end(ap);
 
+    // Menus aren't logged, but errors should be
+    if (!terminal_logging) bootlog_printf("*** %s", errbuf);
+
     // Print the message
     UB_PRINT("*** %s", errbuf);
     if (errbuf[len-2] == '\n') terminal_y--; // !!!: polyaniline_error() will take newlines.
@@ -62,10 +80,20 @@ void polyaniline_error(char *format, ...) {
  * @note This will redirect back to @c polyaniline_menu
  */
 void polyaniline_error_nonfatal(char *format, ...) {
-    terminal_clearScreen(BOOT_DEFAULT_FG, BOOT_DEFAULT_BG);
-    terminal_drawTestTube(BOOT_LIQUID_ERROR);
-    
-    menu_drawTitleBar(RGB(255, 0, 0), "Polyaniline Error");
+    if (polyaniline_headless) {
+        // There's no menu to go back to
+        char errbuf[512];
+        va_list ap;
+        va_start(ap, format);
+        vsnprintf(errbuf, 512, format, ap);
+        va_end(ap);
+
+        polyaniline_error("%s", errbuf);
+    }
+
+    terminal_setForeground(BOOT_DEFAULT_FG);
+    terminal_setBackground(BOOT_DEFAULT_BG);
+    menu_drawChrome(BOOT_LIQUID_ERROR, RGB(255, 0, 0), "Polyaniline Error", 0);
     terminal_setForeground(RGB(255, 0, 0));
     terminal_y++;
 
@@ -78,6 +106,9 @@ void polyaniline_error_nonfatal(char *format, ...) {
     int len = vsnprintf(errbuf, 512, format, ap);
     va_end(ap);
 
+    // Menus aren't logged, but errors should be
+    if (!terminal_logging) bootlog_printf("*** %s", errbuf);
+
     // Print the message
     UB_PRINT("*** %s", errbuf);
     if (errbuf[len-2] == '\n') terminal_y--; // !!!: polyaniline_error() will take newlines.
@@ -0,0 +1,210 @@
+/**
+ * @file polyaniline/hash.c
+ * @brief XXH64 checksums
+ *
+ * XXH64 runs four independent lanes, so it keeps up with memory bandwidth without needing vector units,
+ * which makes checking a file while it's read cost next to nothing next to the read itself.
+ * It catches corruption, it is not a cryptographic hash.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/hash.h>
+#include <polyaniline/log.h>
+#include <string.h>
+
+#define LOG(level, ...) LOG_WRITE(BOOT, LOG_LEVEL_##level, __VA_ARGS__)
+
+/* XXH64 primes */
+#define HASH_PRIME1     0x9E3779B185EBCA87ULL
+#define HASH_PRIME2     0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3     0x165667B19E3779F9ULL
+#define HASH_PRIME4     0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5     0x27D4EB2F165667C5ULL
+
+static inline uint64_t hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_read64(const uint8_t *p) {
+    uint64_t v;
+    __builtin_memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t hash_read32(const uint8_t *p) {
+    uint32_t v;
+    __builtin_memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * HASH_PRIME2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t lane) {
+    acc ^= hash_round(0, lane);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+/**
+ * @brief Run whole 32-byte stripes through the lanes
+ * @returns The amount of bytes used
+ */
+static size_t hash_stripes(hash_state_t *state, const uint8_t *p, size_t length) {
+    uint64_t a = state->acc[0], b = state->acc[1], c = state->acc[2], d = state->acc[3];
+    size_t used = 0;
+
+    for (; length - used >= 32; used += 32) {
+        a = hash_round(a, hash_read64(p + used));
+        b = hash_round(b, hash_read64(p + used + 8));
+        c = hash_round(c, hash_read64(p + used + 16));
+        d = hash_round(d, hash_read64(p + used + 24));
+    }
+
+    state->acc[0] = a;
+    state->acc[1] = b;
+    state->acc[2] = c;
+    state->acc[3] = d;
+    return used;
+}
+
+/**
+ * @brief Start an XXH64 hash
+ * @param state The state
+ * @param seed Seed, normally 0
+ */
+void hash_init(hash_state_t *state, uint64_t seed) {
+    state->acc[0] = seed + HASH_PRIME1 + HASH_PRIME2;
+    state->acc[1] = seed + HASH_PRIME2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - HASH_PRIME1;
+    state->total = 0;
+    state->buffered = 0;
+}
+
+/**
+ * @brief Add data to an XXH64 hash
+ * @param state The state
+ * @param data The data
+ * @param length The amount of bytes
+ */
+void hash_update(hash_state_t *state, const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t*)data;
+    state->total += length;
+
+    // Finish a stripe left over from last time
+    if (state->buffered) {
+        size_t count = 32 - state->buffered;
+        if (count > length) count = length;
+
+        memcpy(state->buffer + state->buffered, p, count);
+        state->buffered += count;
+        p += count;
+        length -= count;
+
+        if (state->buffered < 32) return;
+        hash_stripes(state, state->buffer, 32);
+        state->buffered = 0;
+    }
+
+    size_t used = hash_stripes(state, p, length);
+    memcpy(state->buffer, p + used, length - used);
+    state->buffered = length - used;
+}
+
+/**
+ * @brief Get the XXH64 of everything added so far
+ * @param state The state
+ */
+uint64_t hash_digest(hash_state_t *state) {
+    uint64_t h;
+
+    if (state->total >= 32) {
+        h = hash_rotl(state->acc[0], 1) + hash_rotl(state->acc[1], 7) + hash_rotl(state->acc[2], 12) + hash_rotl(state->acc[3], 18);
+        for (int i = 0; i < 4; i++) h = hash_merge(h, state->acc[i]);
+    } else {
+        // Never got a full stripe, acc[2] is still the seed
+        h = state->acc[2] + HASH_PRIME5;
+    }
+
+    h += state->total;
+
+    const uint8_t *p = state->buffer;
+    size_t left = state->buffered;
+
+    for (; left >= 8; left -= 8, p += 8) {
+        h ^= hash_round(0, hash_read64(p));
+        h = hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+
+    if (left >= 4) {
+        h ^= (uint64_t)hash_read32(p) * HASH_PRIME1;
+        h = hash_rotl(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+        left -= 4;
+    }
+
+    for (; left; left--, p++) {
+        h ^= *p * HASH_PRIME5;
+        h = hash_rotl(h, 11) * HASH_PRIME1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static int hash_consumerStart(platform_consumer_t *consumer, uint64_t size) {
+    hash_consumer_t *hc = (hash_consumer_t*)consumer;
+    hash_init(&hc->state, 0);
+    return 0;
+}
+
+static int hash_consumerConsume(platform_consumer_t *consumer, const void *data, size_t length) {
+    hash_consumer_t *hc = (hash_consumer_t*)consumer;
+    hash_update(&hc->state, data, length);
+    return 0;
+}
+
+static int hash_consumerFinish(platform_consumer_t *consumer) {
+    hash_consumer_t *hc = (hash_consumer_t*)consumer;
+    uint64_t hash = hash_digest(&hc->state);
+
+    if (hash != hc->expected) {
+        LOG(ERROR, "Checksum mismatch for %s: expected %016llx, got %016llx\n", hc->name, hc->expected, hash);
+        return 1;
+    }
+
+    LOG(DEBUG, "Checksum of %s verified (%016llx)\n", hc->name, hash);
+    return 0;
+}
+
+/**
+ * @brief Set up a consumer that checks a file as it's read
+ * @param hc The consumer
+ * @param name Name of the file, for the error message
+ * @param expected The XXH64 it should have
+ * @returns The consumer, to put in a consumer list
+ */
+platform_consumer_t *hash_checkConsumer(hash_consumer_t *hc, const char *name, uint64_t expected) {
+    hc->consumer.start = hash_consumerStart;
+    hc->consumer.consume = hash_consumerConsume;
+    hc->consumer.finish = hash_consumerFinish;
+    hc->consumer.release = NULL;
+    hc->consumer.next = NULL;
+    hc->expected = expected;
+    hc->name = name;
+    return &hc->consumer;
+}
@@ -11,13 +11,18 @@
  * Copyright (C) 2024 Samuel Stuart
  */
 
+#include <polyaniline/loader/kernel_loader.h>
 #include <polyaniline/loader/elf.h>
 #include <polyaniline/error.h>
 #include <polyaniline/config.h>
+#include <polyaniline/log.h>
+#include <polyaniline/platform.h>
 #include <stdio.h>
 #include <string.h>
 #pragma GCC diagnostic ignored "-Wunused-variable"
 
+#define LOG(level, ...) LOG_WRITE(LOADER, LOG_LEVEL_##level, __VA_ARGS__)
+
 
 /**
  * @brief Check the EHDR of a file
@@ -48,133 +53,222 @@ int kernel_checkEHDR(uint8_t *ehdr) {
 
 
 /**
- * @brief Load an ELF32-style image
+ * @brief Read the PHDRs of the kernel
+ * @param file The kernel file
+ * @param phoff Offset of the PHDRs in the file
+ * @param phnum Amount of PHDRs
+ * @param phentsize Size of one PHDR
+ * @returns A buffer from @c platform_allocate with the PHDRs in it
+ */
+static uint8_t *kernel_readPHDRs(platform_file_t *file, uint64_t phoff, int phnum, int phentsize) {
+    size_t size = (size_t)phnum * phentsize;
+    uint8_t *phdrs = platform_allocate(size);
+    if (!phdrs) {
+        polyaniline_error("kernel_readPHDRs(): Out of memory for %d PHDRs\n", phnum);
+    }
+
+    if (platform_readFileAt(file, phoff, phdrs, size)) {
+        polyaniline_error("kernel_readPHDRs(): Failed to read PHDRs from kernel file\n");
+    }
+
+    return phdrs;
+}
+
+/**
+ * @brief Claim the memory of every PT_LOAD segment
+ * @param segments The segments, sorted by their address in here
+ * @param count The amount of segments
+ */
+static void kernel_reserveSegments(kernel_segment_t *segments, int count) {
+    // Nothing says PHDRs come in address order, sort them so pages shared between segments are only claimed once
+    for (int i = 1; i < count; i++) {
+        kernel_segment_t segment = segments[i];
+        int j = i;
+        for (; j > 0 && segments[j - 1].dest > segment.dest; j--) segments[j] = segments[j - 1];
+        segments[j] = segment;
+    }
+
+    uintptr_t reserved_end = 0x0;
+    for (int i = 0; i < count; i++) {
+        uintptr_t start = segments[i].dest & ~0xFFF;
+        uintptr_t end = (segments[i].dest + segments[i].memsz + 0xFFF) & ~0xFFF;
+        if (start < reserved_end) start = reserved_end;
+        if (start >= end) continue;
+
+        if (platform_reserveMemory(start, end - start)) {
+            polyaniline_error("kernel_reserveSegments(): Memory at %p - %p is not available for the kernel\n", start, end);
+        }
+
+        reserved_end = end;
+    }
+}
+
+/**
+ * @brief Load a PT_LOAD segment straight from the file to where it goes
+ * @param file The kernel file
+ * @param segment The segment, its memory has to be reserved already
+ */
+static void kernel_loadSegment(platform_file_t *file, kernel_segment_t *segment) {
+    if (segment->filesz && platform_readFileAt(file, segment->offset, (void*)segment->dest, segment->filesz)) {
+        polyaniline_error("kernel_loadSegment(): Failed to read segment at offset %p from kernel file\n", segment->offset);
+    }
+
+    if (segment->memsz > segment->filesz) {
+        // Zero out the rest of the section
+        platform_fillMemory((void*)(segment->dest + segment->filesz), 0, segment->memsz - segment->filesz);
+    }
+}
+
+/**
+ * @brief Get the segments of an ELF32-style image
+ * @param file The kernel file
  * @param ehdr The EHDR of the file
+ * @param segments Output for the PT_LOAD segments, room for e_phnum of them
+ * @param count Output for the amount of segments
  * @returns End of the file in memory
  */
-uintptr_t kernel_load32(Elf32_Ehdr *ehdr) {
+uintptr_t kernel_parse32(platform_file_t *file, Elf32_Ehdr *ehdr, kernel_segment_t *segments, int *count) {
     // Make sure machine type is supported
     if (ehdr->e_machine != EM_386) {
-        polyaniline_error("kernel_load32(): ehdr->e_machine != EM_386");
+        polyaniline_error("kernel_parse32(): ehdr->e_machine != EM_386");
     }
 
+    uint8_t *phdrs = kernel_readPHDRs(file, ehdr->e_phoff, ehdr->e_phnum, ehdr->e_phentsize);
+
     uintptr_t end_ptr = 0x0;
     // Load PHDRs
     for (int i = 0; i < ehdr->e_phnum; i++) {
-        Elf32_Phdr *phdr = (Elf32_Phdr*)((uintptr_t)ehdr + ehdr->e_phoff + (i * ehdr->e_phentsize));
+        Elf32_Phdr *phdr = (Elf32_Phdr*)(phdrs + (i * ehdr->e_phentsize));
 
         switch (phdr->p_type) {
             case PT_NULL:
                 break;
             
             case PT_LOAD:
-                printf("PT_LOAD vaddr %p offset %p filesz %d memsz %d\n", phdr->p_vaddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz);
-                
-                // Save variables (memcpy will overwrite)
-                uintptr_t filesz = phdr->p_filesz;
-                uintptr_t memsz = phdr->p_memsz;
-                uintptr_t vaddr = phdr->p_vaddr;
-
-                // Load into memory
-                #pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
-                memcpy((uint8_t*)(phdr->p_vaddr), (uint8_t*)(ehdr) + phdr->p_offset, phdr->p_filesz);
-                
-
-                if (memsz > filesz) {
-                    // Zero out the rest of the section
-                    memset((void*)(uintptr_t)(vaddr + filesz), 0, memsz - filesz);
-                }
-                
-
-                if (vaddr + memsz > end_ptr) end_ptr = vaddr + memsz;
+                LOG(DEBUG, "PT_LOAD vaddr %p offset %p filesz %d memsz %d\n", phdr->p_vaddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz);
+
+                segments[(*count)++] = (kernel_segment_t){ phdr->p_vaddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz };
+
+                if (phdr->p_vaddr + phdr->p_memsz > end_ptr) end_ptr = phdr->p_vaddr + phdr->p_memsz;
 
                 break;
 
             default:
-                polyaniline_error("kernel_load32(): PHDR type unrecognized - 0x%x\n", phdr->p_type);  
+                polyaniline_error("kernel_parse32(): PHDR type unrecognized - 0x%x\n", phdr->p_type);  
         }
     }
 
-    printf("Successfully loaded all PT sections\n");
+    platform_free(phdrs);
     return end_ptr;
 }
 
 /**
- * @brief Load an ELF64-style image
+ * @brief Get the segments of an ELF64-style image
+ * @param file The kernel file
  * @param ehdr The EHDR of the file
- * @returns Entrypoint
+ * @param segments Output for the PT_LOAD segments, room for e_phnum of them
+ * @param count Output for the amount of segments
+ * @returns End of the file in memory
  */
-uintptr_t kernel_load64(Elf64_Ehdr *ehdr) {
-    printf("EHDR available at %p\n", ehdr);
-
+uintptr_t kernel_parse64(platform_file_t *file, Elf64_Ehdr *ehdr, kernel_segment_t *segments, int *count) {
     // Make sure machine type is supported
     if (ehdr->e_machine != EM_X86_64) {
-        polyaniline_error("kernel_load64(): ehdr->e_machine != EM_X86_64");
+        polyaniline_error("kernel_parse64(): ehdr->e_machine != EM_X86_64");
     }
 
+    uint8_t *phdrs = kernel_readPHDRs(file, ehdr->e_phoff, ehdr->e_phnum, ehdr->e_phentsize);
+    LOG(DEBUG, "PHDRs available at %p\n", phdrs);
+
     uintptr_t end_ptr = 0x0;
     // Load PHDRs
     for (int i = 0; i < ehdr->e_phnum; i++) {
-        Elf64_Phdr *phdr = (Elf64_Phdr*)((uintptr_t)ehdr + ehdr->e_phoff + (i * ehdr->e_phentsize));
+        Elf64_Phdr *phdr = (Elf64_Phdr*)(phdrs + (i * ehdr->e_phentsize));
 
         switch (phdr->p_type) {
             case PT_NULL:
                 break;
             
             case PT_LOAD:
-                printf("PT_LOAD vaddr %p paddr %p offset %p filesz %d memsz %d\n", phdr->p_vaddr, phdr->p_paddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz);
-
-                // Save variables (memcpy will overwrite)
-                uintptr_t filesz = phdr->p_filesz;
-                uintptr_t memsz = phdr->p_memsz;
-                uintptr_t addr = phdr->p_paddr;
+                LOG(DEBUG, "PT_LOAD vaddr %p paddr %p offset %p filesz %d memsz %d\n", phdr->p_vaddr, phdr->p_paddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz);
 
-                // Load into memory
-                // Normally you want to use vaddr but our kernel is higher half so copy it to paddr and let it set up its own mapping tables
-                memcpy((uint8_t*)(phdr->p_paddr), (uint8_t*)(ehdr) + phdr->p_offset, phdr->p_filesz);
+                // Normally you want to use vaddr but our kernel is higher half so load it to paddr and let it set up its own mapping tables
+                segments[(*count)++] = (kernel_segment_t){ phdr->p_paddr, phdr->p_offset, phdr->p_filesz, phdr->p_memsz };
 
-                // Zero remainder
-                if (memsz > filesz) {
-                    // Zero out the rest of the section
-                    memset((void*)(uintptr_t)(phdr->p_paddr + filesz), 0, memsz - filesz);
-                }
-
-                if (addr + memsz > end_ptr) end_ptr = addr + memsz;
-
-                printf("PT_LOAD success\n");
+                if (phdr->p_paddr + phdr->p_memsz > end_ptr) end_ptr = phdr->p_paddr + phdr->p_memsz;
 
                 break;
 
             default:
-                polyaniline_error("kernel_load64(): PHDR type unrecognized - 0x%x\n", phdr->p_type);  
+                polyaniline_error("kernel_parse64(): PHDR type unrecognized - 0x%x\n", phdr->p_type);  
         }
     }
 
-    printf("Successfully loaded all PT sections\n");
+    platform_free(phdrs);
     return end_ptr;
 }
 
 /**
  * @brief Load the kernel image
- * @param kernel_image Pointer to kernel image
+ * @param path Path of the kernel file on the boot volume
  * @param entrypoint Output entrypoint
+ * @param reserved Called once all the memory of the kernel is claimed and before the segments are read, or NULL
  * @returns A pointer to the end of the kernel image
+ *
+ * Only the headers are read up front, every segment is read straight from the file to where it belongs.
  */
-uintptr_t kernel_load(void *kernel_image, uintptr_t *entrypoint) {
-    int ehdr_type = kernel_checkEHDR(kernel_image);
-    
+uintptr_t kernel_load(char *path, uintptr_t *entrypoint, void (*reserved)()) {
+    size_t size;
+    platform_file_t *file = platform_openFile(path, &size);
+    if (!file) {
+        polyaniline_error("kernel_load(): Kernel file '%s' not found.\n", path);
+    }
+
+    LOG(INFO, "Located kernel file successfully (\"%s\", %i KB)\n", path, size / 1024);
+
+    // Big enough for either EHDR
+    union {
+        uint8_t ident[EI_NIDENT];
+        Elf32_Ehdr ehdr32;
+        Elf64_Ehdr ehdr64;
+    } ehdr;
+
+    size_t ehdr_size = (size < sizeof(ehdr)) ? size : sizeof(ehdr);
+    if (ehdr_size < sizeof(Elf32_Ehdr) || platform_readFileAt(file, 0, &ehdr, ehdr_size)) {
+        polyaniline_error("kernel_load(): Failed to read EHDR from kernel file\n");
+    }
+
+    int ehdr_type = kernel_checkEHDR(ehdr.ident);
+    if (ehdr_type == 2 && ehdr_size < sizeof(Elf64_Ehdr)) {
+        polyaniline_error("kernel_load(): Kernel file is too small for an ELF64 EHDR\n");
+    }
+
+    int phnum = (ehdr_type == 1) ? ehdr.ehdr32.e_phnum : ehdr.ehdr64.e_phnum;
+    kernel_segment_t *segments = platform_allocate((phnum ? phnum : 1) * sizeof(kernel_segment_t));
+    if (!segments) {
+        polyaniline_error("kernel_load(): Out of memory for %d segments\n", phnum);
+    }
+
+    int count = 0;
+    uintptr_t end_ptr = 0x0;
+
     if (ehdr_type == 1) {
-        Elf32_Ehdr *ehdr = (Elf32_Ehdr*)kernel_image;
-        *entrypoint = ehdr->e_entry;
-        printf("Loading ELF32 kernel image\n");
-        return kernel_load32(ehdr);
+        *entrypoint = ehdr.ehdr32.e_entry;
+        LOG(INFO, "Loading ELF32 kernel image\n");
+        end_ptr = kernel_parse32(file, &ehdr.ehdr32, segments, &count);
     } else if (ehdr_type == 2) {
-        Elf64_Ehdr *ehdr = (Elf64_Ehdr*)kernel_image;
-        *entrypoint = ehdr->e_entry;
-        printf("Loading ELF64 kernel image\n");
-
-        return kernel_load64(ehdr);
+        *entrypoint = ehdr.ehdr64.e_entry;
+        LOG(INFO, "Loading ELF64 kernel image\n");
+        end_ptr = kernel_parse64(file, &ehdr.ehdr64, segments, &count);
     }
 
-    return 0x0; // shouldn't reach
-}
\ No newline at end of file
+    // Claim everything first, so nothing that gets allocated while the segments are read can end up in the way
+    kernel_reserveSegments(segments, count);
+    if (reserved) reserved();
+
+    for (int i = 0; i < count; i++) kernel_loadSegment(file, &segments[i]);
+    LOG(INFO, "Successfully loaded all PT sections\n");
+
+    platform_free(segments);
+    platform_closeFile(file);
+    return end_ptr;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file polyaniline/log.c
+ * @brief Leveled logging
+ *
+ * Log calls keep their format string and raw arguments instead of formatting straight away.
+ * Only messages that are actually shown get formatted on the spot, everything else is recorded
+ * in the boot log and formatted when the log is read (the viewer, the kernel handoff).
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/log.h>
+#include <polyaniline/bootlog.h>
+#include <polyaniline/terminal.h>
+#include <polyaniline/config.h>
+
+/**
+ * @brief Log a message
+ * @param level LOG_LEVEL_xxx
+ * @param format The format string, has to stay around (a literal)
+ * @param count The amount of arguments
+ * @param args The arguments, each widened to 64 bits
+ *
+ * Use @c LOG_WRITE instead. Messages at or below the console level are formatted and printed straight away,
+ * the rest are only recorded into the boot log and formatted when it's read.
+ */
+void log_write(int level, const char *format, int count, const uint64_t *args) {
+    if (level <= __polyaniline_log_console) {
+        char buffer[LOG_LINE_LENGTH];
+        size_t length = log_format(buffer, LOG_LINE_LENGTH, format, count, args);
+        terminal_writeRun(buffer, length);
+        return;
+    }
+
+    // Nobody is looking, keep the raw record
+    if (terminal_logging) bootlog_record(format, count, args);
+}
+
+/**
+ * @brief Format a log message
+ * @param buffer Output buffer
+ * @param size Size of @p buffer
+ * @param format The format string (d, i, u, x, X, p, s, c with flags 0 and -, a width and l/ll/z)
+ * @param count The amount of arguments
+ * @param args The arguments
+ * @returns The amount of characters written, not counting the terminating NUL
+ */
+size_t log_format(char *buffer, size_t size, const char *format, int count, const uint64_t *args) {
+    size_t out = 0;
+    int arg = 0;
+
+#define PUT(c) { if (out + 1 < size) buffer[out++] = (c); }
+
+    for (const char *f = format; *f; f++) {
+        if (*f != '%') {
+            PUT(*f);
+            continue;
+        }
+
+        f++;
+        if (*f == '%') {
+            PUT('%');
+            continue;
+        }
+
+        // Flags and width
+        int left = 0, zero = 0, width = 0, big = 0;
+        for (;; f++) {
+            if (*f == '-') left = 1;
+            else if (*f == '0') zero = 1;
+            else break;
+        }
+
+        while (*f >= '0' && *f <= '9') width = width * 10 + (*f++ - '0');
+
+        // Precision isn't supported, skip it
+        if (*f == '.') {
+            f++;
+            while (*f >= '0' && *f <= '9') f++;
+        }
+
+        while (*f == 'l' || *f == 'z' || *f == 'h' || *f == 'j' || *f == 't') {
+            if (*f != 'h') big = 1;
+            f++;
+        }
+
+        if (!*f) break;
+
+        uint64_t value = (arg < count) ? args[arg++] : 0;
+        char digits[24];
+        int length = 0;
+        const char *str = digits;
+        int prefix = 0;
+
+        switch (*f) {
+            case 'd':
+            case 'i': {
+                int64_t v = big ? (int64_t)value : (int64_t)(int32_t)value;
+                uint64_t u = (v < 0) ? -(uint64_t)v : (uint64_t)v;
+                do { digits[sizeof(digits) - 1 - length++] = '0' + (u % 10); u /= 10; } while (u);
+                if (v < 0) digits[sizeof(digits) - 1 - length++] = '-';
+                str = digits + sizeof(digits) - length;
+                break;
+            }
+
+            case 'u': {
+                uint64_t u = big ? value : (uint32_t)value;
+                do { digits[sizeof(digits) - 1 - length++] = '0' + (u % 10); u /= 10; } while (u);
+                str = digits + sizeof(digits) - length;
+                break;
+            }
+
+            case 'p':
+                prefix = 1;
+                big = 1;
+                // fallthrough
+            case 'x':
+            case 'X': {
+                const char *hex = (*f == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+                uint64_t u = big ? value : (uint32_t)value;
+                do { digits[sizeof(digits) - 1 - length++] = hex[u & 0xF]; u >>= 4; } while (u);
+                str = digits + sizeof(digits) - length;
+                break;
+            }
+
+            case 's':
+                str = value ? (const char*)(uintptr_t)value : "(null)";
+                while (str[length]) length++;
+                zero = 0;
+                break;
+
+            case 'c':
+                digits[0] = (char)value;
+                length = 1;
+                zero = 0;
+                break;
+
+            default:
+                // Unknown conversion, print it as-is
+                PUT('%');
+                PUT(*f);
+                continue;
+        }
+
+        int pad = width - length - (prefix ? 2 : 0);
+
+        if (!left && !zero) while (pad-- > 0) PUT(' ');
+        if (prefix) {
+            PUT('0');
+            PUT('x');
+        }
+
+        // Zero padding goes after the sign
+        int i = 0;
+        if (zero && !left && *str == '-') {
+            PUT('-');
+            i++;
+        }
+
+        if (zero && !left) while (pad-- > 0) PUT('0');
+        for (; i < length; i++) PUT(str[i]);
+        if (left) while (pad-- > 0) PUT(' ');
+    }
+
+#undef PUT
+
+    if (size) buffer[out] = 0;
+    return out;
+}
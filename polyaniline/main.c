@@ -19,6 +19,9 @@
 #include <polyaniline/menu.h>
 #include <stdio.h>
 
+/* No screen, boot straight away */
+int polyaniline_headless = 0;
+
 /**
  * @brief Main function of Polyaniline. Call after all interfaces are setup
  */
@@ -35,7 +38,14 @@ void polyaniline_main() {
         __polyaniline_compiler,
         __polyaniline_build_date, 
         __polyaniline_build_time);
-     
+
+    if (polyaniline_headless) {
+        // Nobody is there to pick anything
+        printf("Headless boot, using the default command line\n");
+        platform_boot((char*)__polyaniline_default_kernel_cmdline);
+        polyaniline_error("polyaniline_main(): Failed to launch kernel.\n");
+    }
+
     terminal_drawTestTube(BOOT_LIQUID_NORMAL);
 
     // Run the menu
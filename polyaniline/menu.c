@@ -19,6 +19,9 @@
 #include <polyaniline/config.h>
 #include <polyaniline/config_opts.h>
 #include <polyaniline/error.h>
+#include <polyaniline/polyaniline.h>
+#include <polyaniline/bootlog.h>
+#include <polyaniline/strbuf.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -26,27 +29,87 @@
 int ub_offset_x = 0;
 int ub_offset_y = 0;
 
+/* Cached menu chrome */
+static menu_chrome_t menu_chrome[MENU_CHROME_SLOTS] = { 0 };
+static uint64_t menu_chrome_clock = 0;
+
 /**
  * @brief Helper function to draw a titlebar
  */
 void menu_drawTitleBar(color_t bg, char *str) {
-    int i = ub_offset_x;
+    size_t len = strlen(str);
+    int off = (terminal_width - len) / 2;
+
+    // One fill for the bar, then the title on top of it
+    terminal_fillSpan(ub_offset_x, ub_offset_y, terminal_width - ub_offset_x * 2, bg);
 
-    terminal_setXY(i, ub_offset_y);
+    terminal_setXY(off, ub_offset_y);
     terminal_setBackground(bg);
+    terminal_writeRun(str, len);
+    terminal_setBackground(BOOT_DEFAULT_BG);
 
-    size_t len = strlen(str);
-    int off = (terminal_width - len) / 2;
+    terminal_setXY(ub_offset_x, ub_offset_y + 1);
+}
 
-    for (; i < off; i++) terminal_putCharacter(' ');
-    while (*str) terminal_putCharacter(*str++);
+/**
+ * @brief Clear the screen and draw the static parts of a menu screen
+ * @param liquid The logo liquid color
+ * @param titlebar The title bar color
+ * @param title The title bar text
+ * @param copyright Whether to draw the copyright footer
+ *
+ * The result is cached, so switching back to a screen is a clear and a copy of the few rows with something on them.
+ * The cursor is left on the line under the title bar.
+ */
+void menu_drawChrome(color_t liquid, color_t titlebar, char *title, int copyright) {
+    menu_chrome_t *victim = &menu_chrome[0];
+
+    // Titles are string literals, so the pointer identifies the screen
+    for (int i = 0; i < MENU_CHROME_SLOTS; i++) {
+        menu_chrome_t *chrome = &menu_chrome[i];
+
+        if (chrome->title == title && chrome->copyright == copyright &&
+                chrome->titlebar.rgb == titlebar.rgb && chrome->liquid.rgb == liquid.rgb &&
+                chrome->fg.rgb == terminal_fg.rgb && chrome->bg.rgb == terminal_bg.rgb) {
+            if (!terminal_restoreSnapshot(&chrome->snapshot)) {
+                chrome->last_used = ++menu_chrome_clock;
+                terminal_setXY(ub_offset_x, ub_offset_y + 1);
+                return;
+            }
 
-    i += len;
-    for (; i < terminal_width - ub_offset_x; i++) terminal_putCharacter(' ');
+            // Stale (the video mode changed), draw it again in the same slot
+            victim = chrome;
+            break;
+        }
 
-    terminal_setBackground(BOOT_DEFAULT_BG);
+        if (!chrome->title) {
+            if (victim->title) victim = chrome;
+        } else if (victim->title && chrome->last_used < victim->last_used) {
+            victim = chrome;
+        }
+    }
 
-    terminal_y++;
+    // Save the key before drawing, the colors change along the way
+    victim->title = title;
+    victim->titlebar = titlebar;
+    victim->liquid = liquid;
+    victim->fg = terminal_fg;
+    victim->bg = terminal_bg;
+    victim->copyright = copyright;
+    victim->last_used = ++menu_chrome_clock;
+
+    terminal_clearScreen(terminal_fg, terminal_bg);
+    terminal_drawTestTube(liquid);
+    if (copyright) polyaniline_copyright();
+    menu_drawTitleBar(titlebar, title);
+
+    if (terminal_saveSnapshot(&victim->snapshot)) {
+        // Not enough memory (or no cell grid), we'll just draw it every time
+        terminal_freeSnapshot(&victim->snapshot);
+        victim->title = NULL;
+    }
+
+    terminal_setXY(ub_offset_x, ub_offset_y + 1);
 }
 
 /**
@@ -72,7 +135,6 @@ void menu_renderOption(option_t *opt, int selected, int page, int pages) {
     }
 
     terminal_setXY(ub_offset_x, terminal_y);
-    size_t l = strlen(opt->name) + (opt->type == OPTION_TYPE_CHECKBOX ? 4 : 0);
 
     switch (opt->type) {
         case OPTION_TYPE_CHECKBOX:
@@ -84,9 +146,8 @@ void menu_renderOption(option_t *opt, int selected, int page, int pages) {
         default:
             printf("%s", opt->name);
     }
-    
-    for (int i = ub_offset_x + l; i < terminal_width - ub_offset_x; i++) terminal_putCharacter(' ');
 
+    terminal_fillSpan(terminal_x, terminal_y, terminal_width - ub_offset_x - terminal_x, terminal_bg);
     terminal_y++;
 
     terminal_setForeground(BOOT_DEFAULT_FG);
@@ -120,11 +181,7 @@ void polyaniline_copyright() {
  * This will construct and use a command line to start the OS
  */
 void polyaniline_configureOS() {
-    terminal_clearScreen(terminal_fg, terminal_bg);
-    terminal_drawTestTube(BOOT_LIQUID_NORMAL);
-    polyaniline_copyright();
-
-    menu_drawTitleBar(TITLEBAR_DEFAULT_COLOR, "Ethereal configuration manager");
+    menu_drawChrome(BOOT_LIQUID_NORMAL, TITLEBAR_DEFAULT_COLOR, "Ethereal configuration manager", 1);
     terminal_y++;
 
     OPTIONS_START(); 
@@ -165,43 +222,126 @@ void polyaniline_configureOS() {
     }
 
     // Collect and build command line
-    char kcmdline[512] = { 0 };
-    int length = 0;
+    char kcmdline[512];
+    strbuf_t cmdline;
+    strbuf_init(&cmdline, kcmdline, sizeof(kcmdline));
 
     terminal_clearScreen(BOOT_DEFAULT_FG, BOOT_DEFAULT_BG);
 
     for (int i = 0; i < pages; i++) {
         for (int o = 0; o < MAX_PAGES; o++) {
             if (options[i][o].type == OPTION_TYPE_CHECKBOX && (options[i][o].enabled)) {
-                length += strlen((const char*)options[i][o].data);
-                if (length >= 512) polyaniline_error_nonfatal("Too many options selected. This is a bug! Report this!");
-                strcat(kcmdline, (const char*)options[i][o].data);
+                strbuf_append(&cmdline, (const char*)options[i][o].data);
             }
         }
     }
 
     for (int i = 0; i < optcount; i++) {
         if (options[selected_page][i].type == OPTION_TYPE_CHECKBOX && (options[selected_page][i].enabled)) {
-            length += strlen((const char*)options[selected_page][i].data);
-            if (length >= 512) polyaniline_error_nonfatal("Too many options selected. This is a bug! Report this!");
-            strcat(kcmdline, (const char*)options[selected_page][i].data);
+            strbuf_append(&cmdline, (const char*)options[selected_page][i].data);
         }
     }
 
+    if (cmdline.truncated) {
+        polyaniline_error_nonfatal("Too many options selected. This is a bug! Report this!");
+        return;
+    }
+
     platform_boot(kcmdline);
 }
 
 
 
+/**
+ * @brief Split text into screen lines, wrapping anything wider than the user box
+ * @param text The text. Characters that would move the cursor are replaced by spaces
+ * @param length Length of the text
+ * @param lines Output for the offset and length of every line, or NULL to just count them
+ * @returns The amount of lines
+ */
+static int menu_splitLines(char *text, size_t length, uint32_t *lines) {
+    int count = 0;
+    size_t start = 0;
+
+    for (size_t i = 0; i <= length; i++) {
+        if (i < length && text[i] != '\n' && (text[i] < ' ' || text[i] > '~')) text[i] = ' ';
+        if (i < length && text[i] != '\n' && i - start < USERBOX_WIDTH) continue;
+
+        if (i == length && i == start) break;
+        if (lines) {
+            lines[count * 2] = start;
+            lines[count * 2 + 1] = i - start;
+        }
+
+        count++;
+        start = (i < length && text[i] == '\n') ? i + 1 : i;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Boot log viewer
+ *
+ * Shows a copy of the boot log taken when it was opened. Redrawing after a scroll only
+ * touches the cells that changed, the terminal's cell grid skips the rest.
+ */
+void polyaniline_viewBootLog() {
+    menu_drawChrome(BOOT_LIQUID_NORMAL, TITLEBAR_DEFAULT_COLOR, "Boot log", 0);
+
+    // Take a copy so the log doesn't change under us
+    size_t length = bootlog_length();
+    char *log = platform_allocate(length + 1);
+    uint32_t *lines = NULL;
+    int count = 0;
+
+    if (log) {
+        length = bootlog_read(log, length);
+        count = menu_splitLines(log, length, NULL);
+        lines = platform_allocate((count + 1) * 2 * sizeof(uint32_t));
+    }
+
+    if (!lines) {
+        if (log) platform_free(log);
+        polyaniline_error_nonfatal("Not enough memory to show the boot log\n");
+        return;
+    }
+
+    menu_splitLines(log, length, lines);
+
+    // Start at the newest lines
+    int top = (count > MENU_LOG_ROWS) ? count - MENU_LOG_ROWS : 0;
+    while (1) {
+        for (int row = 0; row < MENU_LOG_ROWS; row++) {
+            terminal_setXY(ub_offset_x, ub_offset_y + 2 + row);
+            if (top + row < count) terminal_writeRun(log + lines[(top + row) * 2], lines[(top + row) * 2 + 1]);
+            terminal_fillSpan(terminal_x, terminal_y, USERBOX_WIDTH - (terminal_x - ub_offset_x), terminal_bg);
+        }
+
+        terminal_setXY(0, terminal_height - ub_offset_y + 1);
+        terminal_printCentered("Lines %d-%d of %d - <ESC> = back, \030/\031 = scroll, \033/\032 = prev/next page",
+                                count ? top + 1 : 0, (top + MENU_LOG_ROWS < count) ? top + MENU_LOG_ROWS : count, count);
+
+        int k = platform_readKeyboard(0);
+        if (k == KEYBOARD_UP) top--;
+        if (k == KEYBOARD_DOWN) top++;
+        if (k == KEYBOARD_LEFT) top -= MENU_LOG_ROWS;
+        if (k == KEYBOARD_RIGHT) top += MENU_LOG_ROWS;
+        if (k == KEYBOARD_ESC || k == KEYBOARD_ENTER) break;
+
+        if (top > count - MENU_LOG_ROWS) top = count - MENU_LOG_ROWS;
+        if (top < 0) top = 0;
+    }
+
+    platform_free(lines);
+    platform_free(log);
+}
+
 /**
  * @brief Boot choice menu
  */
 void polyaniline_bootChoice() {
-    terminal_clearScreen(terminal_fg, terminal_bg);
-    terminal_drawTestTube(BOOT_LIQUID_NORMAL);
-    polyaniline_copyright();
-
-    menu_drawTitleBar(TITLEBAR_DEFAULT_COLOR, "Select an option to use");
+    menu_drawChrome(BOOT_LIQUID_NORMAL, TITLEBAR_DEFAULT_COLOR, "Select an option to use", 1);
     terminal_y++;
 
     OPTIONS_START();
@@ -209,6 +349,7 @@ void polyaniline_bootChoice() {
     OPTION_SELECT("Start Ethereal", "Load Ethereal with the default options", NULL);
     OPTION_SELECT("Configure Ethereal", "Configure and then load Ethereal using the built-in", "Polyaniline editor");
     OPTION_SELECT("Load custom ELF file", "Load a custom ELF file (Multiboot1 only)", NULL);
+    OPTION_SELECT("View boot log", "Show everything Polyaniline printed while starting up", NULL);
     OPTION_SELECT("Restart system", "Restart the system", NULL);
 
     OPTIONS_LOOP();
@@ -229,6 +370,12 @@ void polyaniline_bootChoice() {
         case 2:
             polyaniline_error_nonfatal("polyaniline_bootChoice(): Not implemented\n");
             break;
+
+        case 3:
+            // View the boot log, then come back here
+            polyaniline_viewBootLog();
+            polyaniline_bootChoice();
+            break;
         
         case -1:
             polyaniline_bootChoice();
@@ -251,10 +398,10 @@ void polyaniline_menu() {
     ub_offset_x = (terminal_width - USERBOX_WIDTH) / 2;
     ub_offset_y = (terminal_height / 2) - (USERBOX_HEIGHT/2);
 
-    terminal_clearScreen(terminal_fg, terminal_bg);
-    terminal_drawTestTube(BOOT_LIQUID_NORMAL);
+    // The serial console shows the user box instead of the raw output from now on
+    terminal_setSerialWindow(ub_offset_x, ub_offset_y);
 
-    polyaniline_copyright();
+    // The boot choice screen draws (or restores) its own chrome
     polyaniline_bootChoice();
 
     terminal_clearScreen(terminal_fg, terminal_bg);
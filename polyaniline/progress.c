@@ -0,0 +1,122 @@
+/**
+ * @file polyaniline/progress.c
+ * @brief Loading progress bar
+ *
+ * The bar gets its own terminal row and is repainted at most every __polyaniline_progress_interval ms,
+ * so a fast disk doesn't spend its time drawing. Other output can carry on below it while the file loads
+ * in the background. It only goes on the screen, the log gets one line when it's done.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/progress.h>
+#include <polyaniline/terminal.h>
+#include <polyaniline/config.h>
+#include <polyaniline/log.h>
+#include <stdio.h>
+
+#define LOG(level, ...) LOG_WRITE(BOOT, LOG_LEVEL_##level, __VA_ARGS__)
+
+/**
+ * @brief Write to the screen only, without moving the bar into the log
+ */
+static void progress_write(const char *str, size_t length) {
+    int logging = terminal_logging;
+    terminal_logging = 0;
+    terminal_writeRun(str, length);
+    terminal_logging = logging;
+}
+
+/**
+ * @brief Draw the bar
+ */
+static void progress_paint(progress_t *progress) {
+    if (!terminal_width || !terminal_height) return;
+
+    // Follow the row up the screen as things get printed below it
+    int row = progress->row - (terminal_scrolled - progress->scrolled);
+    if (row < 0) return;
+
+    int width = terminal_width - 16;
+    if (width > PROGRESS_BAR_WIDTH) width = PROGRESS_BAR_WIDTH;
+    if (width < 10) return;
+
+    int filled = progress->total ? (int)(progress->done * width / progress->total) : width;
+    int percent = progress->total ? (int)(progress->done * 100 / progress->total) : 100;
+
+    char line[PROGRESS_BAR_WIDTH + 64];
+    int length = snprintf(line, sizeof(line), "%s [", progress->label);
+    if (length < 0 || length > (int)sizeof(line) - width - 8) return;
+
+    for (int i = 0; i < width; i++) line[length++] = (i < filled) ? '#' : ' ';
+    length += snprintf(line + length, sizeof(line) - length, "] %3d%%", percent);
+
+    // Keep the bar out of the log, it would be a line per repaint
+    int x = terminal_x, y = terminal_y;
+    terminal_setXY(0, row);
+    progress_write(line, length);
+    terminal_setXY(x, y);
+    terminal_present();
+}
+
+static int progress_start(platform_consumer_t *consumer, uint64_t size) {
+    progress_t *progress = (progress_t*)consumer;
+    progress->total = size;
+    progress->done = 0;
+    progress->started = progress->painted = platform_getTime();
+
+    // Take a row of our own
+    if (terminal_width && terminal_height) {
+        if (terminal_x) progress_write("\n", 1);
+        progress->row = terminal_y;
+        progress->scrolled = terminal_scrolled;
+        progress_paint(progress);
+        progress_write("\n", 1);
+    }
+
+    return 0;
+}
+
+static int progress_consume(platform_consumer_t *consumer, const void *data, size_t length) {
+    progress_t *progress = (progress_t*)consumer;
+    progress->done += length;
+
+    uint64_t now = platform_getTime();
+    if (now - progress->painted >= (uint64_t)__polyaniline_progress_interval * 1000) {
+        progress->painted = now;
+        progress_paint(progress);
+    }
+
+    return 0;
+}
+
+static int progress_finish(platform_consumer_t *consumer) {
+    progress_t *progress = (progress_t*)consumer;
+    progress_paint(progress);
+
+    uint64_t elapsed = platform_getTime() - progress->started;
+    uint64_t rate = elapsed ? (progress->total / elapsed) : 0;   // Bytes per microsecond is MB/s
+    LOG(INFO, "%s: %llu KB in %llu ms (%llu MB/s)\n", progress->label, progress->total / 1024, elapsed / 1000, rate);
+    return 0;
+}
+
+/**
+ * @brief Set up a progress bar consumer
+ * @param progress The consumer
+ * @param label Label shown in front of the bar, has to stay around
+ * @returns The consumer, to put in a consumer list
+ */
+platform_consumer_t *progress_consumer(progress_t *progress, const char *label) {
+    progress->consumer.start = progress_start;
+    progress->consumer.consume = progress_consume;
+    progress->consumer.finish = progress_finish;
+    progress->consumer.release = NULL;
+    progress->consumer.next = NULL;
+    progress->label = label;
+    return &progress->consumer;
+}
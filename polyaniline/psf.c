@@ -0,0 +1,181 @@
+/**
+ * @file polyaniline/psf.c
+ * @brief PC Screen Font loader
+ *
+ * PSF1 and PSF2 fonts are converted into an atlas of PSF_ATLAS_GLYPHS glyphs indexed by
+ * character (through the unicode table, if the font has one). Every glyph gets a power of
+ * two stride and the atlas is cache line aligned, so no glyph straddles a cache line.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/psf.h>
+#include <polyaniline/platform.h>
+#include <string.h>
+
+/* Loaded font */
+psf_atlas_t *psf_font = NULL;
+static psf_atlas_t psf_loaded;
+
+/**
+ * @brief Decode one UTF-8 sequence out of a PSF2 unicode table
+ * @param p Pointer to the sequence, updated to point past it
+ * @param end End of the table
+ * @returns The codepoint
+ */
+static uint32_t psf_decodeUTF8(uint8_t **p, uint8_t *end) {
+    uint8_t c = *(*p)++;
+    int extra = 0;
+    uint32_t cp = c;
+
+    if (c >= 0xF0) { cp = c & 0x07; extra = 3; }
+    else if (c >= 0xE0) { cp = c & 0x0F; extra = 2; }
+    else if (c >= 0xC0) { cp = c & 0x1F; extra = 1; }
+
+    while (extra-- && *p < end && (**p & 0xC0) == 0x80) {
+        cp = (cp << 6) | (*(*p)++ & 0x3F);
+    }
+
+    return cp;
+}
+
+/**
+ * @brief Build the character to glyph map out of the unicode table
+ * @param map The map to fill in, entries start out as the identity
+ * @param table The unicode table
+ * @param end End of the file
+ * @param glyphs Amount of glyphs in the font
+ * @param psf2 Whether the table is a PSF2 (UTF-8) table or a PSF1 (UCS-2) one
+ */
+static void psf_parseTable(uint32_t *map, uint8_t *table, uint8_t *end, uint32_t glyphs, int psf2) {
+    uint8_t mapped[PSF_ATLAS_GLYPHS] = { 0 };
+    uint8_t *p = table;
+
+    for (uint32_t glyph = 0; glyph < glyphs && p < end; glyph++) {
+        int in_sequence = 0;
+
+        while (p < end) {
+            uint32_t cp;
+
+            if (psf2) {
+                if (*p == PSF2_SEPARATOR) { p++; break; }
+                if (*p == PSF2_STARTSEQ) { p++; in_sequence = 1; continue; }
+                cp = psf_decodeUTF8(&p, end);
+            } else {
+                if (p + 2 > end) { p = end; break; }
+                cp = p[0] | (p[1] << 8);
+                p += 2;
+                if (cp == PSF1_SEPARATOR) break;
+                if (cp == PSF1_STARTSEQ) { in_sequence = 1; continue; }
+            }
+
+            // Combining sequences don't map a single character, skip them. First mapping wins.
+            if (!in_sequence && cp < PSF_ATLAS_GLYPHS && !mapped[cp]) {
+                map[cp] = glyph;
+                mapped[cp] = 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Validate a PSF1/PSF2 file and convert it into an atlas
+ * @param data The file
+ * @param size The size of the file
+ * @param atlas The atlas to fill in
+ * @returns 0 on success
+ */
+int psf_parse(void *data, size_t size, psf_atlas_t *atlas) {
+    uint8_t *file = (uint8_t*)data;
+    uint8_t *end = file + size;
+    uint32_t width, height, glyphs, charsize, headersize;
+    uint8_t *table = NULL;
+    int psf2 = 0;
+
+    if (size >= sizeof(psf2_header_t) && ((psf2_header_t*)file)->magic == PSF2_MAGIC) {
+        psf2_header_t *header = (psf2_header_t*)file;
+        width = header->width;
+        height = header->height;
+        glyphs = header->length;
+        charsize = header->charsize;
+        headersize = header->headersize;
+        psf2 = 1;
+
+        if (headersize < sizeof(psf2_header_t) || charsize != height * ((width + 7) / 8)) return 1;
+    } else if (size >= sizeof(psf1_header_t) && file[0] == PSF1_MAGIC0 && file[1] == PSF1_MAGIC1) {
+        psf1_header_t *header = (psf1_header_t*)file;
+        width = 8;
+        height = header->charsize;
+        glyphs = (header->mode & PSF1_MODE512) ? 512 : 256;
+        charsize = header->charsize;
+        headersize = sizeof(psf1_header_t);
+    } else {
+        return 1;
+    }
+
+    if (!width || width > PSF_MAX_WIDTH || !height || height > PSF_MAX_HEIGHT || !glyphs) return 1;
+    if ((uint64_t)headersize + (uint64_t)glyphs * charsize > size) return 1;
+
+    if (psf2 ? (((psf2_header_t*)file)->flags & PSF2_HAS_UNICODE_TABLE)
+             : (((psf1_header_t*)file)->mode & (PSF1_MODEHASTAB | PSF1_MODESEQ))) {
+        table = file + headersize + glyphs * charsize;
+    }
+
+    // Which glyph each character uses
+    uint32_t map[PSF_ATLAS_GLYPHS];
+    for (uint32_t i = 0; i < PSF_ATLAS_GLYPHS; i++) map[i] = (i < glyphs) ? i : 0;
+    if (table) psf_parseTable(map, table, end, glyphs, psf2);
+
+    // Round the glyph up to a power of two below a cache line, or a whole amount of cache lines above it
+    uint32_t stride = 1;
+    if (charsize > PSF_ATLAS_ALIGN) {
+        stride = (charsize + PSF_ATLAS_ALIGN - 1) & ~(PSF_ATLAS_ALIGN - 1);
+    } else {
+        while (stride < charsize) stride <<= 1;
+    }
+
+    uint8_t *memory = platform_allocate(PSF_ATLAS_GLYPHS * stride + PSF_ATLAS_ALIGN);
+    if (!memory) return 1;
+
+    uint8_t *glyph_data = (uint8_t*)(((uintptr_t)memory + PSF_ATLAS_ALIGN - 1) & ~(uintptr_t)(PSF_ATLAS_ALIGN - 1));
+    memset(glyph_data, 0, PSF_ATLAS_GLYPHS * stride);
+
+    for (uint32_t i = 0; i < PSF_ATLAS_GLYPHS; i++) {
+        memcpy(glyph_data + i * stride, file + headersize + map[i] * charsize, charsize);
+    }
+
+    atlas->width = width;
+    atlas->height = height;
+    atlas->row_bytes = (width + 7) / 8;
+    atlas->stride = stride;
+    atlas->glyphs = glyph_data;
+    atlas->file = data;
+    atlas->file_size = size;
+
+    return 0;
+}
+
+/**
+ * @brief Load a font from the boot volume into @c psf_font
+ * @param path The path of the font
+ * @returns 0 on success
+ */
+int psf_load(char *path) {
+    size_t size;
+    void *data = platform_loadFile(path, 0, &size);
+    if (!data) return 1;
+
+    // This runs before the terminal exists, so a bad font just means the built-in one is used
+    if (psf_parse(data, size, &psf_loaded)) {
+        platform_free(data);
+        return 1;
+    }
+
+    psf_font = &psf_loaded;
+    return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file polyaniline/strbuf.c
+ * @brief String builder
+ *
+ * Keeps track of the length so appending doesn't have to find the end of the string
+ * every time like strcat does, and never writes past the end of the buffer.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/strbuf.h>
+#include <string.h>
+
+/**
+ * @brief Start building a string
+ * @param sb The builder
+ * @param buffer Where to build it
+ * @param size Size of @p buffer, has to be at least 1
+ */
+void strbuf_init(strbuf_t *sb, char *buffer, size_t size) {
+    sb->buffer = buffer;
+    sb->size = size;
+    sb->length = 0;
+    sb->truncated = 0;
+    buffer[0] = 0;
+}
+
+/**
+ * @brief Append characters
+ * @param sb The builder
+ * @param str The characters
+ * @param length The amount of characters
+ * @returns 0 on success, 1 if it had to be cut short
+ */
+int strbuf_appendn(strbuf_t *sb, const char *str, size_t length) {
+    size_t space = sb->size - 1 - sb->length;
+    int cut = 0;
+    if (length > space) {
+        length = space;
+        sb->truncated = cut = 1;
+    }
+
+    memmove(sb->buffer + sb->length, str, length);
+    sb->length += length;
+    sb->buffer[sb->length] = 0;
+
+    return cut;
+}
+
+/**
+ * @brief Append a string
+ * @param sb The builder
+ * @param str The string
+ * @returns 0 on success, 1 if it had to be cut short
+ */
+int strbuf_append(strbuf_t *sb, const char *str) {
+    // Don't look further than what could fit, one more tells us if it was cut
+    return strbuf_appendn(sb, str, strnlen(str, sb->size - sb->length));
+}
+
+/**
+ * @brief Append one character
+ * @param sb The builder
+ * @param c The character
+ * @returns 0 on success, 1 if it didn't fit
+ */
+int strbuf_putc(strbuf_t *sb, char c) {
+    return strbuf_appendn(sb, &c, 1);
+}
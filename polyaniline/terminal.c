@@ -12,6 +12,9 @@
  */
 
 #include <polyaniline/terminal.h>
+#include <polyaniline/platform.h>
+#include <polyaniline/ansi.h>
+#include <polyaniline/bootlog.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -30,6 +33,53 @@ int terminal_height = 0;
 color_t terminal_fg;
 color_t terminal_bg;
 
+/* Output is a log (no menu is up), so it's kept in the boot log and sent to the serial console */
+int terminal_logging = 1;
+
+/* Lines we ran off the bottom of the screen by, but haven't scrolled for yet */
+static int terminal_scroll_pending = 0;
+
+/* Lines scrolled in total, counting pending ones. Lets something drawn on a row find it again later */
+int terminal_scrolled = 0;
+
+/* What's on screen, so we only draw cells that actually change. NULL if it couldn't be allocated */
+static terminal_cell_t *terminal_cells = NULL;
+
+/* Background of the last clear, what blank cells show */
+static color_t terminal_clear_bg;
+
+/**
+ * @brief Set a range of cells to blank
+ * @param start The first cell
+ * @param count The amount of cells
+ * @param bg The background they were cleared with
+ */
+static void terminal_blankCells(terminal_cell_t *start, int count, color_t bg) {
+    for (int i = 0; i < count; i++) start[i] = (terminal_cell_t){ .ch = ' ', .fg = bg.rgb, .bg = bg.rgb };
+}
+
+/**
+ * @brief Forget what's in the cells covering a pixel region
+ * @param x X coordinate of the region
+ * @param y Y coordinate of the region
+ * @param width Width of the region
+ * @param height Height of the region
+ */
+static void terminal_invalidateRegion(int x, int y, int width, int height) {
+    if (!terminal_cells) return;
+
+    int x1 = (x < 0 ? 0 : x / (int)info.cell_width);
+    int y1 = (y < 0 ? 0 : y / (int)info.cell_height);
+    int x2 = (x + width + info.cell_width - 1) / info.cell_width;
+    int y2 = (y + height + info.cell_height - 1) / info.cell_height;
+    if (x2 > terminal_width) x2 = terminal_width;
+    if (y2 > terminal_height) y2 = terminal_height;
+
+    for (int cy = y1; cy < y2; cy++) {
+        for (int cx = x1; cx < x2; cx++) terminal_cells[cy * terminal_width + cx].ch = TERMINAL_CELL_INVALID;
+    }
+}
+
 
 
 /**
@@ -38,11 +88,14 @@ color_t terminal_bg;
  */
 int terminal_init(video_info_t vidinfo) {
     // Setup terminal variables
-    terminal_width = vidinfo.width / FONT_CELL_WIDTH;
-    terminal_height = vidinfo.height / FONT_CELL_HEIGHT;
+    info = vidinfo;
+    terminal_width = vidinfo.width / vidinfo.cell_width;
+    terminal_height = vidinfo.height / vidinfo.cell_height;
     terminal_x = 0;
     terminal_y = 0;
-    info = vidinfo; 
+
+    // Get memory for the cell grid. Without it we just draw everything.
+    terminal_cells = platform_allocate(terminal_width * terminal_height * sizeof(terminal_cell_t));
 
     // Clear screen
     terminal_clearScreen(BOOT_DEFAULT_FG, BOOT_DEFAULT_BG);
@@ -58,14 +111,85 @@ int terminal_init(video_info_t vidinfo) {
 void terminal_clearScreen(color_t fg, color_t bg) {
     terminal_fg = fg;
     terminal_bg = bg;
+    terminal_clear_bg = bg;
     platform_clearScreen(bg);
+    if (terminal_cells) terminal_blankCells(terminal_cells, terminal_width * terminal_height, bg);
 
     terminal_x = 0;
     terminal_y = 0;
+    terminal_scroll_pending = 0;
+}
+
+/**
+ * @brief Scroll the screen for any lines we ran off the bottom by
+ * 
+ * Scrolling is deferred until something is actually drawn on the new line,
+ * so a burst of newlines only moves the screen once.
+ */
+static void terminal_scroll() {
+    // Anyone could have moved terminal_y off the screen, not just us
+    if (terminal_y >= terminal_height) {
+        terminal_scrolled += terminal_y - (terminal_height - 1);
+        terminal_scroll_pending += terminal_y - (terminal_height - 1);
+        terminal_y = terminal_height - 1;
+    }
+
+    if (!terminal_scroll_pending) return;
+
+    if (terminal_scroll_pending >= terminal_height) {
+        // Nothing would survive the scroll
+        platform_fillRect(0, 0, terminal_width * info.cell_width, terminal_height * info.cell_height, terminal_bg);
+        if (terminal_cells) terminal_blankCells(terminal_cells, terminal_width * terminal_height, terminal_bg);
+    } else {
+        platform_scroll(terminal_height * info.cell_height, terminal_scroll_pending * info.cell_height, terminal_bg);
+
+        if (terminal_cells) {
+            // Move the grid along with the screen
+            int kept = (terminal_height - terminal_scroll_pending) * terminal_width;
+            terminal_cell_t *src = terminal_cells + terminal_scroll_pending * terminal_width;
+            for (int i = 0; i < kept; i++) terminal_cells[i] = src[i];
+            terminal_blankCells(terminal_cells + kept, terminal_scroll_pending * terminal_width, terminal_bg);
+        }
+    }
+
+    terminal_scroll_pending = 0;
 }
 
 
 
+/**
+ * @brief Draw characters at the cursor, skipping cells that already show them
+ * @param str The characters
+ * @param count The amount of characters, must fit on the current line
+ */
+static void terminal_drawCells(const char *str, int count) {
+    if (!terminal_cells) {
+        platform_drawRun(str, count, terminal_x, terminal_y, terminal_fg, terminal_bg);
+        return;
+    }
+
+    terminal_cell_t *cells = &terminal_cells[terminal_y * terminal_width + terminal_x];
+    int changed = -1; // Start of the run of changed cells we're in
+
+    for (int i = 0; i <= count; i++) {
+        int same = 1;
+        if (i < count) {
+            // Blank cells don't care about the foreground
+            unsigned char ch = str[i];
+            terminal_cell_t new_cell = { .ch = ch, .fg = (ch == ' ' ? terminal_bg.rgb : terminal_fg.rgb), .bg = terminal_bg.rgb };
+            same = (cells[i].ch == new_cell.ch && cells[i].fg == new_cell.fg && cells[i].bg == new_cell.bg);
+            if (!same) cells[i] = new_cell;
+        }
+
+        if (!same && changed < 0) {
+            changed = i;
+        } else if (same && changed >= 0) {
+            platform_drawRun(str + changed, i - changed, terminal_x + changed, terminal_y, terminal_fg, terminal_bg);
+            changed = -1;
+        }
+    }
+}
+
 /**
  * @brief Put a character in the terminal system
  * @param ch The character to place
@@ -96,7 +220,9 @@ void terminal_putCharacter(int ch) {
 
         default:
             // Normal character
-            platform_drawCharacter(ch, terminal_x, terminal_y, terminal_fg, terminal_bg);
+            terminal_scroll();
+            char c = ch;
+            terminal_drawCells(&c, 1);
             terminal_x++;
             break;
     }
@@ -107,12 +233,241 @@ void terminal_putCharacter(int ch) {
         terminal_x = 0;
     }
 
-    // Clear the screen if the height is too big
+    // Ran off the bottom of the screen, remember to scroll once something gets drawn
     if (terminal_y >= terminal_height) {
-        terminal_clearScreen(terminal_fg, terminal_bg); // No scrolling yet
+        terminal_scrolled += terminal_y - (terminal_height - 1);
+        terminal_scroll_pending += terminal_y - (terminal_height - 1);
+        terminal_y = terminal_height - 1;
+    }
+
+    // A finished line is a good point to get it onto the screen
+    if (ch == '\n') terminal_present();
+}
+
+/**
+ * @brief Get everything drawn so far onto the screen and the serial console
+ */
+void terminal_present() {
+    platform_present();
+    ansi_sync(terminal_cells, terminal_width, terminal_height);
+}
+
+/**
+ * @brief Choose what the serial console shows
+ * @param x The first column of the window to mirror, or TERMINAL_SERIAL_LOG for a plain log of output
+ * @param y The first line of the window to mirror
+ *
+ * Output only goes into the boot log while the serial console is a log, menus aren't logged
+ */
+void terminal_setSerialWindow(int x, int y) {
+    terminal_logging = (x == TERMINAL_SERIAL_LOG);
+    ansi_setWindow(x, y);
+    if (x != TERMINAL_SERIAL_LOG) ansi_sync(terminal_cells, terminal_width, terminal_height);
+}
+
+
+/**
+ * @brief Write a run of characters to the terminal
+ * @param run The characters to write
+ * @param length The amount of characters
+ * 
+ * Printable characters are laid out a line at a time and drawn in one go.
+ */
+void terminal_writeRun(const char *run, size_t length) {
+    // The log works before (and without) the screen
+    if (terminal_logging) {
+        bootlog_write(run, length);
+        ansi_log(run, length);
+    }
+
+    if (!terminal_width || !terminal_height) return;
+
+    size_t i = 0;
+    while (i < length) {
+        char ch = run[i];
+        if (ch == '\n' || ch == '\0' || ch == '\t' || ch == '\r') {
+            terminal_putCharacter(ch);
+            i++;
+            continue;
+        }
+
+        // Take everything printable that fits on this line
+        terminal_scroll();
+        int count = 0;
+        while (i + count < length && terminal_x + count < terminal_width) {
+            char c = run[i + count];
+            if (c == '\n' || c == '\0' || c == '\t' || c == '\r') break;
+            count++;
+        }
+
+        terminal_drawCells(run + i, count);
+        terminal_x += count;
+        i += count;
+
+        if (terminal_x >= terminal_width) {
+            // End of the screen width
+            terminal_y++;
+            terminal_x = 0;
+
+            if (terminal_y >= terminal_height) {
+                terminal_scrolled += terminal_y - (terminal_height - 1);
+                terminal_scroll_pending += terminal_y - (terminal_height - 1);
+                terminal_y = terminal_height - 1;
+            }
+        }
     }
 }
 
+/**
+ * @brief Check whether a row shows nothing but the background it was cleared with
+ * @param row The row
+ */
+static int terminal_rowBlank(int row) {
+    terminal_cell_t *cell = terminal_cells + row * terminal_width;
+    for (int i = 0; i < terminal_width; i++) {
+        if (cell[i].ch != ' ' || cell[i].fg != terminal_clear_bg.rgb || cell[i].bg != terminal_clear_bg.rgb) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Save the whole terminal into a snapshot
+ * @param snapshot The snapshot, anything already in it is reused
+ * @returns 0 on success, 1 if there's no memory for it or no cell grid to work out what's on screen
+ */
+int terminal_saveSnapshot(terminal_snapshot_t *snapshot) {
+    terminal_scroll();
+    if (!terminal_cells) return 1;
+
+    size_t size = terminal_width * terminal_height * sizeof(terminal_cell_t);
+    if (snapshot->cells && (snapshot->width != terminal_width || snapshot->height != terminal_height)) {
+        platform_free(snapshot->cells);
+        snapshot->cells = NULL;
+    }
+
+    if (!snapshot->cells) snapshot->cells = platform_allocate(size);
+    if (!snapshot->cells) return 1;
+    platform_copyMemory(snapshot->cells, terminal_cells, size);
+
+    // Blank rows come back with a clear, only keep the pixels of the others
+    int band = 0;
+    for (int row = 0; row < terminal_height; row++) {
+        if (terminal_rowBlank(row)) continue;
+
+        int first = row;
+        if (band == TERMINAL_SNAPSHOT_BANDS - 1) {
+            row = terminal_height - 1;
+            while (terminal_rowBlank(row)) row--;
+        } else {
+            while (row + 1 < terminal_height && !terminal_rowBlank(row + 1)) row++;
+        }
+
+        snapshot->bands[band] = platform_captureRows(snapshot->bands[band], first * info.cell_height, (row - first + 1) * info.cell_height);
+        if (!snapshot->bands[band]) return 1;
+        band++;
+    }
+
+    for (; band < TERMINAL_SNAPSHOT_BANDS; band++) {
+        platform_freeSurface(snapshot->bands[band]);
+        snapshot->bands[band] = NULL;
+    }
+
+    snapshot->width = terminal_width;
+    snapshot->height = terminal_height;
+    snapshot->clear = terminal_clear_bg;
+    snapshot->fg = terminal_fg;
+    snapshot->bg = terminal_bg;
+    return 0;
+}
+
+/**
+ * @brief Put a snapshot back on the screen
+ * @param snapshot The snapshot
+ * @returns 0 on success, 1 if the snapshot is stale and the caller has to draw from scratch
+ *
+ * The cursor is moved to the top left
+ */
+int terminal_restoreSnapshot(terminal_snapshot_t *snapshot) {
+    if (!terminal_cells || !snapshot->cells || snapshot->width != terminal_width || snapshot->height != terminal_height) return 1;
+
+    platform_clearScreen(snapshot->clear);
+    for (int band = 0; band < TERMINAL_SNAPSHOT_BANDS && snapshot->bands[band]; band++) {
+        if (platform_restoreRows(snapshot->bands[band])) {
+            // Different video mode, keep the grid in step with the cleared screen
+            terminal_blankCells(terminal_cells, terminal_width * terminal_height, snapshot->clear);
+            return 1;
+        }
+    }
+
+    platform_copyMemory(terminal_cells, snapshot->cells, terminal_width * terminal_height * sizeof(terminal_cell_t));
+    terminal_clear_bg = snapshot->clear;
+
+    terminal_fg = snapshot->fg;
+    terminal_bg = snapshot->bg;
+    terminal_x = 0;
+    terminal_y = 0;
+    terminal_scroll_pending = 0;
+    return 0;
+}
+
+/**
+ * @brief Free what a snapshot holds
+ * @param snapshot The snapshot
+ */
+void terminal_freeSnapshot(terminal_snapshot_t *snapshot) {
+    for (int band = 0; band < TERMINAL_SNAPSHOT_BANDS; band++) {
+        platform_freeSurface(snapshot->bands[band]);
+        snapshot->bands[band] = NULL;
+    }
+
+    if (snapshot->cells) platform_free(snapshot->cells);
+    snapshot->cells = NULL;
+}
+
+/**
+ * @brief Blank a span of cells on one line
+ * @param x The first column
+ * @param y The line
+ * @param length The amount of cells
+ * @param bg The background to fill with
+ *
+ * The cursor is not moved
+ */
+void terminal_fillSpan(int x, int y, int length, color_t bg) {
+    if (x < 0) {
+        length += x;
+        x = 0;
+    }
+
+    if (x + length > terminal_width) length = terminal_width - x;
+    if (length <= 0 || y < 0 || y >= terminal_height) return;
+
+    // The span is in screen coordinates, so get any pending scroll out of the way first
+    terminal_scroll();
+
+    if (!terminal_cells) {
+        platform_fillRect(x * info.cell_width, y * info.cell_height, length * info.cell_width, info.cell_height, bg);
+        return;
+    }
+
+    // Only fill the cells that aren't already blank with this background
+    terminal_cell_t *cells = &terminal_cells[y * terminal_width + x];
+    int changed = -1;
+
+    for (int i = 0; i <= length; i++) {
+        int same = 1;
+        if (i < length) same = (cells[i].ch == ' ' && cells[i].fg == bg.rgb && cells[i].bg == bg.rgb);
+
+        if (!same && changed < 0) {
+            changed = i;
+        } else if (same && changed >= 0) {
+            platform_fillRect((x + changed) * info.cell_width, y * info.cell_height, (i - changed) * info.cell_width, info.cell_height, bg);
+            terminal_blankCells(cells + changed, i - changed, bg);
+            changed = -1;
+        }
+    }
+}
 
 /**
  * @brief Set X/Y
@@ -126,14 +481,15 @@ void terminal_setXY(int x, int y) {
 
 
 static void draw_square(int x, int y, color_t color) {
-    int center_x = info.width - 30;
-    int center_y = 30;
-
-	for (int _y = 0; _y < 7; ++_y) {
-		for (int _x = 0; _x < 7; ++_x) {
-			platform_putPixel(center_x - 32 + x * 8 + _x, center_y - 32  + y * 8 + _y, color);
-		}
-	}
+    // The logo grows with the font so it stays in proportion to the text
+    int scale = info.scale;
+    int center_x = info.width - 30 * scale;
+    int center_y = 30 * scale;
+    int px = center_x + (x * 8 - 32) * scale;
+    int py = center_y + (y * 8 - 32) * scale;
+
+	platform_fillRect(px, py, 7 * scale, 7 * scale, color);
+	terminal_invalidateRegion(px, py, 7 * scale, 7 * scale);
 }
 
 /**
@@ -191,13 +547,15 @@ void terminal_printCentered(char *fmt, ...) {
     int len = vsnprintf(fmt_buffer, 256, fmt, ap);
     va_end(ap);
 
+    if (len > 255) len = 255;
+
     // Calculate offset
     int off = (terminal_width - len) / 2;
 
-    // The reason we can't set X to off is because we want to overwrite the existing characters
-    terminal_setXY(0, terminal_y);
-    for (int i = 0; i < off; i++) terminal_putCharacter(' ');
-    for (int i = 0; i < len; i++) terminal_putCharacter(fmt_buffer[i]);
-    for (int i = terminal_x; i < terminal_width-1; i++) terminal_putCharacter(' ');
+    // Blank out whatever was on the line around the text
+    terminal_fillSpan(0, terminal_y, off, terminal_bg);
+    terminal_setXY(off < 0 ? 0 : off, terminal_y);
+    terminal_writeRun(fmt_buffer, len);
+    terminal_fillSpan(terminal_x, terminal_y, terminal_width - 1 - terminal_x, terminal_bg);
     terminal_y++;
 }
\ No newline at end of file
@@ -0,0 +1,753 @@
+/**
+ * @file polyaniline/zstd.c
+ * @brief zstd block decoder
+ *
+ * Decodes the compressed blocks of a zstd frame (RFC 8878), decompress.c reads the frame around them.
+ * The output of the whole frame is one buffer, so matches reach back into it directly and no window is kept.
+ * Literals are decoded into a buffer first, then every sequence is decoded and carried out straight away.
+ * Dictionaries aren't supported.
+ *
+ * The FSE and Huffman bitstreams are read backwards through a 64-bit container that is reloaded
+ * every few fields. Reading past the start of a stream gives zeros, a stream that wasn't used up
+ * exactly is corrupt.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include <polyaniline/zstd.h>
+#include <string.h>
+
+/* Literals section types */
+#define ZSTD_LITERALS_RAW           0
+#define ZSTD_LITERALS_RLE           1
+#define ZSTD_LITERALS_COMPRESSED    2
+#define ZSTD_LITERALS_TREELESS      3
+
+/* Sequence table modes */
+#define ZSTD_MODE_PREDEFINED        0
+#define ZSTD_MODE_RLE               1
+#define ZSTD_MODE_FSE               2
+#define ZSTD_MODE_REPEAT            3
+
+/* Huffman weights are FSE compressed with at most this accuracy, and go up to 11 */
+#define ZSTD_WEIGHT_MAX_LOG         6
+#define ZSTD_WEIGHT_SYMBOLS         12
+
+// A bitstream that's read from its end to its start
+typedef struct _zstd_bits {
+    const uint8_t *start;           // First byte of the stream
+    const uint8_t *ptr;             // Where the container was loaded from
+    uint64_t container;
+    unsigned consumed;              // Bits used up from the top of the container, over 64 once it read past the start
+} zstd_bits_t;
+
+/* Default distributions of the sequence fields */
+static const int16_t zstd_llDefault[ZSTD_LL_SYMBOLS] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+
+static const int16_t zstd_mlDefault[ZSTD_ML_SYMBOLS] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+
+static const int16_t zstd_ofDefault[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+/* Literal length and match length codes, as a baseline and the amount of extra bits added to it */
+static const uint32_t zstd_llBase[ZSTD_LL_SYMBOLS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+
+static const uint8_t zstd_llBits[ZSTD_LL_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+
+static const uint32_t zstd_mlBase[ZSTD_ML_SYMBOLS] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+
+static const uint8_t zstd_mlBits[ZSTD_ML_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+static inline uint64_t zstd_read64(const uint8_t *p) {
+    uint64_t value;
+    __builtin_memcpy(&value, p, 8);
+    return value;
+}
+
+/**
+ * @brief Start reading a backwards bitstream
+ * @returns 1 if the stream is empty or has no end marker
+ */
+static int zstd_bitsInit(zstd_bits_t *b, const uint8_t *src, size_t size) {
+    if (!size || !src[size - 1]) return 1;
+
+    b->start = src;
+    if (size >= 8) {
+        b->ptr = src + size - 8;
+        b->container = zstd_read64(b->ptr);
+        b->consumed = 0;
+    } else {
+        // All of it fits, the bytes that aren't there count as used
+        b->ptr = src;
+        b->container = 0;
+        for (size_t i = 0; i < size; i++) b->container |= (uint64_t)src[i] << (8 * i);
+        b->consumed = (8 - size) * 8;
+    }
+
+    // The last byte is padded with zeros down to a 1 bit
+    b->consumed += __builtin_clz(src[size - 1]) - 24 + 1;
+    return 0;
+}
+
+/**
+ * @brief Get the next @p count bits without using them up
+ */
+static inline uint64_t zstd_peek(zstd_bits_t *b, unsigned count) {
+    if (b->consumed >= 64) return 0;
+    return ((b->container << b->consumed) >> 1) >> (63 - count);
+}
+
+static inline uint64_t zstd_read(zstd_bits_t *b, unsigned count) {
+    uint64_t value = zstd_peek(b, count);
+    b->consumed += count;
+    return value;
+}
+
+/**
+ * @brief Move the container back over the bytes that were used up, at least 57 bits are there afterwards unless the start is near
+ */
+static inline void zstd_reload(zstd_bits_t *b) {
+    if (b->consumed > 64) return;
+
+    size_t back = b->consumed >> 3;
+    if (back > (size_t)(b->ptr - b->start)) back = b->ptr - b->start;
+    if (!back) return;
+
+    b->ptr -= back;
+    b->consumed -= back * 8;
+    b->container = zstd_read64(b->ptr);
+}
+
+/**
+ * @brief Check that a stream was used up exactly
+ */
+static inline int zstd_finished(zstd_bits_t *b) {
+    return b->ptr == b->start && b->consumed == 64;
+}
+
+/**
+ * @brief Read bits going forwards, from the bottom of each byte up. Past the end there are zeros.
+ */
+static uint32_t zstd_readForward(const uint8_t *src, size_t size, size_t bit, int count) {
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++, bit++) {
+        if ((bit >> 3) < size && ((src[bit >> 3] >> (bit & 7)) & 1)) value |= 1u << i;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Read the distribution at the start of an FSE table description
+ * @param src The description
+ * @param size Bytes available
+ * @param counts Output for the count of every symbol, -1 for "less than one"
+ * @param symbols The most symbols there can be, changed to the amount read
+ * @param log Output for the accuracy log
+ * @param max_log Biggest accuracy log allowed
+ * @param used Output for the size of the description
+ * @returns 0 on success, 1 if it's corrupt
+ */
+static int zstd_readCounts(const uint8_t *src, size_t size, int16_t *counts, int *symbols, int *log, int max_log, size_t *used) {
+    int accuracy = zstd_readForward(src, size, 0, 4) + 5;
+    if (accuracy > max_log) return 1;
+
+    size_t bit = 4;
+    int remaining = (1 << accuracy) + 1;
+    int symbol = 0;
+
+    while (remaining > 1 && symbol < *symbols) {
+        // Values up to remaining take this many bits, the small ones one bit less
+        int bits = 32 - __builtin_clz(remaining);
+        uint32_t value = zstd_readForward(src, size, bit, bits);
+        uint32_t low = (1u << (bits - 1)) - 1;
+        uint32_t threshold = (1u << bits) - 1 - remaining;
+
+        if ((value & low) < threshold) {
+            value &= low;
+            bit += bits - 1;
+        } else {
+            if (value > low) value -= threshold;
+            bit += bits;
+        }
+
+        int count = (int)value - 1;
+        remaining -= (count < 0) ? -count : count;
+        counts[symbol++] = count;
+
+        // A zero is followed by 2-bit repeat counts of more zeros, 3 means another one follows
+        if (!count) {
+            uint32_t repeat;
+            do {
+                repeat = zstd_readForward(src, size, bit, 2);
+                bit += 2;
+                for (uint32_t i = 0; i < repeat && symbol < *symbols; i++) counts[symbol++] = 0;
+            } while (repeat == 3);
+        }
+    }
+
+    if (remaining != 1 || (bit + 7) / 8 > size) return 1;
+
+    *symbols = symbol;
+    *log = accuracy;
+    *used = (bit + 7) / 8;
+    return 0;
+}
+
+/**
+ * @brief Build an FSE decoding table from a distribution
+ * @param table The table, 1 << @p log entries
+ * @param counts Count of every symbol, -1 for "less than one"
+ * @param symbols Amount of symbols
+ * @param log Accuracy log
+ * @returns 0 on success, 1 if the distribution doesn't fill the table
+ */
+static int zstd_buildFse(zstd_fse_entry_t *table, const int16_t *counts, int symbols, int log) {
+    uint32_t size = 1u << log;
+    uint32_t high = size - 1;
+    uint16_t next[ZSTD_ML_SYMBOLS];
+
+    // "Less than one" symbols get a state each at the top
+    for (int s = 0; s < symbols; s++) {
+        if (counts[s] == -1) {
+            table[high--].symbol = s;
+            next[s] = 1;
+        } else {
+            next[s] = counts[s];
+        }
+    }
+
+    // The rest are spread over the other states
+    uint32_t step = (size >> 1) + (size >> 3) + 3;
+    uint32_t position = 0;
+    for (int s = 0; s < symbols; s++) {
+        for (int i = 0; i < counts[s]; i++) {
+            table[position].symbol = s;
+            do {
+                position = (position + step) & (size - 1);
+            } while (position > high);
+        }
+    }
+
+    if (position) return 1;
+
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t state = next[table[i].symbol]++;
+        int bits = log - (31 - __builtin_clz(state));
+        table[i].bits = bits;
+        table[i].base = (state << bits) - size;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a Huffman tree description and build the Huffman table from it
+ * @param z The tables
+ * @param src The description
+ * @param size Bytes available
+ * @param used Output for the size of the description
+ * @returns 0 on success, 1 if it's corrupt
+ */
+static int zstd_readHuffman(zstd_t *z, const uint8_t *src, size_t size, size_t *used) {
+    uint8_t weights[256];
+    int count = 0;
+
+    if (!size) return 1;
+    size_t header = src[0];
+
+    if (header >= 128) {
+        // Weights stored directly, 4 bits each
+        count = header - 127;
+        if (1 + (count + 1) / 2 > size) return 1;
+        for (int i = 0; i < count; i++) weights[i] = (i & 1) ? (src[1 + i / 2] & 15) : (src[1 + i / 2] >> 4);
+        *used = 1 + (count + 1) / 2;
+    } else {
+        // FSE compressed weights, with two states taking turns
+        if (1 + header > size) return 1;
+
+        int16_t counts[ZSTD_WEIGHT_SYMBOLS];
+        int symbols = ZSTD_WEIGHT_SYMBOLS, log;
+        size_t description;
+        zstd_fse_entry_t table[1 << ZSTD_WEIGHT_MAX_LOG];
+        if (zstd_readCounts(src + 1, header, counts, &symbols, &log, ZSTD_WEIGHT_MAX_LOG, &description)) return 1;
+        if (zstd_buildFse(table, counts, symbols, log)) return 1;
+
+        zstd_bits_t b;
+        if (zstd_bitsInit(&b, src + 1 + description, header - description)) return 1;
+
+        uint32_t state[2];
+        state[0] = zstd_read(&b, log);
+        state[1] = zstd_read(&b, log);
+
+        // It ends when the next state would need bits past the start, the other state still has a weight then
+        for (int turn = 0; ; turn ^= 1) {
+            if (count >= 254) return 1;
+
+            zstd_fse_entry_t *entry = &table[state[turn]];
+            weights[count++] = entry->symbol;
+            state[turn] = entry->base + zstd_read(&b, entry->bits);
+            zstd_reload(&b);
+
+            if (b.consumed > 64) {
+                weights[count++] = table[state[turn ^ 1]].symbol;
+                break;
+            }
+        }
+
+        *used = 1 + header;
+    }
+
+    // The last weight isn't stored, it's whatever makes the total a power of 2
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++) {
+        if (weights[i] > ZSTD_HUFFMAN_MAX_BITS) return 1;
+        if (weights[i]) total += 1u << (weights[i] - 1);
+    }
+
+    if (!total) return 1;
+
+    int bits = 32 - __builtin_clz(total);
+    if (bits > ZSTD_HUFFMAN_MAX_BITS) return 1;
+
+    uint32_t left = (1u << bits) - total;
+    if (left & (left - 1)) return 1;
+    weights[count++] = 32 - __builtin_clz(left);
+
+    // Longest codes first, each symbol takes up 1 << (weight - 1) entries
+    uint32_t start[ZSTD_HUFFMAN_MAX_BITS + 1] = { 0 };
+    for (int i = 0; i < count; i++) {
+        if (weights[i]) start[weights[i]] += 1u << (weights[i] - 1);
+    }
+
+    uint32_t position = 0;
+    for (int w = 1; w <= bits; w++) {
+        uint32_t length = start[w];
+        start[w] = position;
+        position += length;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int w = weights[i];
+        if (!w) continue;
+
+        zstd_huffman_entry_t entry = { .symbol = i, .bits = bits + 1 - w };
+        for (uint32_t j = 0; j < (1u << (w - 1)); j++) z->huffman[start[w] + j] = entry;
+        start[w] += 1u << (w - 1);
+    }
+
+    z->huffman_bits = bits;
+    return 0;
+}
+
+/**
+ * @brief Decode one Huffman coded stream of literals
+ * @returns 0 on success, 1 if the stream is corrupt
+ */
+static int zstd_huffmanStream(zstd_t *z, const uint8_t *src, size_t size, uint8_t *dest, size_t count) {
+    zstd_bits_t b;
+    if (zstd_bitsInit(&b, src, size)) return 1;
+
+    int bits = z->huffman_bits;
+    uint8_t *end = dest + count;
+
+    #define ZSTD_HUFFMAN_DECODE() do { \
+            zstd_huffman_entry_t entry = z->huffman[zstd_peek(&b, bits)]; \
+            *dest++ = entry.symbol; \
+            b.consumed += entry.bits; \
+        } while (0)
+
+    while (dest < end) {
+        zstd_reload(&b);
+
+        // 4 codes at a time while they're all in the container
+        if (b.consumed <= 64 - 4 * ZSTD_HUFFMAN_MAX_BITS && end - dest >= 4) {
+            ZSTD_HUFFMAN_DECODE();
+            ZSTD_HUFFMAN_DECODE();
+            ZSTD_HUFFMAN_DECODE();
+            ZSTD_HUFFMAN_DECODE();
+        } else {
+            ZSTD_HUFFMAN_DECODE();
+        }
+    }
+
+    #undef ZSTD_HUFFMAN_DECODE
+
+    return zstd_finished(&b) ? 0 : 1;
+}
+
+/**
+ * @brief Decode the literals section of a block into the literals buffer
+ * @param z The tables
+ * @param src The block
+ * @param size Size of the block
+ * @param count Output for the amount of literals
+ * @param used Output for the size of the literals section
+ * @returns 0 on success, 1 if it's corrupt
+ */
+static int zstd_literals(zstd_t *z, const uint8_t *src, size_t size, size_t *count, size_t *used) {
+    if (!size) return 1;
+
+    int type = src[0] & 3;
+    int format = (src[0] >> 2) & 3;
+    size_t header, regenerated;
+
+    if (type == ZSTD_LITERALS_RAW || type == ZSTD_LITERALS_RLE) {
+        // 5, 12 or 20 bits of size
+        header = (format == 1) ? 2 : (format == 3) ? 3 : 1;
+        if (header > size) return 1;
+
+        if (header == 1) regenerated = src[0] >> 3;
+        else if (header == 2) regenerated = (src[0] >> 4) | (src[1] << 4);
+        else regenerated = (src[0] >> 4) | (src[1] << 4) | ((size_t)src[2] << 12);
+
+        if (regenerated > ZSTD_BLOCK_MAX) return 1;
+
+        if (type == ZSTD_LITERALS_RAW) {
+            if (regenerated > size - header) return 1;
+            memcpy(z->literals, src + header, regenerated);
+            *used = header + regenerated;
+        } else {
+            if (header >= size) return 1;
+            memset(z->literals, src[header], regenerated);
+            *used = header + 1;
+        }
+
+        *count = regenerated;
+        return 0;
+    }
+
+    // Regenerated and compressed sizes of 10, 14 or 18 bits each
+    header = (format < 2) ? 3 : format + 2;
+    if (header > size) return 1;
+
+    uint64_t sizes = 0;
+    for (size_t i = 0; i < header; i++) sizes |= (uint64_t)src[i] << (8 * i);
+
+    int bits = (header == 3) ? 10 : (header == 4) ? 14 : 18;
+    regenerated = (sizes >> 4) & ((1u << bits) - 1);
+    size_t compressed = (sizes >> (4 + bits)) & ((1u << bits) - 1);
+    if (regenerated > ZSTD_BLOCK_MAX || compressed > size - header) return 1;
+
+    const uint8_t *p = src + header;
+    size_t left = compressed;
+
+    // Treeless literals use the table of the block before
+    if (type == ZSTD_LITERALS_COMPRESSED) {
+        size_t description;
+        if (zstd_readHuffman(z, p, left, &description)) return 1;
+        p += description;
+        left -= description;
+    } else if (!z->huffman_bits) {
+        return 1;
+    }
+
+    if (!format) {
+        if (zstd_huffmanStream(z, p, left, z->literals, regenerated)) return 1;
+    } else {
+        // Four streams after a jump table with the sizes of the first three, each has a quarter of the literals
+        if (left < 6) return 1;
+
+        size_t stream[4];
+        stream[0] = p[0] | (p[1] << 8);
+        stream[1] = p[2] | (p[3] << 8);
+        stream[2] = p[4] | (p[5] << 8);
+        p += 6;
+        left -= 6;
+
+        if (stream[0] + stream[1] + stream[2] > left) return 1;
+        stream[3] = left - stream[0] - stream[1] - stream[2];
+
+        size_t quarter = (regenerated + 3) / 4;
+        if (regenerated < 3 * quarter) return 1;
+
+        uint8_t *dest = z->literals;
+        for (int i = 0; i < 4; i++) {
+            size_t literals = (i < 3) ? quarter : regenerated - 3 * quarter;
+            if (zstd_huffmanStream(z, p, stream[i], dest, literals)) return 1;
+            p += stream[i];
+            dest += literals;
+        }
+    }
+
+    *count = regenerated;
+    *used = header + compressed;
+    return 0;
+}
+
+/**
+ * @brief Read the table for one of the sequence fields
+ * @param table The table
+ * @param mode ZSTD_MODE_xxx
+ * @param src Where its description would be
+ * @param size Bytes available
+ * @param used Output for the size of the description
+ * @param defaults Predefined distribution
+ * @param default_symbols Amount of symbols in @p defaults
+ * @param default_log Accuracy log of @p defaults
+ * @param symbols The most symbols the field has
+ * @param max_log Biggest accuracy log allowed
+ * @returns 0 on success, 1 if it's corrupt
+ */
+static int zstd_table(zstd_fse_t *table, int mode, const uint8_t *src, size_t size, size_t *used, const int16_t *defaults, int default_symbols, int default_log, int symbols, int max_log) {
+    int16_t counts[ZSTD_ML_SYMBOLS];
+    *used = 0;
+
+    switch (mode) {
+        case ZSTD_MODE_PREDEFINED:
+            table->log = default_log;
+            if (zstd_buildFse(table->entries, defaults, default_symbols, default_log)) return 1;
+            break;
+
+        case ZSTD_MODE_RLE:
+            // Every sequence has the same code
+            if (!size || src[0] >= symbols) return 1;
+            table->log = 0;
+            table->entries[0] = (zstd_fse_entry_t){ .symbol = src[0], .bits = 0, .base = 0 };
+            *used = 1;
+            break;
+
+        case ZSTD_MODE_FSE:
+            if (zstd_readCounts(src, size, counts, &symbols, &table->log, max_log, used)) return 1;
+            if (zstd_buildFse(table->entries, counts, symbols, table->log)) return 1;
+            break;
+
+        case ZSTD_MODE_REPEAT:
+            return table->valid ? 0 : 1;
+    }
+
+    table->valid = 1;
+    return 0;
+}
+
+/**
+ * @brief Copy 8 bytes at a time, going up to 7 bytes past the end if there's room for it before @p end
+ * @param dest Where to copy to
+ * @param src Where to copy from, at least 8 bytes before @p dest if they overlap
+ * @param size The amount of bytes
+ * @param end The end of the output
+ */
+static inline void zstd_copy(uint8_t *dest, const uint8_t *src, size_t size, const uint8_t *end) {
+    uint8_t *stop = dest + size;
+
+    if (end - stop >= 8) {
+        for (; dest < stop; dest += 8, src += 8) {
+            uint64_t word;
+            __builtin_memcpy(&word, src, 8);
+            __builtin_memcpy(dest, &word, 8);
+        }
+
+        return;
+    }
+
+    for (; size >= 8; size -= 8, dest += 8, src += 8) {
+        uint64_t word;
+        __builtin_memcpy(&word, src, 8);
+        __builtin_memcpy(dest, &word, 8);
+    }
+
+    while (size--) *dest++ = *src++;
+}
+
+/**
+ * @brief Decode the sequences section of a block and carry it out
+ * @param z The tables, with the literals of the block
+ * @param src The sequences section
+ * @param size Size of the section
+ * @param literals Amount of literals in the literals buffer
+ * @returns 0 on success, 1 if it's corrupt
+ */
+static int zstd_sequences(zstd_t *z, const uint8_t *src, size_t size, size_t literals, uint8_t *dest, uint64_t *out, uint64_t dest_size, int partial) {
+    const uint8_t *p = src;
+    const uint8_t *end = src + size;
+    if (p >= end) return 1;
+
+    size_t count = *p++;
+    if (count == 255) {
+        if (end - p < 2) return 1;
+        count = (p[0] | (p[1] << 8)) + 0x7F00;
+        p += 2;
+    } else if (count >= 128) {
+        if (end - p < 1) return 1;
+        count = ((count - 128) << 8) | *p++;
+    }
+
+    uint8_t *op = dest + *out;
+    uint8_t *oend = dest + dest_size;
+    const uint8_t *lit = z->literals;
+    const uint8_t *lend = z->literals + literals;
+
+    if (count) {
+        if (p >= end) return 1;
+        int modes = *p++;
+        if (modes & 3) return 1;
+
+        size_t used;
+        if (zstd_table(&z->ll, (modes >> 6) & 3, p, end - p, &used, zstd_llDefault, ZSTD_LL_SYMBOLS, 6, ZSTD_LL_SYMBOLS, ZSTD_LL_MAX_LOG)) return 1;
+        p += used;
+        if (zstd_table(&z->of, (modes >> 4) & 3, p, end - p, &used, zstd_ofDefault, 29, 5, ZSTD_OF_SYMBOLS, ZSTD_OF_MAX_LOG)) return 1;
+        p += used;
+        if (zstd_table(&z->ml, (modes >> 2) & 3, p, end - p, &used, zstd_mlDefault, ZSTD_ML_SYMBOLS, 6, ZSTD_ML_SYMBOLS, ZSTD_ML_MAX_LOG)) return 1;
+        p += used;
+
+        zstd_bits_t b;
+        if (zstd_bitsInit(&b, p, end - p)) return 1;
+
+        uint32_t ll_state = zstd_read(&b, z->ll.log);
+        uint32_t of_state = zstd_read(&b, z->of.log);
+        uint32_t ml_state = zstd_read(&b, z->ml.log);
+
+        for (size_t i = 0; i < count; i++) {
+            zstd_fse_entry_t ll = z->ll.entries[ll_state];
+            zstd_fse_entry_t of = z->of.entries[of_state];
+            zstd_fse_entry_t ml = z->ml.entries[ml_state];
+
+            // Offset, match length and literal length, reloading in between so up to 31 + 16 + 16 bits fit
+            zstd_reload(&b);
+            uint64_t offset = ((uint64_t)1 << of.symbol) + zstd_read(&b, of.symbol);
+            zstd_reload(&b);
+            size_t match = zstd_mlBase[ml.symbol] + zstd_read(&b, zstd_mlBits[ml.symbol]);
+            size_t length = zstd_llBase[ll.symbol] + zstd_read(&b, zstd_llBits[ll.symbol]);
+
+            // Offsets 1 to 3 pick one of the repeated offsets, shifted by one if there are no literals
+            if (offset > 3) {
+                offset -= 3;
+                z->repeat[2] = z->repeat[1];
+                z->repeat[1] = z->repeat[0];
+                z->repeat[0] = offset;
+            } else {
+                int index = offset - 1 + (length == 0);
+                if (!index) {
+                    offset = z->repeat[0];
+                } else {
+                    offset = (index == 3) ? z->repeat[0] - 1 : z->repeat[index];
+                    if (index != 1) z->repeat[2] = z->repeat[1];
+                    z->repeat[1] = z->repeat[0];
+                    z->repeat[0] = offset;
+                }
+            }
+
+            // The last sequence leaves the states alone
+            if (i + 1 < count) {
+                zstd_reload(&b);
+                ll_state = ll.base + zstd_read(&b, ll.bits);
+                ml_state = ml.base + zstd_read(&b, ml.bits);
+                of_state = of.base + zstd_read(&b, of.bits);
+            }
+
+            if (length > (size_t)(lend - lit) || !offset) return 1;
+
+            // A partial decompressor fills up what's left and stops
+            int full = 0;
+            if (length + match > (size_t)(oend - op)) {
+                if (!partial) return 1;
+                full = 1;
+                if (length > (size_t)(oend - op)) length = oend - op;
+                match = (oend - op) - length;
+            }
+
+            zstd_copy(op, lit, length, oend);
+            op += length;
+            lit += length;
+
+            if (match) {
+                if (offset > (uint64_t)(op - dest)) return 1;
+
+                // 8 bytes at a time is only safe if the source is at least 8 bytes back, otherwise it repeats a short pattern
+                const uint8_t *from = op - offset;
+                if (offset >= 8) {
+                    zstd_copy(op, from, match, oend);
+                } else {
+                    for (size_t j = 0; j < match; j++) op[j] = from[j];
+                }
+
+                op += match;
+            }
+
+            if (full) {
+                *out = dest_size;
+                return 0;
+            }
+        }
+
+        if (!zstd_finished(&b)) return 1;
+    } else if (p != end) {
+        return 1;
+    }
+
+    // Whatever literals are left come last
+    size_t length = lend - lit;
+    if (length > (size_t)(oend - op)) {
+        if (!partial) return 1;
+        length = oend - op;
+    }
+
+    zstd_copy(op, lit, length, oend);
+    *out = op + length - dest;
+    return 0;
+}
+
+/**
+ * @brief Get ready for a new frame
+ * @param z The tables
+ */
+void zstd_reset(zstd_t *z) {
+    z->huffman_bits = 0;
+    z->ll.valid = 0;
+    z->of.valid = 0;
+    z->ml.valid = 0;
+    z->repeat[0] = 1;
+    z->repeat[1] = 4;
+    z->repeat[2] = 8;
+}
+
+/**
+ * @brief Decompress one compressed zstd block
+ * @param z Tables from the blocks before
+ * @param src The block
+ * @param size Size of the block
+ * @param dest The whole output of the frame, matches can reach back anywhere in it
+ * @param out Bytes written to @p dest so far, advanced past the block
+ * @param dest_size Size of @p dest
+ * @param partial Stop quietly once @p dest is full instead of failing
+ * @returns 0 on success, 1 if the block is corrupt
+ */
+int zstd_decodeBlock(zstd_t *z, const uint8_t *src, size_t size, uint8_t *dest, uint64_t *out, uint64_t dest_size, int partial) {
+    size_t literals, used;
+    if (zstd_literals(z, src, size, &literals, &used)) return 1;
+    return zstd_sequences(z, src + used, size - used, literals, dest, out, dest_size, partial);
+}
@@ -0,0 +1,169 @@
+/**
+ * @file tests/bench_decompress.c
+ * @brief Measures the loader's LZ4 and zstd decompressor (polyaniline/decompress.c), and what it's worth at different read speeds
+ *
+ * Every file from mkcompressed.py is decompressed the way file.c does it, in 1 MB chunks, and timed.
+ * Loading a file takes about (file size / read speed) + decompression time, or the larger of the two when
+ * the async loader overlaps them, so that's worked out for a few read speeds and compared against loading
+ * the original. Only the decompression is measured here, the read speeds are assumptions: around 20 MB/s
+ * for USB 2 and slow virtual media, 100 MB/s for a virtual disk, 500 MB/s for a SATA SSD.
+ *
+ * decompress.c, zstd.c, hash.c and platform/efi/memory.c are included directly.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../platform/efi/memory.c"
+#include "../polyaniline/decompress.c"
+#include "../polyaniline/zstd.c"
+#undef LOG
+#include "../polyaniline/hash.c"
+
+/* Where the Makefile puts the files */
+#ifndef DECOMPRESS_FILES
+#define DECOMPRESS_FILES    "../build-output/tests/decompress"
+#endif
+
+/* Longest line in the list */
+#define LINE_LENGTH         1024
+
+/* Chunk size, like file_getChunkSize with a small file */
+#define BENCH_CHUNK         (1024 * 1024)
+
+/* How long each file is decompressed over and over for, the best run counts */
+#define BENCH_TIME          300000000ULL
+
+/* Files smaller than this aren't worth timing */
+#define BENCH_MINIMUM       (64 * 1024)
+
+// Read speeds in MB/s
+static const int bench_speeds[] = { 20, 100, 500 };
+#define BENCH_SPEEDS        (sizeof(bench_speeds) / sizeof(*bench_speeds))
+
+/**** STUBS ****/
+
+void *platform_allocate(size_t size) {
+    return malloc(size);
+}
+
+void platform_free(void *ptr) {
+    free(ptr);
+}
+
+void log_write(int level, const char *format, int count, const uint64_t *args) {
+}
+
+/**** BENCHMARK ****/
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief Decompress a file once
+ * @returns Nanoseconds it took, or 0 if it failed
+ */
+static uint64_t bench_run(const uint8_t *data, size_t size, int format, uint8_t *dest, uint64_t dest_size) {
+    uint64_t start = test_time();
+
+    decompress_t d;
+    platform_consumer_t *consumer = decompress_consumer(&d, format, dest, dest_size);
+    int error = consumer->start(consumer, size);
+    for (size_t at = 0; at < size && !error; at += BENCH_CHUNK) {
+        error = consumer->consume(consumer, data + at, (size - at < BENCH_CHUNK) ? size - at : BENCH_CHUNK);
+    }
+
+    if (!error && consumer->finish(consumer)) error = 1;
+    if (error) consumer->release(consumer);
+    uint64_t end = test_time();
+    return error ? 0 : (end - start ? end - start : 1);
+}
+
+int main() {
+    memory_init();
+
+    FILE *list = fopen(DECOMPRESS_FILES "/list", "r");
+    if (!list) {
+        printf("No list in " DECOMPRESS_FILES ", run mkcompressed.py\n");
+        return 1;
+    }
+
+    printf("%-20s %8s %8s %10s", "file", "size KB", "ratio", "MB/s");
+    for (size_t s = 0; s < BENCH_SPEEDS; s++) printf("   %4d MB/s: raw/packed ms", bench_speeds[s]);
+    printf("\n");
+
+    char line[LINE_LENGTH];
+    while (fgets(line, sizeof(line), list)) {
+        char compressed_name[LINE_LENGTH], original_name[LINE_LENGTH], kind[LINE_LENGTH];
+        if (sscanf(line, "%s\t%s\t%s", compressed_name, original_name, kind) != 3 || !strcmp(kind, "unsupported")) continue;
+
+        char path[LINE_LENGTH * 2];
+        size_t size, original_size;
+        snprintf(path, sizeof(path), "%s/%s", DECOMPRESS_FILES, compressed_name);
+        uint8_t *data = read_file(path, &size);
+        snprintf(path, sizeof(path), "%s/%s", DECOMPRESS_FILES, original_name);
+        uint8_t *original = read_file(path, &original_size);
+
+        if (data && original && original_size >= BENCH_MINIMUM) {
+            uint64_t content_size = 0;
+            int format = decompress_detect(data, (size < DECOMPRESS_HEADER_SIZE) ? size : DECOMPRESS_HEADER_SIZE, compressed_name, &content_size);
+            uint8_t *dest = malloc(content_size);
+
+            // Touch the output first, so page faults aren't timed
+            memset(dest, 0, content_size);
+
+            uint64_t best = UINT64_MAX, total = 0;
+            while (total < BENCH_TIME) {
+                uint64_t ns = bench_run(data, size, format, dest, content_size);
+                if (!ns) break;
+                if (ns < best) best = ns;
+                total += ns;
+            }
+
+            if (best == UINT64_MAX || memcmp(dest, original, original_size)) {
+                printf("%-20s failed\n", compressed_name);
+            } else {
+                printf("%-20s %8zu %8.2f %10.0f", compressed_name, original_size / 1024, (double)original_size / size, original_size * 1e3 / best);
+
+                // Serial (read, then decompress) for the compressed file, the async loader overlaps them
+                for (size_t s = 0; s < BENCH_SPEEDS; s++) {
+                    double raw = original_size / (bench_speeds[s] * 1e3);
+                    double packed = size / (bench_speeds[s] * 1e3) + best / 1e6;
+                    printf("   %13.1f / %8.1f", raw, packed);
+                }
+
+                printf("\n");
+            }
+
+            free(dest);
+        }
+
+        free(data);
+        free(original);
+    }
+
+    fclose(list);
+    return 0;
+}
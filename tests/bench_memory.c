@@ -0,0 +1,205 @@
+/**
+ * @file tests/bench_memory.c
+ * @brief Measures the thresholds the copy/fill engine (platform/efi/memory.c) switches methods at
+ *
+ * Two things are measured:
+ *  - Where rep movsb/stosb and the vector loops start beating the word loop (MEMORY_SMALL_THRESHOLD and
+ *    MEMORY_SMALL_FILL_THRESHOLD).
+ *    Small buffers, hot in the cache, timed per call.
+ *  - Where non-temporal stores start paying off (memory_stream_threshold, half the last level cache up to
+ *    MEMORY_STREAM_MAXIMUM).
+ *    Copy throughput for each size, and how long it takes afterwards to read back a working set that
+ *    was in the cache before the copy, which is what streaming is supposed to protect.
+ *
+ * memory.c is included directly so every method can be called on its own.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../platform/efi/memory.c"
+
+/* How long each small measurement runs for */
+#define BENCH_TIME          20000000ULL
+
+/* Working set that should survive a copy, read back after every large copy */
+#define BENCH_WORKING_SET   (256 * 1024)
+
+/* Biggest copy measured */
+#define BENCH_LARGE_MAX     (64 * 1024 * 1024)
+
+// The methods, as platform_copyMemory/platform_fillMemory would call them
+enum { METHOD_WORDS, METHOD_REP, METHOD_SSE2, METHOD_AVX2, METHOD_SSE2_NT, METHOD_AVX2_NT, METHOD_COUNT };
+static const char *bench_methods[METHOD_COUNT] = { "words", "rep", "sse2", "avx2", "sse2-nt", "avx2-nt" };
+
+static uint8_t *bench_src;
+static uint8_t *bench_dest;
+static uint8_t *bench_working_set;
+static volatile uint64_t bench_sink;
+
+static void bench_copy(int method, uint8_t *dest, const uint8_t *src, size_t size) {
+    switch (method) {
+        case METHOD_WORDS: memory_copySmall(dest, src, size); break;
+        case METHOD_REP: __asm__ volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(size) :: "memory"); break;
+        case METHOD_SSE2: memory_copySSE2(dest, src, size, 0); break;
+        case METHOD_AVX2: memory_copyAVX2(dest, src, size, 0); break;
+        case METHOD_SSE2_NT: memory_copySSE2(dest, src, size, 1); break;
+        case METHOD_AVX2_NT: memory_copyAVX2(dest, src, size, 1); break;
+    }
+}
+
+static void bench_fill(int method, uint8_t *dest, size_t size) {
+    switch (method) {
+        case METHOD_WORDS: memory_fillSmall(dest, 0x5A, size); break;
+        case METHOD_REP: __asm__ volatile ("rep stosb" : "+D"(dest), "+c"(size) : "a"(0x5A) : "memory"); break;
+        case METHOD_SSE2: memory_fillSSE2(dest, 0x5A, size, 0); break;
+        case METHOD_AVX2: memory_fillAVX2(dest, 0x5A, size, 0); break;
+        case METHOD_SSE2_NT: memory_fillSSE2(dest, 0x5A, size, 1); break;
+        case METHOD_AVX2_NT: memory_fillAVX2(dest, 0x5A, size, 1); break;
+    }
+}
+
+/**
+ * @brief Check which methods this CPU can run
+ */
+static int bench_available(int method) {
+    uint32_t a, b, c, d;
+    cpu_cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 7) return method != METHOD_AVX2 && method != METHOD_AVX2_NT;
+
+    cpu_cpuid(7, 0, &a, &b, &c, &d);
+    if (method == METHOD_AVX2 || method == METHOD_AVX2_NT) return (b & CPU_FEATURE7_AVX2) ? 1 : 0;
+    return 1;
+}
+
+/**
+ * @brief Time one small operation, hot in the cache
+ * @returns Nanoseconds per call
+ */
+static double bench_small(int method, int fill, size_t size) {
+    uint64_t calls = 0;
+    uint64_t start = test_time();
+    uint64_t now;
+
+    do {
+        for (int i = 0; i < 64; i++) {
+            // The destination is aligned and the source isn't, like most copies in the loader
+            if (fill) bench_fill(method, bench_dest, size);
+            else bench_copy(method, bench_dest, bench_src + 1, size);
+        }
+
+        calls += 64;
+    } while ((now = test_time()) - start < BENCH_TIME);
+
+    return (double)(now - start) / calls;
+}
+
+/**
+ * @brief Read the working set, which pulls it into the cache
+ * @returns Nanoseconds it took
+ */
+static uint64_t bench_readWorkingSet() {
+    uint64_t start = test_time();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BENCH_WORKING_SET; i += 64) sum += bench_working_set[i];
+    bench_sink = sum;
+    return test_time() - start;
+}
+
+/**
+ * @brief Time one large copy with a warm working set around it
+ * @param reload Output for how long reading the working set back took afterwards
+ * @returns Bytes per nanosecond (GB/s)
+ */
+static double bench_large(int method, size_t size, double *reload) {
+    uint64_t copy_time = 0, reload_time = 0;
+    int runs = (size >= 16 * 1024 * 1024) ? 3 : 9;
+
+    for (int run = 0; run < runs; run++) {
+        bench_readWorkingSet();
+        bench_readWorkingSet();
+
+        uint64_t start = test_time();
+        bench_copy(method, bench_dest, bench_src + 1, size);
+        copy_time += test_time() - start;
+
+        reload_time += bench_readWorkingSet();
+    }
+
+    *reload = (double)reload_time / runs;
+    return (double)size * runs / copy_time;
+}
+
+int main() {
+    memory_init();
+
+    bench_src = aligned_alloc(4096, BENCH_LARGE_MAX + 4096);
+    bench_dest = aligned_alloc(4096, BENCH_LARGE_MAX + 4096);
+    bench_working_set = aligned_alloc(4096, BENCH_WORKING_SET);
+    for (size_t i = 0; i < BENCH_LARGE_MAX + 4096; i++) bench_src[i] = (uint8_t)(i * 31);
+    memset(bench_dest, 1, BENCH_LARGE_MAX + 4096);
+    memset(bench_working_set, 2, BENCH_WORKING_SET);
+
+    printf("CPU: erms %d, vector %s, largest cache %zu KB, stream threshold %zu KB\n",
+        memory_erms, (memory_vector == MEMORY_VECTOR_AVX2) ? "avx2" : "sse2",
+        memory_cacheSize() / 1024, memory_stream_threshold / 1024);
+    printf("Word loop below %zu bytes for copies, %zu bytes for fills\n\n", memory_small_copy, memory_small_fill);
+
+    static const size_t small_sizes[] = { 1, 4, 8, 12, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 1024, 2048, 4096 };
+    for (int fill = 0; fill < 2; fill++) {
+        printf("%s, ns per call (hot)\n%6s", fill ? "Fill" : "Copy", "bytes");
+        for (int m = METHOD_WORDS; m <= METHOD_AVX2; m++) printf(" %9s", bench_methods[m]);
+        printf("\n");
+
+        size_t crossover = 0;
+        for (size_t s = 0; s < sizeof(small_sizes) / sizeof(*small_sizes); s++) {
+            size_t size = small_sizes[s];
+            printf("%6zu", size);
+
+            double words = 0, best_other = 0;
+            for (int m = METHOD_WORDS; m <= METHOD_AVX2; m++) {
+                if (!bench_available(m)) {
+                    printf(" %9s", "-");
+                    continue;
+                }
+
+                double ns = bench_small(m, fill, size);
+                printf(" %9.1f", ns);
+                if (m == METHOD_WORDS) words = ns;
+                else if (!best_other || ns < best_other) best_other = ns;
+            }
+
+            printf("\n");
+            if (!crossover && best_other < words) crossover = size;
+        }
+
+        printf("Something beats the word loop from %zu bytes\n\n", crossover);
+    }
+
+    // What the engine would use below the stream threshold, and the non-temporal version of it
+    int cached = memory_erms ? METHOD_REP : (memory_vector == MEMORY_VECTOR_AVX2) ? METHOD_AVX2 : METHOD_SSE2;
+    int streamed = (memory_vector == MEMORY_VECTOR_AVX2) ? METHOD_AVX2_NT : METHOD_SSE2_NT;
+
+    printf("Copy, GB/s and ns to read a %d KB working set back afterwards\n", BENCH_WORKING_SET / 1024);
+    printf("%9s %9s %9s %11s %11s\n", "KB", bench_methods[cached], bench_methods[streamed], "reload", "reload-nt");
+
+    size_t crossover = 0;
+    for (size_t size = 64 * 1024; size <= BENCH_LARGE_MAX; size *= 2) {
+        double reload_cached, reload_streamed;
+        double gbs_cached = bench_large(cached, size, &reload_cached);
+        double gbs_streamed = bench_large(streamed, size, &reload_streamed);
+        printf("%9zu %9.2f %9.2f %11.0f %11.0f\n", size / 1024, gbs_cached, gbs_streamed, reload_cached, reload_streamed);
+
+        if (!crossover && gbs_streamed >= gbs_cached) crossover = size;
+    }
+
+    printf("Non-temporal stores are at least as fast from %zu KB\n", crossover / 1024);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file tests/bench_string.c
+ * @brief Times the minilib string functions against plain byte loops
+ *
+ * The byte loops are what minilib had before the word-at-a-time versions (strlen, strcpy)
+ * or the obvious way to write the ones it didn't have. Both are built with the same flags as the
+ * loader, see the Makefile.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+size_t minilib_strlen(const char *s);
+size_t minilib_strnlen(const char *s, size_t maxlen);
+char *minilib_strcpy(char *dest, const char *src);
+void *minilib_memchr(const void *ptr, int value, size_t size);
+int minilib_memcmp(const void *a, const void *b, size_t size);
+void *minilib_memmove(void *dest, const void *src, size_t size);
+
+/* How long each measurement runs for */
+#define BENCH_TIME      50000000ULL
+
+/* The string lengths measured */
+static const size_t bench_sizes[] = { 7, 32, 256, 4096 };
+
+/* Stops the compiler from throwing results away */
+static volatile size_t bench_sink;
+
+static char bench_source[8192];
+static char bench_dest[8192];
+
+/**** BYTE LOOPS ****/
+
+static size_t __attribute__((noinline)) byte_strlen(const char *s) {
+    size_t out = 0;
+    while (*s++) out++;
+    return out;
+}
+
+static size_t __attribute__((noinline)) byte_strnlen(const char *s, size_t maxlen) {
+    size_t out = 0;
+    while (out < maxlen && s[out]) out++;
+    return out;
+}
+
+static char * __attribute__((noinline)) byte_strcpy(char *dest, const char *src) {
+    char *d = dest;
+    while ((*d = *src)) {
+        d++;
+        src++;
+    }
+
+    return dest;
+}
+
+static void * __attribute__((noinline)) byte_memchr(const void *ptr, int value, size_t size) {
+    const unsigned char *p = ptr;
+    for (; size; size--, p++) {
+        if (*p == (unsigned char)value) return (void*)p;
+    }
+
+    return NULL;
+}
+
+static int __attribute__((noinline)) byte_memcmp(const void *a, const void *b, size_t size) {
+    const unsigned char *x = a, *y = b;
+    for (; size; size--, x++, y++) {
+        if (*x != *y) return *x - *y;
+    }
+
+    return 0;
+}
+
+static void * __attribute__((noinline)) byte_memmove(void *dest, const void *src, size_t size) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    if (d < s) {
+        for (size_t i = 0; i < size; i++) d[i] = s[i];
+    } else {
+        for (size_t i = size; i; i--) d[i - 1] = s[i - 1];
+    }
+
+    return dest;
+}
+
+/**** BENCHMARK ****/
+
+// One call of a function on a string of some length, with its source shifted by 3 so nothing starts aligned
+typedef void (*bench_call_t)(int minilib, size_t size);
+
+static void call_strlen(int minilib, size_t size) {
+    bench_sink = minilib ? minilib_strlen(bench_source + 3) : byte_strlen(bench_source + 3);
+}
+
+static void call_strnlen(int minilib, size_t size) {
+    bench_sink = minilib ? minilib_strnlen(bench_source + 3, size * 2) : byte_strnlen(bench_source + 3, size * 2);
+}
+
+static void call_strcpy(int minilib, size_t size) {
+    bench_sink = (size_t)(minilib ? minilib_strcpy(bench_dest + 1, bench_source + 3) : byte_strcpy(bench_dest + 1, bench_source + 3));
+}
+
+static void call_memchr(int minilib, size_t size) {
+    bench_sink = (size_t)(minilib ? minilib_memchr(bench_source + 3, 0, size + 1) : byte_memchr(bench_source + 3, 0, size + 1));
+}
+
+static void call_memcmp(int minilib, size_t size) {
+    bench_sink = minilib ? minilib_memcmp(bench_source + 3, bench_dest + 1, size) : byte_memcmp(bench_source + 3, bench_dest + 1, size);
+}
+
+static void call_memmove(int minilib, size_t size) {
+    bench_sink = (size_t)(minilib ? minilib_memmove(bench_source + 5, bench_source + 3, size) : byte_memmove(bench_source + 5, bench_source + 3, size));
+}
+
+/**
+ * @brief Time a function, as many calls as fit in BENCH_TIME
+ * @returns Nanoseconds per call
+ */
+static double bench_run(bench_call_t call, int minilib, size_t size) {
+    uint64_t calls = 0;
+    uint64_t start = test_time();
+    uint64_t now;
+
+    do {
+        for (int i = 0; i < 256; i++) call(minilib, size);
+        calls += 256;
+    } while ((now = test_time()) - start < BENCH_TIME);
+
+    return (double)(now - start) / calls;
+}
+
+int main() {
+    static const struct {
+        const char *name;
+        bench_call_t call;
+    } functions[] = {
+        { "strlen", call_strlen },
+        { "strnlen", call_strnlen },
+        { "strcpy", call_strcpy },
+        { "memchr", call_memchr },
+        { "memcmp", call_memcmp },
+        { "memmove", call_memmove },
+    };
+
+    printf("%-8s %6s %12s %12s %8s\n", "function", "bytes", "bytes ns", "minilib ns", "speedup");
+
+    for (size_t f = 0; f < sizeof(functions) / sizeof(*functions); f++) {
+        for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(*bench_sizes); s++) {
+            size_t size = bench_sizes[s];
+
+            // A string of the right length, and an equal copy of it for memcmp
+            memset(bench_source, 'a', sizeof(bench_source));
+            bench_source[3 + size] = 0;
+            memcpy(bench_dest + 1, bench_source + 3, size + 1);
+
+            double bytes = bench_run(functions[f].call, 0, size);
+            double words = bench_run(functions[f].call, 1, size);
+            printf("%-8s %6zu %12.1f %12.1f %7.2fx\n", functions[f].name, size, bytes, words, bytes / words);
+
+            // memmove moves the string along, put it back
+            memset(bench_source, 'a', sizeof(bench_source));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file tests/include/efi.h
+ * @brief Just enough of GNU-EFI's efi.h to build EFI platform code for the host tests
+ *
+ * Protocol functions use the Microsoft calling convention like real firmware, and uefi_call_wrapper
+ * calls them directly, like GNU-EFI does when the compiler knows about ms_abi.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_TESTS_EFI_H
+#define POLYANILINE_TESTS_EFI_H
+
+/**** INCLUDES ****/
+#include <stdint.h>
+#include <stddef.h>
+
+/**** DEFINITIONS ****/
+
+#define EFIAPI                      __attribute__((ms_abi))
+#define uefi_call_wrapper(func, va_num, ...) func(__VA_ARGS__)
+
+#define EFIERR(a)                   (0x8000000000000000ULL | (a))
+#define EFI_ERROR(a)                (((int64_t)(a)) < 0)
+
+#define EFI_SUCCESS                 0
+#define EFI_WARN_DELETE_FAILURE     2
+#define EFI_UNSUPPORTED             EFIERR(3)
+#define EFI_BUFFER_TOO_SMALL        EFIERR(5)
+#define EFI_DEVICE_ERROR            EFIERR(7)
+#define EFI_WRITE_PROTECTED         EFIERR(8)
+#define EFI_OUT_OF_RESOURCES        EFIERR(9)
+#define EFI_NOT_FOUND               EFIERR(14)
+
+#define EFI_PAGE_SIZE               4096
+#define EFI_PAGE_SHIFT              12
+#define EFI_SIZE_TO_PAGES(a)        (((a) >> EFI_PAGE_SHIFT) + ((a) & 0xFFF ? 1 : 0))
+
+#define EFI_FILE_MODE_READ          1ULL
+#define EFI_FILE_READ_ONLY          1ULL
+#define EFI_FILE_PROTOCOL_REVISION  0x00010000
+
+#define EFI_FILE_INFO_ID            { 0x9576e92, 0x6d3f, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } }
+#define EFI_BLOCK_IO_PROTOCOL_GUID  { 0x964e5b21, 0x6459, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } }
+
+/**** TYPES ****/
+
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef uint32_t UINT32;
+typedef uint16_t UINT16;
+typedef int16_t INT16;
+typedef uint8_t UINT8;
+typedef uint16_t CHAR16;
+typedef uint64_t UINTN;
+typedef int64_t INTN;
+typedef void VOID;
+typedef uint8_t BOOLEAN;
+
+typedef UINTN EFI_STATUS;
+typedef UINT64 EFI_PHYSICAL_ADDRESS;
+typedef UINT64 EFI_LBA;
+typedef void *EFI_HANDLE;
+typedef void *EFI_EVENT;
+
+typedef struct {
+    UINT32 Data1;
+    UINT16 Data2;
+    UINT16 Data3;
+    UINT8 Data4[8];
+} EFI_GUID;
+
+typedef enum { AllocateAnyPages, AllocateMaxAddress, AllocateAddress } EFI_ALLOCATE_TYPE;
+typedef enum { EfiReservedMemoryType, EfiLoaderCode, EfiLoaderData } EFI_MEMORY_TYPE;
+
+typedef struct {
+    UINT16 Year;
+    UINT8 Month, Day, Hour, Minute, Second, Pad1;
+    UINT32 Nanosecond;
+    INT16 TimeZone;
+    UINT8 Daylight, Pad2;
+} EFI_TIME;
+
+// Only the boot services the tested code calls, everything else is left out
+typedef struct {
+    EFI_STATUS (EFIAPI *AllocatePages)(EFI_ALLOCATE_TYPE, EFI_MEMORY_TYPE, UINTN, EFI_PHYSICAL_ADDRESS*);
+    EFI_STATUS (EFIAPI *FreePages)(EFI_PHYSICAL_ADDRESS, UINTN);
+    EFI_STATUS (EFIAPI *HandleProtocol)(EFI_HANDLE, EFI_GUID*, VOID**);
+} EFI_BOOT_SERVICES;
+
+typedef struct {
+    UINT32 Revision;
+    EFI_HANDLE ParentHandle;
+    VOID *SystemTable;
+    EFI_HANDLE DeviceHandle;
+} EFI_LOADED_IMAGE;
+
+typedef struct {
+    UINT32 MediaId;
+    BOOLEAN RemovableMedia, MediaPresent, LogicalPartition, ReadOnly, WriteCaching;
+    UINT32 BlockSize;
+    UINT32 IoAlign;
+    EFI_LBA LastBlock;
+} EFI_BLOCK_IO_MEDIA;
+
+typedef struct _EFI_BLOCK_IO_PROTOCOL {
+    UINT64 Revision;
+    EFI_BLOCK_IO_MEDIA *Media;
+    EFI_STATUS (EFIAPI *Reset)(struct _EFI_BLOCK_IO_PROTOCOL*, BOOLEAN);
+    EFI_STATUS (EFIAPI *ReadBlocks)(struct _EFI_BLOCK_IO_PROTOCOL*, UINT32, EFI_LBA, UINTN, VOID*);
+} EFI_BLOCK_IO_PROTOCOL;
+
+typedef struct _EFI_FILE_PROTOCOL {
+    UINT64 Revision;
+    EFI_STATUS (EFIAPI *Open)(struct _EFI_FILE_PROTOCOL*, struct _EFI_FILE_PROTOCOL**, CHAR16*, UINT64, UINT64);
+    EFI_STATUS (EFIAPI *Close)(struct _EFI_FILE_PROTOCOL*);
+    EFI_STATUS (EFIAPI *Delete)(struct _EFI_FILE_PROTOCOL*);
+    EFI_STATUS (EFIAPI *Read)(struct _EFI_FILE_PROTOCOL*, UINTN*, VOID*);
+    EFI_STATUS (EFIAPI *Write)(struct _EFI_FILE_PROTOCOL*, UINTN*, VOID*);
+    EFI_STATUS (EFIAPI *GetPosition)(struct _EFI_FILE_PROTOCOL*, UINT64*);
+    EFI_STATUS (EFIAPI *SetPosition)(struct _EFI_FILE_PROTOCOL*, UINT64);
+    EFI_STATUS (EFIAPI *GetInfo)(struct _EFI_FILE_PROTOCOL*, EFI_GUID*, UINTN*, VOID*);
+    EFI_STATUS (EFIAPI *SetInfo)(struct _EFI_FILE_PROTOCOL*, EFI_GUID*, UINTN, VOID*);
+    EFI_STATUS (EFIAPI *Flush)(struct _EFI_FILE_PROTOCOL*);
+} EFI_FILE_PROTOCOL;
+
+typedef struct {
+    UINT64 Size;
+    UINT64 FileSize;
+    UINT64 PhysicalSize;
+    EFI_TIME CreateTime, LastAccessTime, ModificationTime;
+    UINT64 Attribute;
+    CHAR16 FileName[1];
+} EFI_FILE_INFO;
+
+#define SIZE_OF_EFI_FILE_INFO       offsetof(EFI_FILE_INFO, FileName)
+
+#endif
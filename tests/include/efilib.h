@@ -0,0 +1,23 @@
+/**
+ * @file tests/include/efilib.h
+ * @brief Just enough of GNU-EFI's efilib.h for the host tests
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_TESTS_EFILIB_H
+#define POLYANILINE_TESTS_EFILIB_H
+
+/**** INCLUDES ****/
+#include <efi.h>
+
+/**** VARIABLES ****/
+
+extern EFI_BOOT_SERVICES *BS;
+
+#endif
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+# mkcompressed.py
+# Builds compressed files for test_decompress and bench_decompress with the lz4 and zstd tools
+#
+# Usage: mkcompressed.py <directory>
+#
+# Writes a few originals, copies of them compressed in different ways and <directory>/list, with one
+# "compressed<TAB>original<TAB>lz4|zstd|unsupported" line per copy. "unsupported" ones have to be refused
+# by decompress_detect. A tool that isn't installed is skipped with a warning, its copies just aren't listed.
+
+import os
+import random
+import shutil
+import subprocess
+import sys
+
+if len(sys.argv) != 2:
+    sys.exit("usage: mkcompressed.py <directory>")
+
+out = sys.argv[1]
+os.makedirs(out, exist_ok=True)
+rnd = random.Random(1)
+words = ["".join(rnd.choice("etaoinshrdlucmfwypvbgkjqxz") for _ in range(rnd.randrange(2, 10))) for _ in range(2000)]
+
+
+def text(size):
+    # Words with a skewed distribution, so there are lots of matches and the literals have a Huffman table worth having
+    result = []
+    length = 0
+    while length < size:
+        word = words[min(int(rnd.expovariate(1 / 150)), len(words) - 1)]
+        result.append(word)
+        length += len(word) + 1
+    return " ".join(result).encode()[:size]
+
+
+def binary(size):
+    # Something like a directory of drivers: tables of small numbers, repeated code, strings and a bit of noise
+    code = [bytes(rnd.randrange(256) for _ in range(rnd.randrange(8, 64))) for _ in range(300)]
+    result = bytearray()
+    while len(result) < size:
+        kind = rnd.random()
+        if kind < 0.5:
+            result += code[min(int(rnd.expovariate(1 / 40)), len(code) - 1)]
+        elif kind < 0.7:
+            base = rnd.randrange(1 << 20)
+            for i in range(rnd.randrange(4, 32)):
+                result += (base + i * 16).to_bytes(4, "little")
+        elif kind < 0.85:
+            result += text(rnd.randrange(8, 80)) + b"\0"
+        elif kind < 0.95:
+            result += bytes(rnd.randrange(16, 512))
+        else:
+            result += bytes(rnd.randrange(256) for _ in range(rnd.randrange(1, 200)))
+    return bytes(result[:size])
+
+
+def sparse(count):
+    # Short runs of zeros between a few different bytes, few enough symbols for Huffman weights stored directly
+    return b"".join(bytes(rnd.randrange(1, 40)) + bytes([rnd.randrange(1, 4)]) for _ in range(count))
+
+
+def zeros(size):
+    # Mostly zeros, which zstd turns into RLE blocks and matches at offset 1
+    result = bytearray(size)
+    for _ in range(size // 50000):
+        at = rnd.randrange(size - 8)
+        result[at:at + 8] = bytes(rnd.randrange(256) for _ in range(8))
+    return bytes(result)
+
+
+originals = {
+    "text": text(1024 * 1024 + 77),
+    "binary": binary(2 * 1024 * 1024 + 5),
+    "random": bytes(rnd.randrange(256) for _ in range(256 * 1024 + 3)),
+    "zeros": zeros(1024 * 1024),
+    "sparse": sparse(3000),
+    "small": text(100),
+    "short": b"abcdefgh" * 40 + b"the end",
+    "tiny": b"x",
+}
+
+# Name, tool, arguments, which originals and the format decompress_detect should see
+variants = [
+    ("lz4-1", "lz4", ["--content-size", "-1"], None, "lz4"),
+    ("lz4-9", "lz4", ["--content-size", "-9"], None, "lz4"),
+    ("lz4-linked", "lz4", ["--content-size", "-B4", "-BD", "-BX"], None, "lz4"),
+    ("lz4-nosize", "lz4", [], ["text"], "unsupported"),
+    ("zstd-1", "zstd", ["-1"], None, "zstd"),
+    ("zstd-3", "zstd", ["-3", "--no-check"], None, "zstd"),
+    ("zstd-19", "zstd", ["-19"], ["text", "binary", "small"], "zstd"),
+    ("zstd-22", "zstd", ["--ultra", "-22"], ["text", "binary"], "zstd"),
+    ("zstd-nosize", "zstd", ["--no-content-size"], ["text"], "unsupported"),
+]
+
+for name, data in originals.items():
+    with open(os.path.join(out, name), "wb") as f:
+        f.write(data)
+
+lines = []
+missing = set()
+for variant, tool, arguments, which, fmt in variants:
+    if not shutil.which(tool):
+        missing.add(tool)
+        continue
+
+    for name in which or originals:
+        original = os.path.join(out, name)
+        compressed = os.path.join(out, "%s.%s" % (name, variant))
+        output = [compressed] if tool == "lz4" else ["-o", compressed]
+        subprocess.run([tool, "-q", "-f"] + arguments + [original] + output, check=True)
+        lines.append("%s\t%s\t%s\n" % (os.path.basename(compressed), name, fmt))
+
+for tool in sorted(missing):
+    print("mkcompressed.py: %s isn't installed, test_decompress won't have any %s files" % (tool, tool))
+
+with open(os.path.join(out, "list"), "w") as f:
+    f.writelines(lines)
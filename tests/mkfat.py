@@ -0,0 +1,296 @@
+#!/usr/bin/env python3
+
+# mkfat.py
+# Builds FAT12/16/32 images for test_fat, optionally damaged in one specific way
+#
+# Usage: mkfat.py <image> <12|16|32> <bytes per sector> <sectors per cluster> <seed> [damage]
+#
+# Writes <image> and <image>.list. The list starts with "volume ok" or "volume broken" (the reader
+# has to refuse the whole volume), then has one "path<TAB>size<TAB>id<TAB>ok|broken" line per file.
+# File contents aren't stored anywhere, test_fat works them out from the id (see file_data).
+#
+# Files are spread over fragmented cluster chains, the subdirectory takes more than one cluster
+# and most names need long file name entries, some of them with deleted entries in front.
+
+import random
+import struct
+import sys
+
+DAMAGE = [
+    # The reader has to refuse the volume
+    "signature", "sector-size", "cluster-size", "fat-too-small", "root-type", "truncated",
+    # The volume is fine, the kernel's chain isn't
+    "chain-short", "chain-loop", "chain-range", "chain-free",
+    # The EFI directory has no end and loops back on itself
+    "directory-loop",
+]
+
+if len(sys.argv) not in (6, 7) or (len(sys.argv) == 7 and sys.argv[6] not in DAMAGE):
+    sys.exit("usage: mkfat.py <image> <12|16|32> <bytes per sector> <sectors per cluster> <seed> [%s]" % "|".join(DAMAGE))
+
+out = sys.argv[1]
+fat_type, sector_size, spc, seed = (int(a) for a in sys.argv[2:6])
+damage = sys.argv[6] if len(sys.argv) == 7 else None
+rnd = random.Random(seed)
+
+# Just over the minimum cluster count of each type
+clusters = {12: 3000, 16: 4500, 32: 66000}[fat_type]
+root_entries = 0 if fat_type == 32 else 512
+reserved = 32 if fat_type == 32 else 1
+fats = 2
+
+entry_size = {12: 1.5, 16: 2, 32: 4}[fat_type]
+fat_sectors = int(((clusters + 2) * entry_size + sector_size - 1) // sector_size) + 1
+root_sectors = (root_entries * 32 + sector_size - 1) // sector_size
+data_start = reserved + fats * fat_sectors + root_sectors
+total = data_start + clusters * spc
+cluster_size = sector_size * spc
+
+EOC = {12: 0xFFF, 16: 0xFFFF, 32: 0x0FFFFFFF}[fat_type]
+image = bytearray(total * sector_size)
+fat = [0] * (clusters + 2)
+fat[0] = EOC & ~7
+fat[1] = EOC
+free = list(range(3 if fat_type == 32 else 2, clusters + 2))
+
+
+def file_data(file_id, size):
+    # Every 32-bit word is different, so data from the wrong place never matches. Same as test_fat.c.
+    words = (size + 3) // 4
+    data = struct.pack("<%dI" % words, *(((w * 2654435761) + file_id * 40503) & 0xFFFFFFFF for w in range(words)))
+    return data[:size]
+
+
+def allocate(count, fragment):
+    result = []
+    at = 0
+    while len(result) < count:
+        if fragment and rnd.random() < 0.1 and len(free) > count * 2:
+            at = rnd.randrange(len(free))
+        if at >= len(free):
+            at = 0
+        result.append(free.pop(at))
+    return result
+
+
+def link(chain):
+    for a, b in zip(chain, chain[1:]):
+        fat[a] = b
+    if chain:
+        fat[chain[-1]] = EOC
+
+
+def cluster_offset(cluster):
+    return (data_start + (cluster - 2) * spc) * sector_size
+
+
+def write_clusters(chain, data):
+    for k, cluster in enumerate(chain):
+        piece = data[k * cluster_size:(k + 1) * cluster_size]
+        image[cluster_offset(cluster):cluster_offset(cluster) + len(piece)] = piece
+
+
+def short_name(name, n):
+    base, _, ext = name.upper().partition(".")
+    if len(base) <= 8 and len(ext) <= 3 and name == name.upper() and " " not in name:
+        return (base.ljust(8) + ext.ljust(3)).encode()
+    tail = "~" + str(n)
+    base = "".join(c for c in base if c.isalnum())[:8 - len(tail)] + tail
+    return (base.ljust(8) + ext[:3].ljust(3)).encode()
+
+
+def checksum(name):
+    s = 0
+    for c in name:
+        s = (((s & 1) << 7) + (s >> 1) + c) & 0xFF
+    return s
+
+
+def entries(name, short, attributes, cluster, size, noise=True):
+    result = []
+    if noise and rnd.random() < 0.5:
+        deleted = bytearray(32)
+        deleted[0] = 0xE5
+        deleted[1:11] = b"ELETED TXT"
+        result.append(bytes(deleted))
+
+    plain = short[:8].rstrip() + (b"." + short[8:].rstrip() if short[8:].strip() else b"")
+    if plain != name.encode():
+        encoded = name.encode("utf-16-le")
+        chars = [encoded[i:i + 2] for i in range(0, len(encoded), 2)]
+        count = (len(chars) + 12) // 13
+        if len(chars) % 13:
+            chars.append(b"\0\0")
+        chars += [b"\xff\xff"] * (count * 13 - len(chars))
+
+        for order in range(count, 0, -1):
+            part = chars[(order - 1) * 13:order * 13]
+            lfn = bytearray(32)
+            lfn[0] = order | (0x40 if order == count else 0)
+            lfn[1:11] = b"".join(part[0:5])
+            lfn[11] = 0x0F
+            lfn[13] = checksum(short)
+            lfn[14:26] = b"".join(part[5:11])
+            lfn[28:32] = b"".join(part[11:13])
+            result.append(bytes(lfn))
+
+    entry = bytearray(32)
+    entry[0:11] = short
+    entry[11] = attributes
+    struct.pack_into("<H", entry, 20, cluster >> 16)
+    struct.pack_into("<HI", entry, 26, cluster & 0xFFFF, size)
+    result.append(bytes(entry))
+    return result
+
+
+def directory(items, parent, this):
+    result = []
+    if this is None:
+        volume = bytearray(32)
+        volume[0:11] = b"TESTVOL    "
+        volume[11] = 0x08
+        result.append(bytes(volume))
+    else:
+        result += entries(".", b".          ", 0x10, this, 0, False)
+        result += entries("..", b"..         ", 0x10, parent, 0, False)
+
+    for i, (name, attributes, cluster, size) in enumerate(items):
+        result += entries(name, short_name(name, i + 1), attributes, cluster, size)
+    return b"".join(result)
+
+
+def place_directory(blob, chain):
+    # Room for at least one end marker
+    count = max(1, (len(blob) + 32 + cluster_size - 1) // cluster_size)
+    chain = chain + allocate(count - len(chain), True)
+    link(chain)
+    write_clusters(chain, blob + b"\0" * (count * cluster_size - len(blob)))
+    return chain
+
+
+files = []
+chains = {}
+
+
+def make_file(path, size, fragment):
+    file_id = len(files) + 1
+    chain = allocate((size + cluster_size - 1) // cluster_size, fragment)
+    link(chain)
+    write_clusters(chain, file_data(file_id, size))
+    files.append((path, size, file_id))
+    chains[path] = chain
+    return chain[0] if chain else 0
+
+
+big = min(3 * 1024 * 1024 + 123, clusters * cluster_size // 3)
+
+# EFI/sub dir/, with enough long names to take more than one cluster
+sub_items = [("initrd.tar.img", 0x20, make_file("EFI/sub dir/initrd.tar.img", big, True), big)]
+for k in range(40):
+    name = "filler number %d with a long name.bin" % k
+    size = rnd.randrange(0, 3000)
+    sub_items.append((name, 0x20, make_file("EFI/sub dir/" + name, size, False), size))
+
+efi_chain = allocate(1, False)
+sub_length = len(directory(sub_items, efi_chain[0], 0))
+sub_chain = allocate(max(1, (sub_length + 32 + cluster_size - 1) // cluster_size), True)
+place_directory(directory(sub_items, efi_chain[0], sub_chain[0]), sub_chain)
+efi_blob = directory([("sub dir", 0x10, sub_chain[0], 0)], 0, efi_chain[0])
+place_directory(efi_blob, efi_chain)
+
+root_items = [("EFI", 0x10, efi_chain[0], 0)]
+for name, size, fragment in (("hexahedron-kernel.elf", big // 2 + 7, True), ("FONT.PSF", 4096, False), ("empty.txt", 0, False)):
+    root_items.append((name, 0x20, make_file(name, size, fragment), size))
+
+root = directory(root_items, 0, None)
+if fat_type == 32:
+    place_directory(root, [2])
+    root_cluster = 2
+else:
+    assert len(root) <= root_entries * 32
+    offset = (reserved + fats * fat_sectors) * sector_size
+    image[offset:offset + len(root)] = root
+    root_cluster = 0
+
+# Damage to the kernel's chain
+kernel = chains["hexahedron-kernel.elf"]
+broken = set()
+if damage and damage.startswith("chain-"):
+    broken.add("hexahedron-kernel.elf")
+    if damage == "chain-short":
+        fat[kernel[len(kernel) // 2]] = EOC
+    elif damage == "chain-loop":
+        fat[kernel[-1]] = kernel[len(kernel) // 2]
+    elif damage == "chain-range":
+        fat[kernel[len(kernel) // 2]] = clusters + 10
+    elif damage == "chain-free":
+        fat[kernel[len(kernel) // 2]] = 0
+elif damage == "directory-loop":
+    # No end marker, so a lookup that doesn't find its name keeps going round
+    efi = cluster_offset(efi_chain[0])
+    for i in range(efi + len(efi_blob), efi + cluster_size, 32):
+        image[i] = 0xE5
+    fat[efi_chain[0]] = efi_chain[0]
+
+# FATs
+table = bytearray(fat_sectors * sector_size)
+for cluster, value in enumerate(fat):
+    if fat_type == 12:
+        offset = cluster + cluster // 2
+        if cluster & 1:
+            table[offset] = (table[offset] & 0x0F) | ((value << 4) & 0xF0)
+            table[offset + 1] = (value >> 4) & 0xFF
+        else:
+            table[offset] = value & 0xFF
+            table[offset + 1] = (table[offset + 1] & 0xF0) | ((value >> 8) & 0x0F)
+    elif fat_type == 16:
+        struct.pack_into("<H", table, cluster * 2, value)
+    else:
+        struct.pack_into("<I", table, cluster * 4, value)
+
+for i in range(fats):
+    offset = (reserved + i * fat_sectors) * sector_size
+    image[offset:offset + len(table)] = table
+
+# BPB
+bpb = bytearray(sector_size)
+bpb[0:3] = b"\xEB\x3C\x90"
+bpb[3:11] = b"MSWIN4.1"
+struct.pack_into("<HBHBHHBHHHI", bpb, 11, sector_size, spc, reserved, fats, root_entries,
+                 total if total < 65536 else 0, 0xF8, fat_sectors if fat_type != 32 else 0, 63, 255, 0)
+struct.pack_into("<I", bpb, 32, total if total >= 65536 else 0)
+if fat_type == 32:
+    struct.pack_into("<IHHI", bpb, 36, fat_sectors, 0, 0, root_cluster)
+bpb[510] = 0x55
+bpb[511] = 0xAA
+
+if damage == "signature":
+    bpb[510] = 0
+elif damage == "sector-size":
+    struct.pack_into("<H", bpb, 11, 384)
+elif damage == "cluster-size":
+    bpb[13] = 3
+elif damage == "fat-too-small":
+    if fat_type == 32:
+        struct.pack_into("<I", bpb, 36, 1)
+    else:
+        struct.pack_into("<H", bpb, 22, 1)
+elif damage == "root-type":
+    # A FAT32 root cluster past the end, or a FAT12/16 volume without a root directory
+    if fat_type == 32:
+        struct.pack_into("<I", bpb, 44, clusters + 2)
+    else:
+        struct.pack_into("<H", bpb, 17, 0)
+
+image[0:sector_size] = bpb
+if damage == "truncated":
+    del image[len(image) // 2:]
+
+with open(out, "wb") as f:
+    f.write(image)
+
+volume_broken = damage is not None and damage in DAMAGE[:6]
+with open(out + ".list", "w") as f:
+    f.write("volume %s\n" % ("broken" if volume_broken else "ok"))
+    for path, size, file_id in files:
+        f.write("%s\t%d\t%d\t%s\n" % (path, size, file_id, "broken" if path in broken else "ok"))
@@ -0,0 +1,54 @@
+/**
+ * @file tests/test.h
+ * @brief Helpers for the host tests
+ *
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#ifndef POLYANILINE_TESTS_TEST_H
+#define POLYANILINE_TESTS_TEST_H
+
+/**** INCLUDES ****/
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**** DEFINITIONS ****/
+
+/* Count a failure and say where it was, the test keeps going */
+#define TEST_CHECK(condition, ...) do { \
+        if (!(condition)) { \
+            test_failures++; \
+            if (test_failures <= 20) { \
+                printf("%s:%d: ", __FILE__, __LINE__); \
+                printf(__VA_ARGS__); \
+                printf("\n"); \
+            } \
+        } \
+    } while (0)
+
+/* Exit status of a test */
+#define TEST_RESULT(name) (printf("%s: %s (%d failures)\n", name, test_failures ? "FAILED" : "passed", test_failures), test_failures ? 1 : 0)
+
+/**** VARIABLES ****/
+
+static int __attribute__((unused)) test_failures = 0;
+
+/**** FUNCTIONS ****/
+
+/**
+ * @brief Get a monotonic time in nanoseconds, for the benchmarks
+ */
+static inline uint64_t test_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,349 @@
+/**
+ * @file tests/test_decompress.c
+ * @brief Decompresses LZ4 and zstd frames with the loader's decompressor (polyaniline/decompress.c)
+ *
+ * The files come from mkcompressed.py (see the Makefile), which compresses text, binary-ish data, random
+ * data and zeros with the lz4 and zstd tools at a few levels. Every file is fed to the decompressor in
+ * chunks of different sizes, like the FAT reader and the async loader hand them over, and has to come out
+ * the same as the original. Partial decompressors have to stop with just the start, damaged and truncated
+ * files mustn't touch anything outside the output. A few frames made by hand are always tested, even if
+ * the tools aren't installed.
+ *
+ * decompress.c, zstd.c and hash.c are included directly, the platform functions are stubs below.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../polyaniline/decompress.c"
+#include "../polyaniline/zstd.c"
+#undef LOG
+#include "../polyaniline/hash.c"
+
+/* Where the Makefile puts the files */
+#ifndef DECOMPRESS_FILES
+#define DECOMPRESS_FILES    "../build-output/tests/decompress"
+#endif
+
+/* Longest line in the list */
+#define LINE_LENGTH         1024
+
+/* Damaged copies of every file, and truncated ones */
+#define DAMAGED_COPIES      40
+#define TRUNCATED_COPIES    20
+
+/* Files that decompress to more than this aren't fed in tiny chunks and get fewer damaged copies, they take long */
+#define BIG_FILE            (512 * 1024)
+#define BIG_FILE_COPIES     4
+
+/* A whole file in one chunk */
+#define WHOLE               ((size_t)-1)
+
+// Chunk sizes the files are fed in
+static const size_t chunk_sizes[] = { 1, 7, 4096, 65536 + 17, 1024 * 1024, WHOLE };
+
+// Messages from the decompressor, printed if a check fails
+static int log_count = 0;
+
+/**** STUBS ****/
+
+void *platform_allocate(size_t size) {
+    return malloc(size);
+}
+
+void platform_free(void *ptr) {
+    free(ptr);
+}
+
+void platform_copyMemory(void *dest, const void *src, size_t size) {
+    memcpy(dest, src, size);
+}
+
+void platform_fillMemory(void *dest, int value, size_t size) {
+    memset(dest, value, size);
+}
+
+void log_write(int level, const char *format, int count, const uint64_t *args) {
+    log_count++;
+}
+
+/**** HELPERS ****/
+
+/**
+ * @brief Read a whole file
+ * @param path The path
+ * @param size Output for the size
+ * @returns The contents (at least 1 byte allocated) or NULL
+ */
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief Decompress some data like file.c does, chunk by chunk
+ * @param data The compressed data
+ * @param size Size of the compressed data
+ * @param format DECOMPRESS_xxx
+ * @param dest Output
+ * @param dest_size Size of the output
+ * @param chunk Chunk size
+ * @param partial Whether it's a partial decompressor
+ * @param out Output for the amount of bytes written, or NULL
+ * @returns 0 on success
+ */
+static int decompress_run(const uint8_t *data, size_t size, int format, uint8_t *dest, uint64_t dest_size, size_t chunk, int partial, uint64_t *out) {
+    decompress_t d;
+    platform_consumer_t *consumer = decompress_consumer(&d, format, dest, dest_size);
+    d.partial = partial;
+
+    int error = consumer->start(consumer, size);
+    for (size_t at = 0; at < size && !error; at += chunk) {
+        size_t length = (size - at < chunk) ? size - at : chunk;
+        error = consumer->consume(consumer, data + at, length);
+
+        // file_decompressHead stops reading once the start is there
+        if (partial && d.out == dest_size) break;
+    }
+
+    // Like file_readChunked: finish after the last chunk, release after a failure. LeakSanitizer sees anything left over.
+    if (!error && consumer->finish(consumer)) error = 1;
+    if (error) consumer->release(consumer);
+    if (out) *out = d.out;
+    return error;
+}
+
+/**
+ * @brief Decompress a file every way there is and compare it with the original
+ * @param name Name of the file, for the failure messages
+ * @param data The compressed file
+ * @param size Its size
+ * @param original What it should come out as
+ * @param original_size Its size
+ */
+static void test_file(const char *name, uint8_t *data, size_t size, const uint8_t *original, size_t original_size) {
+    uint64_t content_size = 0;
+    int format = decompress_detect(data, (size < DECOMPRESS_HEADER_SIZE) ? size : DECOMPRESS_HEADER_SIZE, name, &content_size);
+    TEST_CHECK(format == DECOMPRESS_LZ4 || format == DECOMPRESS_ZSTD, "%s: detected as %d", name, format);
+    TEST_CHECK(content_size == original_size, "%s: content size %lu, should be %zu", name, content_size, original_size);
+    if ((format != DECOMPRESS_LZ4 && format != DECOMPRESS_ZSTD) || content_size != original_size) return;
+
+    // Exactly as big as it needs to be, so ASan sees anything written past it
+    uint8_t *dest = malloc(original_size ? original_size : 1);
+
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(*chunk_sizes); i++) {
+        // Tiny chunks split every block just the same in a smaller file
+        if (chunk_sizes[i] < 64 && original_size > BIG_FILE) continue;
+
+        memset(dest, 0xA5, original_size);
+        int logged = log_count;
+        int error = decompress_run(data, size, format, dest, original_size, chunk_sizes[i], 0, NULL);
+        TEST_CHECK(!error, "%s: failed in chunks of %zu (%d messages)", name, chunk_sizes[i], log_count - logged);
+        TEST_CHECK(error || !memcmp(dest, original, original_size), "%s: wrong output in chunks of %zu", name, chunk_sizes[i]);
+    }
+
+    // Just the start, like platform_openFile
+    size_t heads[] = { 1, 100, 4096, 100000 };
+    for (size_t i = 0; i < sizeof(heads) / sizeof(*heads); i++) {
+        size_t head = (heads[i] < original_size) ? heads[i] : original_size;
+        uint64_t out;
+        uint8_t *start = malloc(head ? head : 1);
+        int error = decompress_run(data, size, format, start, head, 4096, 1, &out);
+        TEST_CHECK(!error && out == head, "%s: partial decompression of %zu bytes gave %lu", name, head, out);
+        TEST_CHECK(error || !memcmp(start, original, head), "%s: wrong start (%zu bytes)", name, head);
+        free(start);
+    }
+
+    // A zstd frame with a checksum can only come out right if it decompresses at all
+    int checked = (format == DECOMPRESS_ZSTD && (data[4] & ZSTD_FHD_CHECKSUM));
+
+    int big = original_size > BIG_FILE;
+    uint8_t *damaged = malloc(size);
+    srand(size);
+    for (int i = 0; i < (big ? BIG_FILE_COPIES : DAMAGED_COPIES); i++) {
+        memcpy(damaged, data, size);
+        size_t at = rand() % size;
+        damaged[at] ^= 1 << (rand() % 8);
+
+        // A damaged content size isn't worth allocating for
+        uint64_t damaged_size = 0;
+        int damaged_format = decompress_detect(damaged, (size < DECOMPRESS_HEADER_SIZE) ? size : DECOMPRESS_HEADER_SIZE, name, &damaged_size);
+        if (damaged_format != format || damaged_size > original_size * 2 + 4096) continue;
+
+        uint8_t *out = malloc(damaged_size ? damaged_size : 1);
+        int error = decompress_run(damaged, size, format, out, damaged_size, 65536, 0, NULL);
+        if (checked && !error) {
+            TEST_CHECK(damaged_size == original_size && !memcmp(out, original, original_size), "%s: byte %zu damaged, decompressed wrong without an error", name, at);
+        }
+
+        free(out);
+    }
+
+    for (int i = 0; i < (big ? BIG_FILE_COPIES : TRUNCATED_COPIES); i++) {
+        size_t cut = rand() % size;
+        int error = decompress_run(data, cut, format, dest, original_size, 65536, 0, NULL);
+        TEST_CHECK(error, "%s: cut off after %zu of %zu bytes, decompressed without an error", name, cut, size);
+    }
+
+    free(damaged);
+    free(dest);
+}
+
+/**** TESTS ****/
+
+/**
+ * @brief Check decompress_detect on headers made by hand
+ */
+static void test_detect() {
+    static const struct {
+        const char *name;
+        uint8_t header[DECOMPRESS_HEADER_SIZE];
+        size_t length;
+        int format;
+        uint64_t content_size;
+    } headers[] = {
+        { "plain", "hello world", 11, DECOMPRESS_NONE, 0 },
+        { "gzip", { 0x1F, 0x8B, 0x08 }, 3, DECOMPRESS_UNSUPPORTED, 0 },
+        { "zstd, 1-byte size", { 0x28, 0xB5, 0x2F, 0xFD, 0x20, 200 }, 6, DECOMPRESS_ZSTD, 200 },
+        { "zstd, 2-byte size", { 0x28, 0xB5, 0x2F, 0xFD, 0x60, 0x10, 0x01 }, 7, DECOMPRESS_ZSTD, 0x110 + 256 },
+        { "zstd, window and 4-byte size", { 0x28, 0xB5, 0x2F, 0xFD, 0x80, 0x50, 0x78, 0x56, 0x34, 0x12 }, 10, DECOMPRESS_ZSTD, 0x12345678 },
+        { "zstd, 8-byte size", { 0x28, 0xB5, 0x2F, 0xFD, 0xE0, 1, 2, 3, 4, 5, 0, 0, 0 }, 13, DECOMPRESS_ZSTD, 0x0504030201ULL },
+        { "zstd, dictionary 0", { 0x28, 0xB5, 0x2F, 0xFD, 0x22, 0, 0, 9 }, 8, DECOMPRESS_ZSTD, 9 },
+        { "zstd, dictionary 7", { 0x28, 0xB5, 0x2F, 0xFD, 0x21, 7, 9 }, 7, DECOMPRESS_UNSUPPORTED, 0 },
+        { "zstd, no size", { 0x28, 0xB5, 0x2F, 0xFD, 0x00, 0x50 }, 6, DECOMPRESS_UNSUPPORTED, 0 },
+        { "zstd, reserved bit", { 0x28, 0xB5, 0x2F, 0xFD, 0x28, 9 }, 6, DECOMPRESS_UNSUPPORTED, 0 },
+        { "zstd, cut off", { 0x28, 0xB5, 0x2F, 0xFD, 0x80, 0x50, 0x78 }, 7, DECOMPRESS_UNSUPPORTED, 0 },
+        { "lz4, no size", { 0x04, 0x22, 0x4D, 0x18, 0x60, 0x40, 0x82 }, 7, DECOMPRESS_UNSUPPORTED, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(headers) / sizeof(*headers); i++) {
+        uint64_t content_size = 0;
+        int format = decompress_detect(headers[i].header, headers[i].length, headers[i].name, &content_size);
+        TEST_CHECK(format == headers[i].format, "%s: detected as %d, should be %d", headers[i].name, format, headers[i].format);
+        TEST_CHECK(format != DECOMPRESS_ZSTD || content_size == headers[i].content_size, "%s: content size %lu, should be %lu", headers[i].name, content_size, headers[i].content_size);
+    }
+}
+
+/**
+ * @brief Decompress zstd frames made by hand and by zstd -19, so there's always something even without the tools
+ */
+static void test_builtin() {
+    // A raw block of "abc", then an RLE block of 7 z's
+    static uint8_t blocks[] = { 0x28, 0xB5, 0x2F, 0xFD, 0x20, 10, 0x18, 0x00, 0x00, 'a', 'b', 'c', 0x3B, 0x00, 0x00, 'z' };
+    test_file("raw and RLE blocks", blocks, sizeof(blocks), (const uint8_t*)"abczzzzzzz", 10);
+
+    // A compressed block of just 5 RLE literals and no sequences
+    static uint8_t literals[] = { 0x28, 0xB5, 0x2F, 0xFD, 0x20, 5, 0x1D, 0x00, 0x00, 0x29, 'q', 0x00 };
+    test_file("RLE literals", literals, sizeof(literals), (const uint8_t*)"qqqqq", 5);
+
+    // "abcd", then 32768 sequences (a 3-byte count) of no literals and a 3-byte match, all with RLE tables
+    // and no extra bits, so the bitstream is just its end marker. Offsets alternate between repeats 2 and 1.
+    static uint8_t sequences[] = {
+        0x28, 0xB5, 0x2F, 0xFD, 0xA0, 0x04, 0x80, 0x01, 0x00,
+        0x20, 0x00, 0x00, 'a', 'b', 'c', 'd',
+        0x4D, 0x00, 0x00, 0x00, 0xFF, 0x00, 0x01, 0x54, 0x00, 0x00, 0x00, 0x01,
+    };
+
+    size_t size = 4 + 32768 * 3;
+    uint8_t *expect = malloc(size);
+    memcpy(expect, "abcd", 4);
+    for (size_t i = 0, at = 4; i < 32768; i++) {
+        size_t offset = (i & 1) ? 1 : 4;
+        for (int j = 0; j < 3; j++, at++) expect[at] = expect[at - offset];
+    }
+
+    test_file("32768 sequences", sequences, sizeof(sequences), expect, size);
+    free(expect);
+
+    // One compressed block with Huffman coded literals, and a checksum
+    static const char text[] = "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog. "
+                               "The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs! "
+                               "Pack my box with five dozen liquor jugs! How vexingly quick daft zebras jump; the five "
+                               "boxing wizards jump quickly. How vexingly quick daft zebras jump; the five boxing wizards jump quickly. ";
+    static uint8_t compressed[] = {
+        0x28, 0xb5, 0x2f, 0xfd, 0x64, 0x6f, 0x00, 0x05, 0x04, 0x00, 0xe2, 0x87, 0x18, 0x17, 0x70, 0xab,
+        0x0e, 0x04, 0x43, 0xd3, 0x48, 0x9a, 0xf6, 0xaf, 0xd9, 0x69, 0x7a, 0x80, 0xac, 0xd7, 0x08, 0x20,
+        0x1c, 0x04, 0x54, 0x9d, 0x17, 0x0f, 0x68, 0x4b, 0xef, 0x54, 0x9e, 0x6f, 0xb4, 0x2c, 0x5e, 0x80,
+        0xe7, 0xa1, 0xad, 0x8f, 0xea, 0x24, 0xda, 0x96, 0xe3, 0x66, 0x99, 0xcf, 0x1e, 0x00, 0xb8, 0xe4,
+        0xf1, 0xd7, 0x72, 0xe1, 0x76, 0xb7, 0xb5, 0xd3, 0x97, 0x61, 0x75, 0x16, 0x79, 0xbe, 0x69, 0x74,
+        0x9a, 0x1c, 0x31, 0x0e, 0xf1, 0x60, 0x75, 0x3a, 0xad, 0xa7, 0x7d, 0x59, 0xfc, 0x5b, 0xa6, 0x0f,
+        0x95, 0x44, 0x1e, 0x6f, 0x5a, 0xdd, 0xcd, 0x7e, 0xe8, 0x88, 0xc1, 0x72, 0xf9, 0xb2, 0x22, 0x09,
+        0x00, 0xe8, 0x04, 0x44, 0x58, 0x61, 0x10, 0xd4, 0x98, 0xa6, 0x01, 0x13, 0x31, 0xba, 0x61, 0xd7,
+        0x2f, 0x4c, 0x96, 0x90, 0x29, 0xa8, 0xf4, 0xe0, 0xa4, 0xf4, 0x0f, 0x1b, 0x9d, 0x4e,
+    };
+    test_file("zstd -19", compressed, sizeof(compressed), (const uint8_t*)text, sizeof(text) - 1);
+
+    // The same with a wrong checksum
+    uint8_t wrong[sizeof(compressed)];
+    memcpy(wrong, compressed, sizeof(compressed));
+    wrong[sizeof(wrong) - 1] ^= 0x80;
+    uint8_t *dest = malloc(sizeof(text) - 1);
+    TEST_CHECK(decompress_run(wrong, sizeof(wrong), DECOMPRESS_ZSTD, dest, sizeof(text) - 1, WHOLE, 0, NULL), "a wrong checksum wasn't noticed");
+    free(dest);
+}
+
+int main() {
+    test_detect();
+    test_builtin();
+
+    FILE *list = fopen(DECOMPRESS_FILES "/list", "r");
+    TEST_CHECK(list, "no list in " DECOMPRESS_FILES ", run mkcompressed.py");
+    if (!list) return TEST_RESULT("decompress");
+
+    char line[LINE_LENGTH];
+    int files[3] = { 0 };
+    while (fgets(line, sizeof(line), list)) {
+        char compressed_name[LINE_LENGTH], original_name[LINE_LENGTH], kind[LINE_LENGTH];
+        if (sscanf(line, "%s\t%s\t%s", compressed_name, original_name, kind) != 3) continue;
+
+        char path[LINE_LENGTH * 2];
+        size_t size, original_size;
+        snprintf(path, sizeof(path), "%s/%s", DECOMPRESS_FILES, compressed_name);
+        uint8_t *data = read_file(path, &size);
+        snprintf(path, sizeof(path), "%s/%s", DECOMPRESS_FILES, original_name);
+        uint8_t *original = read_file(path, &original_size);
+
+        TEST_CHECK(data && original, "%s: couldn't read it or %s", compressed_name, original_name);
+        if (data && original) {
+            if (!strcmp(kind, "unsupported")) {
+                uint64_t content_size;
+                int format = decompress_detect(data, (size < DECOMPRESS_HEADER_SIZE) ? size : DECOMPRESS_HEADER_SIZE, compressed_name, &content_size);
+                TEST_CHECK(format == DECOMPRESS_UNSUPPORTED, "%s: detected as %d, should be refused", compressed_name, format);
+                files[2]++;
+            } else {
+                test_file(compressed_name, data, size, original, original_size);
+                files[strcmp(kind, "lz4") ? 1 : 0]++;
+            }
+        }
+
+        free(data);
+        free(original);
+    }
+
+    fclose(list);
+    printf("decompress: %d LZ4 files, %d zstd files, %d refused\n", files[0], files[1], files[2]);
+    if (!files[0]) printf("decompress: no LZ4 files, is lz4 installed?\n");
+    if (!files[1]) printf("decompress: no zstd files, is zstd installed?\n");
+
+    return TEST_RESULT("decompress");
+}
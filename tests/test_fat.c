@@ -0,0 +1,308 @@
+/**
+ * @file tests/test_fat.c
+ * @brief Reads FAT images with the built-in FAT reader (platform/efi/fat.c)
+ *
+ * The images come from mkfat.py (see the Makefile): FAT12, FAT16 and FAT32 volumes with fragmented
+ * files, long names and a directory of more than one cluster, plus copies with a broken BPB, a broken
+ * cluster chain or a directory that loops. Every file is read whole and at random offsets and checked,
+ * and whatever is broken has to be refused so the firmware's driver gets used instead.
+ *
+ * fat.c is included directly to get at the volume. BlockIo and the boot services are stubs working on
+ * the image in memory, they check that reads are whole blocks, aligned for Media->IoAlign and inside
+ * the device.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../platform/efi/fat.c"
+
+/* Where the Makefile puts the images */
+#ifndef FAT_IMAGES
+#define FAT_IMAGES      "../build-output/tests/fat"
+#endif
+
+/* Longest line in a list */
+#define LINE_LENGTH     1024
+
+/* Random reads per file */
+#define RANDOM_READS    200
+
+// The images and how the device is set up for them. The Makefile has to build every one of these.
+static const struct {
+    const char *name;
+    uint32_t block_size;
+    uint32_t io_align;
+} images[] = {
+    { "fat12", 512, 0 },
+    { "fat16", 512, 512 },
+    { "fat16-2048", 512, 0 },               // 2048-byte sectors on 512-byte blocks
+    { "fat16-2048", 2048, 64 },
+    { "fat32", 512, 4096 },
+    { "fat12-signature", 512, 0 },
+    { "fat12-sector-size", 512, 0 },
+    { "fat12-cluster-size", 512, 0 },
+    { "fat12-fat-too-small", 512, 0 },
+    { "fat12-root-type", 512, 0 },
+    { "fat32-root-type", 512, 0 },
+    { "fat16-truncated", 512, 0 },
+    { "fat12-chain-short", 512, 0 },
+    { "fat16-chain-loop", 512, 0 },
+    { "fat12-chain-range", 512, 0 },
+    { "fat16-chain-free", 512, 0 },
+    { "fat16-directory-loop", 512, 0 },
+};
+
+EFI_BOOT_SERVICES *BS;
+EFI_LOADED_IMAGE *LoadedImage;
+
+/* The device */
+static uint8_t *disk;
+static size_t disk_size;
+static EFI_BLOCK_IO_MEDIA media;
+static EFI_BLOCK_IO_PROTOCOL blockio;
+
+/* ReadBlocks calls so far, and pages handed out but not freed */
+static uint64_t block_reads = 0;
+static int pages_allocated = 0;
+
+/**** STUBS ****/
+
+void log_write(int level, const char *format, int count, const uint64_t *args) {
+}
+
+void *platform_allocate(size_t size) {
+    return malloc(size);
+}
+
+void platform_free(void *ptr) {
+    free(ptr);
+}
+
+void platform_copyMemory(void *dest, const void *src, size_t size) {
+    memcpy(dest, src, size);
+}
+
+void platform_fillMemory(void *dest, int value, size_t size) {
+    memset(dest, value, size);
+}
+
+static EFIAPI EFI_STATUS stub_readBlocks(EFI_BLOCK_IO_PROTOCOL *protocol, UINT32 media_id, EFI_LBA block, UINTN size, VOID *buffer) {
+    TEST_CHECK(size % media.BlockSize == 0, "ReadBlocks of %lu bytes with %u-byte blocks", size, media.BlockSize);
+    TEST_CHECK(media.IoAlign <= 1 || (uintptr_t)buffer % media.IoAlign == 0, "ReadBlocks into %p with IoAlign %u", buffer, media.IoAlign);
+    TEST_CHECK(block + size / media.BlockSize - 1 <= media.LastBlock, "ReadBlocks past the end of the device");
+
+    if (size % media.BlockSize || block * media.BlockSize + size > disk_size) return EFI_DEVICE_ERROR;
+
+    block_reads++;
+    memcpy(buffer, disk + block * media.BlockSize, size);
+    return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS stub_handleProtocol(EFI_HANDLE handle, EFI_GUID *guid, VOID **interface) {
+    EFI_GUID blockio_guid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    if (memcmp(guid, &blockio_guid, sizeof(EFI_GUID))) return EFI_UNSUPPORTED;
+
+    *interface = &blockio;
+    return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS stub_allocatePages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, UINTN pages, EFI_PHYSICAL_ADDRESS *address) {
+    void *memory = aligned_alloc(EFI_PAGE_SIZE, pages * EFI_PAGE_SIZE);
+    if (!memory) return EFI_OUT_OF_RESOURCES;
+
+    pages_allocated++;
+    *address = (uintptr_t)memory;
+    return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS stub_freePages(EFI_PHYSICAL_ADDRESS address, UINTN pages) {
+    pages_allocated--;
+    free((void*)(uintptr_t)address);
+    return EFI_SUCCESS;
+}
+
+/**** TESTS ****/
+
+/**
+ * @brief Work out what's in a file, see file_data in mkfat.py
+ */
+static void file_data(uint8_t *buffer, size_t size, int id) {
+    for (size_t i = 0; i < size; i += 4) {
+        uint32_t word = (uint32_t)((i / 4) * 2654435761u + id * 40503u);
+        for (size_t b = 0; b < 4 && i + b < size; b++) buffer[i + b] = word >> (b * 8);
+    }
+}
+
+/**
+ * @brief Load an image as the boot device
+ * @returns 0 on success
+ */
+static int load_image(const char *path, uint32_t block_size, uint32_t io_align) {
+    FILE *f = fopen(path, "rb");
+    TEST_CHECK(f, "can't open %s, is it built?", path);
+    if (!f) return 1;
+
+    fseek(f, 0, SEEK_END);
+    disk_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    disk = malloc(disk_size);
+    size_t got = fread(disk, 1, disk_size, f);
+    fclose(f);
+    TEST_CHECK(got == disk_size, "short read of %s", path);
+
+    media = (EFI_BLOCK_IO_MEDIA){ .MediaPresent = 1, .BlockSize = block_size, .IoAlign = io_align, .LastBlock = disk_size / block_size - 1 };
+    blockio = (EFI_BLOCK_IO_PROTOCOL){ .Media = &media, .ReadBlocks = stub_readBlocks };
+    return 0;
+}
+
+/**
+ * @brief Open a file, mixing up the separators and case depending on @p variant
+ */
+static EFI_FILE_PROTOCOL *open_file(const char *name, int variant) {
+    char path[LINE_LENGTH + 1];
+    snprintf(path, sizeof(path), "%s%s", (variant & 1) ? "/" : "", name);
+
+    for (char *p = path; *p; p++) {
+        if ((variant & 2) && *p == '/') *p = '\\';
+        if ((variant & 4) && *p >= 'a' && *p <= 'z') *p -= 'a' - 'A';
+    }
+
+    return fat_open(path);
+}
+
+/**
+ * @brief Read a whole file and then pieces of it, and check everything
+ */
+static void check_file(const char *image, EFI_FILE_PROTOCOL *file, const char *name, size_t size, int id, int variant) {
+    uint8_t *expect = malloc(size + 1);
+    uint8_t *buffer = malloc(size + 64);
+    file_data(expect, size, id);
+
+    EFI_GUID info_id = EFI_FILE_INFO_ID;
+    UINTN info_size = 0;
+    TEST_CHECK(file->GetInfo(file, &info_id, &info_size, NULL) == EFI_BUFFER_TOO_SMALL, "%s: %s: GetInfo without a buffer", image, name);
+    EFI_FILE_INFO *info = malloc(info_size);
+    TEST_CHECK(file->GetInfo(file, &info_id, &info_size, info) == EFI_SUCCESS, "%s: %s: GetInfo", image, name);
+    TEST_CHECK(info->FileSize == size, "%s: %s: size %lu instead of %zu", image, name, info->FileSize, size);
+    free(info);
+
+    // The whole file in 1 MiB pieces, to an unaligned address most of the time
+    uint64_t reads = block_reads;
+    uint8_t *dest = buffer + (variant % 3 ? 3 : 0);
+    size_t offset = 0;
+    while (offset < size + 1) {
+        UINTN count = 1024 * 1024;
+        TEST_CHECK(file->Read(file, &count, dest + offset) == EFI_SUCCESS, "%s: %s: Read at %zu", image, name, offset);
+        if (!count) break;
+        offset += count;
+    }
+
+    TEST_CHECK(offset == size, "%s: %s: read %zu bytes of %zu", image, name, offset, size);
+    TEST_CHECK(!memcmp(dest, expect, size), "%s: %s: wrong data", image, name);
+    reads = block_reads - reads;
+
+    // Reading whole runs is the point of the reader
+    fat_file_t *fat_file = (fat_file_t*)file;
+    size_t clusters = size / fat_volume.cluster_size;
+    if (size >= 256 * 1024) {
+        printf("%-20s %-30s %8zu bytes, %5d runs, %5lu ReadBlocks\n", image, name, size, fat_file->run_count, reads);
+        TEST_CHECK(reads <= (uint64_t)fat_file->run_count + size / (1024 * 1024) * 2 + 2, "%s: %s: %lu ReadBlocks for %d runs", image, name, reads, fat_file->run_count);
+        TEST_CHECK(reads < clusters, "%s: %s: a ReadBlocks per cluster", image, name);
+    }
+
+    // Random pieces, some running past the end
+    for (int i = 0; i < RANDOM_READS && size; i++) {
+        size_t at = rand() % size;
+        UINTN count = rand() % (size - at + 100);
+        size_t want = (at + count > size) ? size - at : count;
+
+        TEST_CHECK(file->SetPosition(file, at) == EFI_SUCCESS, "%s: %s: SetPosition", image, name);
+        TEST_CHECK(file->Read(file, &count, buffer + 5) == EFI_SUCCESS, "%s: %s: Read", image, name);
+        TEST_CHECK(count == want && !memcmp(buffer + 5, expect + at, count), "%s: %s: %zu bytes at %zu", image, name, want, at);
+
+        UINT64 position;
+        file->GetPosition(file, &position);
+        TEST_CHECK(position == at + count, "%s: %s: position %lu after reading %lu at %zu", image, name, position, count, at);
+    }
+
+    free(expect);
+    free(buffer);
+}
+
+/**
+ * @brief Check every file of an image against its list
+ */
+static void check_image(const char *image, uint32_t block_size, uint32_t io_align) {
+    char path[LINE_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s.img", FAT_IMAGES, image);
+    if (load_image(path, block_size, io_align)) return;
+
+    strcat(path, ".list");
+    FILE *list = fopen(path, "r");
+    TEST_CHECK(list, "can't open %s", path);
+    if (!list) return;
+
+    char line[LINE_LENGTH];
+    int volume_ok = fgets(line, sizeof(line), list) && !strcmp(line, "volume ok\n");
+
+    int variant = 0;
+    while (fgets(line, sizeof(line), list)) {
+        char name[LINE_LENGTH], state[16];
+        size_t size;
+        int id;
+        if (sscanf(line, "%[^\t]\t%zu\t%d\t%15s", name, &size, &id, state) != 4) continue;
+
+        EFI_FILE_PROTOCOL *file = open_file(name, variant);
+        if (!volume_ok || strcmp(state, "ok")) {
+            TEST_CHECK(!file, "%s: %s was opened, but it's broken", image, name);
+            if (file) file->Close(file);
+        } else {
+            TEST_CHECK(file, "%s: can't open %s (variant %d)", image, name, variant);
+            if (file) {
+                check_file(image, file, name, size, id, variant);
+                TEST_CHECK(file->Close(file) == EFI_SUCCESS, "%s: %s: Close", image, name);
+            }
+        }
+
+        variant++;
+    }
+
+    fclose(list);
+
+    // Things that aren't there, or aren't files
+    static const char *missing[] = { "nope.bin", "EFI/nothere", "hexahedron-kernel.elf/x", "EFI", "EFI/sub dir", "", "/" };
+    for (size_t i = 0; i < sizeof(missing) / sizeof(*missing); i++) {
+        EFI_FILE_PROTOCOL *file = fat_open((char*)missing[i]);
+        TEST_CHECK(!file, "%s: \"%s\" was opened", image, missing[i]);
+        if (file) file->Close(file);
+    }
+
+    fat_shutdown();
+    TEST_CHECK(pages_allocated == 0, "%s: %d page allocations left after fat_shutdown", image, pages_allocated);
+
+    free(disk);
+    disk = NULL;
+}
+
+int main() {
+    static EFI_BOOT_SERVICES boot_services = { .AllocatePages = stub_allocatePages, .FreePages = stub_freePages, .HandleProtocol = stub_handleProtocol };
+    static EFI_LOADED_IMAGE loaded_image = { 0 };
+    BS = &boot_services;
+    LoadedImage = &loaded_image;
+
+    srand(7);
+    for (size_t i = 0; i < sizeof(images) / sizeof(*images); i++) {
+        check_image(images[i].name, images[i].block_size, images[i].io_align);
+    }
+
+    return TEST_RESULT("fat");
+}
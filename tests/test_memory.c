@@ -0,0 +1,91 @@
+/**
+ * @file tests/test_memory.c
+ * @brief Checks every copy and fill method of platform/efi/memory.c against the C library
+ *
+ * memory.c is included directly so the methods can be forced one at a time, whatever this CPU has.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <string.h>
+#include "../platform/efi/memory.c"
+
+/* Sizes go up to here, past a few of the 64-byte vector loop iterations */
+#define MAX_SIZE        600
+
+/* Bytes around the tested area that have to stay untouched */
+#define GUARD           64
+
+static uint8_t source[MAX_SIZE + GUARD * 2];
+static uint8_t expect[MAX_SIZE + GUARD * 2];
+static uint8_t actual[MAX_SIZE + GUARD * 2];
+
+static void fill(uint8_t *buffer, size_t size, unsigned seed) {
+    for (size_t i = 0; i < size; i++) buffer[i] = (uint8_t)(seed + i * 13);
+}
+
+/**
+ * @brief Run every size and alignment through platform_copyMemory and platform_fillMemory
+ * @param name What's being forced, for the failure messages
+ */
+static void test_method(const char *name) {
+    fill(source, sizeof(source), 1);
+
+    for (int align = 0; align < 33; align += 3) {
+        for (size_t size = 0; size <= MAX_SIZE; size++) {
+            fill(expect, sizeof(expect), 7);
+            fill(actual, sizeof(actual), 7);
+            memcpy(expect + GUARD + align, source + 5, size);
+            platform_copyMemory(actual + GUARD + align, source + 5, size);
+            TEST_CHECK(!memcmp(expect, actual, sizeof(expect)), "%s copy +%d size %zu", name, align, size);
+
+            memset(expect + GUARD + align, 0xA5, size);
+            platform_fillMemory(actual + GUARD + align, 0xA5, size);
+            TEST_CHECK(!memcmp(expect, actual, sizeof(expect)), "%s fill +%d size %zu", name, align, size);
+        }
+    }
+}
+
+int main() {
+    uint32_t a, b, c, d;
+    cpu_cpuid(0, 0, &a, &b, &c, &d);
+    int avx2 = 0;
+    if (a >= 7) {
+        cpu_cpuid(7, 0, &a, &b, &c, &d);
+        avx2 = (b & CPU_FEATURE7_AVX2) ? 1 : 0;
+    }
+
+    // What memory_init picked
+    memory_init();
+    test_method("default");
+
+    // Word loops only
+    memory_small_copy = memory_small_fill = MAX_SIZE + 1;
+    test_method("words");
+
+    // Every other method for everything, cached and streamed
+    memory_small_copy = memory_small_fill = 0;
+    for (int stream = 0; stream < 2; stream++) {
+        memory_stream_threshold = stream ? 0 : MAX_SIZE + 1;
+
+        memory_erms = 0;
+        memory_vector = MEMORY_VECTOR_SSE2;
+        test_method(stream ? "sse2 streamed" : "sse2");
+
+        if (avx2) {
+            memory_vector = MEMORY_VECTOR_AVX2;
+            test_method(stream ? "avx2 streamed" : "avx2");
+        }
+
+        memory_erms = 1;
+        test_method(stream ? "rep (streamed)" : "rep");
+    }
+
+    return TEST_RESULT("memory");
+}
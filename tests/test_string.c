@@ -0,0 +1,238 @@
+/**
+ * @file tests/test_string.c
+ * @brief Checks the minilib string functions against the C library
+ *
+ * Every source and destination alignment within a word is tried with every length around the word
+ * boundaries. Strings are also put right in front of an unmapped page, so a word read that goes past
+ * the page a string ends in crashes the test.
+ *
+ * minilib/string.c is built with its functions renamed to minilib_xxx, see the Makefile.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void *minilib_memcpy(void *dest, const void *src, size_t size);
+void *minilib_memset(void *dest, int value, size_t size);
+void *minilib_memmove(void *dest, const void *src, size_t size);
+int minilib_memcmp(const void *a, const void *b, size_t size);
+void *minilib_memchr(const void *ptr, int value, size_t size);
+size_t minilib_strlen(const char *s);
+size_t minilib_strnlen(const char *s, size_t maxlen);
+char *minilib_strcpy(char *dest, const char *src);
+char *minilib_strncpy(char *dest, const char *src, size_t num);
+char *minilib_strcat(char *dest, const char *src);
+
+/* Lengths go up to here, which covers a few words on either side of every boundary */
+#define MAX_LENGTH      80
+
+/* Alignments tried, two words worth */
+#define ALIGNMENTS      16
+
+/* Size of the buffers, with room for the alignment and guard bytes around everything */
+#define BUFFER_SIZE     (MAX_LENGTH + ALIGNMENTS * 2 + 64)
+
+/* Where the tested area starts in a buffer, bytes before it have to stay untouched */
+#define GUARD           16
+
+static unsigned char expect[BUFFER_SIZE];
+static unsigned char actual[BUFFER_SIZE];
+static char source[BUFFER_SIZE];
+
+/**
+ * @brief Fill a buffer with a pattern that has no zero bytes
+ */
+static void fill(void *buffer, size_t size, unsigned seed) {
+    unsigned char *p = buffer;
+    for (size_t i = 0; i < size; i++) p[i] = 1 + (seed + i * 7) % 251;
+}
+
+/**
+ * @brief Make a string of @p length characters at @p source + @p align
+ */
+static char *make_string(int align, int length) {
+    fill(source, BUFFER_SIZE, length);
+    char *s = source + GUARD + align;
+    s[length] = 0;
+    return s;
+}
+
+static int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+static void test_copies() {
+    for (int src_align = 0; src_align < ALIGNMENTS; src_align++) {
+        for (int dest_align = 0; dest_align < ALIGNMENTS; dest_align++) {
+            for (int length = 0; length <= MAX_LENGTH; length++) {
+                char *s = make_string(src_align, length);
+
+                // strcpy
+                fill(expect, BUFFER_SIZE, 3);
+                fill(actual, BUFFER_SIZE, 3);
+                strcpy((char*)expect + GUARD + dest_align, s);
+                char *ret = minilib_strcpy((char*)actual + GUARD + dest_align, s);
+                TEST_CHECK(ret == (char*)actual + GUARD + dest_align, "strcpy returned the wrong pointer");
+                TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "strcpy src+%d dest+%d length %d", src_align, dest_align, length);
+
+                // strncpy, shorter than, as long as and longer than the string
+                for (int num = length - 9; num <= length + 9; num++) {
+                    if (num < 0) continue;
+                    fill(expect, BUFFER_SIZE, 5);
+                    fill(actual, BUFFER_SIZE, 5);
+                    strncpy((char*)expect + GUARD + dest_align, s, num);
+                    minilib_strncpy((char*)actual + GUARD + dest_align, s, num);
+                    TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "strncpy src+%d dest+%d length %d num %d", src_align, dest_align, length, num);
+                }
+
+                // strcat onto strings of a few lengths
+                for (int prefix = 0; prefix < 10; prefix += 3) {
+                    fill(expect, BUFFER_SIZE, 9);
+                    fill(actual, BUFFER_SIZE, 9);
+                    expect[GUARD + dest_align + prefix] = 0;
+                    actual[GUARD + dest_align + prefix] = 0;
+                    strcat((char*)expect + GUARD + dest_align, s);
+                    minilib_strcat((char*)actual + GUARD + dest_align, s);
+                    TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "strcat src+%d dest+%d length %d prefix %d", src_align, dest_align, length, prefix);
+                }
+
+                // memcpy and memset
+                fill(expect, BUFFER_SIZE, 11);
+                fill(actual, BUFFER_SIZE, 11);
+                memcpy(expect + GUARD + dest_align, s, length);
+                minilib_memcpy(actual + GUARD + dest_align, s, length);
+                TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "memcpy src+%d dest+%d length %d", src_align, dest_align, length);
+
+                memset(expect + GUARD + dest_align, src_align, length);
+                minilib_memset(actual + GUARD + dest_align, src_align, length);
+                TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "memset dest+%d length %d", dest_align, length);
+            }
+        }
+    }
+}
+
+static void test_memmove() {
+    // Every overlap in both directions, plus no overlap at all
+    for (int align = 0; align < ALIGNMENTS; align++) {
+        for (int length = 0; length <= MAX_LENGTH; length++) {
+            for (int distance = -ALIGNMENTS - 9; distance <= ALIGNMENTS + 9; distance++) {
+                fill(expect, BUFFER_SIZE, length);
+                fill(actual, BUFFER_SIZE, length);
+
+                int from = GUARD + ALIGNMENTS + 9 + align;
+                void *ret = minilib_memmove(actual + from + distance, actual + from, length);
+                memmove(expect + from + distance, expect + from, length);
+
+                TEST_CHECK(ret == actual + from + distance, "memmove returned the wrong pointer");
+                TEST_CHECK(!memcmp(expect, actual, BUFFER_SIZE), "memmove +%d length %d distance %d", align, length, distance);
+            }
+        }
+    }
+}
+
+static void test_compare() {
+    for (int a_align = 0; a_align < ALIGNMENTS; a_align++) {
+        for (int b_align = 0; b_align < ALIGNMENTS; b_align += 3) {
+            for (int length = 0; length <= MAX_LENGTH; length++) {
+                unsigned char *a = expect + GUARD + a_align;
+                unsigned char *b = actual + GUARD + b_align;
+                fill(a, length, 1);
+                fill(b, length, 1);
+
+                TEST_CHECK(minilib_memcmp(a, b, length) == 0, "memcmp of equal bytes +%d +%d length %d", a_align, b_align, length);
+
+                // A difference at every position, both ways round
+                for (int at = 0; at < length; at++) {
+                    b[at] += 1;
+                    TEST_CHECK(sign(minilib_memcmp(a, b, length)) == sign(memcmp(a, b, length)), "memcmp +%d +%d length %d at %d", a_align, b_align, length, at);
+                    TEST_CHECK(sign(minilib_memcmp(b, a, length)) == sign(memcmp(b, a, length)), "memcmp +%d +%d length %d at %d (swapped)", a_align, b_align, length, at);
+
+                    // Differences in the top bit have to compare as unsigned
+                    b[at] ^= 0x80;
+                    TEST_CHECK(sign(minilib_memcmp(a, b, length)) == sign(memcmp(a, b, length)), "memcmp +%d +%d length %d at %d (top bit)", a_align, b_align, length, at);
+                    b[at] = a[at];
+                }
+            }
+        }
+    }
+}
+
+static void test_scans() {
+    for (int align = 0; align < ALIGNMENTS; align++) {
+        for (int length = 0; length <= MAX_LENGTH; length++) {
+            char *s = make_string(align, length);
+
+            TEST_CHECK(minilib_strlen(s) == (size_t)length, "strlen +%d length %d", align, length);
+
+            for (int maxlen = 0; maxlen <= MAX_LENGTH + 9; maxlen++) {
+                TEST_CHECK(minilib_strnlen(s, maxlen) == strnlen(s, maxlen), "strnlen +%d length %d maxlen %d", align, length, maxlen);
+            }
+
+            // Look for a byte at every position, one that isn't there and the NUL
+            for (int at = 0; at <= length; at++) {
+                int c = (unsigned char)s[at];
+                TEST_CHECK(minilib_memchr(s, c, length + 1) == memchr(s, c, length + 1), "memchr +%d length %d at %d", align, length, at);
+                TEST_CHECK(minilib_memchr(s, c, at) == memchr(s, c, at), "memchr +%d length %d size %d", align, length, at);
+            }
+
+            TEST_CHECK(minilib_memchr(s, 0xFF, length) == NULL, "memchr found a byte that isn't there");
+            TEST_CHECK(minilib_memchr(s, 0x100 + (unsigned char)s[0], length + 1) == s, "memchr doesn't truncate the value");
+        }
+    }
+}
+
+/**
+ * @brief Put strings right in front of an unmapped page
+ *
+ * The word loops read whole aligned words past the end of a string, which is only fine as long as they
+ * stay in the page the string ends in.
+ */
+static void test_page_end() {
+    size_t page = sysconf(_SC_PAGESIZE);
+    unsigned char *map = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_CHECK(map != MAP_FAILED, "mmap failed");
+    if (map == MAP_FAILED) return;
+
+    mprotect(map + page, page, PROT_NONE);
+    unsigned char *end = map + page;
+
+    static char copy[MAX_LENGTH + 1];
+    for (int length = 0; length <= MAX_LENGTH; length++) {
+        char *s = (char*)end - length - 1;
+        fill(s, length, length);
+        s[length] = 0;
+
+        TEST_CHECK(minilib_strlen(s) == (size_t)length, "strlen at the end of a page, length %d", length);
+        TEST_CHECK(minilib_strnlen(s, length + 100) == (size_t)length, "strnlen at the end of a page, length %d", length);
+        TEST_CHECK(minilib_memchr(s, 0, length + 1) == s + length, "memchr at the end of a page, length %d", length);
+        TEST_CHECK(!strcmp(minilib_strcpy(copy, s), s), "strcpy from the end of a page, length %d", length);
+        TEST_CHECK(minilib_memcmp(s, copy, length + 1) == 0, "memcmp at the end of a page, length %d", length);
+
+        // Without a NUL, memchr and memcmp must not look past the size they're given
+        unsigned char *bytes = end - length;
+        fill(bytes, length, 1);
+        TEST_CHECK(minilib_memchr(bytes, 0, length) == NULL, "memchr at the end of a page, size %d", length);
+        TEST_CHECK(minilib_memcmp(bytes, bytes, length) == 0, "memcmp at the end of a page, size %d", length);
+    }
+
+    munmap(map, page * 2);
+}
+
+int main() {
+    test_copies();
+    test_memmove();
+    test_compare();
+    test_scans();
+    test_page_end();
+    return TEST_RESULT("string");
+}
@@ -0,0 +1,293 @@
+/**
+ * @file tests/test_terminal.c
+ * @brief Counts what the boot menu draws for every keypress
+ *
+ * The configuration menu (polyaniline_configureOS) is run on top of terminal.c with the drawing
+ * functions replaced by counters and the keyboard replaced by a script. Moving the selection should
+ * only draw the two option rows that changed and whatever changed in the help text under the box,
+ * and a key that changes nothing shouldn't draw anything. The same script is run without the cell
+ * grid as well, which draws everything like the terminal did before it had one.
+ *
+ * terminal.c and menu.c are included directly, the platform functions they call are stubs below.
+ *
+ * @copyright
+ * This file is part of the Polyaniline bootloader, which is part of the Ethereal Operating System.
+ * It is released under the terms of the GPLv3 license, unlike other parts of Ethereal.
+ * Please see the LICENSE file in the main repository for more details.
+ *
+ * Copyright (C) 2024 Samuel Stuart
+ */
+
+#include "test.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../polyaniline/terminal.c"
+#include "../polyaniline/config.c"
+#include "../polyaniline/strbuf.c"
+
+// The loader's printf goes to the terminal
+static int test_printf(const char *format, ...);
+#define printf test_printf
+#include "../polyaniline/menu.c"
+#undef printf
+
+/* Screen the menu is drawn on, 1024x768 with an 8x16 font */
+#define SCREEN_WIDTH    1024
+#define SCREEN_HEIGHT   768
+#define CELL_WIDTH      8
+#define CELL_HEIGHT     16
+
+/* The most keypresses a script has */
+#define MAX_KEYS        16
+
+struct _video_surface {
+    int height;
+};
+
+/* Drawn so far */
+static uint64_t pixels_drawn = 0;
+static uint64_t cells_drawn = 0;
+
+/* Pixels held by surfaces */
+static uint64_t pixels_held = 0;
+
+/* Keys fed to the menu, and what was drawn in reaction to each one */
+static const int *script;
+static int script_length;
+static int script_at;
+static uint64_t key_pixels[MAX_KEYS];
+static uint64_t key_cells[MAX_KEYS];
+static uint64_t pixels_before_key, cells_before_key;
+
+/* Make platform_allocate fail, to run without the cell grid */
+static int allocations_fail = 0;
+
+/**** STUBS ****/
+
+void platform_drawRun(const char *str, int count, int x, int y, color_t fg, color_t bg) {
+    TEST_CHECK(x >= 0 && x + count <= terminal_width && y >= 0 && y < terminal_height, "drawRun off the screen: %d+%d, %d", x, count, y);
+    cells_drawn += count;
+    pixels_drawn += (uint64_t)count * CELL_WIDTH * CELL_HEIGHT;
+}
+
+void platform_fillRect(int x, int y, int width, int height, color_t color) {
+    pixels_drawn += (uint64_t)width * height;
+}
+
+void platform_clearScreen(color_t color) {
+    pixels_drawn += SCREEN_WIDTH * SCREEN_HEIGHT;
+}
+
+void platform_scroll(int height, int pixels, color_t color) {
+    pixels_drawn += (uint64_t)SCREEN_WIDTH * height;
+}
+
+void platform_present() {
+}
+
+void platform_freeSurface(video_surface_t *surface) {
+    if (surface) pixels_held -= (uint64_t)SCREEN_WIDTH * surface->height;
+    free(surface);
+}
+
+video_surface_t *platform_captureRows(video_surface_t *surface, int y, int height) {
+    TEST_CHECK(y >= 0 && height > 0 && y + height <= SCREEN_HEIGHT, "captured rows %d+%d off the screen", y, height);
+
+    platform_freeSurface(surface);
+    surface = calloc(1, sizeof(video_surface_t));
+    surface->height = height;
+    pixels_held += (uint64_t)SCREEN_WIDTH * height;
+    return surface;
+}
+
+int platform_restoreRows(video_surface_t *surface) {
+    pixels_drawn += (uint64_t)SCREEN_WIDTH * surface->height;
+    return 0;
+}
+
+void *platform_allocate(size_t size) {
+    return allocations_fail ? NULL : malloc(size);
+}
+
+void platform_free(void *ptr) {
+    free(ptr);
+}
+
+void platform_copyMemory(void *dest, const void *src, size_t size) {
+    memcpy(dest, src, size);
+}
+
+int platform_readKeyboard(int timeout) {
+    // Whatever got drawn since the last key was the reaction to it
+    if (script_at > 0) {
+        key_pixels[script_at - 1] = pixels_drawn - pixels_before_key;
+        key_cells[script_at - 1] = cells_drawn - cells_before_key;
+    }
+
+    pixels_before_key = pixels_drawn;
+    cells_before_key = cells_drawn;
+
+    TEST_CHECK(script_at < script_length, "the menu read more keys than the script has");
+    if (script_at >= script_length) return KEYBOARD_ESC;
+    return script[script_at++];
+}
+
+void platform_boot(char *cmdline) {
+    TEST_CHECK(0, "platform_boot called");
+}
+
+void platform_reboot() {
+    TEST_CHECK(0, "platform_reboot called");
+}
+
+void polyaniline_error(char *format, ...) {
+    TEST_CHECK(0, "polyaniline_error: %s", format);
+    exit(1);
+}
+
+void polyaniline_error_nonfatal(char *format, ...) {
+    TEST_CHECK(0, "polyaniline_error_nonfatal: %s", format);
+}
+
+void bootlog_write(const char *str, size_t length) {
+}
+
+size_t bootlog_read(char *buffer, size_t size) {
+    return 0;
+}
+
+size_t bootlog_length() {
+    return 0;
+}
+
+void ansi_setWindow(int x, int y) {
+}
+
+void ansi_log(const char *str, size_t length) {
+}
+
+void ansi_sync(terminal_cell_t *cells, int width, int height) {
+}
+
+static int test_printf(const char *format, ...) {
+    char buffer[512];
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, ap);
+    va_end(ap);
+
+    if (length > (int)sizeof(buffer) - 1) length = sizeof(buffer) - 1;
+    terminal_writeRun(buffer, length);
+    return length;
+}
+
+/**** TESTS ****/
+
+/**
+ * @brief Run the configuration menu with a script of keys
+ * @param keys The keys, the last one has to leave the menu
+ * @param count The amount of keys
+ * @param grid Whether the terminal gets its cell grid
+ */
+static void run_menu(const int *keys, int count, int grid) {
+    allocations_fail = !grid;
+    terminal_init((video_info_t){ .width = SCREEN_WIDTH, .height = SCREEN_HEIGHT, .bpp = 32, .cell_width = CELL_WIDTH, .cell_height = CELL_HEIGHT, .scale = 1 });
+    allocations_fail = 0;
+
+    TEST_CHECK(!terminal_cells == !grid, "the cell grid is %s", terminal_cells ? "there" : "missing");
+
+    // Like polyaniline_menu
+    ub_offset_x = (terminal_width - USERBOX_WIDTH) / 2;
+    ub_offset_y = (terminal_height / 2) - (USERBOX_HEIGHT / 2);
+    terminal_setSerialWindow(ub_offset_x, ub_offset_y);
+
+    script = keys;
+    script_length = count;
+    script_at = 0;
+    memset(key_pixels, 0, sizeof(key_pixels));
+    memset(key_cells, 0, sizeof(key_cells));
+
+    polyaniline_configureOS();
+    TEST_CHECK(script_at == count, "the menu stopped after %d of %d keys", script_at, count);
+
+    free(terminal_cells);
+    terminal_cells = NULL;
+}
+
+/**
+ * @brief Draw some menu chrome twice, the second time has to come from the cache
+ */
+static void test_chrome() {
+    terminal_init((video_info_t){ .width = SCREEN_WIDTH, .height = SCREEN_HEIGHT, .bpp = 32, .cell_width = CELL_WIDTH, .cell_height = CELL_HEIGHT, .scale = 1 });
+    ub_offset_x = (terminal_width - USERBOX_WIDTH) / 2;
+    ub_offset_y = (terminal_height / 2) - (USERBOX_HEIGHT / 2);
+
+    char *title = "Chrome test";
+    uint64_t held = pixels_held;
+    menu_drawChrome(BOOT_LIQUID_NORMAL, TITLEBAR_DEFAULT_COLOR, title, 1);
+    held = pixels_held - held;
+
+    size_t size = terminal_width * terminal_height * sizeof(terminal_cell_t);
+    terminal_cell_t *drawn = malloc(size);
+    memcpy(drawn, terminal_cells, size);
+
+    // Only the logo, title bar and copyright rows are kept
+    TEST_CHECK(held && held * 4 <= SCREEN_WIDTH * SCREEN_HEIGHT, "the chrome keeps %lu pixels of a %d pixel screen", held, SCREEN_WIDTH * SCREEN_HEIGHT);
+
+    terminal_clearScreen(BOOT_DEFAULT_FG, BOOT_DEFAULT_BG);
+    uint64_t cells = cells_drawn;
+    menu_drawChrome(BOOT_LIQUID_NORMAL, TITLEBAR_DEFAULT_COLOR, title, 1);
+
+    TEST_CHECK(cells_drawn == cells, "restoring the chrome drew %lu cells", cells_drawn - cells);
+    TEST_CHECK(!memcmp(terminal_cells, drawn, size), "the cell grid differs after restoring the chrome");
+    printf("chrome: %lu pixels kept of %d\n", held, SCREEN_WIDTH * SCREEN_HEIGHT);
+
+    free(drawn);
+    free(terminal_cells);
+    terminal_cells = NULL;
+}
+
+int main() {
+    // Down a few rows, up against the top (nothing to do), toggle a checkbox, then leave
+    static const int keys[] = { KEYBOARD_DOWN, KEYBOARD_DOWN, KEYBOARD_UP, KEYBOARD_UP, KEYBOARD_UP,
+                                KEYBOARD_DOWN, KEYBOARD_DOWN, KEYBOARD_DOWN, KEYBOARD_DOWN, KEYBOARD_DOWN,
+                                KEYBOARD_ENTER, KEYBOARD_ESC };
+    static const char *names[] = { "down", "down", "up", "up", "up (at the top)",
+                                   "down", "down", "down", "down", "down (onto a checkbox)",
+                                   "enter (toggle)", "esc" };
+    int count = sizeof(keys) / sizeof(*keys);
+
+    run_menu(keys, count, 0);
+    uint64_t full_pixels[MAX_KEYS], full_cells[MAX_KEYS];
+    memcpy(full_pixels, key_pixels, sizeof(full_pixels));
+    memcpy(full_cells, key_cells, sizeof(full_cells));
+
+    run_menu(keys, count, 1);
+
+    // One option row of the user box, and the three help lines under it
+    uint64_t row_cells = USERBOX_WIDTH;
+    uint64_t help_cells = 3 * terminal_width;
+
+    printf("%-24s %12s %12s %12s %12s\n", "key", "cells", "pixels", "cells (old)", "pixels (old)");
+    for (int k = 0; k < count - 1; k++) {
+        printf("%-24s %12lu %12lu %12lu %12lu\n", names[k], key_cells[k], key_pixels[k], full_cells[k], full_pixels[k]);
+
+        if (k == 4) {
+            TEST_CHECK(key_pixels[k] == 0, "a key that changes nothing drew %lu pixels", key_pixels[k]);
+            continue;
+        }
+
+        // Two rows change, plus the help text for the new selection
+        TEST_CHECK(key_cells[k] > 0, "key %d (%s) drew nothing", k, names[k]);
+        TEST_CHECK(key_cells[k] <= 2 * row_cells + help_cells, "key %d (%s) drew %lu cells", k, names[k], key_cells[k]);
+        TEST_CHECK(key_pixels[k] * 4 <= full_pixels[k], "key %d (%s) drew %lu pixels, %lu without the grid", k, names[k], key_pixels[k], full_pixels[k]);
+    }
+
+    // Toggling a checkbox only changes the one character in its box
+    TEST_CHECK(key_cells[10] == 1, "toggling a checkbox drew %lu cells", key_cells[10]);
+
+    test_chrome();
+    return TEST_RESULT("terminal");
+}